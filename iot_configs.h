@@ -54,6 +54,50 @@
 
 #endif // IOT_CONFIG_USE_X509_CERT
 
+// Enable macro IOT_CONFIG_USE_DPS to get the IoT Hub and device id from the Azure IoT Device
+// Provisioning Service instead of IOT_CONFIG_IOTHUB_FQDN/IOT_CONFIG_DEVICE_ID. The assignment is
+// cached in NVS, so DPS is only contacted on the first boot and when the hub refuses the device.
+// Authentication uses the same device key or x509 certificate configured in this file.
+
+// #define IOT_CONFIG_USE_DPS
+
+#ifdef IOT_CONFIG_USE_DPS
+#define IOT_CONFIG_DPS_ENDPOINT "global.azure-devices-provisioning.net"
+#define IOT_CONFIG_DPS_ID_SCOPE "ID Scope"
+#define IOT_CONFIG_DPS_REGISTRATION_ID "Registration ID"
+#endif // IOT_CONFIG_USE_DPS
+
+// Enable macro IOT_CONFIG_RECORD_EVENTS to keep a binary trace of sensor samples, clock ticks and
+// MQTT events in SPIFFS. Send 'r' on the serial monitor to export it as hex for replay on a host.
+
+// #define IOT_CONFIG_RECORD_EVENTS
+
+#ifdef IOT_CONFIG_RECORD_EVENTS
+#define IOT_CONFIG_RECORD_EVENTS_PATH "/spiffs/events.bin"
+#endif // IOT_CONFIG_RECORD_EVENTS
+
+// Readings are also kept in a rolling history in SPIFFS (about 9 hours at the default rate), which
+// the backend can query with the getHistory direct method to backfill gaps. Comment out to disable.
+
+#define IOT_CONFIG_HISTORY_PATH "/spiffs/history"
+
+// Gateway mode shares one IoT Hub connection between the boards of a site. Define
+// IOT_CONFIG_GATEWAY on the board that connects to IoT Hub and IOT_CONFIG_GATEWAY_LEAF on the
+// others, and give every leaf its own IOT_CONFIG_BOARD_ID from 1 (the gateway keeps 0). Leaves send each reading to the gateway as an
+// 18-byte UDP frame and need only the Wi-Fi settings; the gateway batches them per BOARD_ID into
+// its routine telemetry. Alerts, edge rules and history cover the gateway's own sensor only.
+
+// #define IOT_CONFIG_GATEWAY
+// #define IOT_CONFIG_GATEWAY_LEAF
+
+#if defined(IOT_CONFIG_GATEWAY) || defined(IOT_CONFIG_GATEWAY_LEAF)
+#define IOT_CONFIG_GATEWAY_PORT 47810
+// The gateway's IPv4 address on the site network; give it a DHCP reservation.
+#define IOT_CONFIG_GATEWAY_ADDRESS "192.168.1.2"
+#endif // IOT_CONFIG_GATEWAY || IOT_CONFIG_GATEWAY_LEAF
+
+// #define IOT_CONFIG_BOARD_ID 1
+
 // Azure IoT
 #define IOT_CONFIG_IOTHUB_FQDN "[your Azure IoT host name].azure-devices.net"
 #define IOT_CONFIG_DEVICE_ID "Device ID"
@@ -62,5 +106,28 @@
 #define IOT_CONFIG_DEVICE_KEY "Device Key"
 #endif // IOT_CONFIG_USE_X509_CERT
 
-// Publish 1 message every 2 seconds
-#define TELEMETRY_FREQUENCY_MILLISECS 2000
\ No newline at end of file
+// Read the sensor every 2 seconds; routine readings are sent in batches (see TelemetryBatch.h)
+#define TELEMETRY_FREQUENCY_MILLISECS 2000
+
+// Enable macro IOT_CONFIG_TELEMETRY_CBOR to send routine telemetry as CBOR instead of JSON.
+// Both encodings are generated from the single schema in TelemetrySchema.h.
+
+// #define IOT_CONFIG_TELEMETRY_CBOR
+
+// Enable macro IOT_CONFIG_SEND_SUMMARIES_ONLY to send one averaged reading per batch instead of
+// every reading; edge rule hits and alerts are still sent as they happen.
+
+// #define IOT_CONFIG_SEND_SUMMARIES_ONLY
+
+// Alert thresholds, in sensor units: centi-degrees Celsius and per-mille relative humidity.
+// Crossing one publishes an alert right away; it clears once the reading is back inside the
+// threshold by the hysteresis margin.
+#define IOT_CONFIG_ALERT_TEMPERATURE_LOW 0
+#define IOT_CONFIG_ALERT_TEMPERATURE_HIGH 3500
+#define IOT_CONFIG_ALERT_TEMPERATURE_HYSTERESIS 50
+#define IOT_CONFIG_ALERT_HUMIDITY_LOW 200
+#define IOT_CONFIG_ALERT_HUMIDITY_HIGH 900
+#define IOT_CONFIG_ALERT_HUMIDITY_HYSTERESIS 20
+
+// Publish memory diagnostics once a minute
+#define DIAGNOSTICS_FREQUENCY_MILLISECS 60000
@@ -0,0 +1,64 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "AlertMonitor.h"
+
+static const char* const level_names[] = { "normal", "low", "high" };
+
+AlertMonitor::AlertMonitor(const AlertThreshold* thresholds)
+{
+  this->thresholds = thresholds;
+
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++)
+  {
+    this->level[i] = ALERT_LEVEL_NORMAL;
+  }
+}
+
+int AlertMonitor::Evaluate(const SensorSample& sample, AlertEvent* events)
+{
+  int count = 0;
+
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++)
+  {
+    SensorChannel channel = (SensorChannel)i;
+    const AlertThreshold& threshold = this->thresholds[i];
+    int32_t value = sample.value[i];
+    AlertLevel next = this->level[i];
+
+    if (!sample.IsValid(channel))
+    {
+      continue;
+    }
+
+    if (threshold.high != ALERT_THRESHOLD_DISABLED_HIGH && value >= threshold.high)
+    {
+      next = ALERT_LEVEL_HIGH;
+    }
+    else if (threshold.low != ALERT_THRESHOLD_DISABLED_LOW && value <= threshold.low)
+    {
+      next = ALERT_LEVEL_LOW;
+    }
+    else if (
+        (next == ALERT_LEVEL_HIGH && value < (int32_t)threshold.high - threshold.hysteresis)
+        || (next == ALERT_LEVEL_LOW && value > (int32_t)threshold.low + threshold.hysteresis))
+    {
+      next = ALERT_LEVEL_NORMAL;
+    }
+
+    if (next != this->level[i])
+    {
+      this->level[i] = next;
+      events[count].channel = channel;
+      events[count].level = next;
+      events[count].value = sample.value[i];
+      count++;
+    }
+  }
+
+  return count;
+}
+
+AlertLevel AlertMonitor::Level(SensorChannel channel) { return this->level[channel]; }
+
+const char* AlertLevelName(AlertLevel level) { return level_names[level]; }
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef ALERTMONITOR_H
+#define ALERTMONITOR_H
+
+#include "SensorSample.h"
+#include <stdint.h>
+
+// Use as the low or high threshold of a channel that has no alert on that side.
+#define ALERT_THRESHOLD_DISABLED_LOW INT16_MIN
+#define ALERT_THRESHOLD_DISABLED_HIGH INT16_MAX
+
+enum AlertLevel
+{
+  ALERT_LEVEL_NORMAL = 0,
+  ALERT_LEVEL_LOW,
+  ALERT_LEVEL_HIGH
+};
+
+// Thresholds in channel units (see SensorSchema).
+struct AlertThreshold
+{
+  int16_t low;
+  int16_t high;
+  int16_t hysteresis;
+};
+
+struct AlertEvent
+{
+  SensorChannel channel;
+  AlertLevel level;
+  int16_t value;
+};
+
+/*
+ * Tracks the alert level of each sensor channel. A channel enters LOW/HIGH when a
+ * reading reaches its threshold and returns to NORMAL only once the reading is
+ * back inside it by the hysteresis margin, so a value hovering on the threshold
+ * does not flood the alert lane. Invalid readings leave the level unchanged.
+ */
+class AlertMonitor
+{
+public:
+  // thresholds must hold SENSOR_CHANNEL_COUNT entries and outlive the monitor.
+  AlertMonitor(const AlertThreshold* thresholds);
+
+  /*
+   * @brief Updates the levels from a sample.
+   * @return Number of level changes written to events (at most SENSOR_CHANNEL_COUNT).
+   */
+  int Evaluate(const SensorSample& sample, AlertEvent* events);
+  AlertLevel Level(SensorChannel channel);
+
+private:
+  const AlertThreshold* thresholds;
+  AlertLevel level[SENSOR_CHANNEL_COUNT];
+};
+
+const char* AlertLevelName(AlertLevel level);
+
+#endif // ALERTMONITOR_H
@@ -0,0 +1,348 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "AzIoTProvisioning.h"
+#include "SerialLogger.h"
+#include <Preferences.h>
+#include <az_result.h>
+#include <string.h>
+
+#define DPS_PREFERENCES_NAMESPACE "dps"
+#define DPS_MQTT_PORT 8883
+#define DPS_MQTT_QOS 1
+#define DPS_DEFAULT_RETRY_AFTER_SECONDS 3
+#define DPS_SAS_TOKEN_DURATION_IN_MINUTES 60
+#define DPS_POLL_INTERVAL_MILLISECS 100
+
+// Only one registration runs at a time, so the MQTT credentials can live here.
+static char dps_mqtt_broker_uri[160];
+static char dps_mqtt_client_id[128];
+static char dps_mqtt_username[256];
+static char dps_mqtt_password[256];
+static uint8_t dps_sas_signature_buffer[256];
+static char dps_topic[256];
+static char dps_payload[160];
+
+static bool copySpan(az_span span, char* buffer, size_t bufferSize)
+{
+  if (az_span_size(span) <= 0 || (size_t)az_span_size(span) >= bufferSize)
+  {
+    return false;
+  }
+
+  memcpy(buffer, az_span_ptr(span), az_span_size(span));
+  buffer[az_span_size(span)] = '\0';
+  return true;
+}
+
+AzIoTProvisioning::AzIoTProvisioning(
+    const char* endpoint,
+    const char* idScope,
+    const char* registrationId,
+    const char* deviceKey)
+{
+  this->endpoint = endpoint;
+  this->idScope = idScope;
+  this->registrationId = registrationId;
+  this->deviceKey = deviceKey;
+  this->clientCertPem = NULL;
+  this->clientKeyPem = NULL;
+  this->mqttClient = NULL;
+  this->connected = false;
+  this->responseReceived = false;
+  this->assigned = false;
+  this->failed = false;
+  this->retryAfterSeconds = 0;
+  this->operationId[0] = '\0';
+  this->assignedHostname[0] = '\0';
+  this->assignedDeviceId[0] = '\0';
+}
+
+void AzIoTProvisioning::SetClientCertificate(const char* certPem, const char* keyPem)
+{
+  this->clientCertPem = certPem;
+  this->clientKeyPem = keyPem;
+}
+
+bool AzIoTProvisioning::LoadAssignment(
+    char* hostname,
+    size_t hostnameSize,
+    char* deviceId,
+    size_t deviceIdSize)
+{
+  Preferences preferences;
+  if (!preferences.begin(DPS_PREFERENCES_NAMESPACE, true))
+  {
+    return false;
+  }
+
+  // An assignment made for another scope or registration id is stale.
+  bool valid = preferences.getString("scope") == this->idScope
+      && preferences.getString("regId") == this->registrationId
+      && preferences.getString("hub", hostname, hostnameSize) > 0
+      && preferences.getString("device", deviceId, deviceIdSize) > 0;
+
+  preferences.end();
+  return valid;
+}
+
+void AzIoTProvisioning::ClearAssignment()
+{
+  Preferences preferences;
+  if (preferences.begin(DPS_PREFERENCES_NAMESPACE, false))
+  {
+    preferences.clear();
+    preferences.end();
+  }
+}
+
+void AzIoTProvisioning::saveAssignment()
+{
+  Preferences preferences;
+  if (!preferences.begin(DPS_PREFERENCES_NAMESPACE, false))
+  {
+    Logger.Error("Failed opening NVS to cache the DPS assignment");
+    return;
+  }
+
+  preferences.putString("scope", this->idScope);
+  preferences.putString("regId", this->registrationId);
+  preferences.putString("hub", this->assignedHostname);
+  preferences.putString("device", this->assignedDeviceId);
+  preferences.end();
+}
+
+int AzIoTProvisioning::Register(
+    char* hostname,
+    size_t hostnameSize,
+    char* deviceId,
+    size_t deviceIdSize,
+    unsigned long timeoutMs)
+{
+  unsigned long startTime = millis();
+
+  Logger.Info("Registering with DPS at " + String(this->endpoint));
+
+  if (az_result_failed(az_iot_provisioning_client_init(
+          &this->client,
+          az_span_create((uint8_t*)this->endpoint, strlen(this->endpoint)),
+          az_span_create((uint8_t*)this->idScope, strlen(this->idScope)),
+          az_span_create((uint8_t*)this->registrationId, strlen(this->registrationId)),
+          NULL)))
+  {
+    Logger.Error("Failed initializing Azure IoT Provisioning client");
+    return 1;
+  }
+
+  if (az_result_failed(az_iot_provisioning_client_get_client_id(
+          &this->client, dps_mqtt_client_id, sizeof(dps_mqtt_client_id), NULL))
+      || az_result_failed(az_iot_provisioning_client_get_user_name(
+          &this->client, dps_mqtt_username, sizeof(dps_mqtt_username), NULL)))
+  {
+    Logger.Error("Failed getting DPS MQTT client id or user name");
+    return 1;
+  }
+
+  esp_mqtt_client_config_t mqtt_config;
+  memset(&mqtt_config, 0, sizeof(mqtt_config));
+  snprintf(dps_mqtt_broker_uri, sizeof(dps_mqtt_broker_uri), "mqtts://%s", this->endpoint);
+  mqtt_config.uri = dps_mqtt_broker_uri;
+  mqtt_config.port = DPS_MQTT_PORT;
+  mqtt_config.client_id = dps_mqtt_client_id;
+  mqtt_config.username = dps_mqtt_username;
+
+  if (this->deviceKey != NULL)
+  {
+    AzIoTSasToken sasToken(
+        &this->client,
+        az_span_create((uint8_t*)this->deviceKey, strlen(this->deviceKey)),
+        AZ_SPAN_FROM_BUFFER(dps_sas_signature_buffer),
+        AZ_SPAN_FROM_BUFFER(dps_mqtt_password));
+
+    if (sasToken.Generate(DPS_SAS_TOKEN_DURATION_IN_MINUTES) != 0)
+    {
+      Logger.Error("Failed generating DPS SAS token");
+      return 1;
+    }
+
+    mqtt_config.password = (const char*)az_span_ptr(sasToken.Get());
+  }
+  else
+  {
+    mqtt_config.client_cert_pem = this->clientCertPem;
+    mqtt_config.client_key_pem = this->clientKeyPem;
+  }
+
+  mqtt_config.keepalive = 60;
+  mqtt_config.disable_auto_reconnect = true;
+  mqtt_config.event_handle = AzIoTProvisioning::mqttEventHandler;
+  mqtt_config.user_context = this;
+  // Relies on the caller having loaded ca_pem into the esp-tls global CA store.
+  mqtt_config.use_global_ca_store = true;
+
+  this->connected = false;
+  this->responseReceived = false;
+  this->assigned = false;
+  this->failed = false;
+
+  this->mqttClient = esp_mqtt_client_init(&mqtt_config);
+  if (this->mqttClient == NULL || esp_mqtt_client_start(this->mqttClient) != ESP_OK)
+  {
+    Logger.Error("Failed starting DPS MQTT client");
+
+    if (this->mqttClient != NULL)
+    {
+      (void)esp_mqtt_client_destroy(this->mqttClient);
+      this->mqttClient = NULL;
+    }
+
+    return 1;
+  }
+
+  while (!this->assigned && !this->failed && millis() - startTime < timeoutMs)
+  {
+    if (this->responseReceived)
+    {
+      this->responseReceived = false;
+      delay((this->retryAfterSeconds > 0 ? this->retryAfterSeconds : DPS_DEFAULT_RETRY_AFTER_SECONDS) * 1000);
+
+      if (az_result_failed(az_iot_provisioning_client_query_status_get_publish_topic(
+              &this->client,
+              az_span_create((uint8_t*)this->operationId, strlen(this->operationId)),
+              dps_topic,
+              sizeof(dps_topic),
+              NULL))
+          || !this->publish(dps_topic, ""))
+      {
+        Logger.Error("Failed querying DPS operation status");
+        this->failed = true;
+      }
+    }
+
+    delay(DPS_POLL_INTERVAL_MILLISECS);
+  }
+
+  (void)esp_mqtt_client_destroy(this->mqttClient);
+  this->mqttClient = NULL;
+
+  if (!this->assigned)
+  {
+    Logger.Error(this->failed ? "DPS registration failed" : "DPS registration timed out");
+    return 1;
+  }
+
+  if (strlen(this->assignedHostname) >= hostnameSize || strlen(this->assignedDeviceId) >= deviceIdSize)
+  {
+    Logger.Error("DPS assignment does not fit the caller's buffers");
+    return 1;
+  }
+
+  strcpy(hostname, this->assignedHostname);
+  strcpy(deviceId, this->assignedDeviceId);
+  this->saveAssignment();
+
+  Logger.Info(
+      "DPS assigned device " + String(deviceId) + " to " + String(hostname) + " in "
+      + String(millis() - startTime) + " ms");
+  return 0;
+}
+
+bool AzIoTProvisioning::publish(const char* topic, const char* payload)
+{
+  return esp_mqtt_client_publish(this->mqttClient, topic, payload, strlen(payload), DPS_MQTT_QOS, 0)
+      > 0;
+}
+
+esp_err_t AzIoTProvisioning::mqttEventHandler(esp_mqtt_event_handle_t event)
+{
+  ((AzIoTProvisioning*)event->user_context)->onMqttEvent(event);
+  return ESP_OK;
+}
+
+void AzIoTProvisioning::onMqttEvent(esp_mqtt_event_handle_t event)
+{
+  az_iot_provisioning_client_register_response response;
+
+  switch (event->event_id)
+  {
+  case MQTT_EVENT_CONNECTED:
+    Logger.Info("DPS MQTT connected");
+    this->connected = true;
+
+    if (esp_mqtt_client_subscribe(
+            this->mqttClient, AZ_IOT_PROVISIONING_CLIENT_REGISTER_SUBSCRIBE_TOPIC, DPS_MQTT_QOS)
+        == -1)
+    {
+      Logger.Error("Could not subscribe for DPS responses");
+      this->failed = true;
+    }
+    break;
+  case MQTT_EVENT_SUBSCRIBED:
+    snprintf(dps_payload, sizeof(dps_payload), "{\"registrationId\":\"%s\"}", this->registrationId);
+
+    if (az_result_failed(az_iot_provisioning_client_register_get_publish_topic(
+            &this->client, dps_topic, sizeof(dps_topic), NULL))
+        || !this->publish(dps_topic, dps_payload))
+    {
+      Logger.Error("Failed publishing DPS registration request");
+      this->failed = true;
+    }
+    break;
+  case MQTT_EVENT_DATA:
+    if (az_result_failed(az_iot_provisioning_client_parse_received_topic_and_payload(
+            &this->client,
+            az_span_create((uint8_t*)event->topic, event->topic_len),
+            az_span_create((uint8_t*)event->data, event->data_len),
+            &response)))
+    {
+      Logger.Error("Failed parsing DPS response");
+      this->failed = true;
+      break;
+    }
+
+    if (!az_iot_provisioning_client_operation_complete(response.operation_status))
+    {
+      // The event data is released after this handler returns; keep what the poll needs.
+      if (!copySpan(response.operation_id, this->operationId, sizeof(this->operationId)))
+      {
+        this->failed = true;
+        break;
+      }
+
+      this->retryAfterSeconds = response.retry_after_seconds;
+      this->responseReceived = true;
+    }
+    else if (
+        response.operation_status == AZ_IOT_PROVISIONING_STATUS_ASSIGNED
+        && copySpan(
+            response.registration_state.assigned_hub_hostname,
+            this->assignedHostname,
+            sizeof(this->assignedHostname))
+        && copySpan(
+            response.registration_state.device_id,
+            this->assignedDeviceId,
+            sizeof(this->assignedDeviceId)))
+    {
+      this->assigned = true;
+    }
+    else
+    {
+      Logger.Error(
+          "DPS registration not assigned; error code " + String(response.registration_state.error_code));
+      this->failed = true;
+    }
+    break;
+  case MQTT_EVENT_DISCONNECTED:
+    this->connected = false;
+    if (!this->assigned)
+    {
+      this->failed = true;
+    }
+    break;
+  case MQTT_EVENT_ERROR:
+    Logger.Error("DPS MQTT event MQTT_EVENT_ERROR");
+    break;
+  default:
+    break;
+  }
+}
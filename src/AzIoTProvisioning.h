@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef AZIOTPROVISIONING_H
+#define AZIOTPROVISIONING_H
+
+#include "AzIoTSasToken.h"
+#include <Arduino.h>
+#include <az_iot_provisioning_client.h>
+#include <mqtt_client.h>
+
+#define DPS_HOSTNAME_BUFFER_SIZE 128
+#define DPS_DEVICE_ID_BUFFER_SIZE 128
+#define DPS_OPERATION_ID_BUFFER_SIZE 128
+
+/*
+ * Registers the device with the Azure IoT Device Provisioning Service and caches
+ * the assigned IoT Hub and device id in NVS.
+ *
+ * Warm boots load the cached assignment and never open a DPS connection; callers
+ * clear it and register again only when the hub rejects the device.
+ */
+class AzIoTProvisioning
+{
+public:
+  AzIoTProvisioning(
+      const char* endpoint,
+      const char* idScope,
+      const char* registrationId,
+      const char* deviceKey);
+
+  // For X.509 enrollments; pass a NULL deviceKey to the constructor.
+  void SetClientCertificate(const char* certPem, const char* keyPem);
+
+  bool LoadAssignment(char* hostname, size_t hostnameSize, char* deviceId, size_t deviceIdSize);
+  void ClearAssignment();
+
+  /*
+   * @brief Runs the DPS register/poll exchange over its own MQTT connection.
+   * @return 0 once the device is assigned (and the assignment cached), 1 otherwise.
+   */
+  int Register(
+      char* hostname,
+      size_t hostnameSize,
+      char* deviceId,
+      size_t deviceIdSize,
+      unsigned long timeoutMs);
+
+private:
+  static esp_err_t mqttEventHandler(esp_mqtt_event_handle_t event);
+  void onMqttEvent(esp_mqtt_event_handle_t event);
+  bool publish(const char* topic, const char* payload);
+  void saveAssignment();
+
+  const char* endpoint;
+  const char* idScope;
+  const char* registrationId;
+  const char* deviceKey;
+  const char* clientCertPem;
+  const char* clientKeyPem;
+
+  az_iot_provisioning_client client;
+  esp_mqtt_client_handle_t mqttClient;
+
+  volatile bool connected;
+  volatile bool responseReceived;
+  volatile bool assigned;
+  volatile bool failed;
+  uint32_t retryAfterSeconds;
+  char operationId[DPS_OPERATION_ID_BUFFER_SIZE];
+  char assignedHostname[DPS_HOSTNAME_BUFFER_SIZE];
+  char assignedDeviceId[DPS_DEVICE_ID_BUFFER_SIZE];
+};
+
+#endif // AZIOTPROVISIONING_H
@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: MIT
 
 #include "AzIoTSasToken.h"
+#include "LatencyTracer.h"
 #include "SerialLogger.h"
 #include <az_result.h>
 #include <mbedtls/base64.h>
@@ -169,6 +170,7 @@ int64_t iot_sample_get_epoch_expiration_time_from_minutes(uint32_t minutes)
 
 az_span generate_sas_token(
     az_iot_hub_client* hub_client,
+    az_iot_provisioning_client* provisioning_client,
     az_span device_key,
     az_span sas_signature,
     unsigned int expiryTimeInMinutes,
@@ -180,7 +182,15 @@ az_span generate_sas_token(
 
   // Get the signature that will later be signed with the decoded key.
   // az_span sas_signature = AZ_SPAN_FROM_BUFFER(signature);
-  rc = az_iot_hub_client_sas_get_signature(hub_client, sas_duration, sas_signature, &sas_signature);
+  if (provisioning_client != NULL)
+  {
+    rc = az_iot_provisioning_client_sas_get_signature(
+        provisioning_client, sas_duration, sas_signature, &sas_signature);
+  }
+  else
+  {
+    rc = az_iot_hub_client_sas_get_signature(hub_client, sas_duration, sas_signature, &sas_signature);
+  }
   if (az_result_failed(rc))
   {
     Logger.Error("Could not get the signature for SAS key: az_result return code " + rc);
@@ -204,14 +214,28 @@ az_span generate_sas_token(
 
   // Get the resulting MQTT password, passing the base64 encoded, HMAC signed bytes.
   size_t mqtt_password_length;
-  rc = az_iot_hub_client_sas_get_password(
-      hub_client,
-      sas_duration,
-      sas_base64_encoded_signed_signature,
-      AZ_SPAN_EMPTY,
-      (char*)az_span_ptr(sas_token),
-      az_span_size(sas_token),
-      &mqtt_password_length);
+  if (provisioning_client != NULL)
+  {
+    rc = az_iot_provisioning_client_sas_get_password(
+        provisioning_client,
+        sas_base64_encoded_signed_signature,
+        sas_duration,
+        AZ_SPAN_EMPTY,
+        (char*)az_span_ptr(sas_token),
+        az_span_size(sas_token),
+        &mqtt_password_length);
+  }
+  else
+  {
+    rc = az_iot_hub_client_sas_get_password(
+        hub_client,
+        sas_duration,
+        sas_base64_encoded_signed_signature,
+        AZ_SPAN_EMPTY,
+        (char*)az_span_ptr(sas_token),
+        az_span_size(sas_token),
+        &mqtt_password_length);
+  }
 
   if (az_result_failed(rc))
   {
@@ -231,6 +255,22 @@ AzIoTSasToken::AzIoTSasToken(
     az_span sasTokenBuffer)
 {
   this->client = client;
+  this->provisioningClient = NULL;
+  this->deviceKey = deviceKey;
+  this->signatureBuffer = signatureBuffer;
+  this->sasTokenBuffer = sasTokenBuffer;
+  this->expirationUnixTime = 0;
+  this->sasToken = AZ_SPAN_EMPTY;
+}
+
+AzIoTSasToken::AzIoTSasToken(
+    az_iot_provisioning_client* provisioningClient,
+    az_span deviceKey,
+    az_span signatureBuffer,
+    az_span sasTokenBuffer)
+{
+  this->client = NULL;
+  this->provisioningClient = provisioningClient;
   this->deviceKey = deviceKey;
   this->signatureBuffer = signatureBuffer;
   this->sasTokenBuffer = sasTokenBuffer;
@@ -240,8 +280,11 @@ AzIoTSasToken::AzIoTSasToken(
 
 int AzIoTSasToken::Generate(unsigned int expiryTimeInMinutes)
 {
+  TraceScope trace(TRACE_STAGE_SAS_GENERATE);
+
   this->sasToken = generate_sas_token(
       this->client,
+      this->provisioningClient,
       this->deviceKey,
       this->signatureBuffer,
       expiryTimeInMinutes,
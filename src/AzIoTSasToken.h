@@ -6,6 +6,7 @@
 
 #include <Arduino.h>
 #include <az_iot_hub_client.h>
+#include <az_iot_provisioning_client.h>
 #include <az_span.h>
 
 class AzIoTSasToken
@@ -16,12 +17,18 @@ public:
       az_span deviceKey,
       az_span signatureBuffer,
       az_span sasTokenBuffer);
+  AzIoTSasToken(
+      az_iot_provisioning_client* provisioningClient,
+      az_span deviceKey,
+      az_span signatureBuffer,
+      az_span sasTokenBuffer);
   int Generate(unsigned int expiryTimeInMinutes);
   bool IsExpired();
   az_span Get();
 
 private:
   az_iot_hub_client* client;
+  az_iot_provisioning_client* provisioningClient;
   az_span deviceKey;
   az_span signatureBuffer;
   az_span sasTokenBuffer;
@@ -12,13 +12,19 @@
  * MQTT topic names and messages exchanged with the Azure IoT Hub.
  *
  * This sample performs the following tasks:
+ * - Reconnect to the last-good access point and restore the clock from NVS while SNTP and Wi-Fi
+ * association run concurrently, timing each startup phase;
  * - Synchronize the device clock with a NTP server;
+ * - Optionally get the IoT Hub and device id from the Device Provisioning Service, caching the
+ * assignment in NVS so warm boots connect straight to the hub;
  * - Initialize our "az_iot_hub_client" (struct for data, part of our azure-sdk-for-c);
  * - Initialize the MQTT client (here we use ESPRESSIF's esp_mqtt_client, which also handle the tcp
  * connection and TLS);
  * - Connect the MQTT client (using server-certificate validation, SAS-tokens for client
  * authentication);
- * - Periodically send telemetry data to the Azure IoT Hub.
+ * - Periodically send telemetry data to the Azure IoT Hub;
+ * - Periodically send memory diagnostics (heap, PSRAM, task stacks, per-subsystem allocations)
+ * and per-stage publish latency histograms.
  *
  * To properly connect to your Azure IoT Hub, please fill the information in the `iot_configs.h`
  * file.
@@ -31,6 +37,10 @@
 
 // Libraries for MQTT client and WiFi connection
 #include <WiFi.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <esp_sntp.h>
+#include <esp_tls.h>
 #include <mqtt_client.h>
 
 // Azure IoT SDK for C includes
@@ -39,14 +49,29 @@
 #include <azure_ca.h>
 
 // Additional sample headers
+#include "AlertMonitor.h"
+#include "AzIoTProvisioning.h"
 #include "AzIoTSasToken.h"
+#include "ConnectionCache.h"
+#include "ConnectionHealth.h"
+#include "DhtSensor.h"
+#include "EventRecorder.h"
+#include "GatewayLink.h"
+#include "HistoryStore.h"
+#include "LatencyTracer.h"
+#include "MemoryMonitor.h"
+#include "OtaUpdater.h"
+#include "PsramArena.h"
+#include "ReprovisionBackoff.h"
+#include "RoutineLane.h"
+#include "RulesEngine.h"
+#include "SensorSample.h"
 #include "SerialLogger.h"
+#include "StartupProfiler.h"
+#include "TelemetryBatch.h"
+#include "TelemetrySchema.h"
 #include "iot_configs.h"
 
-// Sensors
-#include <Adafruit_Sensor.h>
-#include <DHT.h>
-
 // Data format
 #include <ArduinoJson.h>
 
@@ -57,10 +82,13 @@
 // Utility macros and defines
 #define sizeofarray(a) (sizeof(a) / sizeof(a[0]))
 #define NTP_SERVERS "pool.ntp.org", "time.nist.gov"
+#define MQTT_QOS0 0
 #define MQTT_QOS1 1
+#define STORE_IN_OUTBOX true
 #define DO_NOT_RETAIN_MSG 0
 #define SAS_TOKEN_DURATION_IN_MINUTES 60
 #define UNIX_TIME_NOV_13_2017 1510592825
+#define WIFI_FAST_CONNECT_TIMEOUT_MILLISECS 3000
 
 #define PST_TIME_ZONE 9
 #define PST_TIME_ZONE_DAYLIGHT_SAVINGS_DIFF 0
@@ -71,9 +99,10 @@
 // Translate iot_configs.h defines into variables used by the sample
 static const char *ssid = IOT_CONFIG_WIFI_SSID;
 static const char *password = IOT_CONFIG_WIFI_PASSWORD;
-static const char *host = IOT_CONFIG_IOTHUB_FQDN;
-static const char *mqtt_broker_uri = "mqtts://" IOT_CONFIG_IOTHUB_FQDN;
-static const char *device_id = IOT_CONFIG_DEVICE_ID;
+// The hub and device id are replaced by the DPS assignment when IOT_CONFIG_USE_DPS is defined.
+static char host[128] = IOT_CONFIG_IOTHUB_FQDN;
+static char mqtt_broker_uri[136];
+static char device_id[128] = IOT_CONFIG_DEVICE_ID;
 static const int mqtt_port = AZ_IOT_DEFAULT_MQTT_CONNECT_PORT;
 
 // Memory allocated for the sample's variables and structures.
@@ -85,16 +114,122 @@ static char mqtt_username[128];
 static char mqtt_password[200];
 static uint8_t sas_signature_buffer[256];
 static unsigned long next_telemetry_send_time_ms = 0;
+static unsigned long next_diagnostics_send_time_ms = DIAGNOSTICS_FREQUENCY_MILLISECS;
 
 // Topic 설정
-static char telemetry_topic[128];
+static char telemetry_topic[256];
+static char alert_topic[128];
 
 static uint32_t telemetry_send_count = 0;
-static String telemetry_payload = "{}";
+
+// JSON documents are built in a PSRAM arena that is reset after every publish,
+// and serialized into pooled payload buffers.
+static PsramArena json_arena(JSON_ARENA_SIZE);
+static PayloadBufferPool payload_buffers;
 
 #define INCOMING_DATA_BUFFER_SIZE 128
 static char incoming_data[INCOMING_DATA_BUFFER_SIZE];
 
+// Diagnostics messages carry a "type" application property so the hub can route them apart.
+#define DIAGNOSTICS_PROPERTIES_BUFFER_SIZE 32
+#define MEMORY_DUMP_C2D_COMMAND "dumpMemory"
+#define MEMORY_DUMP_SERIAL_COMMAND 'm'
+#define TRACE_DUMP_SERIAL_COMMAND 't'
+#define EVENT_TRACE_EXPORT_SERIAL_COMMAND 'r'
+static char diagnostics_properties_buffer[DIAGNOSTICS_PROPERTIES_BUFFER_SIZE];
+
+// Connectivity health goes out with the diagnostics as a "type" = "health" message, and into the
+// twin's reported properties after every connect and then hourly (the hub throttles twin updates).
+#define TWIN_REPORT_FREQUENCY_MILLISECS (60UL * 60UL * 1000UL)
+static char twin_patch_topic[128];
+static uint32_t twin_request_id = 0;
+static volatile bool twin_report_pending = false;
+static unsigned long next_twin_report_time_ms = TWIN_REPORT_FREQUENCY_MILLISECS;
+
+// Two publish lanes. Alerts are published from loop() at QoS1 as soon as a threshold is crossed,
+// with "type" = "alert" and "alert" = <channel> properties. Routine readings are batched and
+// handed to the MQTT task's outbox at QoS0 (QoS1 until the first one is acknowledged); once the
+// outbox holds more than ROUTINE_OUTBOX_LIMIT_BYTES, routine batches are dropped instead of
+// queueing ahead of alerts.
+#define ALERT_PROPERTIES_BUFFER_SIZE 48
+static char alert_properties_buffer[ALERT_PROPERTIES_BUFFER_SIZE];
+static RoutineLane routine_lane(ROUTINE_OUTBOX_LIMIT_BYTES);
+
+// Routine telemetry is JSON unless IOT_CONFIG_TELEMETRY_CBOR is set; the IoT Hub content type and
+// encoding system properties ($.ct/$.ce, URL-encoded) tell the hub how to read the body.
+#ifdef IOT_CONFIG_TELEMETRY_CBOR
+#define TELEMETRY_ENCODING TELEMETRY_ENCODING_CBOR
+#define TELEMETRY_CONTENT_TYPE "application%2Fcbor"
+#else
+#define TELEMETRY_ENCODING TELEMETRY_ENCODING_JSON
+#define TELEMETRY_CONTENT_TYPE "application%2Fjson"
+#endif
+#define TELEMETRY_PROPERTIES_BUFFER_SIZE 64
+static char telemetry_properties_buffer[TELEMETRY_PROPERTIES_BUFFER_SIZE];
+static const AlertThreshold alert_thresholds[SENSOR_CHANNEL_COUNT] = {
+  { IOT_CONFIG_ALERT_TEMPERATURE_LOW,
+    IOT_CONFIG_ALERT_TEMPERATURE_HIGH,
+    IOT_CONFIG_ALERT_TEMPERATURE_HYSTERESIS },
+  { IOT_CONFIG_ALERT_HUMIDITY_LOW, IOT_CONFIG_ALERT_HUMIDITY_HIGH, IOT_CONFIG_ALERT_HUMIDITY_HYSTERESIS },
+};
+static AlertMonitor alert_monitor(alert_thresholds);
+
+// Edge rules are evaluated on every sample; hits go out on the alert lane. Updates arrive as a
+// C2D JSON message with "type" = "rules", are copied here by the MQTT task and compiled in
+// loop(), then kept in NVS.
+#define RULES_UPDATE_BUFFER_SIZE 512
+#define RULES_NAMESPACE "rules"
+static RulesEngine rules_engine;
+static char rules_update_buffer[RULES_UPDATE_BUFFER_SIZE];
+static volatile bool rules_update_pending = false;
+
+// Firmware chunks arrive as binary C2D messages with the properties ota-size, ota-sha256 (hex)
+// and ota-offset, and are written to flash from the MQTT task as they come in. Every chunk is
+// answered with a "type" = "ota" message carrying the next expected offset, which the sender
+// waits for before sending the next chunk and resumes from after a disconnect or reboot.
+#define OTA_RESTART_DELAY_MILLISECS 2000
+static bool ota_chunk_receiving = false;
+static bool ota_chunk_accepted = false;
+static uint32_t ota_chunk_offset;
+static uint32_t ota_image_size;
+static uint8_t ota_image_digest[OTA_DIGEST_SIZE];
+static volatile bool ota_status_pending = false;
+
+// Direct method requests are copied here by the MQTT task and answered from loop(). getHistory
+// {"from": <epoch>, "to": <epoch>, "resolution": <seconds>} answers with the range it found and
+// then streams the readings as "type" = "history" messages, one page per loop() while the outbox
+// is below ROUTINE_OUTBOX_LIMIT_BYTES; the last page has "history" = "end".
+#define METHOD_NAME_SIZE 16
+#define METHOD_REQUEST_ID_SIZE 32
+#define METHOD_PAYLOAD_SIZE 128
+#define HISTORY_METHOD_NAME "getHistory"
+#define HISTORY_READINGS_PER_MESSAGE 20
+#define HISTORY_PROPERTIES_BUFFER_SIZE 96
+static char method_name[METHOD_NAME_SIZE];
+static char method_request_id[METHOD_REQUEST_ID_SIZE];
+static char method_payload[METHOD_PAYLOAD_SIZE];
+static volatile bool method_request_pending = false;
+static char method_response_topic[128];
+static char history_properties_buffer[HISTORY_PROPERTIES_BUFFER_SIZE];
+static HistoryQuery history_query;
+static bool history_streaming = false;
+static uint32_t history_page = 0;
+
+// Gateway mode: a leaf board sends each reading to the gateway as a UDP frame instead of keeping
+// its own IoT Hub connection, and the gateway publishes them as routine telemetry batches carrying
+// the leaf's BOARD_ID. Leaf batches share the routine lane, and its outbox limit, with our own.
+#if defined(IOT_CONFIG_GATEWAY) && defined(IOT_CONFIG_GATEWAY_LEAF)
+#error "Define either IOT_CONFIG_GATEWAY or IOT_CONFIG_GATEWAY_LEAF, not both"
+#endif
+
+static TelemetryBatch routine_batch;
+static volatile bool memory_dump_requested = false;
+static bool startup_profile_logged = false;
+
+// Start of the current TCP/TLS/MQTT connect, taken at MQTT_EVENT_BEFORE_CONNECT. The connect can
+// outlast the cycle counter and its events may arrive on either core, so it is timed in micros.
+static uint32_t mqtt_connect_start_micros = 0;
+
 // Auxiliary functions; 보조 함수
 #ifndef IOT_CONFIG_USE_X509_CERT
 static AzIoTSasToken sasToken(
@@ -104,69 +239,195 @@ static AzIoTSasToken sasToken(
     AZ_SPAN_FROM_BUFFER(mqtt_password));
 #endif // IOT_CONFIG_USE_X509_CERT
 
+#ifdef IOT_CONFIG_USE_DPS
+#define DPS_REGISTRATION_TIMEOUT_MILLISECS 60000
+
+#ifdef IOT_CONFIG_USE_X509_CERT
+static AzIoTProvisioning provisioning(
+    IOT_CONFIG_DPS_ENDPOINT,
+    IOT_CONFIG_DPS_ID_SCOPE,
+    IOT_CONFIG_DPS_REGISTRATION_ID,
+    NULL);
+#else
+static AzIoTProvisioning provisioning(
+    IOT_CONFIG_DPS_ENDPOINT,
+    IOT_CONFIG_DPS_ID_SCOPE,
+    IOT_CONFIG_DPS_REGISTRATION_ID,
+    IOT_CONFIG_DEVICE_KEY);
+#endif // IOT_CONFIG_USE_X509_CERT
+
+static ReprovisionBackoff reprovisioning;
+static int provisionDevice(bool force); // DPS 할당 (NVS 캐시 우선)
+#endif // IOT_CONFIG_USE_DPS
+
 static void connectToWiFi();                                            // WiFi 연결, loop()에서 핸들링
+static bool waitForWiFi(unsigned long timeout_ms);                      // 0 = 무한 대기
 static void initializeTime();                                           // getTime() 인증서 유효성 검사용 - print하는 함수 추가: printLocalTime()
+static void waitForTime(bool require_sync);                             // 캐시된 시간 또는 SNTP 동기화 대기
+static void onTimeSynchronized(struct timeval *tv);                     // SNTP 동기화 콜백
 void receivedCallback(char *topic, byte *payload, unsigned int length); // 메시지 수신 콜백
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event);     // MQTT 이벤트 핸들러
 static void initializeIoTHubClient();                                   // IoT Hub Client 초기화
 static int initializeMqttClient();                                      // MQTT Client 초기화, SAS 토큰 사용하네
+static int renewMqttCredentials();                                      // SAS 갱신 시 클라이언트/아웃박스 재사용
+static int buildMqttConfig(esp_mqtt_client_config_t *mqtt_config);      // MQTT 설정 (SAS 토큰 생성 포함)
 static uint32_t getEpochTimeInSecs();
 static void establishConnection();      // 각종 연결 수립(WiFi, time, iothub, mqtt)
-static void generateTelemetryPayload(); // payload 생성; telemetry_payload
-static void sendTelemetry();            // publish Message; telemetry_topic
+static size_t generateTelemetryPayload(
+    uint32_t board_id, TelemetryBatch &batch, char *payload, size_t payload_size); // payload 생성
+static void sampleSensors();            // read sensors, raise alerts, batch routine readings
+#ifdef IOT_CONFIG_GATEWAY_LEAF
+static void sendToGateway();            // read sensors and send the reading to the gateway
+#endif
+#ifdef IOT_CONFIG_GATEWAY
+static void sendLeafTelemetry();        // publish the next ready leaf batch; telemetry_topic
+#endif
+static void sendTelemetry(uint32_t board_id, TelemetryBatch &batch); // publish a routine batch; telemetry_topic
+static void sendAlert(const AlertEvent &alert); // publish an alert immediately; alert_topic
+static void sendRuleHit(const RuleHit &hit);    // publish a rule state change; alert_topic
+static void applyRules(const char *rules_json, bool persist); // compile an edge rule set
+static void sendOtaStatus();            // report firmware download progress; alert_topic
+static void handleMethodRequest();      // answer a direct method; method_response_topic
+static void sendHistoryPage();          // publish the next page of a getHistory query; telemetry_topic
+static void sendDiagnostics();          // publish memory diagnostics
+static void sendHealth();               // publish connectivity health; telemetry_topic
+static void reportHealth();             // patch connectivity health into the twin; twin_patch_topic
+static void resetJsonDocument();        // empty doc and rewind its arena
 
 // DHT Sensor config
-// Set your Board ID (ESP32 Sender #1 = BOARD_ID 1, ESP32 Sender #2 = BOARD_ID 2, etc)
+// Board ID sent as "id" with every reading; see IOT_CONFIG_BOARD_ID in iot_configs.h.
+#ifdef IOT_CONFIG_BOARD_ID
+#define BOARD_ID IOT_CONFIG_BOARD_ID
+#else
 #define BOARD_ID 0
+#endif
+
+#if BOARD_ID < 0 || BOARD_ID > 65535
+#error "IOT_CONFIG_BOARD_ID must fit in 16 bits"
+#endif
+
+// The gateway tells leaves apart by their id; frames with its own default would be merged with its
+// readings.
+#if defined(IOT_CONFIG_GATEWAY_LEAF) && BOARD_ID == 0
+#error "Set IOT_CONFIG_BOARD_ID on every leaf board, from 1; 0 is the gateway's"
+#endif
 
 // Digital pin connected to the DHT sensor
 #define DHTPIN 4
 
 // Uncomment the type of sensor in use:
-// #define DHTTYPE    DHT11     // DHT 11
-#define DHTTYPE DHT22 // DHT 22 (AM2302)
-// #define DHTTYPE    DHT21     // DHT 21 (AM2301)
+// #define DHTTYPE    DHT_MODEL_DHT11     // DHT 11
+#define DHTTYPE DHT_MODEL_DHT22 // DHT 22 (AM2302), DHT 21 (AM2301)
 
-static DHT dht(DHTPIN, DHTTYPE);
-static JsonDocument doc; // Allocate the JSON document
+static DhtSensor dht;
+static JsonDocument doc(&json_arena); // Allocate the JSON document
 static void printLocalTime();
 
-static float readDHTTemperature();
-static float readDHTHumidity();
+static void readDHT(SensorSample& sample);
 static void publishTemperatureHumidity();
 
+static bool waitForWiFi(unsigned long timeout_ms)
+{
+  unsigned long start = millis();
+
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    if (timeout_ms > 0 && millis() - start >= timeout_ms)
+    {
+      return false;
+    }
+
+    delay(100);
+    Serial.print(".");
+  }
+
+  return true;
+}
+
+static void onWiFiDisconnected(arduino_event_id_t event, arduino_event_info_t info)
+{
+  (void)event;
+  LinkHealth.OnWiFiDisconnected(info.wifi_sta_disconnected.reason);
+}
+
+// The core's auto-reconnect rejoins without connectToWiFi(); without this, only the first drop
+// after a connectToWiFi() would be counted.
+static void onWiFiGotIp(arduino_event_id_t event, arduino_event_info_t info)
+{
+  (void)event;
+  (void)info;
+  LinkHealth.OnWiFiConnected();
+}
+
 static void connectToWiFi()
 {
   Logger.Info("Connecting to WIFI SSID " + String(ssid));
+  StartupPhases.Begin(STARTUP_PHASE_WIFI);
+  LinkHealth.BeginPhase(HEALTH_PHASE_WIFI);
 
   WiFi.mode(WIFI_STA);
   WiFi.disconnect();
   delay(100);
-  WiFi.begin(ssid, password);
-  while (WiFi.status() != WL_CONNECTED)
+
+  bool connected = false;
+  if (NetworkCache.HasAccessPoint())
   {
-    delay(500);
-    Serial.print(".");
+    // Joining the cached BSSID on its channel skips the full channel scan.
+    WiFi.begin(ssid, password, NetworkCache.Channel(), NetworkCache.Bssid());
+    connected = waitForWiFi(WIFI_FAST_CONNECT_TIMEOUT_MILLISECS);
+
+    if (!connected)
+    {
+      Logger.Info("Cached access point not reachable; scanning");
+      WiFi.disconnect();
+    }
+  }
+
+  if (!connected)
+  {
+    WiFi.begin(ssid, password);
+    (void)waitForWiFi(0);
   }
 
   Serial.println("");
 
+  NetworkCache.SaveAccessPoint(WiFi.BSSID(), WiFi.channel());
+  StartupPhases.End(STARTUP_PHASE_WIFI);
+  LinkHealth.EndPhase(HEALTH_PHASE_WIFI);
+  LinkHealth.OnWiFiConnected();
   Logger.Info("WiFi connected, IP address: " + WiFi.localIP().toString());
 }
 
+static void onTimeSynchronized(struct timeval *tv)
+{
+  (void)tv;
+  NetworkCache.OnTimeSynchronized();
+  StartupPhases.End(STARTUP_PHASE_TIME_SYNC);
+}
+
+// Starts SNTP without waiting for it; the cached epoch stands in until it answers.
 static void initializeTime()
 {
   Logger.Info("Setting time using SNTP");
+  StartupPhases.Begin(STARTUP_PHASE_TIME);
+  StartupPhases.Begin(STARTUP_PHASE_TIME_SYNC);
 
+  sntp_set_time_sync_notification_cb(onTimeSynchronized);
   configTime(GMT_OFFSET_SECS, GMT_OFFSET_SECS_DST, NTP_SERVERS);
+  (void)NetworkCache.RestoreTime(UNIX_TIME_NOV_13_2017);
+}
+
+static void waitForTime(bool require_sync)
+{
   time_t now = time(NULL);
-  while (now < UNIX_TIME_NOV_13_2017)
+  while (now < UNIX_TIME_NOV_13_2017 || (require_sync && !NetworkCache.IsTimeSynchronized()))
   {
     delay(500);
     Serial.print(".");
     now = time(nullptr);
   }
   Serial.println("");
+  StartupPhases.End(STARTUP_PHASE_TIME);
   Logger.Info("Time initialized!");
 }
 
@@ -183,17 +444,197 @@ void receivedCallback(char *topic, byte *payload, unsigned int length)
   Serial.println("");
 }
 
+static void recordMqttEvent(esp_mqtt_event_handle_t event)
+{
+  RecordedMqttEvent recorded;
+  recorded.eventId = (uint8_t)event->event_id;
+  recorded.errorType = event->error_handle != NULL ? (uint8_t)event->error_handle->error_type : 0;
+  recorded.connectReturnCode
+      = event->error_handle != NULL ? (uint8_t)event->error_handle->connect_return_code : 0;
+  recorded.msgId = event->msg_id;
+  recorded.dataLength = event->total_data_len;
+  recorded.outboxSize = mqtt_client != NULL ? esp_mqtt_client_get_outbox_size(mqtt_client) : 0;
+  Recorder.RecordMqttEvent(recorded);
+}
+
+// Returns true if the message is a firmware chunk; its ota-* properties are kept for the remaining parts.
+static bool parseOtaChunk(esp_mqtt_event_handle_t event)
+{
+  az_iot_hub_client_c2d_request request;
+  az_span value;
+
+  if (az_result_failed(az_iot_hub_client_c2d_parse_received_topic(
+          &client, az_span_create((uint8_t *)event->topic, event->topic_len), &request))
+      || az_result_failed(az_iot_message_properties_find(
+          &request.properties, AZ_SPAN_FROM_STR("ota-offset"), &value)))
+  {
+    return false;
+  }
+
+  ota_chunk_accepted = az_result_succeeded(az_span_atou32(value, &ota_chunk_offset))
+      && az_result_succeeded(az_iot_message_properties_find(
+          &request.properties, AZ_SPAN_FROM_STR("ota-size"), &value))
+      && az_result_succeeded(az_span_atou32(value, &ota_image_size))
+      && az_result_succeeded(az_iot_message_properties_find(
+          &request.properties, AZ_SPAN_FROM_STR("ota-sha256"), &value))
+      && OtaUpdater::ParseDigest((const char *)az_span_ptr(value), az_span_size(value), ota_image_digest);
+
+  if (!ota_chunk_accepted)
+  {
+    Logger.Error("Firmware chunk has malformed ota-* properties");
+  }
+
+  return true;
+}
+
+// Returns true if the message is a rule set: a C2D message with the property "type" = "rules".
+static bool parseRulesUpdate(esp_mqtt_event_handle_t event)
+{
+  az_iot_hub_client_c2d_request request;
+  az_span value;
+
+  if (az_result_failed(az_iot_hub_client_c2d_parse_received_topic(
+          &client, az_span_create((uint8_t *)event->topic, event->topic_len), &request))
+      || az_result_failed(
+          az_iot_message_properties_find(&request.properties, AZ_SPAN_FROM_STR("type"), &value))
+      || !az_span_is_content_equal(value, AZ_SPAN_FROM_STR("rules")))
+  {
+    return false;
+  }
+
+  if (event->data_len != event->total_data_len || event->data_len >= RULES_UPDATE_BUFFER_SIZE)
+  {
+    Logger.Error("Rules update ignored; larger than " + String(RULES_UPDATE_BUFFER_SIZE - 1) + " bytes");
+  }
+  else if (rules_update_pending)
+  {
+    Logger.Error("Rules update ignored; the previous one is not applied yet");
+  }
+  else
+  {
+    memcpy(rules_update_buffer, event->data, event->data_len);
+    rules_update_buffer[event->data_len] = '\0';
+    rules_update_pending = true;
+  }
+
+  return true;
+}
+
+static void receiveOtaChunk(esp_mqtt_event_handle_t event)
+{
+  if (ota_chunk_accepted
+      && !Ota.Write(
+          ota_image_size,
+          ota_image_digest,
+          ota_chunk_offset + event->current_data_offset,
+          (const uint8_t *)event->data,
+          event->data_len))
+  {
+    ota_chunk_accepted = false; // The rest is dropped; the sender resumes from Ota.Offset().
+  }
+
+  if (event->current_data_offset + event->data_len >= event->total_data_len)
+  {
+    ota_status_pending = true;
+  }
+}
+
+// Returns true if the message answers one of our twin requests.
+static bool parseTwinResponse(esp_mqtt_event_handle_t event)
+{
+  az_iot_hub_client_twin_response response;
+
+  if (az_result_failed(az_iot_hub_client_twin_parse_received_topic(
+          &client, az_span_create((uint8_t *)event->topic, event->topic_len), &response)))
+  {
+    return false;
+  }
+
+  if (response.status != AZ_IOT_STATUS_NO_CONTENT && response.status != AZ_IOT_STATUS_OK)
+  {
+    Logger.Error("Twin request failed with status " + String((int)response.status));
+  }
+
+  return true;
+}
+
+// Returns true if the message is a direct method request; it is queued for loop() to answer.
+static bool parseMethodRequest(esp_mqtt_event_handle_t event)
+{
+  az_iot_hub_client_method_request request;
+
+  if (az_result_failed(az_iot_hub_client_methods_parse_received_topic(
+          &client, az_span_create((uint8_t *)event->topic, event->topic_len), &request)))
+  {
+    return false;
+  }
+
+  if (method_request_pending || az_span_size(request.request_id) >= METHOD_REQUEST_ID_SIZE)
+  {
+    Logger.Error("Direct method request dropped");
+    return true;
+  }
+
+  az_span_to_str(method_request_id, sizeof(method_request_id), request.request_id);
+  az_span_to_str(
+      method_name,
+      sizeof(method_name),
+      az_span_size(request.name) < METHOD_NAME_SIZE ? request.name : AZ_SPAN_EMPTY);
+
+  // An oversized payload is left empty, which fails to parse and is answered with 400.
+  method_payload[0] = '\0';
+  if (event->data_len == event->total_data_len && event->data_len < METHOD_PAYLOAD_SIZE)
+  {
+    memcpy(method_payload, event->data, event->data_len);
+    method_payload[event->data_len] = '\0';
+  }
+
+  method_request_pending = true;
+  return true;
+}
+
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
+  // The esp-mqtt task is not pinned to a core.
+  TraceMicrosScope trace(TRACE_STAGE_MQTT_EVENT);
+
+  if (Recorder.IsRecording())
+  {
+    recordMqttEvent(event);
+  }
+
   switch (event->event_id)
   {
     int i, r;
 
   case MQTT_EVENT_ERROR:
     Logger.Info("MQTT event MQTT_EVENT_ERROR");
+    if (event->error_handle != NULL)
+    {
+      bool refused = event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED;
+      LinkHealth.OnMqttError(
+          refused ? MQTT_DROP_REFUSED : MQTT_DROP_TRANSPORT, event->error_handle->connect_return_code);
+    }
+#ifdef IOT_CONFIG_USE_DPS
+    // A refusal before SNTP has answered may just be a SAS token signed with the cached clock.
+    if (event->error_handle != NULL
+        && event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED
+        && NetworkCache.IsTimeSynchronized())
+    {
+      // Only codes saying the cached hub no longer knows this device (e.g. it was moved) ask DPS again.
+      reprovisioning.OnRefused((uint8_t)event->error_handle->connect_return_code, millis());
+    }
+#endif
     break;
   case MQTT_EVENT_CONNECTED:
     Logger.Info("MQTT event MQTT_EVENT_CONNECTED");
+    StartupPhases.End(STARTUP_PHASE_MQTT_CONNECT);
+    Tracer.RecordMicros(TRACE_STAGE_MQTT_CONNECT, mqtt_connect_start_micros, LatencyTracer::Micros());
+    LinkHealth.EndPhase(HEALTH_PHASE_MQTT);
+    LinkHealth.OnMqttConnected();
+#ifdef IOT_CONFIG_USE_DPS
+    reprovisioning.OnConnected();
+#endif
 
     r = esp_mqtt_client_subscribe(mqtt_client, AZ_IOT_HUB_CLIENT_C2D_SUBSCRIBE_TOPIC, 1);
     if (r == -1)
@@ -205,9 +646,29 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
       Logger.Info("Subscribed for cloud-to-device messages; message id:" + String(r));
     }
 
+    r = esp_mqtt_client_subscribe(mqtt_client, AZ_IOT_HUB_CLIENT_METHODS_SUBSCRIBE_TOPIC, 0);
+    if (r == -1)
+    {
+      Logger.Error("Could not subscribe for direct methods.");
+    }
+
+    r = esp_mqtt_client_subscribe(mqtt_client, AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_SUBSCRIBE_TOPIC, 0);
+    if (r == -1)
+    {
+      Logger.Error("Could not subscribe for twin responses.");
+    }
+    twin_report_pending = true;
+
+    Ota.Confirm();
+    if (Ota.State() == OTA_STATE_RECEIVING)
+    {
+      ota_status_pending = true; // Tells the sender where to resume.
+    }
+
     break;
   case MQTT_EVENT_DISCONNECTED:
     Logger.Info("MQTT event MQTT_EVENT_DISCONNECTED");
+    LinkHealth.OnMqttDisconnected();
     break;
   case MQTT_EVENT_SUBSCRIBED:
     Logger.Info("MQTT event MQTT_EVENT_SUBSCRIBED");
@@ -217,8 +678,28 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
     break;
   case MQTT_EVENT_PUBLISHED:
     Logger.Info("MQTT event MQTT_EVENT_PUBLISHED");
+    Tracer.EndAck(event->msg_id);
+    StartupPhases.End(STARTUP_PHASE_FIRST_TELEMETRY);
     break;
   case MQTT_EVENT_DATA:
+    // Only the first part of a message larger than the MQTT buffer carries the topic.
+    if (event->current_data_offset == 0)
+    {
+      ota_chunk_receiving = parseOtaChunk(event);
+
+      if (!ota_chunk_receiving
+          && (parseRulesUpdate(event) || parseMethodRequest(event) || parseTwinResponse(event)))
+      {
+        break;
+      }
+    }
+
+    if (ota_chunk_receiving)
+    {
+      receiveOtaChunk(event);
+      break;
+    }
+
     Logger.Info("MQTT event MQTT_EVENT_DATA");
 
     for (i = 0; i < (INCOMING_DATA_BUFFER_SIZE - 1) && i < event->topic_len; i++)
@@ -235,9 +716,16 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
     incoming_data[i] = '\0';
     Logger.Info("Data: " + String(incoming_data));
 
+    if (strcmp(incoming_data, MEMORY_DUMP_C2D_COMMAND) == 0)
+    {
+      memory_dump_requested = true;
+    }
+
     break;
   case MQTT_EVENT_BEFORE_CONNECT:
     Logger.Info("MQTT event MQTT_EVENT_BEFORE_CONNECT");
+    mqtt_connect_start_micros = LatencyTracer::Micros();
+    LinkHealth.BeginPhase(HEALTH_PHASE_MQTT);
     break;
   default:
     Logger.Error("MQTT event UNKNOWN");
@@ -281,7 +769,7 @@ static void initializeIoTHubClient()
   Logger.Info("Username: " + String(mqtt_username));
 }
 
-static int initializeMqttClient()
+static int buildMqttConfig(esp_mqtt_client_config_t *mqtt_config)
 {
 #ifndef IOT_CONFIG_USE_X509_CERT
   if (sasToken.Generate(SAS_TOKEN_DURATION_IN_MINUTES) != 0)
@@ -291,27 +779,43 @@ static int initializeMqttClient()
   }
 #endif
 
-  esp_mqtt_client_config_t mqtt_config;
-  memset(&mqtt_config, 0, sizeof(mqtt_config));
-  mqtt_config.uri = mqtt_broker_uri;
-  mqtt_config.port = mqtt_port;
-  mqtt_config.client_id = mqtt_client_id;
-  mqtt_config.username = mqtt_username;
+  memset(mqtt_config, 0, sizeof(*mqtt_config));
+  snprintf(mqtt_broker_uri, sizeof(mqtt_broker_uri), "mqtts://%s", host);
+  mqtt_config->uri = mqtt_broker_uri;
+  mqtt_config->port = mqtt_port;
+  mqtt_config->client_id = mqtt_client_id;
+  mqtt_config->username = mqtt_username;
 
 #ifdef IOT_CONFIG_USE_X509_CERT
   Logger.Info("MQTT client using X509 Certificate authentication");
-  mqtt_config.client_cert_pem = IOT_CONFIG_DEVICE_CERT;
-  mqtt_config.client_key_pem = IOT_CONFIG_DEVICE_CERT_PRIVATE_KEY;
+  mqtt_config->client_cert_pem = IOT_CONFIG_DEVICE_CERT;
+  mqtt_config->client_key_pem = IOT_CONFIG_DEVICE_CERT_PRIVATE_KEY;
 #else // Using SAS key
-  mqtt_config.password = (const char *)az_span_ptr(sasToken.Get());
+  mqtt_config->password = (const char *)az_span_ptr(sasToken.Get());
 #endif
 
-  mqtt_config.keepalive = 240;
-  mqtt_config.disable_clean_session = 0;
-  mqtt_config.disable_auto_reconnect = false;
-  mqtt_config.event_handle = mqtt_event_handler;
-  mqtt_config.user_context = NULL;
-  mqtt_config.cert_pem = (const char *)ca_pem;
+  mqtt_config->keepalive = 240;
+  mqtt_config->disable_clean_session = 0;
+  mqtt_config->disable_auto_reconnect = false;
+  mqtt_config->event_handle = mqtt_event_handler;
+  mqtt_config->user_context = NULL;
+  // The CA chain is parsed once into the global store (see setup()) instead of on every handshake.
+  mqtt_config->use_global_ca_store = true;
+  // Every reconnect still pays a full handshake: the esp-mqtt bundled with the Arduino core cannot
+  // resume TLS sessions. A framework=espidf build could enable CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS.
+
+  return 0;
+}
+
+static int initializeMqttClient()
+{
+  esp_mqtt_client_config_t mqtt_config;
+  if (buildMqttConfig(&mqtt_config) != 0)
+  {
+    return 1;
+  }
+
+  StartupPhases.Begin(STARTUP_PHASE_MQTT_CONNECT);
 
   mqtt_client = esp_mqtt_client_init(&mqtt_config);
 
@@ -325,7 +829,7 @@ static int initializeMqttClient()
 
   if (start_result != ESP_OK)
   {
-    Logger.Error("Could not start mqtt client; error code:" + start_result);
+    Logger.Error("Could not start mqtt client; error code:" + String(start_result));
     return 1;
   }
   else
@@ -335,141 +839,1024 @@ static int initializeMqttClient()
   }
 }
 
+/*
+ * Reconnects with a fresh SAS token while keeping the MQTT client, its buffers and its outbox,
+ * so unacknowledged QoS1 messages survive the renewal and nothing is reallocated.
+ */
+static int renewMqttCredentials()
+{
+  esp_mqtt_client_config_t mqtt_config;
+
+  LinkHealth.OnMqttStopped(MQTT_DROP_RENEWAL);
+  (void)esp_mqtt_client_stop(mqtt_client);
+
+  if (buildMqttConfig(&mqtt_config) != 0)
+  {
+    LinkHealth.OnCredentialRenewal(false);
+    return 1;
+  }
+
+  if (esp_mqtt_set_config(mqtt_client, &mqtt_config) != ESP_OK)
+  {
+    Logger.Error("Failed updating mqtt client configuration; recreating the client");
+    (void)esp_mqtt_client_destroy(mqtt_client);
+    int result = initializeMqttClient();
+    LinkHealth.OnCredentialRenewal(result == 0);
+    return result;
+  }
+
+  esp_err_t start_result = esp_mqtt_client_start(mqtt_client);
+  LinkHealth.OnCredentialRenewal(start_result == ESP_OK);
+
+  if (start_result != ESP_OK)
+  {
+    Logger.Error("Could not restart mqtt client; error code:" + String(start_result));
+    return 1;
+  }
+
+  Logger.Info("MQTT client restarted with renewed credentials");
+  return 0;
+}
+
 /*
  * @brief           Gets the number of seconds since UNIX epoch until now.
  * @return uint32_t Number of seconds.
  */
 static uint32_t getEpochTimeInSecs() { return (uint32_t)time(NULL); }
 
+#ifdef IOT_CONFIG_USE_DPS
+static int provisionDevice(bool force)
+{
+  if (!force && provisioning.LoadAssignment(host, sizeof(host), device_id, sizeof(device_id)))
+  {
+    Logger.Info("Using cached DPS assignment: " + String(device_id) + " on " + String(host));
+    return 0;
+  }
+
+  // DPS is the cold path anyway; do not sign its SAS token with a cached clock.
+  waitForTime(true);
+  provisioning.ClearAssignment();
+#ifdef IOT_CONFIG_USE_X509_CERT
+  provisioning.SetClientCertificate(IOT_CONFIG_DEVICE_CERT, IOT_CONFIG_DEVICE_CERT_PRIVATE_KEY);
+#endif
+  return provisioning.Register(
+      host, sizeof(host), device_id, sizeof(device_id), DPS_REGISTRATION_TIMEOUT_MILLISECS);
+}
+#endif // IOT_CONFIG_USE_DPS
+
 static void establishConnection()
 {
-  connectToWiFi();
+  // Bring the station interface up first so SNTP runs while the access point associates.
+  WiFi.mode(WIFI_STA);
   initializeTime();
+  connectToWiFi();
+#if defined(IOT_CONFIG_USE_X509_CERT) && !defined(IOT_CONFIG_GATEWAY_LEAF)
+  // Certificate validity checks only need a lower bound on the clock, which the cache provides.
+  waitForTime(false);
+#else
+  // A SAS token signed with the restored clock may already be expired, and leaf frames carry the
+  // epoch, so both wait for SNTP.
+  waitForTime(true);
+#endif
 
   printLocalTime();
 
+#ifdef IOT_CONFIG_GATEWAY_LEAF
+  // Leaves reach IoT Hub through the gateway; they only need Wi-Fi and the clock. Having both is
+  // all a leaf image can prove, so a trial boot is confirmed here rather than on MQTT connect.
+  Ota.Confirm();
+  (void)Gateway.BeginLeaf(IOT_CONFIG_GATEWAY_ADDRESS, IOT_CONFIG_GATEWAY_PORT, BOARD_ID);
+  return;
+#endif
+
+#ifdef IOT_CONFIG_USE_DPS
+  StartupPhases.Begin(STARTUP_PHASE_PROVISIONING);
+  (void)provisionDevice(false);
+  StartupPhases.End(STARTUP_PHASE_PROVISIONING);
+#endif
+
   initializeIoTHubClient();
   (void)initializeMqttClient();
+
+#ifdef IOT_CONFIG_GATEWAY
+  (void)Gateway.BeginGateway(IOT_CONFIG_GATEWAY_PORT);
+#endif
+}
+
+static void resetJsonDocument()
+{
+  doc.clear();
+  json_arena.Reset();
 }
 
-static void generateTelemetryPayload()
+static size_t generateTelemetryPayload(
+    uint32_t board_id, TelemetryBatch &batch, char *payload, size_t payload_size)
 {
-  // You can generate the JSON using any lib you want. Here we're showing how to do it manually, for simplicity.
-  // This sample shows how to generate the payload using a syntax closer to regular delevelopment for Arduino, with
-  // String type instead of az_span as it might be done in other samples. Using az_span has the advantage of reusing the
-  // same char buffer instead of dynamically allocating memory each time, as it is done by using the String type below.
-  // 원하는 lib를 사용하여 JSON을 생성할 수 있습니다.여기서는 단순화를 위해 수동으로 수행하는 방법을 보여줍니다.
-  // 이 샘플은 다른 샘플에서 할 수 있는 것처럼 az_span 대신 String type을 사용하여 Arduino에 대한 일반 디벨롭먼트에
-  // 가까운 구문을 사용하여 페이로드를 생성하는 방법을 보여줍니다. az_span을 사용하면 아래 String 유형을 사용하여
-  // 수행되는 것처럼 매번 동적으로 메모리를 할당하는 대신 동일한 char 버퍼를 재사용할 수 있는 장점이 있습니다.
+  // The payload is written straight into the pooled buffer by the encoders generated from
+  // TelemetrySchema.h, so keys are precomputed literals and nothing is allocated per message.
+  // TelemetrySchema.h에서 생성된 인코더가 풀링된 페이로드 버퍼에 직접 씁니다.
   // telemetry_payload = "{ \"msgCount\": " + String(telemetry_send_count++) + " }";
 
-  // Read Seonsor Data
-  float t = readDHTTemperature();
-  float h = readDHTHumidity();
+  TraceScope trace(TRACE_STAGE_SERIALIZE);
+
+  TelemetryHeader header;
+  header.id = board_id;
+  header.msgCount = telemetry_send_count++;
 
   // Read Time Data
   struct tm timeinfo;
-  char tsbuf[30];
   if (!getLocalTime(&timeinfo))
   {
     Logger.Info("Failed to obtain time");
-    strcpy(tsbuf, "Failed to obtain time");
+    header.currentTime[0] = '\0'; // Optional in the schema; left out of the message.
   }
   else
   {
-    strftime(tsbuf, sizeof(tsbuf), "%Y-%m-%d %H:%M:%S (%a)", &timeinfo);
+    strftime(header.currentTime, sizeof(header.currentTime), "%Y-%m-%d %H:%M:%S (%a)", &timeinfo);
   }
 
-  /*
-    // serial print
-    Serial.printf("Temp: %.1f℃\n", t);
-    Serial.printf("Humi: %.1f%%\n", h);
-    Serial.println(&timeinfo, "%Y %b %d %a, %H:%M:%S");
-  */
+#ifdef IOT_CONFIG_SEND_SUMMARIES_ONLY
+  BatchedReading summary;
+  const BatchedReading *readings = &summary;
+  size_t reading_count = batch.Summarize(&summary) ? 1 : 0;
+#else
+  const BatchedReading *readings = batch.Readings();
+  size_t reading_count = batch.Count();
+#endif
 
-  doc["id"] = BOARD_ID;
-  doc["currentTime"] = tsbuf;
-  doc["msgCount"] = telemetry_send_count++;
-  doc["temperature"] = t;
-  doc["humidity"] = h;
+  size_t payload_length = TelemetryEncode(
+      TELEMETRY_ENCODING, header, readings, reading_count, (uint8_t *)payload, payload_size);
 
-  serializeJsonPretty(doc, telemetry_payload);
+  if (payload_length == 0)
+  {
+    Logger.Error("Telemetry payload does not fit; increase PAYLOAD_BUFFER_SIZE");
+  }
+
+  return payload_length;
 }
 
-static void sendTelemetry()
+static void sampleSensors()
 {
-  Logger.Info("Sending telemetry ...");
+  // Read Seonsor Data
+  SensorSample sample;
+  {
+    TraceScope trace(TRACE_STAGE_SENSOR_READ);
+    readDHT(sample);
+  }
+  Recorder.RecordSensorSample(sample);
 
-  // The topic could be obtained just once during setup,
-  // however if properties are used the topic need to be generated again to reflect the
-  // current values of the properties.
-  // setup()동안 한 번만 주제를 얻을 수 있었습니다,
-  // 그러나 properties을 사용하는 경우 속성의 현재 값을 반영하기 위해 항목을 다시 생성해야 합니다.
-  // az_iot_hub_client_telemetry_get_publish_topic() 함수로 미리 정해진 topic을 가져오네
-  if (az_result_failed(az_iot_hub_client_telemetry_get_publish_topic(
-          &client, NULL, telemetry_topic, sizeof(telemetry_topic), NULL)))
+  // Alerts go out before any routine work, so their latency does not depend on the batch.
+  uint32_t sampled_micros = LatencyTracer::Micros();
+  uint32_t sampled_cycles = LatencyTracer::Cycles();
+  AlertEvent alerts[SENSOR_CHANNEL_COUNT];
+  int alert_count = alert_monitor.Evaluate(sample, alerts);
+
+  for (int i = 0; i < alert_count; i++)
   {
-    Logger.Error("Failed az_iot_hub_client_telemetry_get_publish_topic");
-    return;
+    sendAlert(alerts[i]);
   }
 
-  // 이스케이프 문 사용 " 출력을 위한 \"
-  // "{ \"msgCount\": " + String(telemetry_send_count++) + " }";
-  // { "msgCount": 1557}
-  generateTelemetryPayload();
+  if (alert_count > 0)
+  {
+    Tracer.Record(TRACE_STAGE_ALERT, sampled_micros, sampled_cycles, LatencyTracer::Cycles());
+  }
 
-  // Publish 부분, QoS설정 가능, topic 수정은 어떻게 하지?
-  if (esp_mqtt_client_publish(
-          mqtt_client,
-          telemetry_topic,
-          (const char *)telemetry_payload.c_str(),
-          telemetry_payload.length(),
-          MQTT_QOS1,
-          DO_NOT_RETAIN_MSG) == 0)
+  RuleHit hits[RULES_MAX];
+  size_t hit_count;
   {
-    Logger.Error("Failed publishing");
+    TraceScope trace(TRACE_STAGE_RULES);
+    hit_count = rules_engine.Evaluate(sample, millis(), hits);
   }
-  else
+
+  for (size_t i = 0; i < hit_count; i++)
   {
-    Logger.Info("Publish Topic: " + String(telemetry_topic));
-    Logger.Info("Message published successfully");
+    sendRuleHit(hits[i]);
   }
-}
 
-// Arduino setup and loop main functions.
+  // After a power cycle the clock is the restored epoch until SNTP answers; readings are not
+  // stamped with it, nor kept in the history (a later query would place them days early). Alerts
+  // above still go out, just without "ts".
+  uint32_t epoch;
+  if (!NetworkCache.SynchronizedTime(&epoch))
+  {
+    Logger.Info("Clock not synchronized yet; reading not batched");
+    return;
+  }
 
-void setup()
-{
-  establishConnection();
+  History.Append(epoch, sample);
 
-  Serial.begin(115200); // Init Serial Monitor
-  dht.begin();          // Init dht Sensor
+  routine_batch.Add(epoch, sample);
 
-  // 추가
+  // Until the first message is acknowledged every reading goes out alone, so batching does not
+  // delay the first telemetry after boot.
+  if (routine_batch.IsFull() || !StartupPhases.IsComplete())
+  {
+    sendTelemetry(BOARD_ID, routine_batch);
+  }
 }
 
-void loop()
+#ifdef IOT_CONFIG_GATEWAY_LEAF
+static void sendToGateway()
 {
-  if (WiFi.status() != WL_CONNECTED)
+  SensorSample sample;
   {
-    connectToWiFi();
+    TraceScope trace(TRACE_STAGE_SENSOR_READ);
+    readDHT(sample);
   }
-#ifndef IOT_CONFIG_USE_X509_CERT
-  else if (sasToken.IsExpired())
+  Recorder.RecordSensorSample(sample);
+
+  uint32_t epoch;
+  if (!NetworkCache.SynchronizedTime(&epoch))
   {
-    Logger.Info("SAS token expired; reconnecting with a new one.");
-    (void)esp_mqtt_client_destroy(mqtt_client);
-    initializeMqttClient();
+    Logger.Info("Clock not synchronized yet; reading not sent to the gateway");
+    return;
+  }
+
+  if (!Gateway.Send(epoch, sample))
+  {
+    Logger.Error("Failed sending the reading to the gateway");
+  }
+}
+#endif // IOT_CONFIG_GATEWAY_LEAF
+
+#ifdef IOT_CONFIG_GATEWAY
+static void sendLeafTelemetry()
+{
+  GatewayLeaf *leaf = Gateway.NextReady();
+  if (leaf != NULL)
+  {
+    sendTelemetry(leaf->board, leaf->batch);
+  }
+}
+#endif // IOT_CONFIG_GATEWAY
+
+// Publishes the message already built in `doc` with the properties "type" = <type> and <type> = <name>.
+static void publishImmediate(const char *type, const char *name)
+{
+  az_span type_span = az_span_create_from_str((char *)type);
+
+  az_iot_message_properties properties;
+  if (az_result_failed(az_iot_message_properties_init(
+          &properties, AZ_SPAN_FROM_BUFFER(alert_properties_buffer), 0))
+      || az_result_failed(
+          az_iot_message_properties_append(&properties, AZ_SPAN_FROM_STR("type"), type_span))
+      || az_result_failed(az_iot_message_properties_append(
+          &properties, type_span, az_span_create_from_str((char *)name))))
+  {
+    Logger.Error("Failed building alert message properties");
+    resetJsonDocument();
+    return;
+  }
+
+  if (az_result_failed(az_iot_hub_client_telemetry_get_publish_topic(
+          &client, &properties, alert_topic, sizeof(alert_topic), NULL)))
+  {
+    Logger.Error("Failed az_iot_hub_client_telemetry_get_publish_topic");
+    resetJsonDocument();
+    return;
+  }
+
+  char *payload = payload_buffers.Acquire();
+  if (payload == NULL)
+  {
+    resetJsonDocument();
+    return;
+  }
+
+  size_t payload_length = 0;
+  if (!doc.overflowed() && measureJson(doc) < payload_buffers.BufferSize())
+  {
+    payload_length = serializeJson(doc, payload, payload_buffers.BufferSize());
+  }
+
+  // Written to the socket from this task instead of waiting behind routine batches in the outbox.
+  int message_id = -1;
+  if (payload_length > 0)
+  {
+    message_id = esp_mqtt_client_publish(
+        mqtt_client, alert_topic, payload, payload_length, MQTT_QOS1, DO_NOT_RETAIN_MSG);
+  }
+
+  if (message_id <= 0)
+  {
+    Logger.Error("Failed publishing alert");
+  }
+  else
+  {
+    Tracer.BeginAck(message_id);
+  }
+
+  payload_buffers.Release(payload);
+  resetJsonDocument();
+}
+
+// Leaves "ts" out while the clock may still be the epoch restored after a power cycle.
+static void addTimestamp()
+{
+  uint32_t epoch;
+  if (NetworkCache.SynchronizedTime(&epoch))
+  {
+    doc["ts"] = epoch;
+  }
+}
+
+static void sendAlert(const AlertEvent &alert)
+{
+  const char *channel_name = SensorSchema[alert.channel].name;
+  Logger.Info("Sending alert: " + String(channel_name) + " " + AlertLevelName(alert.level));
+
+  char value[SENSOR_VALUE_TEXT_SIZE];
+  size_t value_length = SensorFormat(alert.channel, alert.value, value, sizeof(value));
+
+  resetJsonDocument();
+  doc["id"] = BOARD_ID;
+  addTimestamp();
+  doc["channel"] = channel_name;
+  doc["level"] = AlertLevelName(alert.level);
+  if (value_length > 0)
+  {
+    doc["value"] = serialized(value, value_length);
+  }
+
+  publishImmediate("alert", channel_name);
+}
+
+static void sendRuleHit(const RuleHit &hit)
+{
+  const char *rule_name = rules_engine.Name(hit.rule);
+  Logger.Info("Sending rule hit: " + String(rule_name) + (hit.active ? " active" : " cleared"));
+
+  resetJsonDocument();
+  doc["id"] = BOARD_ID;
+  addTimestamp();
+  doc["rule"] = rule_name;
+  doc["state"] = hit.active ? "active" : "cleared";
+
+  publishImmediate("alert", rule_name);
+}
+
+static void sendOtaStatus()
+{
+  const char *state = OtaStateName(Ota.State());
+
+  resetJsonDocument();
+  doc["id"] = BOARD_ID;
+  addTimestamp();
+  doc["state"] = state;
+  doc["offset"] = Ota.Offset();
+  doc["size"] = Ota.Size();
+
+  publishImmediate("ota", state);
+}
+
+/*
+ * Replaces the rule set from {"rules": [{"name": "hot", "expr": "temperature > 30", "for": 3}, ...]}.
+ * Nothing changes unless every rule compiles; a successful update is kept in NVS when persist is set.
+ */
+static void applyRules(const char *rules_json, bool persist)
+{
+  static RulesEngine staged_rules;
+
+  resetJsonDocument();
+  DeserializationError error = deserializeJson(doc, rules_json);
+  if (error)
+  {
+    Logger.Error("Rules update is not valid JSON: " + String(error.c_str()));
+    resetJsonDocument();
+    return;
+  }
+
+  // Anything else (a missing key, an object) would otherwise iterate as empty and clear every rule.
+  if (!doc["rules"].is<JsonArray>())
+  {
+    Logger.Error("Rules update has no \"rules\" array");
+    resetJsonDocument();
+    return;
+  }
+
+  staged_rules.Clear();
+  for (JsonVariant rule : doc["rules"].as<JsonArray>())
+  {
+    // as<uint8_t>() would turn 300 into 0, which Add() then takes as 1.
+    if (!rule["for"].isNull() && !rule["for"].is<uint8_t>())
+    {
+      Logger.Error("Rule " + String(rule["name"].as<const char *>()) + ": \"for\" must be 0 to 255");
+      resetJsonDocument();
+      return;
+    }
+
+    const char *compile_error = staged_rules.Add(
+        rule["name"].as<const char *>(), rule["expr"].as<const char *>(), rule["for"].as<uint8_t>());
+
+    if (compile_error != NULL)
+    {
+      Logger.Error("Rule " + String(rule["name"].as<const char *>()) + ": " + compile_error);
+      resetJsonDocument();
+      return;
+    }
+  }
+
+  resetJsonDocument();
+
+  // Rules that stay keep their state; an active one that goes away is reported as cleared.
+  RuleHit cleared[RULES_MAX];
+  size_t cleared_count = staged_rules.CarryOver(rules_engine, cleared);
+  for (size_t i = 0; i < cleared_count; i++)
+  {
+    sendRuleHit(cleared[i]);
+  }
+
+  rules_engine = staged_rules;
+  Logger.Info("Loaded " + String(rules_engine.Count()) + " edge rules");
+
+  if (persist)
+  {
+    Preferences preferences;
+    if (preferences.begin(RULES_NAMESPACE, false))
+    {
+      preferences.putString("rules", rules_json);
+      preferences.end();
+    }
+  }
+}
+
+static void loadRules()
+{
+  Preferences preferences;
+  if (!preferences.begin(RULES_NAMESPACE, true))
+  {
+    return;
+  }
+
+  size_t length = preferences.getString("rules", rules_update_buffer, sizeof(rules_update_buffer));
+  preferences.end();
+
+  if (length > 0)
+  {
+    applyRules(rules_update_buffer, false);
+  }
+}
+
+static void sendTelemetry(uint32_t board_id, TelemetryBatch &batch)
+{
+  Logger.Info("Sending telemetry ...");
+
+  // Only the first message after boot is QoS1, so its acknowledgement marks time-to-first-telemetry.
+  int qos = StartupPhases.IsComplete() ? MQTT_QOS0 : MQTT_QOS1;
+
+  // The startup QoS1 messages are held to the same limit: they queue ahead of alerts just the same.
+  if (!routine_lane.Admit(esp_mqtt_client_get_outbox_size(mqtt_client)))
+  {
+    Logger.Error("Routine lane backlogged; dropping " + String(batch.Count()) + " readings");
+    batch.Clear();
+    return;
+  }
+
+  // The topic could be obtained just once during setup,
+  // however if properties are used the topic need to be generated again to reflect the
+  // current values of the properties.
+  // setup()동안 한 번만 주제를 얻을 수 있었습니다,
+  // 그러나 properties을 사용하는 경우 속성의 현재 값을 반영하기 위해 항목을 다시 생성해야 합니다.
+  // az_iot_hub_client_telemetry_get_publish_topic() 함수로 미리 정해진 topic을 가져오네
+  {
+    TraceScope trace(TRACE_STAGE_TOPIC_BUILD);
+    az_iot_message_properties properties;
+    if (az_result_failed(az_iot_message_properties_init(
+            &properties, AZ_SPAN_FROM_BUFFER(telemetry_properties_buffer), 0))
+        || az_result_failed(az_iot_message_properties_append(
+            &properties, AZ_SPAN_FROM_STR("%24.ct"), AZ_SPAN_FROM_STR(TELEMETRY_CONTENT_TYPE)))
+#ifndef IOT_CONFIG_TELEMETRY_CBOR
+        || az_result_failed(az_iot_message_properties_append(
+            &properties, AZ_SPAN_FROM_STR("%24.ce"), AZ_SPAN_FROM_STR("utf-8")))
+#endif
+    )
+    {
+      Logger.Error("Failed building telemetry message properties");
+      return;
+    }
+
+    if (az_result_failed(az_iot_hub_client_telemetry_get_publish_topic(
+            &client, &properties, telemetry_topic, sizeof(telemetry_topic), NULL)))
+    {
+      Logger.Error("Failed az_iot_hub_client_telemetry_get_publish_topic");
+      return;
+    }
+  }
+
+  char *payload = payload_buffers.Acquire();
+  if (payload == NULL)
+  {
+    return;
+  }
+
+  // 이스케이프 문 사용 " 출력을 위한 \"
+  // "{ \"msgCount\": " + String(telemetry_send_count++) + " }";
+  // { "msgCount": 1557}
+  size_t payload_length
+      = generateTelemetryPayload(board_id, batch, payload, payload_buffers.BufferSize());
+
+  // Publish 부분, QoS설정 가능, topic 수정은 어떻게 하지?
+  // esp_mqtt_client_enqueue() only stores the message; the MQTT task sends it, so loop() never
+  // blocks on the network here. It returns the message id (0 for QoS0), or -1 on failure.
+  int message_id = -1;
+  if (payload_length > 0)
+  {
+    TraceScope trace(TRACE_STAGE_MQTT_ENQUEUE);
+    message_id = esp_mqtt_client_enqueue(
+        mqtt_client, telemetry_topic, payload, payload_length, qos, DO_NOT_RETAIN_MSG, STORE_IN_OUTBOX);
+  }
+
+  batch.Clear();
+
+  if (message_id < 0 || (qos == MQTT_QOS1 && message_id == 0))
+  {
+    Logger.Error("Failed publishing");
+  }
+  else
+  {
+    if (qos == MQTT_QOS1)
+    {
+      Tracer.BeginAck(message_id);
+    }
+    Logger.Info("Publish Topic: " + String(telemetry_topic));
+    Logger.Info("Message published successfully");
+  }
+
+  // esp-mqtt has copied the message into its outbox by now.
+  payload_buffers.Release(payload);
+  MemoryStats.SetBytesInUse(MEMORY_SUBSYSTEM_MQTT_OUTBOX, esp_mqtt_client_get_outbox_size(mqtt_client));
+}
+
+static void respondToMethod(uint16_t status)
+{
+  if (az_result_failed(az_iot_hub_client_methods_response_get_publish_topic(
+          &client,
+          az_span_create_from_str(method_request_id),
+          status,
+          method_response_topic,
+          sizeof(method_response_topic),
+          NULL)))
+  {
+    Logger.Error("Failed az_iot_hub_client_methods_response_get_publish_topic");
+    resetJsonDocument();
+    return;
+  }
+
+  char *payload = payload_buffers.Acquire();
+  if (payload == NULL)
+  {
+    resetJsonDocument();
+    return;
+  }
+
+  size_t payload_length = serializeJson(doc, payload, payload_buffers.BufferSize());
+  if (esp_mqtt_client_publish(
+          mqtt_client, method_response_topic, payload, payload_length, MQTT_QOS0, DO_NOT_RETAIN_MSG)
+      < 0)
+  {
+    Logger.Error("Failed publishing the direct method response");
+  }
+
+  payload_buffers.Release(payload);
+  resetJsonDocument();
+}
+
+static void handleMethodRequest()
+{
+  Logger.Info("Direct method " + String(method_name));
+
+  if (strcmp(method_name, HISTORY_METHOD_NAME) != 0)
+  {
+    resetJsonDocument();
+    doc["error"] = "unknown method";
+    respondToMethod(404);
+    return;
+  }
+
+  resetJsonDocument();
+  DeserializationError error = deserializeJson(doc, method_payload);
+  uint32_t from = doc["from"] | History.OldestEpoch();
+  uint32_t to = doc["to"] | History.NewestEpoch();
+  uint32_t resolution = doc["resolution"] | 0;
+  resetJsonDocument();
+
+  if (error || from > to)
+  {
+    doc["error"] = "expected {\"from\": <epoch>, \"to\": <epoch>, \"resolution\": <seconds>}";
+    respondToMethod(400);
+    return;
+  }
+
+  if (history_streaming)
+  {
+    doc["error"] = "a history query is already running";
+    respondToMethod(409);
+    return;
+  }
+
+  if (!History.Seek(history_query, from, to, resolution))
+  {
+    doc["error"] = "history is not available";
+    respondToMethod(503);
+    return;
+  }
+
+  history_streaming = true;
+  history_page = 0;
+
+  doc["from"] = from;
+  doc["to"] = to;
+  doc["resolution"] = resolution;
+  doc["oldest"] = History.OldestEpoch();
+  doc["newest"] = History.NewestEpoch();
+  respondToMethod(200);
+}
+
+static void sendHistoryPage()
+{
+  // Pages are held back while routine telemetry and earlier pages are still in the outbox.
+  if (routine_lane.IsBacklogged(esp_mqtt_client_get_outbox_size(mqtt_client)))
+  {
+    return;
+  }
+
+  BatchedReading readings[HISTORY_READINGS_PER_MESSAGE];
+  size_t reading_count = History.Read(history_query, readings, HISTORY_READINGS_PER_MESSAGE);
+  const char *position = history_query.done ? "end" : "more";
+
+  az_iot_message_properties properties;
+  if (az_result_failed(az_iot_message_properties_init(
+          &properties, AZ_SPAN_FROM_BUFFER(history_properties_buffer), 0))
+      || az_result_failed(az_iot_message_properties_append(
+          &properties, AZ_SPAN_FROM_STR("%24.ct"), AZ_SPAN_FROM_STR(TELEMETRY_CONTENT_TYPE)))
+#ifndef IOT_CONFIG_TELEMETRY_CBOR
+      || az_result_failed(az_iot_message_properties_append(
+          &properties, AZ_SPAN_FROM_STR("%24.ce"), AZ_SPAN_FROM_STR("utf-8")))
+#endif
+      || az_result_failed(az_iot_message_properties_append(
+          &properties, AZ_SPAN_FROM_STR("type"), AZ_SPAN_FROM_STR("history")))
+      || az_result_failed(az_iot_message_properties_append(
+          &properties, AZ_SPAN_FROM_STR("history"), az_span_create_from_str((char *)position)))
+      || az_result_failed(az_iot_hub_client_telemetry_get_publish_topic(
+          &client, &properties, telemetry_topic, sizeof(telemetry_topic), NULL)))
+  {
+    Logger.Error("Failed building the history message topic");
+    history_streaming = false;
+    return;
+  }
+
+  char *payload = payload_buffers.Acquire();
+  if (payload == NULL)
+  {
+    return;
+  }
+
+  TelemetryHeader header;
+  header.id = BOARD_ID;
+  header.msgCount = history_page++;
+  header.currentTime[0] = '\0';
+
+  size_t payload_length = TelemetryEncode(
+      TELEMETRY_ENCODING, header, readings, reading_count, (uint8_t *)payload, payload_buffers.BufferSize());
+
+  // Backfill is worth the acknowledgement; QoS1 keeps pages in the outbox across a reconnect.
+  if (payload_length == 0
+      || esp_mqtt_client_enqueue(
+             mqtt_client, telemetry_topic, payload, payload_length, MQTT_QOS1, DO_NOT_RETAIN_MSG, STORE_IN_OUTBOX)
+          <= 0)
+  {
+    Logger.Error("Failed publishing history page " + String(header.msgCount));
+  }
+
+  payload_buffers.Release(payload);
+
+  if (history_query.done)
+  {
+    Logger.Info("History query sent in " + String(history_page) + " messages");
+    history_streaming = false;
+  }
+}
+
+// Publishes `doc` to topic at QoS1 and empties it; what names the message in errors.
+static void publishDocument(const char *topic, const char *what)
+{
+  char *payload = payload_buffers.Acquire();
+  if (payload == NULL)
+  {
+    resetJsonDocument();
+    return;
+  }
+
+  size_t payload_length = 0;
+  if (!doc.overflowed() && measureJson(doc) < payload_buffers.BufferSize())
+  {
+    payload_length = serializeJson(doc, payload, payload_buffers.BufferSize());
+  }
+
+  if (payload_length == 0
+      || esp_mqtt_client_publish(
+             mqtt_client, topic, payload, payload_length, MQTT_QOS1, DO_NOT_RETAIN_MSG)
+          <= 0)
+  {
+    Logger.Error("Failed publishing " + String(what));
+  }
+
+  payload_buffers.Release(payload);
+  resetJsonDocument();
+}
+
+static void sendDiagnostics()
+{
+  Logger.Info("Sending diagnostics ...");
+
+  az_iot_message_properties properties;
+  if (az_result_failed(az_iot_message_properties_init(
+          &properties, AZ_SPAN_FROM_BUFFER(diagnostics_properties_buffer), 0))
+      || az_result_failed(az_iot_message_properties_append(
+          &properties, AZ_SPAN_FROM_STR("type"), AZ_SPAN_FROM_STR("diagnostics"))))
+  {
+    Logger.Error("Failed building diagnostics message properties");
+    return;
+  }
+
+  if (az_result_failed(az_iot_hub_client_telemetry_get_publish_topic(
+          &client, &properties, telemetry_topic, sizeof(telemetry_topic), NULL)))
+  {
+    Logger.Error("Failed az_iot_hub_client_telemetry_get_publish_topic");
+    return;
+  }
+
+  MemoryStats.SetBytesInUse(MEMORY_SUBSYSTEM_MQTT_OUTBOX, esp_mqtt_client_get_outbox_size(mqtt_client));
+
+  resetJsonDocument();
+  doc["id"] = BOARD_ID;
+  MemoryStats.ToJson(doc);
+  doc["jsonArenaPeak"] = json_arena.HighWaterMark();
+  doc["routineDropped"] = routine_lane.Dropped();
+#ifdef IOT_CONFIG_RECORD_EVENTS
+  doc["recorderDropped"] = Recorder.Dropped();
+#endif
+#ifdef IOT_CONFIG_GATEWAY
+  Gateway.ToJson(doc);
+#endif
+  Tracer.ToJson(doc);
+  StartupPhases.ToJson(doc);
+
+  publishDocument(telemetry_topic, "diagnostics");
+}
+
+static void sendHealth()
+{
+  az_iot_message_properties properties;
+  if (az_result_failed(az_iot_message_properties_init(
+          &properties, AZ_SPAN_FROM_BUFFER(diagnostics_properties_buffer), 0))
+      || az_result_failed(az_iot_message_properties_append(
+          &properties, AZ_SPAN_FROM_STR("type"), AZ_SPAN_FROM_STR("health")))
+      || az_result_failed(az_iot_hub_client_telemetry_get_publish_topic(
+          &client, &properties, telemetry_topic, sizeof(telemetry_topic), NULL)))
+  {
+    Logger.Error("Failed building the health message topic");
+    return;
+  }
+
+  resetJsonDocument();
+  doc["id"] = BOARD_ID;
+  LinkHealth.ToJson(doc);
+  publishDocument(telemetry_topic, "health");
+}
+
+static void reportHealth()
+{
+  char request_id[12];
+  snprintf(request_id, sizeof(request_id), "%lu", (unsigned long)twin_request_id++);
+
+  if (az_result_failed(az_iot_hub_client_twin_patch_get_publish_topic(
+          &client,
+          az_span_create_from_str(request_id),
+          twin_patch_topic,
+          sizeof(twin_patch_topic),
+          NULL)))
+  {
+    Logger.Error("Failed az_iot_hub_client_twin_patch_get_publish_topic");
+    return;
+  }
+
+  resetJsonDocument();
+  LinkHealth.ToJson(doc);
+  publishDocument(twin_patch_topic, "twin health report");
+}
+
+// Arduino setup and loop main functions.
+
+void setup()
+{
+  StartupPhases.Begin(STARTUP_PHASE_FIRST_TELEMETRY);
+  NetworkCache.Begin();
+  Ota.Begin();
+
+  if (!json_arena.Begin() || !payload_buffers.Begin())
+  {
+    Logger.Error("Failed allocating JSON arena and payload buffers");
+  }
+
+  if (esp_tls_init_global_ca_store() != ESP_OK
+      || esp_tls_set_global_ca_store(ca_pem, ca_pem_len) != ESP_OK)
+  {
+    Logger.Error("Failed loading the CA certificates into the global store");
+  }
+
+#if defined(IOT_CONFIG_RECORD_EVENTS) || defined(IOT_CONFIG_HISTORY_PATH)
+  if (!SPIFFS.begin(true))
+  {
+    Logger.Error("Failed mounting SPIFFS");
+  }
+#endif
+
+#ifdef IOT_CONFIG_RECORD_EVENTS
+  if (!Recorder.Begin(IOT_CONFIG_RECORD_EVENTS_PATH))
+  {
+    Logger.Error("Failed opening the event trace in SPIFFS");
+  }
+#endif
+
+#ifdef IOT_CONFIG_HISTORY_PATH
+  if (!History.Begin(IOT_CONFIG_HISTORY_PATH))
+  {
+    Logger.Error("Failed opening the reading history in SPIFFS");
+  }
+#endif
+
+  loadRules();
+  establishConnection();
+
+  Serial.begin(115200); // Init Serial Monitor
+  if (!dht.Begin(DHTPIN, DHTTYPE)) // Init dht Sensor
+  {
+    Logger.Error("Failed setting up the RMT capture for the DHT sensor");
+  }
+
+  WiFi.onEvent(onWiFiDisconnected, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+  WiFi.onEvent(onWiFiGotIp, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+
+  MemoryStats.WatchTask("loopTask");
+  MemoryStats.WatchTask("mqtt_task");
+  MemoryStats.WatchTask("wifi");
+  MemoryStats.WatchTask("tiT");
+
+  // 추가
+}
+
+static void writeTraceToSerial(const char *text, void *context)
+{
+  (void)context;
+  Serial.print(text);
+}
+
+void loop()
+{
+  if (Serial.available() > 0)
+  {
+    switch (Serial.read())
+    {
+    case MEMORY_DUMP_SERIAL_COMMAND:
+      memory_dump_requested = true;
+      break;
+    case TRACE_DUMP_SERIAL_COMMAND:
+      Tracer.Dump();
+      Tracer.WriteChromeTrace(writeTraceToSerial, NULL);
+      break;
+    case EVENT_TRACE_EXPORT_SERIAL_COMMAND:
+      Recorder.Export(writeTraceToSerial, NULL);
+      break;
+    }
+  }
+
+  if (memory_dump_requested)
+  {
+    memory_dump_requested = false;
+    MemoryStats.Dump();
+  }
+
+  if (rules_update_pending)
+  {
+    applyRules(rules_update_buffer, true);
+    rules_update_pending = false;
+  }
+
+  if (method_request_pending)
+  {
+    handleMethodRequest();
+    method_request_pending = false;
+  }
+
+  if (history_streaming)
+  {
+    sendHistoryPage();
+  }
+
+  if (ota_status_pending)
+  {
+    ota_status_pending = false;
+    sendOtaStatus();
+
+    if (Ota.State() == OTA_STATE_READY)
+    {
+      Logger.Info("Restarting into the new firmware");
+      delay(OTA_RESTART_DELAY_MILLISECS); // Gives the status message time to go out.
+      ESP.restart();
+    }
+  }
+
+  Ota.Service();
+
+  if (!startup_profile_logged && StartupPhases.IsComplete())
+  {
+    startup_profile_logged = true;
+    StartupPhases.Dump();
+  }
+
+  NetworkCache.Service();
+  Recorder.Service();
+  dht.Service();
+
+#ifdef IOT_CONFIG_GATEWAY_LEAF
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    connectToWiFi();
   }
-#endif
-  // 일정 시간마다 보냄
   else if (millis() > next_telemetry_send_time_ms)
   {
-    sendTelemetry();
+    sendToGateway();
     next_telemetry_send_time_ms = millis() + TELEMETRY_FREQUENCY_MILLISECS;
   }
 
+  return; // A leaf has no IoT Hub connection to service.
+#endif
+
+#ifdef IOT_CONFIG_GATEWAY
+  Gateway.Service();
+#endif
+
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    connectToWiFi();
+  }
+#ifndef IOT_CONFIG_USE_X509_CERT
+  else if (sasToken.IsExpired())
+  {
+    Logger.Info("SAS token expired; reconnecting with a new one.");
+    (void)renewMqttCredentials();
+  }
+#endif
+#ifdef IOT_CONFIG_USE_DPS
+  else if (reprovisioning.IsDue(millis()))
+  {
+    reprovisioning.OnAttempt(millis());
+    Logger.Info(
+        "IoT Hub refused the device; provisioning again (attempt " + String(reprovisioning.Attempts())
+        + ")");
+    (void)esp_mqtt_client_destroy(mqtt_client);
+
+    if (provisionDevice(true) == 0)
+    {
+      initializeIoTHubClient();
+    }
+
+    (void)initializeMqttClient();
+
+    if (reprovisioning.IsExhausted())
+    {
+      Logger.Error("No further provisioning attempts until IoT Hub accepts the device or a restart");
+    }
+  }
+#endif
+  // 일정 시간마다 보냄
+  else if (millis() > next_telemetry_send_time_ms)
+  {
+    Recorder.RecordClockTick((uint32_t)time(NULL));
+    LinkHealth.SampleRssi(WiFi.RSSI());
+    sampleSensors();
+    next_telemetry_send_time_ms = millis() + TELEMETRY_FREQUENCY_MILLISECS;
+  }
+#ifdef IOT_CONFIG_GATEWAY
+  else if (Gateway.HasReady())
+  {
+    sendLeafTelemetry();
+  }
+#endif
+  else if (millis() > next_diagnostics_send_time_ms)
+  {
+    sendDiagnostics();
+    sendHealth();
+    next_diagnostics_send_time_ms = millis() + DIAGNOSTICS_FREQUENCY_MILLISECS;
+  }
+  else if (twin_report_pending || millis() > next_twin_report_time_ms)
+  {
+    twin_report_pending = false;
+    reportHealth();
+    next_twin_report_time_ms = millis() + TWIN_REPORT_FREQUENCY_MILLISECS;
+  }
+
   // 구현 내용 추가
   // telemetry_topic = "device";
 }
@@ -488,42 +1875,25 @@ static void printLocalTime()
   Serial.println(&timeinfo, "%Y %b %d %a, %H:%M:%S");
 }
 
-// 온도센서
-static float readDHTTemperature()
+// 온도/습도센서 (centi-degrees Celsius, per-mille relative humidity)
+static void readDHT(SensorSample& sample)
 {
-  // Sensor readings may also be up to 2 seconds 'old' (its a very slow sensor)
-  // Read temperature as Celsius (the default)
-  float t = dht.readTemperature();
-  // Read temperature as Fahrenheit (isFahrenheit = true)
-  // float t = dht.readTemperature(true);
-  // Check if any reads failed and exit early (to try again).
-  if (isnan(t))
-  {
-    Logger.Info("Failed to read from DHT sensor!");
-    return 0;
-  }
-  else
+  // Sensor readings may also be up to 2 seconds 'old' (its a very slow sensor);
+  // dht.Service() captures them in the background from loop().
+  DhtReading reading;
+  if (!dht.Latest(&reading))
   {
-    // Serial.println(t);
-    return t;
+    // Check if any reads failed; the channels are then left out of the telemetry.
+    Logger.Info(String("Failed to read from DHT sensor: ") + DhtStatusName(dht.LastStatus()));
+    sample.value[SENSOR_CHANNEL_TEMPERATURE] = SENSOR_VALUE_INVALID;
+    sample.value[SENSOR_CHANNEL_HUMIDITY] = SENSOR_VALUE_INVALID;
+    return;
   }
-}
 
-// 습도센서
-static float readDHTHumidity()
-{
-  // Sensor readings may also be up to 2 seconds 'old' (its a very slow sensor)
-  float h = dht.readHumidity();
-  if (isnan(h))
-  {
-    Logger.Info("Failed to read from DHT sensor!");
-    return 0;
-  }
-  else
-  {
-    // Serial.println(h);
-    return h;
-  }
+  // The sensor reports tenths of a degree and tenths of a percent.
+  sample.value[SENSOR_CHANNEL_TEMPERATURE]
+      = SensorRescale(SENSOR_CHANNEL_TEMPERATURE, reading.temperature, 1);
+  sample.value[SENSOR_CHANNEL_HUMIDITY] = SensorRescale(SENSOR_CHANNEL_HUMIDITY, reading.humidity, 1);
 }
 
 static void publishTemperatureHumidity()
@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "ConnectionCache.h"
+#include "SerialLogger.h"
+#include <Preferences.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define CONNECTION_CACHE_NAMESPACE "netcache"
+
+// Bounds NVS wear while keeping the lower bound on the clock reasonably fresh.
+#define EPOCH_SAVE_INTERVAL_MILLISECS (60UL * 60UL * 1000UL)
+
+ConnectionCache::ConnectionCache()
+{
+  memset(this->bssid, 0, sizeof(this->bssid));
+  this->channel = 0;
+  this->hasAccessPoint = false;
+  this->cachedEpoch = 0;
+  this->timeSynchronized = false;
+  this->epochSavePending = false;
+  this->lastEpochSaveMillis = 0;
+}
+
+void ConnectionCache::Begin()
+{
+  Preferences preferences;
+  if (!preferences.begin(CONNECTION_CACHE_NAMESPACE, true))
+  {
+    return;
+  }
+
+  this->hasAccessPoint
+      = preferences.getBytes("bssid", this->bssid, sizeof(this->bssid)) == sizeof(this->bssid);
+  this->channel = preferences.getUChar("channel", 0);
+  this->hasAccessPoint = this->hasAccessPoint && this->channel > 0;
+  this->cachedEpoch = preferences.getULong64("epoch", 0);
+  preferences.end();
+}
+
+bool ConnectionCache::HasAccessPoint() { return this->hasAccessPoint; }
+
+const uint8_t* ConnectionCache::Bssid() { return this->bssid; }
+
+int32_t ConnectionCache::Channel() { return this->channel; }
+
+void ConnectionCache::SaveAccessPoint(const uint8_t* bssid, int32_t channel)
+{
+  if (bssid == NULL || channel <= 0
+      || (this->hasAccessPoint && this->channel == channel
+          && memcmp(this->bssid, bssid, sizeof(this->bssid)) == 0))
+  {
+    return;
+  }
+
+  Preferences preferences;
+  if (!preferences.begin(CONNECTION_CACHE_NAMESPACE, false))
+  {
+    return;
+  }
+
+  memcpy(this->bssid, bssid, sizeof(this->bssid));
+  this->channel = channel;
+  this->hasAccessPoint = true;
+  preferences.putBytes("bssid", this->bssid, sizeof(this->bssid));
+  preferences.putUChar("channel", (uint8_t)channel);
+  preferences.end();
+}
+
+void ConnectionCache::ForgetAccessPoint()
+{
+  this->hasAccessPoint = false;
+
+  Preferences preferences;
+  if (preferences.begin(CONNECTION_CACHE_NAMESPACE, false))
+  {
+    preferences.remove("bssid");
+    preferences.remove("channel");
+    preferences.end();
+  }
+}
+
+bool ConnectionCache::RestoreTime(time_t minimumValidEpoch)
+{
+  time_t now = time(NULL);
+
+  if (now >= minimumValidEpoch)
+  {
+    return true;
+  }
+
+  if (this->cachedEpoch < (uint64_t)minimumValidEpoch)
+  {
+    return false;
+  }
+
+  struct timeval cached = { (time_t)this->cachedEpoch, 0 };
+  settimeofday(&cached, NULL);
+  Logger.Info("Clock restored from cached epoch until SNTP answers");
+  return true;
+}
+
+void ConnectionCache::OnTimeSynchronized()
+{
+  this->timeSynchronized = true;
+  this->epochSavePending = true;
+}
+
+bool ConnectionCache::IsTimeSynchronized() { return this->timeSynchronized; }
+
+bool ConnectionCache::SynchronizedTime(uint32_t* epoch)
+{
+  if (!this->timeSynchronized)
+  {
+    return false;
+  }
+
+  *epoch = (uint32_t)time(NULL);
+  return true;
+}
+
+void ConnectionCache::Service()
+{
+  if (this->epochSavePending
+      || (this->timeSynchronized && millis() - this->lastEpochSaveMillis > EPOCH_SAVE_INTERVAL_MILLISECS))
+  {
+    this->epochSavePending = false;
+    this->saveEpoch();
+  }
+}
+
+void ConnectionCache::saveEpoch()
+{
+  Preferences preferences;
+  if (!preferences.begin(CONNECTION_CACHE_NAMESPACE, false))
+  {
+    return;
+  }
+
+  this->cachedEpoch = (uint64_t)time(NULL);
+  this->lastEpochSaveMillis = millis();
+  preferences.putULong64("epoch", this->cachedEpoch);
+  preferences.end();
+}
+
+ConnectionCache NetworkCache;
@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef CONNECTIONCACHE_H
+#define CONNECTIONCACHE_H
+
+#include <Arduino.h>
+#include <time.h>
+
+#define CONNECTION_CACHE_BSSID_SIZE 6
+
+/*
+ * Last-good network state kept in NVS so a reboot does not start from scratch:
+ * the BSSID/channel of the access point (lets WiFi.begin() skip the full scan)
+ * and the last SNTP-validated epoch (a lower bound for the clock after a power
+ * cycle, good enough for certificate validity checks until SNTP answers).
+ */
+class ConnectionCache
+{
+public:
+  ConnectionCache();
+  void Begin();
+
+  bool HasAccessPoint();
+  const uint8_t* Bssid();
+  int32_t Channel();
+  void SaveAccessPoint(const uint8_t* bssid, int32_t channel);
+  void ForgetAccessPoint();
+
+  /*
+   * @brief Sets the system clock from the cached epoch when it has not been set yet.
+   *        A software reset keeps the RTC-backed system time, so nothing is restored then.
+   * @return true if the clock is at or after minimumValidEpoch afterwards.
+   */
+  bool RestoreTime(time_t minimumValidEpoch);
+
+  // Called from the SNTP sync callback; persisting is deferred to Service().
+  void OnTimeSynchronized();
+  bool IsTimeSynchronized();
+
+  /*
+   * @brief Reads the clock only once SNTP has answered since boot. Before that it may still be the
+   *        restored epoch, which lags by however long the device was off: fine as a lower bound
+   *        for certificate checks, wrong for signing tokens or stamping readings.
+   * @return false (and epoch untouched) until the clock is synchronized.
+   */
+  bool SynchronizedTime(uint32_t* epoch);
+
+  // Persists the validated epoch after a sync and then periodically; call from loop().
+  void Service();
+
+private:
+  void saveEpoch();
+
+  uint8_t bssid[CONNECTION_CACHE_BSSID_SIZE];
+  int32_t channel;
+  bool hasAccessPoint;
+  uint64_t cachedEpoch;
+  volatile bool timeSynchronized;
+  volatile bool epochSavePending;
+  unsigned long lastEpochSaveMillis;
+};
+
+extern ConnectionCache NetworkCache;
+
+#endif // CONNECTIONCACHE_H
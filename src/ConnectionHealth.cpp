@@ -0,0 +1,264 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "ConnectionHealth.h"
+#include <string.h>
+
+static portMUX_TYPE health_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* const phase_names[HEALTH_PHASE_COUNT] = { "wifi", "mqtt" };
+
+static const char* const drop_reason_names[MQTT_DROP_COUNT] = {
+  "transport",
+  "refused",
+  "renewal",
+  "other",
+};
+
+ConnectionHealth::ConnectionHealth()
+{
+  memset(this->phases, 0, sizeof(this->phases));
+  this->wifiUp = false;
+  this->wifiDrops = 0;
+  memset(this->wifiReasons, 0, sizeof(this->wifiReasons));
+  this->wifiOtherReasons = 0;
+  this->rssiLast = 0;
+  this->rssiMin = 0;
+  this->rssiSum = 0;
+  this->rssiCount = 0;
+  this->mqttUp = false;
+  memset(this->mqttDrops, 0, sizeof(this->mqttDrops));
+  this->mqttConnectFailures = 0;
+  this->mqttLastRefusal = 0;
+  this->pendingReason = MQTT_DROP_OTHER;
+  this->reasonPending = false;
+  this->sessionStartMillis = 0;
+  this->longestSessionMillis = 0;
+  this->connectedMillis = 0;
+  this->renewalsSucceeded = 0;
+  this->renewalsFailed = 0;
+}
+
+void ConnectionHealth::BeginPhase(HealthPhase phase)
+{
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&health_lock);
+  this->phases[phase].startMillis = now;
+  this->phases[phase].started = true;
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::EndPhase(HealthPhase phase)
+{
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&health_lock);
+  PhaseStats* stats = &this->phases[phase];
+  if (stats->started)
+  {
+    uint32_t elapsed = now - stats->startMillis;
+    stats->count++;
+    stats->totalMillis += elapsed;
+    if (elapsed > stats->maxMillis)
+    {
+      stats->maxMillis = elapsed;
+    }
+    stats->started = false;
+  }
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::OnWiFiConnected()
+{
+  portENTER_CRITICAL(&health_lock);
+  this->wifiUp = true;
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::OnWiFiDisconnected(uint8_t reason)
+{
+  portENTER_CRITICAL(&health_lock);
+  // Failed association attempts while reconnecting are not drops.
+  if (this->wifiUp)
+  {
+    this->wifiUp = false;
+    this->wifiDrops++;
+
+    int slot = 0;
+    while (slot < HEALTH_WIFI_REASON_SLOTS && this->wifiReasons[slot].count > 0
+           && this->wifiReasons[slot].reason != reason)
+    {
+      slot++;
+    }
+
+    if (slot < HEALTH_WIFI_REASON_SLOTS)
+    {
+      this->wifiReasons[slot].reason = reason;
+      this->wifiReasons[slot].count++;
+    }
+    else
+    {
+      this->wifiOtherReasons++;
+    }
+  }
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::SampleRssi(int8_t rssi)
+{
+  portENTER_CRITICAL(&health_lock);
+  if (this->rssiCount == 0 || rssi < this->rssiMin)
+  {
+    this->rssiMin = rssi;
+  }
+  this->rssiLast = rssi;
+  this->rssiSum += rssi;
+  this->rssiCount++;
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::OnMqttConnected()
+{
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&health_lock);
+  this->mqttUp = true;
+  this->reasonPending = false;
+  this->sessionStartMillis = now;
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::OnMqttError(MqttDropReason reason, int returnCode)
+{
+  portENTER_CRITICAL(&health_lock);
+  if (!this->mqttUp)
+  {
+    this->mqttConnectFailures++;
+  }
+
+  if (reason == MQTT_DROP_REFUSED)
+  {
+    this->mqttLastRefusal = returnCode;
+  }
+
+  this->pendingReason = reason;
+  this->reasonPending = true;
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::OnMqttDisconnected()
+{
+  portENTER_CRITICAL(&health_lock);
+  this->endSession(this->reasonPending ? this->pendingReason : MQTT_DROP_OTHER);
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::OnMqttStopped(MqttDropReason reason)
+{
+  portENTER_CRITICAL(&health_lock);
+  this->endSession(reason);
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::OnCredentialRenewal(bool succeeded)
+{
+  portENTER_CRITICAL(&health_lock);
+  if (succeeded)
+  {
+    this->renewalsSucceeded++;
+  }
+  else
+  {
+    this->renewalsFailed++;
+  }
+  portEXIT_CRITICAL(&health_lock);
+}
+
+void ConnectionHealth::ToJson(JsonDocument& document)
+{
+  uint32_t now = millis();
+
+  // Copied under the lock; the JSON is built outside it.
+  portENTER_CRITICAL(&health_lock);
+  ConnectionHealth snapshot = *this;
+  portEXIT_CRITICAL(&health_lock);
+
+  uint32_t session_millis = snapshot.mqttUp ? now - snapshot.sessionStartMillis : 0;
+  uint32_t longest_millis
+      = session_millis > snapshot.longestSessionMillis ? session_millis : snapshot.longestSessionMillis;
+  uint32_t connected_millis = snapshot.connectedMillis + session_millis;
+
+  JsonObject health = document["connectivity"].to<JsonObject>();
+  health["uptimeS"] = now / 1000;
+
+  health["wifiDrops"] = snapshot.wifiDrops;
+  JsonObject wifi_reasons = health["wifiReasons"].to<JsonObject>();
+  for (int i = 0; i < HEALTH_WIFI_REASON_SLOTS && snapshot.wifiReasons[i].count > 0; i++)
+  {
+    wifi_reasons[String(snapshot.wifiReasons[i].reason)] = snapshot.wifiReasons[i].count;
+  }
+  if (snapshot.wifiOtherReasons > 0)
+  {
+    wifi_reasons["other"] = snapshot.wifiOtherReasons;
+  }
+
+  if (snapshot.rssiCount > 0)
+  {
+    JsonObject rssi = health["rssi"].to<JsonObject>();
+    rssi["last"] = snapshot.rssiLast;
+    rssi["min"] = snapshot.rssiMin;
+    rssi["avg"] = snapshot.rssiSum / (int32_t)snapshot.rssiCount;
+  }
+
+  JsonObject mqtt_drops = health["mqttDrops"].to<JsonObject>();
+  for (int i = 0; i < MQTT_DROP_COUNT; i++)
+  {
+    mqtt_drops[drop_reason_names[i]] = snapshot.mqttDrops[i];
+  }
+  health["mqttConnectFails"] = snapshot.mqttConnectFailures;
+  if (snapshot.mqttLastRefusal != 0)
+  {
+    health["mqttLastRefusal"] = snapshot.mqttLastRefusal;
+  }
+
+  health["sessionS"] = session_millis / 1000;
+  health["longestSessionS"] = longest_millis / 1000;
+  health["connectedPct"] = now > 0 ? (uint32_t)((uint64_t)connected_millis * 100 / now) : 0;
+
+  // [count, average, maximum] per phase.
+  JsonObject phases = health["phasesMs"].to<JsonObject>();
+  for (int i = 0; i < HEALTH_PHASE_COUNT; i++)
+  {
+    const PhaseStats& stats = snapshot.phases[i];
+    JsonArray phase = phases[phase_names[i]].to<JsonArray>();
+    phase.add(stats.count);
+    phase.add(stats.count > 0 ? stats.totalMillis / stats.count : 0);
+    phase.add(stats.maxMillis);
+  }
+
+  JsonArray renewals = health["sasRenewals"].to<JsonArray>();
+  renewals.add(snapshot.renewalsSucceeded);
+  renewals.add(snapshot.renewalsFailed);
+}
+
+void ConnectionHealth::endSession(MqttDropReason reason)
+{
+  if (!this->mqttUp)
+  {
+    return;
+  }
+
+  uint32_t session_millis = millis() - this->sessionStartMillis;
+  this->connectedMillis += session_millis;
+  if (session_millis > this->longestSessionMillis)
+  {
+    this->longestSessionMillis = session_millis;
+  }
+
+  this->mqttDrops[reason]++;
+  this->mqttUp = false;
+  this->reasonPending = false;
+}
+
+ConnectionHealth LinkHealth;
@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef CONNECTIONHEALTH_H
+#define CONNECTIONHEALTH_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Distinct Wi-Fi disconnect reasons counted separately; the rest are counted as "other".
+#define HEALTH_WIFI_REASON_SLOTS 4
+
+enum HealthPhase
+{
+  HEALTH_PHASE_WIFI = 0, // connectToWiFi(), including the scan fallback
+  HEALTH_PHASE_MQTT, // MQTT_EVENT_BEFORE_CONNECT to MQTT_EVENT_CONNECTED (TCP, TLS, CONNACK)
+  HEALTH_PHASE_COUNT
+};
+
+enum MqttDropReason
+{
+  MQTT_DROP_TRANSPORT = 0, // TCP or TLS error
+  MQTT_DROP_REFUSED, // CONNACK refused, e.g. an expired SAS token
+  MQTT_DROP_RENEWAL, // Stopped to reconnect with renewed credentials
+  MQTT_DROP_OTHER, // Closed without an error event
+  MQTT_DROP_COUNT
+};
+
+/*
+ * Connectivity counters since boot, for finding the sites where reconnect churn
+ * costs throughput: Wi-Fi and MQTT session drops with their reasons, time spent
+ * in each connection phase, RSSI, MQTT session uptime and SAS renewal outcomes.
+ *
+ * The On*() calls come from the Wi-Fi and MQTT event tasks as well as loop().
+ */
+class ConnectionHealth
+{
+public:
+  ConnectionHealth();
+
+  void BeginPhase(HealthPhase phase);
+  void EndPhase(HealthPhase phase);
+
+  void OnWiFiConnected();
+  void OnWiFiDisconnected(uint8_t reason);
+  void SampleRssi(int8_t rssi);
+
+  void OnMqttConnected();
+  // Remembered as the reason for the next drop; an error without a session is a failed connect.
+  void OnMqttError(MqttDropReason reason, int returnCode);
+  void OnMqttDisconnected();
+  // For stopping the client ourselves, which raises no disconnect event.
+  void OnMqttStopped(MqttDropReason reason);
+
+  void OnCredentialRenewal(bool succeeded);
+
+  // Adds a "connectivity" object to document.
+  void ToJson(JsonDocument& document);
+
+private:
+  struct PhaseStats
+  {
+    uint32_t count;
+    uint32_t totalMillis;
+    uint32_t maxMillis;
+    uint32_t startMillis;
+    bool started;
+  };
+
+  struct ReasonCount
+  {
+    uint8_t reason;
+    uint32_t count;
+  };
+
+  void endSession(MqttDropReason reason);
+
+  PhaseStats phases[HEALTH_PHASE_COUNT];
+
+  bool wifiUp;
+  uint32_t wifiDrops;
+  ReasonCount wifiReasons[HEALTH_WIFI_REASON_SLOTS];
+  uint32_t wifiOtherReasons;
+
+  int8_t rssiLast;
+  int8_t rssiMin;
+  int32_t rssiSum;
+  uint32_t rssiCount;
+
+  bool mqttUp;
+  uint32_t mqttDrops[MQTT_DROP_COUNT];
+  uint32_t mqttConnectFailures;
+  int mqttLastRefusal;
+  MqttDropReason pendingReason;
+  bool reasonPending;
+  uint32_t sessionStartMillis;
+  uint32_t longestSessionMillis;
+  uint32_t connectedMillis;
+
+  uint32_t renewalsSucceeded;
+  uint32_t renewalsFailed;
+};
+
+extern ConnectionHealth LinkHealth;
+
+#endif // CONNECTIONHEALTH_H
@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "DhtDecoder.h"
+
+// Protocol timing in microseconds, widened from the datasheets for part-to-part spread
+// and the edge filter of the capture.
+#define DHT_RESPONSE_HIGH_MIN 50
+#define DHT_RESPONSE_HIGH_MAX 120
+#define DHT_BIT_LOW_MIN 30
+#define DHT_BIT_LOW_MAX 90
+#define DHT_BIT_HIGH_MIN 10
+#define DHT_BIT_HIGH_MAX 90
+// A 0 bit is high for 26-28 us, a 1 bit for 70 us.
+#define DHT_BIT_ONE_THRESHOLD 48
+#define DHT_CLOSING_LOW_MIN 20
+#define DHT_CLOSING_LOW_MAX 100
+
+// Response high, 40 bits and the closing low.
+#define DHT_FRAME_PULSES (1 + 2 * DHT_FRAME_BITS + 1)
+
+#define DHT_TEMPERATURE_MIN -400
+#define DHT_TEMPERATURE_MAX 800
+#define DHT_HUMIDITY_MAX 1000
+
+static const char* const status_names[DHT_STATUS_COUNT] = {
+  "ok", "timeout", "short frame", "bad timing", "checksum", "out of range",
+};
+
+static bool inRange(const DhtPulse& pulse, uint8_t level, uint16_t minimum, uint16_t maximum)
+{
+  return pulse.level == level && pulse.micros >= minimum && pulse.micros <= maximum;
+}
+
+DhtStatus DhtDecode(DhtModel model, const DhtPulse* pulses, size_t count, DhtReading* reading)
+{
+  if (count == 0)
+  {
+    return DHT_STATUS_TIMEOUT;
+  }
+
+  if (count < DHT_FRAME_PULSES)
+  {
+    return DHT_STATUS_SHORT_FRAME;
+  }
+
+  const DhtPulse* frame = pulses + count - DHT_FRAME_PULSES;
+  if (!inRange(frame[0], 1, DHT_RESPONSE_HIGH_MIN, DHT_RESPONSE_HIGH_MAX)
+      || !inRange(frame[DHT_FRAME_PULSES - 1], 0, DHT_CLOSING_LOW_MIN, DHT_CLOSING_LOW_MAX))
+  {
+    return DHT_STATUS_BAD_TIMING;
+  }
+
+  uint8_t bytes[DHT_FRAME_BITS / 8] = { 0 };
+  for (int bit = 0; bit < DHT_FRAME_BITS; bit++)
+  {
+    const DhtPulse& low = frame[1 + 2 * bit];
+    const DhtPulse& high = frame[2 + 2 * bit];
+    if (!inRange(low, 0, DHT_BIT_LOW_MIN, DHT_BIT_LOW_MAX)
+        || !inRange(high, 1, DHT_BIT_HIGH_MIN, DHT_BIT_HIGH_MAX))
+    {
+      return DHT_STATUS_BAD_TIMING;
+    }
+
+    bytes[bit / 8] = (uint8_t)((bytes[bit / 8] << 1) | (high.micros > DHT_BIT_ONE_THRESHOLD ? 1 : 0));
+  }
+
+  if ((uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]) != bytes[4])
+  {
+    return DHT_STATUS_CHECKSUM;
+  }
+
+  // Both models put the sign of the temperature in the top bit of its field.
+  int32_t humidity;
+  int32_t temperature;
+  if (model == DHT_MODEL_DHT11)
+  {
+    humidity = bytes[0] * 10 + bytes[1];
+    temperature = bytes[2] * 10 + (bytes[3] & 0x7F);
+    if (bytes[3] & 0x80)
+    {
+      temperature = -temperature;
+    }
+  }
+  else
+  {
+    humidity = (bytes[0] << 8) | bytes[1];
+    temperature = ((bytes[2] & 0x7F) << 8) | bytes[3];
+    if (bytes[2] & 0x80)
+    {
+      temperature = -temperature;
+    }
+  }
+
+  if (humidity > DHT_HUMIDITY_MAX || temperature < DHT_TEMPERATURE_MIN
+      || temperature > DHT_TEMPERATURE_MAX)
+  {
+    return DHT_STATUS_RANGE;
+  }
+
+  reading->temperature = (int16_t)temperature;
+  reading->humidity = (int16_t)humidity;
+  return DHT_STATUS_OK;
+}
+
+const char* DhtStatusName(DhtStatus status) { return status_names[status]; }
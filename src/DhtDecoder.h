@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef DHTDECODER_H
+#define DHTDECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Response (low, high), 40 bits (low, high) and the closing low, plus slack for the start signal.
+#define DHT_MAX_PULSES 96
+#define DHT_FRAME_BITS 40
+
+enum DhtModel
+{
+  DHT_MODEL_DHT11 = 0,
+  DHT_MODEL_DHT22, // Also DHT21 / AM2301 / AM2302
+};
+
+enum DhtStatus
+{
+  DHT_STATUS_OK = 0,
+  DHT_STATUS_TIMEOUT, // No frame was captured
+  DHT_STATUS_SHORT_FRAME, // Fewer pulses than a frame, e.g. a missed edge
+  DHT_STATUS_BAD_TIMING, // A pulse outside the protocol timing
+  DHT_STATUS_CHECKSUM,
+  DHT_STATUS_RANGE, // Checksum matched but the values are impossible
+  DHT_STATUS_COUNT
+};
+
+// One level of the sensor line and how long it lasted.
+struct DhtPulse
+{
+  uint8_t level;
+  uint16_t micros;
+};
+
+// Tenths of a degree Celsius and tenths of a percent relative humidity, as the sensor reports them.
+struct DhtReading
+{
+  int16_t temperature;
+  int16_t humidity;
+};
+
+/*
+ * @brief Decodes a captured DHT frame. Works backwards from the closing low, so
+ *        leading pulses such as the tail of the host start signal are ignored.
+ *        Plain C with no hardware access, so it also runs on the host.
+ * @param pulses Consecutive pulses of alternating level, oldest first; the idle
+ *        high after the frame is not included.
+ */
+DhtStatus DhtDecode(DhtModel model, const DhtPulse* pulses, size_t count, DhtReading* reading);
+
+const char* DhtStatusName(DhtStatus status);
+
+#endif // DHTDECODER_H
@@ -0,0 +1,201 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "DhtSensor.h"
+#include <driver/gpio.h>
+
+// 1 us per RMT tick from the 80 MHz APB clock.
+#define DHT_RMT_CLOCK_DIVIDER 80
+
+// The line idles high after the closing low; no pulse of a frame is this long.
+#define DHT_RMT_IDLE_MICROS 200
+
+// Glitches shorter than this many APB cycles (1.25 us) are dropped.
+#define DHT_RMT_FILTER_TICKS 100
+
+#define DHT_RMT_BUFFER_SIZE 512
+
+// How long the host holds the line low to request a frame.
+#define DHT11_START_SIGNAL_MILLISECS 20
+#define DHT22_START_SIGNAL_MILLISECS 2
+
+DhtSensor::DhtSensor()
+{
+  this->pin = 0;
+  this->model = DHT_MODEL_DHT22;
+  this->ringbuffer = NULL;
+  this->phase = PHASE_IDLE;
+  this->phaseMillis = 0;
+  this->reading.temperature = 0;
+  this->reading.humidity = 0;
+  this->readingMillis = 0;
+  this->hasReading = false;
+  this->status = DHT_STATUS_TIMEOUT;
+  this->failures = 0;
+}
+
+bool DhtSensor::Begin(uint8_t pin, DhtModel model)
+{
+  this->pin = pin;
+  this->model = model;
+
+  rmt_config_t config = RMT_DEFAULT_CONFIG_RX((gpio_num_t)pin, DHT_RMT_CHANNEL);
+  config.clk_div = DHT_RMT_CLOCK_DIVIDER;
+  config.mem_block_num = 1;
+  config.rx_config.idle_threshold = DHT_RMT_IDLE_MICROS;
+  config.rx_config.filter_en = true;
+  config.rx_config.filter_ticks_thresh = DHT_RMT_FILTER_TICKS;
+
+  if (rmt_config(&config) != ESP_OK
+      || rmt_driver_install(DHT_RMT_CHANNEL, DHT_RMT_BUFFER_SIZE, 0) != ESP_OK
+      || rmt_get_ringbuf_handle(DHT_RMT_CHANNEL, &this->ringbuffer) != ESP_OK)
+  {
+    return false;
+  }
+
+  // Open drain keeps the input, and so the RMT capture, connected while the host drives the line.
+  (void)gpio_set_direction((gpio_num_t)pin, GPIO_MODE_INPUT_OUTPUT_OD);
+  (void)gpio_set_pull_mode((gpio_num_t)pin, GPIO_PULLUP_ONLY);
+  (void)gpio_set_level((gpio_num_t)pin, 1);
+
+  this->phase = PHASE_IDLE;
+  this->phaseMillis = millis() - DHT_INTERVAL_MILLISECS;
+  return true;
+}
+
+void DhtSensor::Service()
+{
+  if (this->ringbuffer == NULL)
+  {
+    return;
+  }
+
+  uint32_t now = millis();
+
+  switch (this->phase)
+  {
+  case PHASE_IDLE:
+    if (now - this->phaseMillis >= DHT_INTERVAL_MILLISECS)
+    {
+      (void)gpio_set_level((gpio_num_t)this->pin, 0);
+      this->phase = PHASE_START_SIGNAL;
+      this->phaseMillis = now;
+    }
+    break;
+
+  case PHASE_START_SIGNAL:
+    if (now - this->phaseMillis
+        >= (this->model == DHT_MODEL_DHT11 ? DHT11_START_SIGNAL_MILLISECS
+                                           : DHT22_START_SIGNAL_MILLISECS))
+    {
+      this->startCapture();
+    }
+    break;
+
+  case PHASE_CAPTURE:
+  {
+    size_t size = 0;
+    rmt_item32_t* items = (rmt_item32_t*)xRingbufferReceive(this->ringbuffer, &size, 0);
+    if (items != NULL)
+    {
+      size_t count = this->toPulses(items, size / sizeof(rmt_item32_t));
+      vRingbufferReturnItem(this->ringbuffer, items);
+      this->finishCapture(DhtDecode(this->model, this->pulses, count, &this->reading));
+    }
+    else if (now - this->phaseMillis >= DHT_CAPTURE_TIMEOUT_MILLISECS)
+    {
+      this->finishCapture(DHT_STATUS_TIMEOUT);
+    }
+    break;
+  }
+  }
+}
+
+bool DhtSensor::Latest(DhtReading* reading)
+{
+  if (!this->hasReading || millis() - this->readingMillis > DHT_MAX_AGE_MILLISECS)
+  {
+    return false;
+  }
+
+  *reading = this->reading;
+  return true;
+}
+
+DhtStatus DhtSensor::LastStatus() { return this->status; }
+
+uint32_t DhtSensor::Failures() { return this->failures; }
+
+void DhtSensor::startCapture()
+{
+  // Drop anything captured since the last frame, e.g. noise on the line.
+  size_t size;
+  void* stale;
+  while ((stale = xRingbufferReceive(this->ringbuffer, &size, 0)) != NULL)
+  {
+    vRingbufferReturnItem(this->ringbuffer, stale);
+  }
+
+  // Armed before the release, since the sensor answers within 40 us.
+  (void)rmt_rx_start(DHT_RMT_CHANNEL, true);
+  (void)gpio_set_level((gpio_num_t)this->pin, 1);
+
+  this->phase = PHASE_CAPTURE;
+  this->phaseMillis = millis();
+}
+
+void DhtSensor::finishCapture(DhtStatus status)
+{
+  (void)rmt_rx_stop(DHT_RMT_CHANNEL);
+
+  this->status = status;
+  if (status == DHT_STATUS_OK)
+  {
+    this->hasReading = true;
+    this->readingMillis = millis();
+  }
+  else
+  {
+    this->failures++;
+  }
+
+  this->phase = PHASE_IDLE;
+  this->phaseMillis = millis();
+}
+
+size_t DhtSensor::toPulses(const rmt_item32_t* items, size_t itemCount)
+{
+  // The decoder works back from the end of the frame, so only the newest pulses are kept.
+  if (itemCount > DHT_MAX_PULSES / 2)
+  {
+    items += itemCount - DHT_MAX_PULSES / 2;
+    itemCount = DHT_MAX_PULSES / 2;
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < 2 * itemCount; i++)
+  {
+    const rmt_item32_t& item = items[i / 2];
+    uint8_t level = (uint8_t)(i % 2 == 0 ? item.level0 : item.level1);
+    uint16_t micros = (uint16_t)(i % 2 == 0 ? item.duration0 : item.duration1);
+
+    // A zero duration marks the end of the capture.
+    if (micros == 0)
+    {
+      break;
+    }
+
+    if (count > 0 && this->pulses[count - 1].level == level)
+    {
+      this->pulses[count - 1].micros += micros;
+    }
+    else
+    {
+      this->pulses[count].level = level;
+      this->pulses[count].micros = micros;
+      count++;
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef DHTSENSOR_H
+#define DHTSENSOR_H
+
+#include "DhtDecoder.h"
+#include <Arduino.h>
+#include <driver/rmt.h>
+#include <freertos/ringbuf.h>
+
+#ifndef DHT_RMT_CHANNEL
+#define DHT_RMT_CHANNEL RMT_CHANNEL_0
+#endif
+
+// The DHT22 cannot be read more often than every 2 seconds (the DHT11 every second).
+#ifndef DHT_INTERVAL_MILLISECS
+#define DHT_INTERVAL_MILLISECS 2000
+#endif
+
+// Latest() reports no reading once the last good one is older than this.
+#define DHT_MAX_AGE_MILLISECS (3 * DHT_INTERVAL_MILLISECS)
+
+// A frame takes about 5 ms; this also covers a loop() iteration that ran long.
+#define DHT_CAPTURE_TIMEOUT_MILLISECS 50
+
+/*
+ * DHT11/DHT22 driver that never masks interrupts. The host start signal is a
+ * timed low on the open-drain pin, the sensor's reply is captured by an RMT
+ * receive channel in the background, and the finished pulse buffer is handed to
+ * DhtDecode(). Service() advances one step per call and never waits, so a read
+ * costs loop() microseconds instead of a 5 ms critical section.
+ *
+ * Not thread-safe; call from loop().
+ */
+class DhtSensor
+{
+public:
+  DhtSensor();
+  bool Begin(uint8_t pin, DhtModel model);
+
+  // Starts a capture every DHT_INTERVAL_MILLISECS and decodes it once received.
+  void Service();
+
+  // @return false when no frame has decoded within DHT_MAX_AGE_MILLISECS.
+  bool Latest(DhtReading* reading);
+
+  // Outcome of the most recent capture.
+  DhtStatus LastStatus();
+  uint32_t Failures();
+
+private:
+  enum Phase
+  {
+    PHASE_IDLE,
+    PHASE_START_SIGNAL,
+    PHASE_CAPTURE,
+  };
+
+  void startCapture();
+  void finishCapture(DhtStatus status);
+  size_t toPulses(const rmt_item32_t* items, size_t itemCount);
+
+  uint8_t pin;
+  DhtModel model;
+  RingbufHandle_t ringbuffer;
+  Phase phase;
+  uint32_t phaseMillis;
+  DhtPulse pulses[DHT_MAX_PULSES];
+  DhtReading reading;
+  uint32_t readingMillis;
+  bool hasReading;
+  DhtStatus status;
+  uint32_t failures;
+};
+
+#endif // DHTSENSOR_H
@@ -0,0 +1,376 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "EventRecorder.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+static portMUX_TYPE recorder_lock = portMUX_INITIALIZER_UNLOCKED;
+#define RECORDER_LOCK() portENTER_CRITICAL(&recorder_lock)
+#define RECORDER_UNLOCK() portEXIT_CRITICAL(&recorder_lock)
+#define RECORDER_MILLIS() millis()
+#define RECORDER_SLEEP(ms) delay(ms)
+#else
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+static std::mutex recorder_lock;
+#define RECORDER_LOCK() recorder_lock.lock()
+#define RECORDER_UNLOCK() recorder_lock.unlock()
+#define RECORDER_MILLIS()                                                            \
+  ((uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(                  \
+       std::chrono::steady_clock::now().time_since_epoch())                          \
+       .count())
+#define RECORDER_SLEEP(ms) std::this_thread::sleep_for(std::chrono::milliseconds(ms))
+#endif
+
+#define RECORD_HEADER_SIZE 6
+#define FILE_HEADER_SIZE 6
+#define MQTT_EVENT_PAYLOAD_SIZE 15
+
+// Flush at least this often so a crash loses little, but batch writes to spare the flash.
+#define RECORDER_FLUSH_INTERVAL_MILLISECS 5000
+
+static const uint8_t file_magic[4] = { 'A', 'Z', 'E', 'V' };
+
+static uint8_t* putU16(uint8_t* out, uint16_t value)
+{
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  return out + 2;
+}
+
+static uint8_t* putU32(uint8_t* out, uint32_t value)
+{
+  out = putU16(out, (uint16_t)value);
+  return putU16(out, (uint16_t)(value >> 16));
+}
+
+static uint16_t getU16(const uint8_t* in) { return (uint16_t)(in[0] | (in[1] << 8)); }
+
+static uint32_t getU32(const uint8_t* in)
+{
+  return (uint32_t)getU16(in) | ((uint32_t)getU16(in + 2) << 16);
+}
+
+EventRecorder::EventRecorder()
+{
+  this->path[0] = '\0';
+  this->file = NULL;
+  this->fileSize = 0;
+  this->used = 0;
+  this->dropped = 0;
+  this->lastFlushMillis = 0;
+  this->started = false;
+  this->recording = false;
+}
+
+bool EventRecorder::Begin(const char* path)
+{
+  if (path == NULL || strlen(path) + sizeof(".old") > sizeof(this->path))
+  {
+    return false;
+  }
+
+  if (this->file != NULL)
+  {
+    this->End();
+  }
+  strcpy(this->path, path);
+
+  this->file = fopen(this->path, "ab");
+  if (this->file == NULL)
+  {
+    return false;
+  }
+
+  fseek(this->file, 0, SEEK_END);
+  this->fileSize = (uint32_t)ftell(this->file);
+
+  if (this->fileSize == 0)
+  {
+    uint8_t header[FILE_HEADER_SIZE];
+    memcpy(header, file_magic, sizeof(file_magic));
+    header[4] = RECORDER_FORMAT_VERSION;
+    header[5] = SENSOR_CHANNEL_COUNT;
+    this->fileSize = (uint32_t)fwrite(header, 1, sizeof(header), this->file);
+  }
+
+  this->lastFlushMillis = RECORDER_MILLIS();
+  this->started = true;
+  this->recording = true;
+  return true;
+}
+
+void EventRecorder::End()
+{
+  // Also stops counting drops after a rotation that could not reopen the file.
+  this->started = false;
+
+  if (this->file == NULL)
+  {
+    return;
+  }
+
+  this->Flush();
+  this->recording = false;
+  fclose(this->file);
+  this->file = NULL;
+}
+
+bool EventRecorder::IsRecording() { return this->started; }
+
+uint32_t EventRecorder::Dropped() { return this->dropped; }
+
+void EventRecorder::RecordSensorSample(const SensorSample& sample)
+{
+  uint8_t payload[2 * SENSOR_CHANNEL_COUNT];
+  uint8_t* out = payload;
+
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++)
+  {
+    out = putU16(out, (uint16_t)sample.value[i]);
+  }
+
+  this->append(RECORD_TYPE_SENSOR_SAMPLE, payload, sizeof(payload));
+}
+
+void EventRecorder::RecordClockTick(uint32_t epoch)
+{
+  uint8_t payload[4];
+  putU32(payload, epoch);
+  this->append(RECORD_TYPE_CLOCK_TICK, payload, sizeof(payload));
+}
+
+void EventRecorder::RecordMqttEvent(const RecordedMqttEvent& event)
+{
+  uint8_t payload[MQTT_EVENT_PAYLOAD_SIZE];
+  payload[0] = event.eventId;
+  payload[1] = event.errorType;
+  payload[2] = event.connectReturnCode;
+  uint8_t* out = putU32(payload + 3, (uint32_t)event.msgId);
+  out = putU32(out, event.dataLength);
+  putU32(out, event.outboxSize);
+  this->append(RECORD_TYPE_MQTT_EVENT, payload, sizeof(payload));
+}
+
+void EventRecorder::append(uint8_t type, const uint8_t* payload, uint8_t length)
+{
+  if (!this->started)
+  {
+    return;
+  }
+
+  uint32_t now = RECORDER_MILLIS();
+
+  RECORDER_LOCK();
+  if (!this->recording || this->used + RECORD_HEADER_SIZE + length > sizeof(this->buffer))
+  {
+    this->dropped++;
+  }
+  else
+  {
+    uint8_t* out = this->buffer + this->used;
+    out[0] = type;
+    out[1] = length;
+    out = putU32(out + 2, now);
+    memcpy(out, payload, length);
+    this->used += RECORD_HEADER_SIZE + length;
+  }
+  RECORDER_UNLOCK();
+}
+
+void EventRecorder::Service()
+{
+  if (this->recording
+      && (this->used >= sizeof(this->buffer) / 2
+          || RECORDER_MILLIS() - this->lastFlushMillis > RECORDER_FLUSH_INTERVAL_MILLISECS))
+  {
+    this->Flush();
+  }
+}
+
+void EventRecorder::Flush()
+{
+  // Copied out under the lock so the MQTT task is never blocked on flash writes.
+  uint8_t pending[RECORDER_BUFFER_SIZE];
+  size_t length;
+
+  if (this->file == NULL)
+  {
+    return;
+  }
+
+  RECORDER_LOCK();
+  length = this->used;
+  memcpy(pending, this->buffer, length);
+  this->used = 0;
+  RECORDER_UNLOCK();
+
+  this->lastFlushMillis = RECORDER_MILLIS();
+
+  if (length > 0)
+  {
+    this->fileSize += (uint32_t)fwrite(pending, 1, length, this->file);
+    fflush(this->file);
+  }
+
+  if (this->fileSize >= RECORDER_MAX_FILE_SIZE)
+  {
+    this->rotate();
+  }
+}
+
+void EventRecorder::rotate()
+{
+  char old_path[RECORDER_PATH_SIZE + sizeof(".old")];
+  snprintf(old_path, sizeof(old_path), "%s.old", this->path);
+
+  this->recording = false;
+  fclose(this->file);
+  this->file = NULL;
+
+  remove(old_path);
+  rename(this->path, old_path);
+
+  char path[RECORDER_PATH_SIZE];
+  strcpy(path, this->path);
+  (void)this->Begin(path);
+}
+
+void EventRecorder::Export(TraceWriter writer, void* context)
+{
+  static const char hex_digits[] = "0123456789abcdef";
+  uint8_t chunk[32];
+  char line[2 * sizeof(chunk) + 2];
+  size_t length;
+
+  this->Flush();
+
+  FILE* in = fopen(this->path, "rb");
+  if (in == NULL)
+  {
+    return;
+  }
+
+  while ((length = fread(chunk, 1, sizeof(chunk), in)) > 0)
+  {
+    for (size_t i = 0; i < length; i++)
+    {
+      line[2 * i] = hex_digits[chunk[i] >> 4];
+      line[2 * i + 1] = hex_digits[chunk[i] & 0x0F];
+    }
+
+    line[2 * length] = '\n';
+    line[2 * length + 1] = '\0';
+    writer(line, context);
+  }
+
+  fclose(in);
+}
+
+int32_t EventReplayer::Replay(const char* path, EventReplayHandler& handler, float speed)
+{
+  uint8_t header[FILE_HEADER_SIZE];
+  uint8_t record[RECORD_HEADER_SIZE + UINT8_MAX];
+  int32_t delivered = 0;
+  bool started = false;
+  uint32_t first_recorded = 0;
+  uint32_t first_replayed = 0;
+
+  FILE* in = fopen(path, "rb");
+  if (in == NULL)
+  {
+    return -1;
+  }
+
+  if (fread(header, 1, sizeof(header), in) != sizeof(header)
+      || memcmp(header, file_magic, sizeof(file_magic)) != 0
+      || header[4] != RECORDER_FORMAT_VERSION)
+  {
+    fclose(in);
+    return -1;
+  }
+
+  uint8_t channels = header[5];
+
+  while (fread(record, 1, RECORD_HEADER_SIZE, in) == RECORD_HEADER_SIZE)
+  {
+    uint8_t type = record[0];
+    uint8_t length = record[1];
+    uint32_t at = getU32(record + 2);
+    const uint8_t* payload = record + RECORD_HEADER_SIZE;
+
+    if (fread(record + RECORD_HEADER_SIZE, 1, length, in) != length)
+    {
+      break; // Truncated by a reset while recording.
+    }
+
+    if (!started)
+    {
+      started = true;
+      first_recorded = at;
+      first_replayed = RECORDER_MILLIS();
+    }
+    else if (speed > 0)
+    {
+      uint32_t due = (uint32_t)((at - first_recorded) / speed);
+      uint32_t elapsed = RECORDER_MILLIS() - first_replayed;
+
+      if (due > elapsed)
+      {
+        RECORDER_SLEEP(due - elapsed);
+      }
+    }
+
+    switch (type)
+    {
+    case RECORD_TYPE_SENSOR_SAMPLE:
+      if (length == 2 * channels)
+      {
+        SensorSample sample;
+        sample.Invalidate();
+
+        for (int i = 0; i < channels && i < SENSOR_CHANNEL_COUNT; i++)
+        {
+          sample.value[i] = (int16_t)getU16(payload + 2 * i);
+        }
+
+        handler.OnSensorSample(at, sample);
+        delivered++;
+      }
+      break;
+    case RECORD_TYPE_CLOCK_TICK:
+      if (length == 4)
+      {
+        handler.OnClockTick(at, getU32(payload));
+        delivered++;
+      }
+      break;
+    case RECORD_TYPE_MQTT_EVENT:
+      if (length == MQTT_EVENT_PAYLOAD_SIZE)
+      {
+        RecordedMqttEvent event;
+        event.eventId = payload[0];
+        event.errorType = payload[1];
+        event.connectReturnCode = payload[2];
+        event.msgId = (int32_t)getU32(payload + 3);
+        event.dataLength = getU32(payload + 7);
+        event.outboxSize = getU32(payload + 11);
+        handler.OnMqttEvent(at, event);
+        delivered++;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  fclose(in);
+  return delivered;
+}
+
+EventRecorder Recorder;
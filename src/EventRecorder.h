@@ -0,0 +1,134 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef EVENTRECORDER_H
+#define EVENTRECORDER_H
+
+#include "LatencyTracer.h"
+#include "SensorSample.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef RECORDER_BUFFER_SIZE
+#define RECORDER_BUFFER_SIZE 1024
+#endif
+
+// Once the file reaches this size it is moved to <path>.old and a new one is started.
+#ifndef RECORDER_MAX_FILE_SIZE
+#define RECORDER_MAX_FILE_SIZE (128 * 1024)
+#endif
+
+#define RECORDER_PATH_SIZE 32
+#define RECORDER_FORMAT_VERSION 1
+
+/*
+ * Trace file layout (all integers little-endian):
+ *   header: "AZEV", version u8, sensor channel count u8
+ *   record: type u8, payload length u8, millis u32, payload
+ * Readers skip record types they do not know by their length.
+ */
+enum RecordType
+{
+  RECORD_TYPE_SENSOR_SAMPLE = 1, // int16 per sensor channel
+  RECORD_TYPE_CLOCK_TICK = 2, // epoch seconds u32
+  RECORD_TYPE_MQTT_EVENT = 3, // RecordedMqttEvent
+};
+
+// The parts of an esp-mqtt event that matter for reproducing connection behavior.
+struct RecordedMqttEvent
+{
+  uint8_t eventId;
+  uint8_t errorType;
+  uint8_t connectReturnCode;
+  int32_t msgId;
+  uint32_t dataLength;
+  uint32_t outboxSize;
+};
+
+/*
+ * Appends sensor samples, clock ticks and MQTT events to a compact binary trace.
+ *
+ * Record*() only copies into a fixed RAM buffer and is safe from the MQTT task;
+ * Service() writes the buffer to the file from loop(). Records that arrive while
+ * the buffer is full, or while the file is being rotated (or could not be
+ * reopened), are dropped and counted.
+ */
+class EventRecorder
+{
+public:
+  EventRecorder();
+  bool Begin(const char* path);
+  void End();
+  // True from a successful Begin() until End(), also while records are being dropped.
+  bool IsRecording();
+
+  void RecordSensorSample(const SensorSample& sample);
+  void RecordClockTick(uint32_t epoch);
+  void RecordMqttEvent(const RecordedMqttEvent& event);
+
+  void Service();
+  void Flush();
+  uint32_t Dropped();
+
+  // Writes the current trace file as hex text, 32 bytes per line (`xxd -r -p` restores it).
+  void Export(TraceWriter writer, void* context);
+
+private:
+  void append(uint8_t type, const uint8_t* payload, uint8_t length);
+  void rotate();
+
+  char path[RECORDER_PATH_SIZE];
+  FILE* file;
+  uint32_t fileSize;
+  uint8_t buffer[RECORDER_BUFFER_SIZE];
+  size_t used;
+  uint32_t dropped;
+  uint32_t lastFlushMillis;
+  volatile bool started;
+  volatile bool recording;
+};
+
+/*
+ * Receives the records of a trace in file order. Times are the device's millis()
+ * at recording.
+ */
+class EventReplayHandler
+{
+public:
+  virtual ~EventReplayHandler() {}
+  virtual void OnSensorSample(uint32_t millis, const SensorSample& sample)
+  {
+    (void)millis;
+    (void)sample;
+  }
+  virtual void OnClockTick(uint32_t millis, uint32_t epoch)
+  {
+    (void)millis;
+    (void)epoch;
+  }
+  virtual void OnMqttEvent(uint32_t millis, const RecordedMqttEvent& event)
+  {
+    (void)millis;
+    (void)event;
+  }
+};
+
+/*
+ * Feeds a recorded trace to a handler. Portable C++ so the same trace can drive
+ * the pipeline on the device or on a Linux host.
+ */
+class EventReplayer
+{
+public:
+  /*
+   * @param speed Playback rate relative to the recording (2.0 = twice as fast);
+   *              0 replays as fast as the handler allows.
+   * @return Number of records delivered, or -1 if the file is missing or not a trace.
+   */
+  static int32_t Replay(const char* path, EventReplayHandler& handler, float speed);
+};
+
+extern EventRecorder Recorder;
+
+#endif // EVENTRECORDER_H
@@ -0,0 +1,220 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "GatewayFrame.h"
+
+static const uint8_t frame_magic[2] = { 'A', 'Z' };
+
+static uint8_t* putU16(uint8_t* out, uint16_t value)
+{
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  return out + 2;
+}
+
+static uint8_t* putU32(uint8_t* out, uint32_t value)
+{
+  out = putU16(out, (uint16_t)value);
+  return putU16(out, (uint16_t)(value >> 16));
+}
+
+static uint16_t getU16(const uint8_t* in) { return (uint16_t)(in[0] | (in[1] << 8)); }
+
+static uint32_t getU32(const uint8_t* in)
+{
+  return (uint32_t)getU16(in) | ((uint32_t)getU16(in + 2) << 16);
+}
+
+uint16_t GatewayCrc16(const uint8_t* data, size_t length)
+{
+  uint16_t crc = 0xFFFF;
+
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= (uint16_t)(data[i] << 8);
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+size_t GatewayFrameEncode(const GatewayFrame& frame, uint8_t* buffer, size_t size)
+{
+  if (buffer == NULL || size < GATEWAY_FRAME_SIZE)
+  {
+    return 0;
+  }
+
+  uint8_t* out = buffer;
+  *out++ = frame_magic[0];
+  *out++ = frame_magic[1];
+  *out++ = GATEWAY_FRAME_VERSION;
+  *out++ = SENSOR_CHANNEL_COUNT;
+  out = putU16(out, frame.board);
+  out = putU32(out, frame.boot);
+  out = putU16(out, frame.sequence);
+  out = putU32(out, frame.epoch);
+
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++)
+  {
+    out = putU16(out, (uint16_t)frame.sample.value[i]);
+  }
+
+  out = putU16(out, GatewayCrc16(buffer, (size_t)(out - buffer)));
+  return (size_t)(out - buffer);
+}
+
+GatewayFrameStatus GatewayFrameDecode(const uint8_t* data, size_t length, GatewayFrame* frame)
+{
+  if (data == NULL || length != GATEWAY_FRAME_SIZE || data[0] != frame_magic[0]
+      || data[1] != frame_magic[1] || data[2] != GATEWAY_FRAME_VERSION
+      || data[3] != SENSOR_CHANNEL_COUNT)
+  {
+    return GATEWAY_FRAME_MALFORMED;
+  }
+
+  if (GatewayCrc16(data, length - 2) != getU16(data + length - 2))
+  {
+    return GATEWAY_FRAME_CRC;
+  }
+
+  const uint8_t* in = data + 4;
+  frame->board = getU16(in);
+  frame->boot = getU32(in + 2);
+  frame->sequence = getU16(in + 6);
+  frame->epoch = getU32(in + 8);
+  in += 12;
+
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++, in += 2)
+  {
+    frame->sample.value[i] = (int16_t)getU16(in);
+  }
+
+  return GATEWAY_FRAME_OK;
+}
+
+GatewayMerger::GatewayMerger()
+{
+  this->leafCount = 0;
+  this->nextLeaf = 0;
+  this->duplicates = 0;
+  this->overflows = 0;
+}
+
+bool GatewayMerger::Add(const GatewayFrame& frame, uint32_t nowMillis)
+{
+  GatewayLeaf* leaf = this->find(frame.board);
+  if (leaf == NULL)
+  {
+    if (this->leafCount == GATEWAY_MAX_LEAVES)
+    {
+      this->overflows++;
+      return false;
+    }
+
+    leaf = &this->leaves[this->leafCount++];
+    leaf->board = frame.board;
+    leaf->boot = frame.boot;
+    leaf->nextSequence = frame.sequence;
+    leaf->batchStartMillis = nowMillis;
+    leaf->frames = 0;
+    leaf->lost = 0;
+    leaf->restarts = 0;
+    leaf->batch.Clear();
+  }
+  else if (frame.boot != leaf->boot)
+  {
+    // The leaf restarted and counts from 0 again; what it sent before is not known to be lost.
+    leaf->boot = frame.boot;
+    leaf->nextSequence = frame.sequence;
+    leaf->restarts++;
+  }
+
+  uint16_t ahead = (uint16_t)(frame.sequence - leaf->nextSequence);
+  if (ahead >= 0x8000)
+  {
+    // Behind the expected sequence: a retransmission, or a sender that lost its place.
+    if ((uint16_t)(leaf->nextSequence - frame.sequence) <= GATEWAY_DUPLICATE_WINDOW)
+    {
+      this->duplicates++;
+      return false;
+    }
+  }
+  else
+  {
+    leaf->lost += ahead;
+  }
+
+  leaf->nextSequence = (uint16_t)(frame.sequence + 1);
+  leaf->frames++;
+
+  if (leaf->batch.IsFull())
+  {
+    this->overflows++;
+    return false;
+  }
+
+  if (leaf->batch.Count() == 0)
+  {
+    leaf->batchStartMillis = nowMillis;
+  }
+
+  leaf->batch.Add(frame.epoch, frame.sample);
+  return true;
+}
+
+bool GatewayMerger::HasReady(uint32_t nowMillis) { return this->findReady(nowMillis) >= 0; }
+
+GatewayLeaf* GatewayMerger::NextReady(uint32_t nowMillis)
+{
+  int index = this->findReady(nowMillis);
+  if (index < 0)
+  {
+    return NULL;
+  }
+
+  this->nextLeaf = ((size_t)index + 1) % this->leafCount;
+  return &this->leaves[index];
+}
+
+size_t GatewayMerger::LeafCount() { return this->leafCount; }
+
+const GatewayLeaf* GatewayMerger::Leaf(size_t index) { return &this->leaves[index]; }
+
+uint32_t GatewayMerger::Duplicates() { return this->duplicates; }
+
+uint32_t GatewayMerger::Overflows() { return this->overflows; }
+
+GatewayLeaf* GatewayMerger::find(uint16_t board)
+{
+  for (size_t i = 0; i < this->leafCount; i++)
+  {
+    if (this->leaves[i].board == board)
+    {
+      return &this->leaves[i];
+    }
+  }
+
+  return NULL;
+}
+
+int GatewayMerger::findReady(uint32_t nowMillis)
+{
+  for (size_t i = 0; i < this->leafCount; i++)
+  {
+    size_t index = (this->nextLeaf + i) % this->leafCount;
+    GatewayLeaf* leaf = &this->leaves[index];
+
+    if (leaf->batch.Count() > 0
+        && (leaf->batch.IsFull()
+            || nowMillis - leaf->batchStartMillis >= GATEWAY_BATCH_MAX_AGE_MILLISECS))
+    {
+      return (int)index;
+    }
+  }
+
+  return -1;
+}
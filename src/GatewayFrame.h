@@ -0,0 +1,108 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef GATEWAYFRAME_H
+#define GATEWAYFRAME_H
+
+#include "SensorSample.h"
+#include "TelemetryBatch.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define GATEWAY_FRAME_VERSION 2
+#define GATEWAY_FRAME_SIZE (16 + 2 * SENSOR_CHANNEL_COUNT + 2)
+
+// Leaf boards one gateway keeps batches for; frames from further boards are dropped.
+#ifndef GATEWAY_MAX_LEAVES
+#define GATEWAY_MAX_LEAVES 16
+#endif
+
+// A leaf batch that has not filled up goes out after this long, so a slow leaf is not held back.
+#ifndef GATEWAY_BATCH_MAX_AGE_MILLISECS
+#define GATEWAY_BATCH_MAX_AGE_MILLISECS 30000
+#endif
+
+// A sequence number this far behind the expected one is a duplicate; further back, the leaf lost
+// its place and is followed from there.
+#define GATEWAY_DUPLICATE_WINDOW 64
+
+/*
+ * One reading from a leaf board. On the wire (all integers little-endian):
+ *   "AZ", version u8, sensor channel count u8, board id u16, boot u32,
+ *   sequence u16, epoch seconds u32, int16 per sensor channel, CRC-16/CCITT-FALSE u16
+ * The CRC covers every byte before it. boot is drawn at random when the leaf
+ * starts, so the gateway can tell a restart, whose sequence begins again at 0,
+ * from a retransmission.
+ */
+struct GatewayFrame
+{
+  uint16_t board;
+  uint32_t boot;
+  uint16_t sequence;
+  uint32_t epoch;
+  SensorSample sample;
+};
+
+enum GatewayFrameStatus
+{
+  GATEWAY_FRAME_OK = 0,
+  GATEWAY_FRAME_MALFORMED, // Wrong size, magic, version or channel count
+  GATEWAY_FRAME_CRC,
+};
+
+// @return GATEWAY_FRAME_SIZE, or 0 if buffer is smaller.
+size_t GatewayFrameEncode(const GatewayFrame& frame, uint8_t* buffer, size_t size);
+GatewayFrameStatus GatewayFrameDecode(const uint8_t* data, size_t length, GatewayFrame* frame);
+
+uint16_t GatewayCrc16(const uint8_t* data, size_t length);
+
+struct GatewayLeaf
+{
+  uint16_t board;
+  uint32_t boot;
+  uint16_t nextSequence;
+  uint32_t batchStartMillis; // Arrival of the oldest reading in batch
+  uint32_t frames;
+  uint32_t lost; // Sequence numbers skipped
+  uint32_t restarts; // Changes of boot
+  TelemetryBatch batch;
+};
+
+/*
+ * Gateway side of gateway mode: merges frames from the leaves into one routine
+ * telemetry batch per board id. Has no transport or clock of its own, so it can
+ * be driven from a host simulation as well as from the UDP link.
+ *
+ * Not thread-safe; use from loop().
+ */
+class GatewayMerger
+{
+public:
+  GatewayMerger();
+
+  // @return false if the frame was dropped: a duplicate, no free leaf slot or a full batch.
+  bool Add(const GatewayFrame& frame, uint32_t nowMillis);
+
+  // True when a leaf batch is full or older than GATEWAY_BATCH_MAX_AGE_MILLISECS.
+  bool HasReady(uint32_t nowMillis);
+
+  // The next such leaf, round robin; clear its batch once sent.
+  GatewayLeaf* NextReady(uint32_t nowMillis);
+
+  size_t LeafCount();
+  const GatewayLeaf* Leaf(size_t index);
+  uint32_t Duplicates();
+  uint32_t Overflows();
+
+private:
+  GatewayLeaf* find(uint16_t board);
+  int findReady(uint32_t nowMillis);
+
+  GatewayLeaf leaves[GATEWAY_MAX_LEAVES];
+  size_t leafCount;
+  size_t nextLeaf; // Where NextReady() resumes, so one busy leaf cannot starve the others
+  uint32_t duplicates;
+  uint32_t overflows;
+};
+
+#endif // GATEWAYFRAME_H
@@ -0,0 +1,157 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "GatewayLink.h"
+#include "SerialLogger.h"
+#include <esp_system.h>
+#include <string.h>
+
+GatewayLink::GatewayLink()
+{
+  this->udpSocket = -1;
+  memset(&this->gateway, 0, sizeof(this->gateway));
+  this->board = 0;
+  this->boot = 0;
+  this->sequence = 0;
+  this->rejected = 0;
+}
+
+bool GatewayLink::BeginLeaf(const char* gatewayAddress, uint16_t port, uint16_t board)
+{
+  memset(&this->gateway, 0, sizeof(this->gateway));
+  this->gateway.sin_family = AF_INET;
+  this->gateway.sin_port = htons(port);
+  if (inet_pton(AF_INET, gatewayAddress, &this->gateway.sin_addr) != 1)
+  {
+    Logger.Error("Gateway address is not a dotted IPv4 address");
+    return false;
+  }
+
+  this->board = board;
+  this->boot = esp_random();
+  this->sequence = 0;
+  return this->open();
+}
+
+bool GatewayLink::Send(uint32_t epoch, const SensorSample& sample)
+{
+  if (this->udpSocket < 0)
+  {
+    return false;
+  }
+
+  GatewayFrame frame;
+  frame.board = this->board;
+  frame.boot = this->boot;
+  frame.sequence = this->sequence++;
+  frame.epoch = epoch;
+  frame.sample = sample;
+
+  uint8_t buffer[GATEWAY_FRAME_SIZE];
+  size_t length = GatewayFrameEncode(frame, buffer, sizeof(buffer));
+
+  // Never blocks; a full send queue or a link that is down loses the frame, which the gateway
+  // sees as a sequence gap.
+  return sendto(this->udpSocket, buffer, length, 0, (struct sockaddr*)&this->gateway, sizeof(this->gateway))
+      == (int)length;
+}
+
+bool GatewayLink::BeginGateway(uint16_t port)
+{
+  if (!this->open())
+  {
+    return false;
+  }
+
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (bind(this->udpSocket, (struct sockaddr*)&local, sizeof(local)) != 0)
+  {
+    Logger.Error("Failed binding the gateway UDP port");
+    this->End();
+    return false;
+  }
+
+  Logger.Info("Gateway listening for leaf boards on UDP port " + String(port));
+  return true;
+}
+
+void GatewayLink::Service()
+{
+  if (this->udpSocket < 0)
+  {
+    return;
+  }
+
+  uint8_t buffer[GATEWAY_FRAME_SIZE + 1]; // One spare byte so oversized datagrams are detected
+  for (int i = 0; i < GATEWAY_FRAMES_PER_SERVICE; i++)
+  {
+    int length = recvfrom(this->udpSocket, buffer, sizeof(buffer), MSG_DONTWAIT, NULL, NULL);
+    if (length < 0)
+    {
+      break;
+    }
+
+    GatewayFrame frame;
+    if (GatewayFrameDecode(buffer, (size_t)length, &frame) != GATEWAY_FRAME_OK)
+    {
+      this->rejected++;
+      continue;
+    }
+
+    (void)this->merger.Add(frame, millis());
+  }
+}
+
+bool GatewayLink::HasReady() { return this->merger.HasReady(millis()); }
+
+GatewayLeaf* GatewayLink::NextReady() { return this->merger.NextReady(millis()); }
+
+void GatewayLink::ToJson(JsonDocument& document)
+{
+  JsonObject gateway = document["gateway"].to<JsonObject>();
+
+  JsonArray leaves = gateway["leaves"].to<JsonArray>();
+  for (size_t i = 0; i < this->merger.LeafCount(); i++)
+  {
+    const GatewayLeaf* leaf = this->merger.Leaf(i);
+    JsonArray entry = leaves.add<JsonArray>();
+    entry.add(leaf->board);
+    entry.add(leaf->frames);
+    entry.add(leaf->lost);
+    entry.add(leaf->restarts);
+  }
+
+  gateway["rejected"] = this->rejected;
+  gateway["duplicates"] = this->merger.Duplicates();
+  gateway["overflows"] = this->merger.Overflows();
+}
+
+void GatewayLink::End()
+{
+  if (this->udpSocket >= 0)
+  {
+    close(this->udpSocket);
+    this->udpSocket = -1;
+  }
+}
+
+bool GatewayLink::open()
+{
+  this->End();
+
+  this->udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (this->udpSocket < 0)
+  {
+    Logger.Error("Failed creating the gateway UDP socket");
+    return false;
+  }
+
+  return true;
+}
+
+GatewayLink Gateway;
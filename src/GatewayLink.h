@@ -0,0 +1,60 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef GATEWAYLINK_H
+#define GATEWAYLINK_H
+
+#include "GatewayFrame.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <lwip/sockets.h>
+
+// Frames read per Service() call, bounding the time one loop() spends on the link.
+#define GATEWAY_FRAMES_PER_SERVICE 16
+
+/*
+ * UDP transport of gateway mode. A leaf board sends each reading to the gateway
+ * as one GatewayFrame datagram; the gateway drains its socket without blocking
+ * and merges the frames into per-board batches for the routine telemetry.
+ * Datagrams go through a plain non-blocking lwIP socket, so nothing is
+ * allocated per frame.
+ *
+ * Not thread-safe; use from loop().
+ */
+class GatewayLink
+{
+public:
+  GatewayLink();
+
+  // Leaf: frames are sent to gatewayAddress (dotted IPv4) as board.
+  bool BeginLeaf(const char* gatewayAddress, uint16_t port, uint16_t board);
+  // @return false if the frame could not be handed to the network stack.
+  bool Send(uint32_t epoch, const SensorSample& sample);
+
+  // Gateway: frames are received on port.
+  bool BeginGateway(uint16_t port);
+  void Service();
+  bool HasReady();
+  GatewayLeaf* NextReady();
+
+  // Adds a "gateway" object to document: per-leaf [board, frames, lost, restarts] and drop counters.
+  void ToJson(JsonDocument& document);
+
+  void End();
+
+private:
+  bool open();
+
+  int udpSocket;
+  struct sockaddr_in gateway;
+  uint16_t board;
+  uint32_t boot;
+  uint16_t sequence;
+
+  GatewayMerger merger;
+  uint32_t rejected;
+};
+
+extern GatewayLink Gateway;
+
+#endif // GATEWAYLINK_H
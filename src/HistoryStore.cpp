@@ -0,0 +1,521 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "HistoryStore.h"
+#include <string.h>
+
+#define FILE_HEADER_SIZE 8
+#define SEGMENT_PATH_SIZE (HISTORY_PATH_SIZE + sizeof(".255"))
+
+// Records read from the file at a time by Read().
+#define HISTORY_READ_RECORDS 32
+
+static const uint8_t file_magic[4] = { 'A', 'Z', 'H', 'S' };
+
+static uint8_t* putU16(uint8_t* out, uint16_t value)
+{
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  return out + 2;
+}
+
+static uint8_t* putU32(uint8_t* out, uint32_t value)
+{
+  out = putU16(out, (uint16_t)value);
+  return putU16(out, (uint16_t)(value >> 16));
+}
+
+static uint16_t getU16(const uint8_t* in) { return (uint16_t)(in[0] | (in[1] << 8)); }
+
+static uint32_t getU32(const uint8_t* in)
+{
+  return (uint32_t)getU16(in) | ((uint32_t)getU16(in + 2) << 16);
+}
+
+static void decodeRecord(const uint8_t* in, BatchedReading* reading)
+{
+  reading->epoch = getU32(in);
+  in += 4;
+
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++, in += 2)
+  {
+    reading->sample.value[i] = (int16_t)getU16(in);
+  }
+}
+
+static long recordOffset(uint32_t record)
+{
+  return FILE_HEADER_SIZE + (long)record * HISTORY_RECORD_SIZE;
+}
+
+HistoryStore::HistoryStore()
+{
+  this->path[0] = '\0';
+  this->file = NULL;
+  memset(this->segments, 0, sizeof(this->segments));
+  this->head = 0;
+  this->used = 0;
+}
+
+bool HistoryStore::Begin(const char* path)
+{
+  if (path == NULL || strlen(path) >= sizeof(this->path))
+  {
+    return false;
+  }
+
+  this->End();
+  strcpy(this->path, path);
+
+  this->head = 0;
+  for (uint8_t i = 0; i < HISTORY_SEGMENT_COUNT; i++)
+  {
+    this->loadSegment(i);
+
+    if (this->segments[i].records > 0
+        && (this->segments[this->head].records == 0
+            || this->segments[i].lastEpoch > this->segments[this->head].lastEpoch))
+    {
+      this->head = i;
+    }
+  }
+
+  return this->openHead(false);
+}
+
+void HistoryStore::End()
+{
+  if (this->file == NULL)
+  {
+    return;
+  }
+
+  (void)this->Flush();
+  if (this->file != NULL)
+  {
+    fclose(this->file);
+    this->file = NULL;
+  }
+}
+
+bool HistoryStore::IsOpen() { return this->file != NULL; }
+
+bool HistoryStore::Append(uint32_t epoch, const SensorSample& sample)
+{
+  if (this->file == NULL || epoch < this->NewestEpoch())
+  {
+    return false;
+  }
+
+  if (this->segments[this->head].records >= HISTORY_SEGMENT_RECORDS)
+  {
+    // Moves on even if the flush failed: emptying the oldest segment is what frees space.
+    (void)this->Flush();
+    if (this->file != NULL)
+    {
+      fclose(this->file);
+    }
+    this->head = (uint8_t)((this->head + 1) % HISTORY_SEGMENT_COUNT);
+
+    if (!this->openHead(true))
+    {
+      return false;
+    }
+  }
+
+  Segment& segment = this->segments[this->head];
+  if (segment.records % HISTORY_INDEX_STRIDE == 0)
+  {
+    segment.index[segment.records / HISTORY_INDEX_STRIDE] = epoch;
+  }
+
+  uint8_t* out = putU32(this->buffer + this->used, epoch);
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++)
+  {
+    out = putU16(out, (uint16_t)sample.value[i]);
+  }
+
+  this->used += HISTORY_RECORD_SIZE;
+  segment.records++;
+  segment.lastEpoch = epoch;
+
+  if (this->used == sizeof(this->buffer))
+  {
+    return this->Flush();
+  }
+
+  return true;
+}
+
+bool HistoryStore::Flush()
+{
+  if (this->file == NULL || this->used == 0)
+  {
+    return true;
+  }
+
+  bool written = fwrite(this->buffer, 1, this->used, this->file) == this->used && fflush(this->file) == 0;
+  this->used = 0;
+  if (written)
+  {
+    return true;
+  }
+
+  // The buffered readings were counted when appended. Recount the head segment from what actually
+  // reached the file (a torn record is not counted, as after a reset) and reopen it there, so the
+  // index and the next append agree with the file.
+  fclose(this->file);
+  this->file = NULL;
+  this->loadSegment(this->head);
+  (void)this->openHead(false);
+  return false;
+}
+
+uint32_t HistoryStore::Count()
+{
+  uint32_t count = 0;
+
+  for (int i = 0; i < HISTORY_SEGMENT_COUNT; i++)
+  {
+    count += this->segments[i].records;
+  }
+
+  return count;
+}
+
+uint32_t HistoryStore::OldestEpoch()
+{
+  for (int i = 1; i <= HISTORY_SEGMENT_COUNT; i++)
+  {
+    const Segment& segment = this->segments[(this->head + i) % HISTORY_SEGMENT_COUNT];
+
+    if (segment.records > 0)
+    {
+      return segment.index[0];
+    }
+  }
+
+  return 0;
+}
+
+uint32_t HistoryStore::NewestEpoch()
+{
+  const Segment& segment = this->segments[this->head];
+  return segment.records > 0 ? segment.lastEpoch : 0;
+}
+
+bool HistoryStore::Seek(HistoryQuery& query, uint32_t from, uint32_t to, uint32_t resolution)
+{
+  query.from = from;
+  query.to = to;
+  query.resolution = resolution;
+  query.segment = 0;
+  query.generation = 0;
+  query.record = 0;
+  query.exhausted = true;
+  query.done = true;
+  query.hasBucket = false;
+  query.bucketEpoch = 0;
+
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++)
+  {
+    query.accumulators[i].Reset();
+  }
+
+  if (this->file == NULL || from > to)
+  {
+    return false;
+  }
+
+  // Segments oldest first; the first whose last reading is not before from holds the start.
+  for (int i = 1; i <= HISTORY_SEGMENT_COUNT; i++)
+  {
+    uint8_t s = (uint8_t)((this->head + i) % HISTORY_SEGMENT_COUNT);
+    const Segment& segment = this->segments[s];
+
+    if (segment.records == 0 || segment.lastEpoch < from)
+    {
+      continue;
+    }
+
+    if (segment.index[0] > to)
+    {
+      break;
+    }
+
+    // Last index entry at or before from; its stride is the only one read before the range.
+    size_t low = 0;
+    size_t high = (segment.records + HISTORY_INDEX_STRIDE - 1) / HISTORY_INDEX_STRIDE;
+    while (high - low > 1)
+    {
+      size_t middle = low + (high - low) / 2;
+
+      if (segment.index[middle] <= from)
+      {
+        low = middle;
+      }
+      else
+      {
+        high = middle;
+      }
+    }
+
+    query.segment = s;
+    query.generation = segment.generation;
+    query.record = (uint32_t)low * HISTORY_INDEX_STRIDE;
+    query.exhausted = false;
+    query.done = false;
+    break;
+  }
+
+  return true;
+}
+
+size_t HistoryStore::Read(HistoryQuery& query, BatchedReading* readings, size_t maxReadings)
+{
+  uint8_t records[HISTORY_READ_RECORDS * HISTORY_RECORD_SIZE];
+  FILE* segment_file = NULL;
+  uint8_t open_segment = 0;
+  size_t count = 0;
+
+  (void)this->Flush();
+
+  while (!query.exhausted && count < maxReadings)
+  {
+    const Segment& segment = this->segments[query.segment];
+
+    // The segment was emptied for new readings since the last page: what it held is gone, but the
+    // segments after it still are, so carry on from the oldest one kept.
+    if (segment.generation != query.generation)
+    {
+      query.segment = (uint8_t)((this->head + 1) % HISTORY_SEGMENT_COUNT);
+      query.generation = this->segments[query.segment].generation;
+      query.record = 0;
+      continue;
+    }
+
+    if (query.record >= segment.records)
+    {
+      this->nextSegment(query);
+      continue;
+    }
+
+    if (segment_file == NULL || open_segment != query.segment)
+    {
+      char segment_path[SEGMENT_PATH_SIZE];
+
+      if (segment_file != NULL)
+      {
+        fclose(segment_file);
+      }
+
+      this->segmentPath(query.segment, segment_path);
+      segment_file = fopen(segment_path, "rb");
+      open_segment = query.segment;
+
+      if (segment_file == NULL)
+      {
+        this->nextSegment(query);
+        continue;
+      }
+    }
+
+    uint32_t wanted = segment.records - query.record;
+    if (wanted > HISTORY_READ_RECORDS)
+    {
+      wanted = HISTORY_READ_RECORDS;
+    }
+
+    size_t available = 0;
+    if (fseek(segment_file, recordOffset(query.record), SEEK_SET) == 0)
+    {
+      available = fread(records, HISTORY_RECORD_SIZE, wanted, segment_file);
+    }
+
+    if (available == 0)
+    {
+      this->nextSegment(query);
+      continue;
+    }
+
+    for (size_t i = 0; i < available && count < maxReadings; i++)
+    {
+      BatchedReading reading;
+      decodeRecord(records + i * HISTORY_RECORD_SIZE, &reading);
+      query.record++;
+
+      if (reading.epoch < query.from)
+      {
+        continue;
+      }
+
+      if (reading.epoch > query.to)
+      {
+        query.exhausted = true;
+        break;
+      }
+
+      if (query.resolution == 0)
+      {
+        readings[count++] = reading;
+        continue;
+      }
+
+      uint32_t bucket = reading.epoch - reading.epoch % query.resolution;
+      if (query.hasBucket && bucket != query.bucketEpoch)
+      {
+        readings[count].epoch = query.bucketEpoch;
+        for (int c = 0; c < SENSOR_CHANNEL_COUNT; c++)
+        {
+          readings[count].sample.value[c] = query.accumulators[c].Mean();
+          query.accumulators[c].Reset();
+        }
+
+        count++;
+      }
+
+      query.hasBucket = true;
+      query.bucketEpoch = bucket;
+      for (int c = 0; c < SENSOR_CHANNEL_COUNT; c++)
+      {
+        query.accumulators[c].Add(reading.sample.value[c]);
+      }
+    }
+  }
+
+  if (segment_file != NULL)
+  {
+    fclose(segment_file);
+  }
+
+  if (query.exhausted && query.hasBucket && count < maxReadings)
+  {
+    readings[count].epoch = query.bucketEpoch;
+    for (int c = 0; c < SENSOR_CHANNEL_COUNT; c++)
+    {
+      readings[count].sample.value[c] = query.accumulators[c].Mean();
+    }
+
+    count++;
+    query.hasBucket = false;
+  }
+
+  query.done = query.exhausted && !query.hasBucket;
+  return count;
+}
+
+void HistoryStore::segmentPath(uint8_t segment, char* buffer)
+{
+  snprintf(buffer, SEGMENT_PATH_SIZE, "%s.%u", this->path, (unsigned)segment);
+}
+
+void HistoryStore::loadSegment(uint8_t segment)
+{
+  Segment& loaded = this->segments[segment];
+  char segment_path[SEGMENT_PATH_SIZE];
+  uint8_t header[FILE_HEADER_SIZE];
+  uint8_t epoch[4];
+
+  loaded.records = 0;
+  loaded.lastEpoch = 0;
+
+  this->segmentPath(segment, segment_path);
+  FILE* segment_file = fopen(segment_path, "rb");
+  if (segment_file == NULL)
+  {
+    return;
+  }
+
+  // A segment written with another channel count is ignored and overwritten in turn.
+  if (fread(header, 1, sizeof(header), segment_file) == sizeof(header)
+      && memcmp(header, file_magic, sizeof(file_magic)) == 0 && header[4] == HISTORY_FORMAT_VERSION
+      && header[5] == SENSOR_CHANNEL_COUNT && fseek(segment_file, 0, SEEK_END) == 0)
+  {
+    // A record cut short by a reset is not counted; the next append overwrites it.
+    long size = ftell(segment_file);
+    uint32_t records
+        = size > FILE_HEADER_SIZE ? (uint32_t)((size - FILE_HEADER_SIZE) / HISTORY_RECORD_SIZE) : 0;
+    if (records > HISTORY_SEGMENT_RECORDS)
+    {
+      records = HISTORY_SEGMENT_RECORDS;
+    }
+
+    for (uint32_t record = 0; record < records; record += HISTORY_INDEX_STRIDE)
+    {
+      if (fseek(segment_file, recordOffset(record), SEEK_SET) != 0
+          || fread(epoch, 1, sizeof(epoch), segment_file) != sizeof(epoch))
+      {
+        records = record;
+        break;
+      }
+
+      loaded.index[record / HISTORY_INDEX_STRIDE] = getU32(epoch);
+    }
+
+    if (records > 0 && fseek(segment_file, recordOffset(records - 1), SEEK_SET) == 0
+        && fread(epoch, 1, sizeof(epoch), segment_file) == sizeof(epoch))
+    {
+      loaded.records = records;
+      loaded.lastEpoch = getU32(epoch);
+    }
+  }
+
+  fclose(segment_file);
+}
+
+bool HistoryStore::openHead(bool truncate)
+{
+  Segment& segment = this->segments[this->head];
+  char segment_path[SEGMENT_PATH_SIZE];
+
+  this->segmentPath(this->head, segment_path);
+  this->file = NULL;
+  this->used = 0;
+
+  if (!truncate && segment.records > 0)
+  {
+    this->file = fopen(segment_path, "r+b");
+  }
+
+  if (this->file == NULL)
+  {
+    uint8_t header[FILE_HEADER_SIZE] = { 0 };
+    memcpy(header, file_magic, sizeof(file_magic));
+    header[4] = HISTORY_FORMAT_VERSION;
+    header[5] = SENSOR_CHANNEL_COUNT;
+
+    segment.records = 0;
+    segment.lastEpoch = 0;
+    segment.generation++;
+
+    this->file = fopen(segment_path, "w+b");
+    if (this->file == NULL)
+    {
+      return false;
+    }
+
+    if (fwrite(header, 1, sizeof(header), this->file) != sizeof(header))
+    {
+      fclose(this->file);
+      this->file = NULL;
+      return false;
+    }
+  }
+
+  return fseek(this->file, recordOffset(segment.records), SEEK_SET) == 0;
+}
+
+void HistoryStore::nextSegment(HistoryQuery& query)
+{
+  if (query.segment == this->head)
+  {
+    query.exhausted = true;
+    return;
+  }
+
+  query.segment = (uint8_t)((query.segment + 1) % HISTORY_SEGMENT_COUNT);
+  query.generation = this->segments[query.segment].generation;
+  query.record = 0;
+}
+
+HistoryStore History;
@@ -0,0 +1,127 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include "SensorSample.h"
+#include "TelemetryBatch.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The history is a ring of segment files <path>.0 ... <path>.<HISTORY_SEGMENT_COUNT - 1>;
+// the oldest segment is emptied when the newest one is full.
+#ifndef HISTORY_SEGMENT_COUNT
+#define HISTORY_SEGMENT_COUNT 4
+#endif
+
+#ifndef HISTORY_SEGMENT_RECORDS
+#define HISTORY_SEGMENT_RECORDS 4096
+#endif
+
+// One index entry (the epoch of the first record) per this many records.
+#ifndef HISTORY_INDEX_STRIDE
+#define HISTORY_INDEX_STRIDE 128
+#endif
+
+// Appended records are written to the file in groups of this many.
+#define HISTORY_BUFFER_RECORDS 16
+
+#define HISTORY_INDEX_SIZE (HISTORY_SEGMENT_RECORDS / HISTORY_INDEX_STRIDE)
+#define HISTORY_RECORD_SIZE (4 + 2 * SENSOR_CHANNEL_COUNT)
+#define HISTORY_PATH_SIZE 32
+#define HISTORY_FORMAT_VERSION 1
+
+/*
+ * Position of a range query, owned by the caller so a long range can be read a
+ * page at a time across loop() iterations.
+ */
+struct HistoryQuery
+{
+  uint32_t from;
+  uint32_t to;
+  uint32_t resolution;
+  uint8_t segment;
+  uint32_t generation;
+  uint32_t record;
+  bool exhausted;
+  bool done; // Every matching reading has been returned.
+
+  // The bucket being averaged when resolution is not 0.
+  bool hasBucket;
+  uint32_t bucketEpoch;
+  SensorAccumulator accumulators[SENSOR_CHANNEL_COUNT];
+};
+
+/*
+ * Rolling on-flash history of readings for backfilling gaps upstream.
+ *
+ * Segment layout (all integers little-endian):
+ *   header: "AZHS", version u8, sensor channel count u8, 2 reserved bytes
+ *   record: epoch seconds u32, int16 per sensor channel
+ * Records are fixed-size and in time order, so record i is found by offset. A
+ * sparse index in RAM keeps the epoch of every HISTORY_INDEX_STRIDE-th record;
+ * a query binary-searches it and reads at most one stride before reaching the
+ * start of its range, however large the history.
+ *
+ * Not thread-safe; append and query from loop().
+ */
+class HistoryStore
+{
+public:
+  HistoryStore();
+  bool Begin(const char* path);
+  void End();
+  bool IsOpen();
+
+  // Readings older than the newest one are dropped (the clock went backwards).
+  bool Append(uint32_t epoch, const SensorSample& sample);
+
+  /*
+   * @brief Writes the buffered readings to the file.
+   * @return false if they could not all be written; the counts then match what is in the file.
+   */
+  bool Flush();
+
+  uint32_t Count();
+  uint32_t OldestEpoch();
+  uint32_t NewestEpoch();
+
+  /*
+   * @brief Positions query at the first reading at or after from.
+   * @param resolution Seconds per averaged reading; 0 returns every reading.
+   */
+  bool Seek(HistoryQuery& query, uint32_t from, uint32_t to, uint32_t resolution);
+
+  /*
+   * @brief Returns the next readings of query in time order.
+   * @return Number written to readings; query.done is set after the last one.
+   */
+  size_t Read(HistoryQuery& query, BatchedReading* readings, size_t maxReadings);
+
+private:
+  struct Segment
+  {
+    uint32_t records;
+    uint32_t lastEpoch;
+    uint32_t generation;
+    uint32_t index[HISTORY_INDEX_SIZE];
+  };
+
+  void segmentPath(uint8_t segment, char* buffer);
+  void loadSegment(uint8_t segment);
+  bool openHead(bool truncate);
+  void nextSegment(HistoryQuery& query);
+
+  char path[HISTORY_PATH_SIZE];
+  FILE* file;
+  Segment segments[HISTORY_SEGMENT_COUNT];
+  uint8_t head;
+  uint8_t buffer[HISTORY_BUFFER_RECORDS * HISTORY_RECORD_SIZE];
+  size_t used;
+};
+
+extern HistoryStore History;
+
+#endif // HISTORYSTORE_H
@@ -0,0 +1,377 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "LatencyTracer.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include "SerialLogger.h"
+#include <Arduino.h>
+
+static portMUX_TYPE tracer_lock = portMUX_INITIALIZER_UNLOCKED;
+#define TRACER_LOCK() portENTER_CRITICAL(&tracer_lock)
+#define TRACER_UNLOCK() portEXIT_CRITICAL(&tracer_lock)
+#else
+#include <chrono>
+#include <mutex>
+
+static std::mutex tracer_lock;
+#define TRACER_LOCK() tracer_lock.lock()
+#define TRACER_UNLOCK() tracer_lock.unlock()
+#endif
+
+#define NO_PENDING_ACK -1
+
+static const char* const stage_names[TRACE_STAGE_COUNT] = {
+  "topic", "sensor", "serialize", "enqueue", "ack", "sasToken", "mqttEvent", "connect", "alert", "rules",
+};
+
+// Spans on the MQTT task are drawn on their own track in the Chrome trace.
+static int stageThread(uint8_t stage)
+{
+  return (stage == TRACE_STAGE_MQTT_ACK || stage == TRACE_STAGE_MQTT_EVENT
+          || stage == TRACE_STAGE_MQTT_CONNECT)
+      ? 2
+      : 1;
+}
+
+static int histogramBucket(uint32_t micros)
+{
+  int bucket = 0;
+
+  while (micros > 1 && bucket < TRACE_HISTOGRAM_BUCKETS - 1)
+  {
+    micros >>= 1;
+    bucket++;
+  }
+
+  return bucket;
+}
+
+uint32_t LatencyTracer::Cycles()
+{
+#ifdef ARDUINO
+  return ESP.getCycleCount();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+uint32_t LatencyTracer::Micros()
+{
+#ifdef ARDUINO
+  return micros();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+uint32_t LatencyTracer::CyclesPerMicro()
+{
+#ifdef ARDUINO
+  return ESP.getCpuFreqMHz();
+#else
+  return 1000; // Host "cycles" are nanoseconds.
+#endif
+}
+
+LatencyTracer::LatencyTracer() { this->Reset(); }
+
+void LatencyTracer::Clear()
+{
+  TRACER_LOCK();
+  this->Reset();
+  TRACER_UNLOCK();
+}
+
+void LatencyTracer::Reset()
+{
+  memset(this->ring, 0, sizeof(this->ring));
+  memset(this->summaries, 0, sizeof(this->summaries));
+  this->ringHead = 0;
+  this->ringCount = 0;
+
+  for (int i = 0; i < TRACE_MAX_PENDING_ACKS; i++)
+  {
+    this->pendingAckIds[i] = NO_PENDING_ACK;
+    this->pendingAckStartMicros[i] = 0;
+  }
+}
+
+void LatencyTracer::Record(
+    TraceStage stage,
+    uint32_t startMicros,
+    uint32_t startCycles,
+    uint32_t endCycles)
+{
+  TRACER_LOCK();
+  // Unsigned subtraction handles a single wrap of the 32-bit cycle counter.
+  this->RecordLocked(stage, startMicros, endCycles - startCycles);
+  TRACER_UNLOCK();
+}
+
+void LatencyTracer::RecordMicros(TraceStage stage, uint32_t startMicros, uint32_t endMicros)
+{
+  TRACER_LOCK();
+  this->RecordMicrosLocked(stage, startMicros, endMicros);
+  TRACER_UNLOCK();
+}
+
+void LatencyTracer::RecordMicrosLocked(TraceStage stage, uint32_t startMicros, uint32_t endMicros)
+{
+  uint32_t elapsed = endMicros - startMicros;
+  uint32_t limit = UINT32_MAX / CyclesPerMicro();
+  this->RecordLocked(stage, startMicros, (elapsed < limit ? elapsed : limit) * CyclesPerMicro());
+}
+
+void LatencyTracer::RecordLocked(TraceStage stage, uint32_t startMicros, uint32_t durationCycles)
+{
+  TraceSpan* span = &this->ring[this->ringHead];
+  span->stage = (uint8_t)stage;
+  span->startMicros = startMicros;
+  span->durationCycles = durationCycles;
+  this->ringHead = (this->ringHead + 1) % TRACE_RING_SIZE;
+
+  if (this->ringCount < TRACE_RING_SIZE)
+  {
+    this->ringCount++;
+  }
+
+  TraceStageSummary* summary = &this->summaries[stage];
+  summary->count++;
+  summary->totalCycles += durationCycles;
+
+  if (durationCycles > summary->maxCycles)
+  {
+    summary->maxCycles = durationCycles;
+  }
+
+  summary->histogram[histogramBucket(durationCycles / CyclesPerMicro())]++;
+}
+
+void LatencyTracer::BeginAck(int messageId)
+{
+  uint32_t now = Micros();
+
+  TRACER_LOCK();
+  // Reuse the oldest slot when more messages are in flight than we track.
+  int slot = 0;
+  for (int i = 0; i < TRACE_MAX_PENDING_ACKS; i++)
+  {
+    if (this->pendingAckIds[i] == NO_PENDING_ACK)
+    {
+      slot = i;
+      break;
+    }
+
+    if (now - this->pendingAckStartMicros[i] > now - this->pendingAckStartMicros[slot])
+    {
+      slot = i;
+    }
+  }
+
+  this->pendingAckIds[slot] = messageId;
+  this->pendingAckStartMicros[slot] = now;
+  TRACER_UNLOCK();
+}
+
+void LatencyTracer::EndAck(int messageId)
+{
+  uint32_t now = Micros();
+
+  TRACER_LOCK();
+  for (int i = 0; i < TRACE_MAX_PENDING_ACKS; i++)
+  {
+    if (this->pendingAckIds[i] == messageId)
+    {
+      this->pendingAckIds[i] = NO_PENDING_ACK;
+      this->RecordMicrosLocked(TRACE_STAGE_MQTT_ACK, this->pendingAckStartMicros[i], now);
+      break;
+    }
+  }
+  TRACER_UNLOCK();
+}
+
+void LatencyTracer::GetSummary(TraceStage stage, TraceStageSummary* summary)
+{
+  TRACER_LOCK();
+  *summary = this->summaries[stage];
+  TRACER_UNLOCK();
+}
+
+uint32_t LatencyTracer::PercentileMicros(TraceStage stage, uint8_t percentile)
+{
+  TraceStageSummary summary;
+  this->GetSummary(stage, &summary);
+
+  if (summary.count == 0)
+  {
+    return 0;
+  }
+
+  uint32_t maxMicros = summary.maxCycles / CyclesPerMicro();
+  uint64_t target = ((uint64_t)summary.count * percentile + 99) / 100;
+  uint64_t seen = 0;
+
+  for (int i = 0; i < TRACE_HISTOGRAM_BUCKETS; i++)
+  {
+    seen += summary.histogram[i];
+
+    if (seen >= target)
+    {
+      // Report the bucket's upper bound, never more than the largest span seen.
+      uint32_t upperBound = (uint32_t)2 << i;
+      return upperBound < maxMicros ? upperBound : maxMicros;
+    }
+  }
+
+  return maxMicros;
+}
+
+void LatencyTracer::ToJson(JsonDocument& document)
+{
+  JsonObject trace = document["latencyUs"].to<JsonObject>();
+
+  for (int i = 0; i < TRACE_STAGE_COUNT; i++)
+  {
+    TraceStageSummary summary;
+    this->GetSummary((TraceStage)i, &summary);
+
+    if (summary.count == 0)
+    {
+      continue;
+    }
+
+    JsonObject stage = trace[stage_names[i]].to<JsonObject>();
+    stage["n"] = summary.count;
+    stage["avg"] = (uint32_t)(summary.totalCycles / summary.count / CyclesPerMicro());
+    stage["p90"] = this->PercentileMicros((TraceStage)i, 90);
+    stage["max"] = summary.maxCycles / CyclesPerMicro();
+
+    // The log2(us) histogram, without its trailing empty buckets to keep the message small.
+    int used = TRACE_HISTOGRAM_BUCKETS;
+    while (summary.histogram[used - 1] == 0)
+    {
+      used--;
+    }
+
+    JsonArray histogram = stage["hist"].to<JsonArray>();
+    for (int b = 0; b < used; b++)
+    {
+      histogram.add(summary.histogram[b]);
+    }
+  }
+}
+
+void LatencyTracer::WriteChromeTrace(TraceWriter writer, void* context)
+{
+  TraceSpan spans[TRACE_RING_SIZE];
+  size_t count;
+
+  TRACER_LOCK();
+  count = this->ringCount;
+  for (size_t i = 0; i < count; i++)
+  {
+    spans[i] = this->ring[(this->ringHead + TRACE_RING_SIZE - count + i) % TRACE_RING_SIZE];
+  }
+  TRACER_UNLOCK();
+
+  char event[160];
+  writer("{\"traceEvents\":[", context);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t durationNanos = (uint32_t)((uint64_t)spans[i].durationCycles * 1000 / CyclesPerMicro());
+    snprintf(
+        event,
+        sizeof(event),
+        "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu.%03lu,\"pid\":1,\"tid\":%d}",
+        i == 0 ? "" : ",",
+        stage_names[spans[i].stage],
+        (unsigned long)spans[i].startMicros,
+        (unsigned long)(durationNanos / 1000),
+        (unsigned long)(durationNanos % 1000),
+        stageThread(spans[i].stage));
+    writer(event, context);
+  }
+
+  writer("]}\n", context);
+}
+
+#ifdef ARDUINO
+void LatencyTracer::Dump()
+{
+  for (int i = 0; i < TRACE_STAGE_COUNT; i++)
+  {
+    TraceStageSummary summary;
+    this->GetSummary((TraceStage)i, &summary);
+
+    if (summary.count == 0)
+    {
+      continue;
+    }
+
+    String histogram;
+    for (int b = 0; b < TRACE_HISTOGRAM_BUCKETS; b++)
+    {
+      histogram += String(summary.histogram[b]) + (b + 1 < TRACE_HISTOGRAM_BUCKETS ? " " : "");
+    }
+
+    Logger.Info(
+        "Trace " + String(stage_names[i]) + ": n=" + String(summary.count) + " avg="
+        + String((uint32_t)(summary.totalCycles / summary.count / CyclesPerMicro())) + "us p90="
+        + String(this->PercentileMicros((TraceStage)i, 90)) + "us max="
+        + String(summary.maxCycles / CyclesPerMicro()) + "us log2(us) buckets [" + histogram + "]");
+  }
+}
+#else
+void LatencyTracer::Dump()
+{
+  for (int i = 0; i < TRACE_STAGE_COUNT; i++)
+  {
+    TraceStageSummary summary;
+    this->GetSummary((TraceStage)i, &summary);
+
+    if (summary.count > 0)
+    {
+      printf(
+          "%s: n=%lu avg=%luus p90=%luus max=%luus\n",
+          stage_names[i],
+          (unsigned long)summary.count,
+          (unsigned long)(summary.totalCycles / summary.count / CyclesPerMicro()),
+          (unsigned long)this->PercentileMicros((TraceStage)i, 90),
+          (unsigned long)(summary.maxCycles / CyclesPerMicro()));
+    }
+  }
+}
+#endif
+
+TraceScope::TraceScope(TraceStage stage)
+{
+  this->stage = stage;
+  this->startMicros = LatencyTracer::Micros();
+  this->startCycles = LatencyTracer::Cycles();
+}
+
+TraceScope::~TraceScope()
+{
+  Tracer.Record(this->stage, this->startMicros, this->startCycles, LatencyTracer::Cycles());
+}
+
+TraceMicrosScope::TraceMicrosScope(TraceStage stage)
+{
+  this->stage = stage;
+  this->startMicros = LatencyTracer::Micros();
+}
+
+TraceMicrosScope::~TraceMicrosScope()
+{
+  Tracer.RecordMicros(this->stage, this->startMicros, LatencyTracer::Micros());
+}
+
+LatencyTracer Tracer;
@@ -0,0 +1,131 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef LATENCYTRACER_H
+#define LATENCYTRACER_H
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 64
+#endif
+
+// Bucket i counts spans of [2^i, 2^(i+1)) microseconds; the last one is open-ended.
+#define TRACE_HISTOGRAM_BUCKETS 16
+#define TRACE_MAX_PENDING_ACKS 8
+
+enum TraceStage
+{
+  TRACE_STAGE_TOPIC_BUILD = 0,
+  TRACE_STAGE_SENSOR_READ,
+  TRACE_STAGE_SERIALIZE,
+  TRACE_STAGE_MQTT_ENQUEUE,
+  TRACE_STAGE_MQTT_ACK,
+  TRACE_STAGE_SAS_GENERATE,
+  TRACE_STAGE_MQTT_EVENT,
+  TRACE_STAGE_MQTT_CONNECT,
+  TRACE_STAGE_ALERT,
+  TRACE_STAGE_RULES,
+  TRACE_STAGE_COUNT
+};
+
+struct TraceSpan
+{
+  uint8_t stage;
+  uint32_t startMicros;
+  uint32_t durationCycles;
+};
+
+struct TraceStageSummary
+{
+  uint32_t count;
+  uint64_t totalCycles;
+  uint32_t maxCycles;
+  uint32_t histogram[TRACE_HISTOGRAM_BUCKETS];
+};
+
+// Receives the Chrome trace text piece by piece (Serial on the device, a FILE* on the host).
+typedef void (*TraceWriter)(const char* text, void* context);
+
+/*
+ * Fixed-memory latency tracer.
+ * Spans are timed with the CPU cycle counter on the ESP32 (std::chrono on the host),
+ * kept in a ring of the last TRACE_RING_SIZE spans, and folded into per-stage
+ * log2 histograms that survive ring wrap-around.
+ */
+class LatencyTracer
+{
+public:
+  LatencyTracer();
+
+  static uint32_t Cycles();
+  static uint32_t Micros();
+  static uint32_t CyclesPerMicro();
+
+  void Record(TraceStage stage, uint32_t startMicros, uint32_t startCycles, uint32_t endCycles);
+
+  /*
+   * For spans that cross tasks (the cycle counter is per core) or may outlast the 32-bit cycle
+   * counter (about 17.9 s at 240 MHz). Durations beyond that saturate instead of wrapping.
+   */
+  void RecordMicros(TraceStage stage, uint32_t startMicros, uint32_t endMicros);
+
+  // Publish-to-PUBACK latency crosses tasks (and cores), so it is timed in microseconds.
+  void BeginAck(int messageId);
+  void EndAck(int messageId);
+
+  void GetSummary(TraceStage stage, TraceStageSummary* summary);
+  uint32_t PercentileMicros(TraceStage stage, uint8_t percentile);
+  void ToJson(JsonDocument& document);
+  void WriteChromeTrace(TraceWriter writer, void* context);
+  void Dump();
+  void Clear();
+
+private:
+  void Reset();
+  void RecordLocked(TraceStage stage, uint32_t startMicros, uint32_t durationCycles);
+  void RecordMicrosLocked(TraceStage stage, uint32_t startMicros, uint32_t endMicros);
+
+  TraceSpan ring[TRACE_RING_SIZE];
+  size_t ringHead;
+  size_t ringCount;
+  TraceStageSummary summaries[TRACE_STAGE_COUNT];
+  int pendingAckIds[TRACE_MAX_PENDING_ACKS];
+  uint32_t pendingAckStartMicros[TRACE_MAX_PENDING_ACKS];
+};
+
+extern LatencyTracer Tracer;
+
+/*
+ * Times the enclosing block as one span of the given stage.
+ */
+class TraceScope
+{
+public:
+  TraceScope(TraceStage stage);
+  ~TraceScope();
+
+private:
+  TraceStage stage;
+  uint32_t startMicros;
+  uint32_t startCycles;
+};
+
+/*
+ * Times the enclosing block in microseconds, for code on a task that is not pinned to a core:
+ * it may be preempted and resumed on the other core, whose cycle counter differs.
+ */
+class TraceMicrosScope
+{
+public:
+  TraceMicrosScope(TraceStage stage);
+  ~TraceMicrosScope();
+
+private:
+  TraceStage stage;
+  uint32_t startMicros;
+};
+
+#endif // LATENCYTRACER_H
@@ -0,0 +1,159 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "MemoryMonitor.h"
+#include "SerialLogger.h"
+#include <string.h>
+
+static portMUX_TYPE memory_monitor_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* const subsystem_names[MEMORY_SUBSYSTEM_COUNT] = {
+  "json",
+  "mqttOutbox",
+  "payload",
+};
+
+MemoryMonitor::MemoryMonitor()
+{
+  this->taskCount = 0;
+  memset(this->taskNames, 0, sizeof(this->taskNames));
+  memset(this->subsystems, 0, sizeof(this->subsystems));
+}
+
+bool MemoryMonitor::WatchTask(const char* taskName)
+{
+  if (this->taskCount >= MEMORY_MONITOR_MAX_TASKS)
+  {
+    return false;
+  }
+
+  this->taskNames[this->taskCount++] = taskName;
+  return true;
+}
+
+void MemoryMonitor::CountAllocation(MemorySubsystem subsystem, size_t size)
+{
+  portENTER_CRITICAL(&memory_monitor_lock);
+  MemorySubsystemStats* stats = &this->subsystems[subsystem];
+  stats->allocations++;
+  stats->bytesInUse += size;
+
+  if (stats->bytesInUse > stats->peakBytesInUse)
+  {
+    stats->peakBytesInUse = stats->bytesInUse;
+  }
+  portEXIT_CRITICAL(&memory_monitor_lock);
+}
+
+void MemoryMonitor::CountRelease(MemorySubsystem subsystem, size_t size)
+{
+  portENTER_CRITICAL(&memory_monitor_lock);
+  MemorySubsystemStats* stats = &this->subsystems[subsystem];
+  stats->releases++;
+  stats->bytesInUse = (stats->bytesInUse > size) ? stats->bytesInUse - size : 0;
+  portEXIT_CRITICAL(&memory_monitor_lock);
+}
+
+void MemoryMonitor::SetBytesInUse(MemorySubsystem subsystem, size_t size)
+{
+  portENTER_CRITICAL(&memory_monitor_lock);
+  MemorySubsystemStats* stats = &this->subsystems[subsystem];
+  stats->bytesInUse = size;
+
+  if (stats->bytesInUse > stats->peakBytesInUse)
+  {
+    stats->peakBytesInUse = stats->bytesInUse;
+  }
+  portEXIT_CRITICAL(&memory_monitor_lock);
+}
+
+void MemoryMonitor::Sample(MemorySnapshot* snapshot)
+{
+  snapshot->freeHeap = ESP.getFreeHeap();
+  snapshot->minFreeHeap = ESP.getMinFreeHeap();
+  snapshot->largestFreeHeapBlock = ESP.getMaxAllocHeap();
+  snapshot->freePsram = ESP.getFreePsram();
+  snapshot->minFreePsram = ESP.getMinFreePsram();
+  snapshot->largestFreePsramBlock = ESP.getMaxAllocPsram();
+
+  snapshot->taskCount = 0;
+  for (size_t i = 0; i < this->taskCount; i++)
+  {
+    TaskHandle_t task = xTaskGetHandle(this->taskNames[i]);
+
+    if (task != NULL)
+    {
+      MemoryTaskStats* taskStats = &snapshot->tasks[snapshot->taskCount++];
+      taskStats->name = this->taskNames[i];
+      // On the ESP32 port the stack type is one byte wide, so this is already in bytes.
+      taskStats->stackHighWaterMark = uxTaskGetStackHighWaterMark(task);
+    }
+  }
+
+  portENTER_CRITICAL(&memory_monitor_lock);
+  memcpy(snapshot->subsystems, this->subsystems, sizeof(this->subsystems));
+  portEXIT_CRITICAL(&memory_monitor_lock);
+}
+
+void MemoryMonitor::ToJson(JsonDocument& document)
+{
+  MemorySnapshot snapshot;
+  this->Sample(&snapshot);
+
+  JsonObject heap = document["heap"].to<JsonObject>();
+  heap["free"] = snapshot.freeHeap;
+  heap["minFree"] = snapshot.minFreeHeap;
+  heap["largestBlock"] = snapshot.largestFreeHeapBlock;
+
+  JsonObject psram = document["psram"].to<JsonObject>();
+  psram["free"] = snapshot.freePsram;
+  psram["minFree"] = snapshot.minFreePsram;
+  psram["largestBlock"] = snapshot.largestFreePsramBlock;
+
+  JsonObject stacks = document["stackFree"].to<JsonObject>();
+  for (size_t i = 0; i < snapshot.taskCount; i++)
+  {
+    stacks[snapshot.tasks[i].name] = snapshot.tasks[i].stackHighWaterMark;
+  }
+
+  JsonObject allocations = document["alloc"].to<JsonObject>();
+  for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++)
+  {
+    JsonObject subsystem = allocations[subsystem_names[i]].to<JsonObject>();
+    subsystem["count"] = snapshot.subsystems[i].allocations;
+    subsystem["freed"] = snapshot.subsystems[i].releases;
+    subsystem["inUse"] = snapshot.subsystems[i].bytesInUse;
+    subsystem["peak"] = snapshot.subsystems[i].peakBytesInUse;
+  }
+}
+
+void MemoryMonitor::Dump()
+{
+  MemorySnapshot snapshot;
+  this->Sample(&snapshot);
+
+  Logger.Info(
+      "Heap free " + String(snapshot.freeHeap) + ", min free " + String(snapshot.minFreeHeap)
+      + ", largest block " + String(snapshot.largestFreeHeapBlock));
+  Logger.Info(
+      "PSRAM free " + String(snapshot.freePsram) + ", min free " + String(snapshot.minFreePsram)
+      + ", largest block " + String(snapshot.largestFreePsramBlock));
+
+  for (size_t i = 0; i < snapshot.taskCount; i++)
+  {
+    Logger.Info(
+        "Task " + String(snapshot.tasks[i].name) + " stack high-water mark "
+        + String(snapshot.tasks[i].stackHighWaterMark) + " bytes");
+  }
+
+  for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++)
+  {
+    Logger.Info(
+        "Alloc " + String(subsystem_names[i]) + ": " + String(snapshot.subsystems[i].allocations)
+        + " allocated, " + String(snapshot.subsystems[i].releases) + " freed, "
+        + String(snapshot.subsystems[i].bytesInUse) + " bytes in use (peak "
+        + String(snapshot.subsystems[i].peakBytesInUse) + ")");
+  }
+}
+
+MemoryMonitor MemoryStats;
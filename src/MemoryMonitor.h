@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MEMORYMONITOR_H
+#define MEMORYMONITOR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#ifndef MEMORY_MONITOR_MAX_TASKS
+#define MEMORY_MONITOR_MAX_TASKS 6
+#endif
+
+// Subsystems whose allocations are counted separately.
+enum MemorySubsystem
+{
+  MEMORY_SUBSYSTEM_JSON = 0,
+  MEMORY_SUBSYSTEM_MQTT_OUTBOX,
+  MEMORY_SUBSYSTEM_PAYLOAD,
+  MEMORY_SUBSYSTEM_COUNT
+};
+
+struct MemorySubsystemStats
+{
+  uint32_t allocations;
+  uint32_t releases;
+  uint32_t bytesInUse;
+  uint32_t peakBytesInUse;
+};
+
+struct MemoryTaskStats
+{
+  const char* name;
+  uint32_t stackHighWaterMark; // Minimum free stack ever seen, in bytes.
+};
+
+struct MemorySnapshot
+{
+  uint32_t freeHeap;
+  uint32_t minFreeHeap;
+  uint32_t largestFreeHeapBlock;
+  uint32_t freePsram;
+  uint32_t minFreePsram;
+  uint32_t largestFreePsramBlock;
+  MemoryTaskStats tasks[MEMORY_MONITOR_MAX_TASKS];
+  size_t taskCount;
+  MemorySubsystemStats subsystems[MEMORY_SUBSYSTEM_COUNT];
+};
+
+class MemoryMonitor
+{
+public:
+  MemoryMonitor();
+
+  /*
+   * @brief Adds a FreeRTOS task, by name, to the stack high-water report.
+   *        The handle is looked up on every sample, so tasks that are recreated
+   *        (e.g. the esp-mqtt task after a reconnect) are still tracked.
+   */
+  bool WatchTask(const char* taskName);
+
+  void CountAllocation(MemorySubsystem subsystem, size_t size);
+  void CountRelease(MemorySubsystem subsystem, size_t size);
+
+  // For subsystems that own their memory (e.g. the esp-mqtt outbox) and only expose a size.
+  void SetBytesInUse(MemorySubsystem subsystem, size_t size);
+
+  void Sample(MemorySnapshot* snapshot);
+  void ToJson(JsonDocument& document);
+  void Dump();
+
+private:
+  const char* taskNames[MEMORY_MONITOR_MAX_TASKS];
+  size_t taskCount;
+  MemorySubsystemStats subsystems[MEMORY_SUBSYSTEM_COUNT];
+};
+
+extern MemoryMonitor MemoryStats;
+
+#endif // MEMORYMONITOR_H
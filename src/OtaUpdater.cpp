@@ -0,0 +1,344 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "OtaUpdater.h"
+#include "SerialLogger.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <string.h>
+
+#define OTA_NAMESPACE "ota"
+#define OTA_NOT_ON_TRIAL 0xFF
+
+// Chunk size used to read back a partially written image when rebuilding its hash.
+#define OTA_READ_BACK_SIZE 512
+
+static const char* const state_names[] = { "idle", "receiving", "ready", "failed" };
+
+// Keeps the Arduino core from marking a freshly booted image valid before Confirm().
+bool verifyRollbackLater() { return true; }
+
+OtaUpdater::OtaUpdater()
+{
+  this->partition = NULL;
+  mbedtls_sha256_init(&this->sha);
+  memset(this->digest, 0, sizeof(this->digest));
+  this->size = 0;
+  this->offset = 0;
+  this->erasedOffset = 0;
+  this->savedOffset = 0;
+  this->state = OTA_STATE_IDLE;
+  this->trialBoot = false;
+}
+
+void OtaUpdater::Begin()
+{
+  Preferences preferences;
+  if (!preferences.begin(OTA_NAMESPACE, false))
+  {
+    return;
+  }
+
+  uint8_t attempts = preferences.getUChar("trial", OTA_NOT_ON_TRIAL);
+  if (attempts != OTA_NOT_ON_TRIAL)
+  {
+    if (attempts >= OTA_BOOT_ATTEMPTS)
+    {
+      preferences.remove("trial");
+      preferences.end();
+
+      // With two app slots, the next update partition is the one holding the previous image.
+      Logger.Error("New firmware never connected; restoring the previous image");
+      const esp_partition_t* previous = esp_ota_get_next_update_partition(NULL);
+      if (previous != NULL && esp_ota_set_boot_partition(previous) == ESP_OK)
+      {
+        esp_restart();
+      }
+
+      Logger.Error("Previous image is not bootable; keeping the new one");
+      return;
+    }
+
+    preferences.putUChar("trial", attempts + 1);
+    this->trialBoot = true;
+    Logger.Info("Running new firmware on trial, boot " + String(attempts + 1));
+  }
+
+  this->size = preferences.getUInt("size", 0);
+  bool has_digest
+      = preferences.getBytes("digest", this->digest, sizeof(this->digest)) == sizeof(this->digest);
+  this->savedOffset = preferences.getUInt("offset", 0);
+  preferences.end();
+
+  if (this->size > 0 && has_digest)
+  {
+    (void)this->resume();
+  }
+}
+
+bool OtaUpdater::Write(
+    uint32_t imageSize,
+    const uint8_t* digest,
+    uint32_t offset,
+    const uint8_t* data,
+    size_t length)
+{
+  if (this->state == OTA_STATE_READY)
+  {
+    return false;
+  }
+
+  bool same_image = this->state == OTA_STATE_RECEIVING && imageSize == this->size
+      && memcmp(digest, this->digest, sizeof(this->digest)) == 0;
+
+  if (!same_image && (offset != 0 || !this->start(imageSize, digest)))
+  {
+    return false;
+  }
+
+  if (offset != this->offset)
+  {
+    return false;
+  }
+
+  if (length > this->size - this->offset)
+  {
+    this->fail("Chunk runs past the end of the image");
+    return false;
+  }
+
+  while (this->erasedOffset < this->offset + length)
+  {
+    if (esp_partition_erase_range(this->partition, this->erasedOffset, SPI_FLASH_SEC_SIZE) != ESP_OK)
+    {
+      this->fail("Failed erasing flash");
+      return false;
+    }
+
+    this->erasedOffset += SPI_FLASH_SEC_SIZE;
+  }
+
+  if (esp_partition_write(this->partition, this->offset, data, length) != ESP_OK)
+  {
+    this->fail("Failed writing flash");
+    return false;
+  }
+
+  (void)mbedtls_sha256_update_ret(&this->sha, data, length);
+  this->offset += length;
+
+  if (this->offset == this->size)
+  {
+    return this->finish();
+  }
+
+  if (this->offset - this->savedOffset >= SPI_FLASH_SEC_SIZE)
+  {
+    this->saveProgress();
+  }
+
+  return true;
+}
+
+OtaState OtaUpdater::State() { return this->state; }
+
+uint32_t OtaUpdater::Offset() { return this->offset; }
+
+uint32_t OtaUpdater::Size() { return this->size; }
+
+bool OtaUpdater::IsTrialBoot() { return this->trialBoot; }
+
+void OtaUpdater::Confirm()
+{
+  if (!this->trialBoot)
+  {
+    return;
+  }
+
+  this->trialBoot = false;
+  (void)esp_ota_mark_app_valid_cancel_rollback();
+
+  Preferences preferences;
+  if (preferences.begin(OTA_NAMESPACE, false))
+  {
+    preferences.remove("trial");
+    preferences.end();
+  }
+
+  Logger.Info("New firmware confirmed");
+}
+
+void OtaUpdater::Service()
+{
+  if (this->trialBoot && millis() > OTA_CONFIRM_TIMEOUT_MILLISECS)
+  {
+    Logger.Error("New firmware has not connected to IoT Hub; restarting");
+    esp_restart();
+  }
+}
+
+bool OtaUpdater::ParseDigest(const char* hex, size_t length, uint8_t* digest)
+{
+  if (hex == NULL || length != OTA_DIGEST_SIZE * 2)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < length; i++)
+  {
+    char c = hex[i];
+    uint8_t nibble = (c >= '0' && c <= '9') ? c - '0'
+        : (c >= 'a' && c <= 'f')            ? c - 'a' + 10
+        : (c >= 'A' && c <= 'F')            ? c - 'A' + 10
+                                            : 0xFF;
+    if (nibble == 0xFF)
+    {
+      return false;
+    }
+
+    digest[i / 2] = (i % 2 == 0) ? (uint8_t)(nibble << 4) : (uint8_t)(digest[i / 2] | nibble);
+  }
+
+  return true;
+}
+
+bool OtaUpdater::start(uint32_t imageSize, const uint8_t* digest)
+{
+  this->partition = esp_ota_get_next_update_partition(NULL);
+  if (this->partition == NULL || imageSize == 0 || imageSize > this->partition->size)
+  {
+    this->fail("Firmware image does not fit the update partition");
+    return false;
+  }
+
+  mbedtls_sha256_free(&this->sha);
+  mbedtls_sha256_init(&this->sha);
+  (void)mbedtls_sha256_starts_ret(&this->sha, 0);
+
+  memcpy(this->digest, digest, sizeof(this->digest));
+  this->size = imageSize;
+  this->offset = 0;
+  this->erasedOffset = 0;
+  this->savedOffset = 0;
+  this->state = OTA_STATE_RECEIVING;
+
+  Preferences preferences;
+  if (preferences.begin(OTA_NAMESPACE, false))
+  {
+    preferences.putUInt("size", this->size);
+    preferences.putBytes("digest", this->digest, sizeof(this->digest));
+    preferences.putUInt("offset", 0);
+    preferences.end();
+  }
+
+  Logger.Info("Receiving firmware image of " + String(imageSize) + " bytes into " + this->partition->label);
+  return true;
+}
+
+bool OtaUpdater::resume()
+{
+  this->partition = esp_ota_get_next_update_partition(NULL);
+  if (this->partition == NULL || this->size > this->partition->size || this->savedOffset > this->size
+      || this->savedOffset % SPI_FLASH_SEC_SIZE != 0)
+  {
+    this->clearProgress();
+    return false;
+  }
+
+  mbedtls_sha256_free(&this->sha);
+  mbedtls_sha256_init(&this->sha);
+  (void)mbedtls_sha256_starts_ret(&this->sha, 0);
+
+  // The running hash is not kept across reboots; rebuild it from what is already in flash.
+  uint8_t buffer[OTA_READ_BACK_SIZE];
+  for (uint32_t position = 0; position < this->savedOffset; position += sizeof(buffer))
+  {
+    if (esp_partition_read(this->partition, position, buffer, sizeof(buffer)) != ESP_OK)
+    {
+      this->fail("Failed reading back the partial firmware image");
+      return false;
+    }
+
+    (void)mbedtls_sha256_update_ret(&this->sha, buffer, sizeof(buffer));
+  }
+
+  // The sector after the saved offset may hold a partial write; it is erased again before use.
+  this->offset = this->savedOffset;
+  this->erasedOffset = this->savedOffset;
+  this->state = OTA_STATE_RECEIVING;
+
+  Logger.Info("Resuming firmware download at " + String(this->offset) + " of " + String(this->size));
+  return true;
+}
+
+bool OtaUpdater::finish()
+{
+  uint8_t computed[OTA_DIGEST_SIZE];
+  (void)mbedtls_sha256_finish_ret(&this->sha, computed);
+
+  if (memcmp(computed, this->digest, sizeof(computed)) != 0)
+  {
+    this->fail("Firmware image digest does not match");
+    return false;
+  }
+
+  // Also validates the image header and checksums.
+  if (esp_ota_set_boot_partition(this->partition) != ESP_OK)
+  {
+    this->fail("Firmware image is not bootable");
+    return false;
+  }
+
+  this->clearProgress();
+
+  Preferences preferences;
+  if (preferences.begin(OTA_NAMESPACE, false))
+  {
+    preferences.putUChar("trial", 0);
+    preferences.end();
+  }
+
+  this->state = OTA_STATE_READY;
+  Logger.Info("Firmware image verified; it runs after the next restart");
+  return true;
+}
+
+void OtaUpdater::saveProgress()
+{
+  Preferences preferences;
+  if (!preferences.begin(OTA_NAMESPACE, false))
+  {
+    return;
+  }
+
+  this->savedOffset = this->offset - this->offset % SPI_FLASH_SEC_SIZE;
+  preferences.putUInt("offset", this->savedOffset);
+  preferences.end();
+}
+
+void OtaUpdater::clearProgress()
+{
+  Preferences preferences;
+  if (preferences.begin(OTA_NAMESPACE, false))
+  {
+    preferences.remove("size");
+    preferences.remove("digest");
+    preferences.remove("offset");
+    preferences.end();
+  }
+}
+
+void OtaUpdater::fail(const char* reason)
+{
+  Logger.Error(reason);
+  this->clearProgress();
+  this->size = 0;
+  this->offset = 0;
+  this->state = OTA_STATE_FAILED;
+}
+
+const char* OtaStateName(OtaState state) { return state_names[state]; }
+
+OtaUpdater Ota;
@@ -0,0 +1,98 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef OTAUPDATER_H
+#define OTAUPDATER_H
+
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTA_DIGEST_SIZE 32
+
+// Boots of a new image that may fail to reach IoT Hub before the previous image is restored.
+#define OTA_BOOT_ATTEMPTS 3
+#define OTA_CONFIRM_TIMEOUT_MILLISECS (5UL * 60UL * 1000UL)
+
+enum OtaState
+{
+  OTA_STATE_IDLE,
+  OTA_STATE_RECEIVING,
+  OTA_STATE_READY, // Verified and set as the boot partition; restart to run it.
+  OTA_STATE_FAILED
+};
+
+/*
+ * Streams a firmware image into the inactive app slot of the A/B partition table.
+ *
+ * Chunks are written to flash as they arrive, with sectors erased just ahead of
+ * them, while a running SHA-256 is kept; nothing larger than a chunk is buffered.
+ * Progress is saved to NVS at every sector boundary, so after a reboot the
+ * download resumes from the last completed sector (the hash is rebuilt by reading
+ * back what is already in flash). A completed image is checked against the
+ * expected digest before it is made bootable.
+ *
+ * The new image boots on trial: it must Confirm() (i.e. reach IoT Hub) within
+ * OTA_CONFIRM_TIMEOUT_MILLISECS, and after OTA_BOOT_ATTEMPTS unconfirmed boots
+ * the previous image is restored.
+ */
+class OtaUpdater
+{
+public:
+  OtaUpdater();
+
+  // Restores an interrupted download and handles a trial boot; call early in setup().
+  void Begin();
+
+  /*
+   * @brief Writes the chunk at offset of the image identified by imageSize and digest.
+   *        A chunk of a different image discards the current download, and must start at 0.
+   * @return false if the chunk was not written; Offset() is where the sender should continue.
+   */
+  bool Write(
+      uint32_t imageSize,
+      const uint8_t* digest,
+      uint32_t offset,
+      const uint8_t* data,
+      size_t length);
+
+  OtaState State();
+  uint32_t Offset();
+  uint32_t Size();
+
+  bool IsTrialBoot();
+
+  // Keeps the running image; call once it has connected to IoT Hub.
+  void Confirm();
+
+  // Restarts an unconfirmed image that has not connected in time; call from loop().
+  void Service();
+
+  // Decodes a hex SHA-256 into OTA_DIGEST_SIZE bytes.
+  static bool ParseDigest(const char* hex, size_t length, uint8_t* digest);
+
+private:
+  bool start(uint32_t imageSize, const uint8_t* digest);
+  bool resume();
+  bool finish();
+  void saveProgress();
+  void clearProgress();
+  void fail(const char* reason);
+
+  const esp_partition_t* partition;
+  mbedtls_sha256_context sha;
+  uint8_t digest[OTA_DIGEST_SIZE];
+  uint32_t size;
+  uint32_t offset;
+  uint32_t erasedOffset;
+  uint32_t savedOffset;
+  volatile OtaState state;
+  bool trialBoot;
+};
+
+const char* OtaStateName(OtaState state);
+
+extern OtaUpdater Ota;
+
+#endif // OTAUPDATER_H
@@ -0,0 +1,201 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "PsramArena.h"
+#include "MemoryMonitor.h"
+#include "SerialLogger.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Every block is prefixed with its size and kept 8-byte aligned.
+#define ARENA_BLOCK_HEADER_SIZE 8
+#define ARENA_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+static uint8_t* allocateBackingStore(size_t size)
+{
+  uint8_t* memory = (uint8_t*)ps_malloc(size);
+
+  if (memory == NULL)
+  {
+    Logger.Info("PSRAM not available; using internal heap for " + String(size) + " bytes");
+    memory = (uint8_t*)malloc(size);
+  }
+
+  return memory;
+}
+
+PsramArena::PsramArena(size_t capacity)
+{
+  this->buffer = NULL;
+  this->capacity = capacity;
+  this->offset = 0;
+  this->highWaterMark = 0;
+  this->lastBlock = NULL;
+}
+
+bool PsramArena::Begin()
+{
+  if (this->buffer == NULL)
+  {
+    this->buffer = allocateBackingStore(this->capacity);
+  }
+
+  return this->buffer != NULL;
+}
+
+void PsramArena::Reset()
+{
+  if (this->offset > 0)
+  {
+    MemoryStats.CountRelease(MEMORY_SUBSYSTEM_JSON, this->offset);
+  }
+
+  this->offset = 0;
+  this->lastBlock = NULL;
+}
+
+size_t PsramArena::Used() { return this->offset; }
+
+size_t PsramArena::HighWaterMark() { return this->highWaterMark; }
+
+void* PsramArena::allocate(size_t size)
+{
+  size_t blockSize = ARENA_BLOCK_HEADER_SIZE + ARENA_ALIGN(size);
+
+  if (this->buffer == NULL || this->offset + blockSize > this->capacity)
+  {
+    // ArduinoJson reports this through JsonDocument::overflowed().
+    return NULL;
+  }
+
+  uint8_t* block = this->buffer + this->offset;
+  *(size_t*)block = size;
+  this->lastBlock = block;
+  this->offset += blockSize;
+
+  if (this->offset > this->highWaterMark)
+  {
+    this->highWaterMark = this->offset;
+  }
+
+  MemoryStats.CountAllocation(MEMORY_SUBSYSTEM_JSON, blockSize);
+  return block + ARENA_BLOCK_HEADER_SIZE;
+}
+
+void PsramArena::deallocate(void* pointer)
+{
+  // Only the most recent block can be given back; the rest is reclaimed by Reset().
+  if (pointer != NULL && (uint8_t*)pointer - ARENA_BLOCK_HEADER_SIZE == this->lastBlock)
+  {
+    size_t blockSize = this->offset - (size_t)(this->lastBlock - this->buffer);
+    this->offset -= blockSize;
+    this->lastBlock = NULL;
+    MemoryStats.CountRelease(MEMORY_SUBSYSTEM_JSON, blockSize);
+  }
+}
+
+void* PsramArena::reallocate(void* pointer, size_t newSize)
+{
+  if (pointer == NULL)
+  {
+    return this->allocate(newSize);
+  }
+
+  uint8_t* block = (uint8_t*)pointer - ARENA_BLOCK_HEADER_SIZE;
+  size_t oldSize = *(size_t*)block;
+
+  if (block == this->lastBlock)
+  {
+    // Grow or shrink the most recent block in place.
+    size_t blockStart = (size_t)(block - this->buffer);
+    size_t newEnd = blockStart + ARENA_BLOCK_HEADER_SIZE + ARENA_ALIGN(newSize);
+
+    if (newEnd > this->capacity)
+    {
+      return NULL;
+    }
+
+    if (newEnd > this->offset)
+    {
+      MemoryStats.CountAllocation(MEMORY_SUBSYSTEM_JSON, newEnd - this->offset);
+    }
+    else
+    {
+      MemoryStats.CountRelease(MEMORY_SUBSYSTEM_JSON, this->offset - newEnd);
+    }
+
+    *(size_t*)block = newSize;
+    this->offset = newEnd;
+
+    if (this->offset > this->highWaterMark)
+    {
+      this->highWaterMark = this->offset;
+    }
+
+    return pointer;
+  }
+
+  void* moved = this->allocate(newSize);
+
+  if (moved != NULL)
+  {
+    memcpy(moved, pointer, oldSize < newSize ? oldSize : newSize);
+  }
+
+  return moved;
+}
+
+PayloadBufferPool::PayloadBufferPool()
+{
+  this->storage = NULL;
+  memset(this->inUse, 0, sizeof(this->inUse));
+}
+
+bool PayloadBufferPool::Begin()
+{
+  if (this->storage == NULL)
+  {
+    this->storage = allocateBackingStore(PAYLOAD_BUFFER_SIZE * PAYLOAD_BUFFER_COUNT);
+  }
+
+  return this->storage != NULL;
+}
+
+char* PayloadBufferPool::Acquire()
+{
+  if (this->storage == NULL)
+  {
+    return NULL;
+  }
+
+  for (int i = 0; i < PAYLOAD_BUFFER_COUNT; i++)
+  {
+    if (!this->inUse[i])
+    {
+      this->inUse[i] = true;
+      MemoryStats.CountAllocation(MEMORY_SUBSYSTEM_PAYLOAD, PAYLOAD_BUFFER_SIZE);
+      return (char*)(this->storage + i * PAYLOAD_BUFFER_SIZE);
+    }
+  }
+
+  Logger.Error("Payload buffer pool exhausted");
+  return NULL;
+}
+
+void PayloadBufferPool::Release(char* buffer)
+{
+  if (buffer == NULL)
+  {
+    return;
+  }
+
+  int i = ((uint8_t*)buffer - this->storage) / PAYLOAD_BUFFER_SIZE;
+
+  if (i >= 0 && i < PAYLOAD_BUFFER_COUNT && this->inUse[i])
+  {
+    this->inUse[i] = false;
+    MemoryStats.CountRelease(MEMORY_SUBSYSTEM_PAYLOAD, PAYLOAD_BUFFER_SIZE);
+  }
+}
+
+size_t PayloadBufferPool::BufferSize() { return PAYLOAD_BUFFER_SIZE; }
@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef PSRAMARENA_H
+#define PSRAMARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#ifndef JSON_ARENA_SIZE
+#define JSON_ARENA_SIZE (8 * 1024)
+#endif
+
+#ifndef PAYLOAD_BUFFER_SIZE
+#define PAYLOAD_BUFFER_SIZE 2048
+#endif
+
+#ifndef PAYLOAD_BUFFER_COUNT
+#define PAYLOAD_BUFFER_COUNT 2
+#endif
+
+/*
+ * Bump allocator for ArduinoJson documents.
+ *
+ * The backing store is taken once from PSRAM (falling back to the heap on boards
+ * without it) and handed out linearly; nothing is returned to the system until
+ * Reset(), which must only be called once the document using the arena is empty.
+ * This keeps per-message allocation cost constant and internal SRAM free for
+ * Wi-Fi and TLS.
+ */
+class PsramArena : public ArduinoJson::Allocator
+{
+public:
+  PsramArena(size_t capacity);
+  bool Begin();
+  void Reset();
+  size_t Used();
+  size_t HighWaterMark();
+
+  void* allocate(size_t size) override;
+  void deallocate(void* pointer) override;
+  void* reallocate(void* pointer, size_t newSize) override;
+
+private:
+  uint8_t* buffer;
+  size_t capacity;
+  size_t offset;
+  size_t highWaterMark;
+  uint8_t* lastBlock;
+};
+
+/*
+ * Fixed set of equally sized buffers for outgoing MQTT payloads.
+ * esp-mqtt copies the payload into its outbox on publish, so a buffer can be
+ * released as soon as esp_mqtt_client_publish() returns.
+ */
+class PayloadBufferPool
+{
+public:
+  PayloadBufferPool();
+  bool Begin();
+  char* Acquire();
+  void Release(char* buffer);
+  size_t BufferSize();
+
+private:
+  uint8_t* storage;
+  bool inUse[PAYLOAD_BUFFER_COUNT];
+};
+
+#endif // PSRAMARENA_H
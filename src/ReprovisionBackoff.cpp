@@ -0,0 +1,78 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "ReprovisionBackoff.h"
+
+// MQTT 3.1.1 CONNACK return codes.
+#define CONNACK_IDENTIFIER_REJECTED 2
+#define CONNACK_BAD_USER_NAME_OR_PASSWORD 4
+#define CONNACK_NOT_AUTHORIZED 5
+
+ReprovisionBackoff::ReprovisionBackoff()
+{
+  this->pending = false;
+  this->waitStartMillis = 0;
+  this->attempts = 0;
+}
+
+void ReprovisionBackoff::OnRefused(uint8_t connectReturnCode, uint32_t nowMillis)
+{
+  if (!MeansDeviceMoved(connectReturnCode) || this->pending || this->IsExhausted())
+  {
+    return;
+  }
+
+  // The backoff after an attempt runs from that attempt; the first one from the refusal.
+  if (this->attempts == 0)
+  {
+    this->waitStartMillis = nowMillis;
+  }
+
+  this->pending = true;
+}
+
+void ReprovisionBackoff::OnConnected()
+{
+  this->pending = false;
+  this->attempts = 0;
+}
+
+bool ReprovisionBackoff::IsDue(uint32_t nowMillis)
+{
+  return this->pending && !this->IsExhausted()
+      && nowMillis - this->waitStartMillis >= this->DelayMillis();
+}
+
+void ReprovisionBackoff::OnAttempt(uint32_t nowMillis)
+{
+  this->pending = false;
+  this->waitStartMillis = nowMillis;
+
+  if (this->attempts < REPROVISION_MAX_ATTEMPTS)
+  {
+    this->attempts++;
+  }
+}
+
+uint8_t ReprovisionBackoff::Attempts() { return this->attempts; }
+
+bool ReprovisionBackoff::IsExhausted() { return this->attempts >= REPROVISION_MAX_ATTEMPTS; }
+
+uint32_t ReprovisionBackoff::DelayMillis()
+{
+  uint32_t delay = REPROVISION_FIRST_DELAY_MILLISECS;
+
+  for (uint8_t i = 0; i < this->attempts && delay < REPROVISION_MAX_DELAY_MILLISECS; i++)
+  {
+    delay *= 2;
+  }
+
+  return delay < REPROVISION_MAX_DELAY_MILLISECS ? delay : REPROVISION_MAX_DELAY_MILLISECS;
+}
+
+bool ReprovisionBackoff::MeansDeviceMoved(uint8_t connectReturnCode)
+{
+  return connectReturnCode == CONNACK_IDENTIFIER_REJECTED
+      || connectReturnCode == CONNACK_BAD_USER_NAME_OR_PASSWORD
+      || connectReturnCode == CONNACK_NOT_AUTHORIZED;
+}
@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef REPROVISIONBACKOFF_H
+#define REPROVISIONBACKOFF_H
+
+#include <stdint.h>
+
+// Wait before the first DPS registration after the cached hub refuses the device; doubles per attempt.
+#ifndef REPROVISION_FIRST_DELAY_MILLISECS
+#define REPROVISION_FIRST_DELAY_MILLISECS (30UL * 1000UL)
+#endif
+
+#ifndef REPROVISION_MAX_DELAY_MILLISECS
+#define REPROVISION_MAX_DELAY_MILLISECS (60UL * 60UL * 1000UL)
+#endif
+
+// Registrations tried before giving up until the next successful connection or reboot.
+#ifndef REPROVISION_MAX_ATTEMPTS
+#define REPROVISION_MAX_ATTEMPTS 6
+#endif
+
+/*
+ * Decides when a device whose cached IoT Hub assignment is refused should ask
+ * DPS again. Only CONNACK codes that mean the hub does not know this device
+ * (identifier rejected, bad user name or password, not authorized) count;
+ * server-unavailable or protocol refusals are left to esp-mqtt's reconnects.
+ * Registrations are spaced by an exponential backoff and capped, so a device
+ * that DPS keeps assigning to the same hub does not hammer either service.
+ *
+ * OnRefused()/OnConnected() may be called from the MQTT task, the rest from loop().
+ */
+class ReprovisionBackoff
+{
+public:
+  ReprovisionBackoff();
+
+  // A CONNACK refusal (MQTT 3.1.1 return code) from the cached hub.
+  void OnRefused(uint8_t connectReturnCode, uint32_t nowMillis);
+  void OnConnected();
+
+  // True when a registration is wanted and its backoff has elapsed.
+  bool IsDue(uint32_t nowMillis);
+  // Call when the registration starts; the next one waits twice as long.
+  void OnAttempt(uint32_t nowMillis);
+
+  uint8_t Attempts();
+  bool IsExhausted();
+  uint32_t DelayMillis();
+
+  static bool MeansDeviceMoved(uint8_t connectReturnCode);
+
+private:
+  volatile bool pending;
+  volatile uint32_t waitStartMillis;
+  volatile uint8_t attempts;
+};
+
+#endif // REPROVISIONBACKOFF_H
@@ -0,0 +1,29 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "RoutineLane.h"
+
+RoutineLane::RoutineLane(uint32_t outboxLimitBytes)
+{
+  this->outboxLimitBytes = outboxLimitBytes;
+  this->dropped = 0;
+}
+
+bool RoutineLane::IsBacklogged(int outboxBytes)
+{
+  // esp_mqtt_client_get_outbox_size() is never negative, but treat it as empty if it were.
+  return outboxBytes > 0 && (uint32_t)outboxBytes > this->outboxLimitBytes;
+}
+
+bool RoutineLane::Admit(int outboxBytes)
+{
+  if (this->IsBacklogged(outboxBytes))
+  {
+    this->dropped++;
+    return false;
+  }
+
+  return true;
+}
+
+uint32_t RoutineLane::Dropped() { return this->dropped; }
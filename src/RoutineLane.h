@@ -0,0 +1,37 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef ROUTINELANE_H
+#define ROUTINELANE_H
+
+#include <stdint.h>
+
+// Outbox bytes above which routine batches are dropped instead of queueing ahead of alerts.
+#ifndef ROUTINE_OUTBOX_LIMIT_BYTES
+#define ROUTINE_OUTBOX_LIMIT_BYTES (8 * 1024)
+#endif
+
+/*
+ * Admission control for the routine publish lane. Alerts are never held back,
+ * but they join the same esp-mqtt outbox, so they wait behind whatever routine
+ * traffic is already queued. Admitting a routine message only while the outbox
+ * holds at most the limit bounds that wait to the limit plus one routine
+ * message, whatever the QoS of the routine message.
+ */
+class RoutineLane
+{
+public:
+  RoutineLane(uint32_t outboxLimitBytes);
+
+  // True when outboxBytes is over the limit; lower-priority traffic (history pages) waits.
+  bool IsBacklogged(int outboxBytes);
+  // Like !IsBacklogged(), but a refusal is counted as a dropped routine message.
+  bool Admit(int outboxBytes);
+  uint32_t Dropped();
+
+private:
+  uint32_t outboxLimitBytes;
+  uint32_t dropped;
+};
+
+#endif // ROUTINELANE_H
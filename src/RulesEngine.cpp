@@ -0,0 +1,619 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "RulesEngine.h"
+#include <string.h>
+
+#define RULE_VALUE_SCALE 1000
+#define MILLIS_PER_MINUTE 60000
+
+static_assert(RULE_CODE_SIZE <= UINT8_MAX, "code length is stored in a byte");
+
+enum RuleOpcode
+{
+  RULE_OP_PUSH = 1, // int32 immediate, little-endian
+  RULE_OP_LOAD, // channel index
+  RULE_OP_RATE, // channel index
+  RULE_OP_ADD,
+  RULE_OP_SUB,
+  RULE_OP_MUL,
+  RULE_OP_DIV,
+  RULE_OP_NEG,
+  RULE_OP_GT,
+  RULE_OP_GE,
+  RULE_OP_LT,
+  RULE_OP_LE,
+  RULE_OP_EQ,
+  RULE_OP_NE,
+  RULE_OP_AND,
+  RULE_OP_OR
+};
+
+static const int32_t decimal_scale[] = { 1, 10, 100, 1000 };
+
+static int32_t clampToInt32(int64_t value)
+{
+  return value > INT32_MAX ? INT32_MAX : value < INT32_MIN ? INT32_MIN : (int32_t)value;
+}
+
+// Converts a channel value to rule units.
+static int32_t channelToRuleValue(SensorChannel channel, int16_t value)
+{
+  return (int32_t)value * decimal_scale[RULE_VALUE_DECIMALS - SensorSchema[channel].decimals];
+}
+
+/*
+ * Recursive-descent compiler from the infix rule text to bytecode. The first
+ * error stops compilation; its message is kept in `error`.
+ */
+struct RuleCompiler
+{
+  const char* text;
+  uint8_t* code;
+  uint8_t length;
+  int depth;
+  const char* error;
+
+  void fail(const char* message)
+  {
+    if (this->error == NULL)
+    {
+      this->error = message;
+    }
+  }
+
+  void skipSpaces()
+  {
+    while (*this->text == ' ' || *this->text == '\t')
+    {
+      this->text++;
+    }
+  }
+
+  bool match(const char* token)
+  {
+    size_t length = strlen(token);
+    this->skipSpaces();
+
+    if (strncmp(this->text, token, length) != 0)
+    {
+      return false;
+    }
+
+    this->text += length;
+    return true;
+  }
+
+  // Matches a whole identifier, not a prefix of a longer one.
+  bool matchWord(const char* word)
+  {
+    const char* start = this->text;
+    size_t length = strlen(word);
+    this->skipSpaces();
+
+    if (strncmp(this->text, word, length) == 0 && !isIdentifier(this->text[length]))
+    {
+      this->text += length;
+      return true;
+    }
+
+    this->text = start;
+    return false;
+  }
+
+  static bool isIdentifier(char c)
+  {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+  }
+
+  static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+  void emit(uint8_t byte)
+  {
+    if (this->length >= RULE_CODE_SIZE)
+    {
+      this->fail("rule too long");
+      return;
+    }
+
+    this->code[this->length++] = byte;
+  }
+
+  // Tracks the stack depth the bytecode will reach at run time.
+  void push()
+  {
+    if (++this->depth > RULE_STACK_DEPTH)
+    {
+      this->fail("expression too deep");
+    }
+  }
+
+  void emitValue(int32_t value)
+  {
+    this->emit(RULE_OP_PUSH);
+    for (int i = 0; i < 4; i++)
+    {
+      this->emit((uint8_t)((uint32_t)value >> (8 * i)));
+    }
+    this->push();
+  }
+
+  void emitBinary(uint8_t opcode)
+  {
+    this->emit(opcode);
+    this->depth--;
+  }
+
+  bool parseNumber(int32_t* value)
+  {
+    int64_t result = 0;
+    int decimals = 0;
+    bool fraction = false;
+
+    this->skipSpaces();
+    if (!isDigit(*this->text))
+    {
+      return false;
+    }
+
+    for (; isDigit(*this->text) || (*this->text == '.' && !fraction); this->text++)
+    {
+      if (*this->text == '.')
+      {
+        fraction = true;
+      }
+      else if (!fraction || decimals++ < RULE_VALUE_DECIMALS)
+      {
+        result = result * 10 + (*this->text - '0');
+        if (result > INT32_MAX)
+        {
+          this->fail("number out of range");
+          return false;
+        }
+      }
+    }
+
+    for (; decimals < RULE_VALUE_DECIMALS; decimals++)
+    {
+      result *= 10;
+    }
+
+    *value = clampToInt32(result);
+    return true;
+  }
+
+  int parseChannel()
+  {
+    char name[RULE_NAME_SIZE];
+    size_t length = 0;
+
+    this->skipSpaces();
+    while (isIdentifier(*this->text) && length < sizeof(name) - 1)
+    {
+      name[length++] = *this->text++;
+    }
+    name[length] = '\0';
+
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++)
+    {
+      if (strcmp(name, SensorSchema[i].name) == 0)
+      {
+        return i;
+      }
+    }
+
+    this->fail("unknown channel");
+    return -1;
+  }
+
+  void parsePrimary()
+  {
+    int32_t value;
+
+    if (this->match("("))
+    {
+      this->parseOr();
+      if (!this->match(")"))
+      {
+        this->fail("missing )");
+      }
+    }
+    else if (this->parseNumber(&value))
+    {
+      this->emitValue(value);
+    }
+    else if (this->matchWord("rate"))
+    {
+      if (!this->match("("))
+      {
+        this->fail("expected ( after rate");
+        return;
+      }
+
+      int channel = this->parseChannel();
+      this->emit(RULE_OP_RATE);
+      this->emit((uint8_t)channel);
+      this->push();
+
+      if (!this->match(")"))
+      {
+        this->fail("missing )");
+      }
+    }
+    else
+    {
+      this->skipSpaces();
+      if (!isIdentifier(*this->text))
+      {
+        this->fail("expected a value");
+        return;
+      }
+
+      int channel = this->parseChannel();
+      this->emit(RULE_OP_LOAD);
+      this->emit((uint8_t)channel);
+      this->push();
+    }
+  }
+
+  void parseUnary()
+  {
+    if (this->match("-"))
+    {
+      this->parseUnary();
+      this->emit(RULE_OP_NEG);
+    }
+    else
+    {
+      this->parsePrimary();
+    }
+  }
+
+  void parseTerm()
+  {
+    this->parseUnary();
+
+    while (this->error == NULL)
+    {
+      if (this->match("*"))
+      {
+        this->parseUnary();
+        this->emitBinary(RULE_OP_MUL);
+      }
+      else if (this->match("/"))
+      {
+        this->parseUnary();
+        this->emitBinary(RULE_OP_DIV);
+      }
+      else
+      {
+        break;
+      }
+    }
+  }
+
+  void parseSum()
+  {
+    this->parseTerm();
+
+    while (this->error == NULL)
+    {
+      if (this->match("+"))
+      {
+        this->parseTerm();
+        this->emitBinary(RULE_OP_ADD);
+      }
+      else if (this->match("-"))
+      {
+        this->parseTerm();
+        this->emitBinary(RULE_OP_SUB);
+      }
+      else
+      {
+        break;
+      }
+    }
+  }
+
+  void parseComparison()
+  {
+    static const struct
+    {
+      const char* token;
+      uint8_t opcode;
+    } comparisons[] = {
+      { ">=", RULE_OP_GE }, { "<=", RULE_OP_LE }, { "==", RULE_OP_EQ },
+      { "!=", RULE_OP_NE }, { ">", RULE_OP_GT },  { "<", RULE_OP_LT },
+    };
+
+    this->parseSum();
+
+    for (size_t i = 0; i < sizeof(comparisons) / sizeof(comparisons[0]); i++)
+    {
+      if (this->match(comparisons[i].token))
+      {
+        this->parseSum();
+        this->emitBinary(comparisons[i].opcode);
+        break;
+      }
+    }
+  }
+
+  void parseAnd()
+  {
+    this->parseComparison();
+
+    while (this->error == NULL && this->match("&&"))
+    {
+      this->parseComparison();
+      this->emitBinary(RULE_OP_AND);
+    }
+  }
+
+  void parseOr()
+  {
+    this->parseAnd();
+
+    while (this->error == NULL && this->match("||"))
+    {
+      this->parseAnd();
+      this->emitBinary(RULE_OP_OR);
+    }
+  }
+};
+
+RulesEngine::RulesEngine()
+{
+  this->Clear();
+  this->previous.Invalidate();
+  this->previousMillis = 0;
+  this->hasPrevious = false;
+}
+
+void RulesEngine::Clear() { this->count = 0; }
+
+size_t RulesEngine::Count() { return this->count; }
+
+const char* RulesEngine::Name(size_t rule) { return this->rules[rule].name; }
+
+bool RulesEngine::IsActive(size_t rule) { return this->rules[rule].active; }
+
+const char* RulesEngine::Add(const char* name, const char* expression, uint8_t forSamples)
+{
+  if (this->count >= RULES_MAX)
+  {
+    return "too many rules";
+  }
+
+  if (name == NULL || expression == NULL || strlen(name) >= RULE_NAME_SIZE)
+  {
+    return "invalid rule name";
+  }
+
+  CompiledRule& rule = this->rules[this->count];
+  RuleCompiler compiler;
+  compiler.text = expression;
+  compiler.code = rule.code;
+  compiler.length = 0;
+  compiler.depth = 0;
+  compiler.error = NULL;
+
+  compiler.parseOr();
+
+  // Optional "for N [samples]" suffix, e.g. "temperature > 30 for 3 samples".
+  if (compiler.error == NULL && compiler.matchWord("for"))
+  {
+    int32_t samples;
+    if (!compiler.parseNumber(&samples) || samples < RULE_VALUE_SCALE
+        || samples > UINT8_MAX * RULE_VALUE_SCALE)
+    {
+      compiler.fail("invalid sample count");
+    }
+    else
+    {
+      forSamples = (uint8_t)(samples / RULE_VALUE_SCALE);
+      (void)(compiler.matchWord("samples") || compiler.matchWord("sample"));
+    }
+  }
+
+  compiler.skipSpaces();
+  if (compiler.error == NULL && *compiler.text != '\0')
+  {
+    compiler.fail("unexpected text");
+  }
+
+  if (compiler.error != NULL)
+  {
+    return compiler.error;
+  }
+
+  strcpy(rule.name, name);
+  rule.codeLength = compiler.length;
+  rule.forSamples = forSamples > 0 ? forSamples : 1;
+  rule.streak = 0;
+  rule.active = false;
+  this->count++;
+  return NULL;
+}
+
+bool RulesEngine::run(const CompiledRule& rule, const SensorSample& sample, uint32_t elapsedMillis)
+{
+  int32_t stack[RULE_STACK_DEPTH];
+  int sp = 0;
+  bool invalid = false;
+  uint8_t pc = 0;
+
+  while (pc < rule.codeLength)
+  {
+    uint8_t opcode = rule.code[pc++];
+
+    if (opcode == RULE_OP_PUSH)
+    {
+      uint32_t value = 0;
+      for (int i = 0; i < 4; i++)
+      {
+        value |= (uint32_t)rule.code[pc++] << (8 * i);
+      }
+      stack[sp++] = (int32_t)value;
+    }
+    else if (opcode == RULE_OP_LOAD || opcode == RULE_OP_RATE)
+    {
+      SensorChannel channel = (SensorChannel)rule.code[pc++];
+      int32_t value = 0;
+
+      if (!sample.IsValid(channel)
+          || (opcode == RULE_OP_RATE
+              && (!this->hasPrevious || !this->previous.IsValid(channel) || elapsedMillis == 0)))
+      {
+        invalid = true;
+      }
+      else if (opcode == RULE_OP_LOAD)
+      {
+        value = channelToRuleValue(channel, sample.value[channel]);
+      }
+      else
+      {
+        int64_t delta = channelToRuleValue(channel, sample.value[channel])
+            - channelToRuleValue(channel, this->previous.value[channel]);
+        value = clampToInt32(delta * MILLIS_PER_MINUTE / (int64_t)elapsedMillis);
+      }
+
+      stack[sp++] = value;
+    }
+    else if (opcode == RULE_OP_NEG)
+    {
+      stack[sp - 1] = clampToInt32(-(int64_t)stack[sp - 1]);
+    }
+    else
+    {
+      int64_t b = stack[--sp];
+      int64_t a = stack[sp - 1];
+      int64_t result;
+
+      switch (opcode)
+      {
+      case RULE_OP_ADD:
+        result = a + b;
+        break;
+      case RULE_OP_SUB:
+        result = a - b;
+        break;
+      case RULE_OP_MUL:
+        result = a * b / RULE_VALUE_SCALE;
+        break;
+      case RULE_OP_DIV:
+        invalid = invalid || b == 0;
+        result = b == 0 ? 0 : a * RULE_VALUE_SCALE / b;
+        break;
+      case RULE_OP_GT:
+        result = a > b;
+        break;
+      case RULE_OP_GE:
+        result = a >= b;
+        break;
+      case RULE_OP_LT:
+        result = a < b;
+        break;
+      case RULE_OP_LE:
+        result = a <= b;
+        break;
+      case RULE_OP_EQ:
+        result = a == b;
+        break;
+      case RULE_OP_NE:
+        result = a != b;
+        break;
+      case RULE_OP_AND:
+        result = a != 0 && b != 0;
+        break;
+      case RULE_OP_OR:
+        result = a != 0 || b != 0;
+        break;
+      default:
+        return false;
+      }
+
+      stack[sp - 1] = clampToInt32(result);
+    }
+  }
+
+  return !invalid && sp == 1 && stack[0] != 0;
+}
+
+size_t RulesEngine::Evaluate(const SensorSample& sample, uint32_t timeMillis, RuleHit* hits)
+{
+  size_t hit_count = 0;
+  uint32_t elapsed = timeMillis - this->previousMillis;
+
+  for (size_t i = 0; i < this->count; i++)
+  {
+    CompiledRule& rule = this->rules[i];
+
+    if (this->run(rule, sample, elapsed))
+    {
+      if (rule.streak < UINT8_MAX)
+      {
+        rule.streak++;
+      }
+
+      if (!rule.active && rule.streak >= rule.forSamples)
+      {
+        rule.active = true;
+        hits[hit_count].rule = (uint8_t)i;
+        hits[hit_count].active = true;
+        hit_count++;
+      }
+    }
+    else
+    {
+      rule.streak = 0;
+
+      if (rule.active)
+      {
+        rule.active = false;
+        hits[hit_count].rule = (uint8_t)i;
+        hits[hit_count].active = false;
+        hit_count++;
+      }
+    }
+  }
+
+  this->previous = sample;
+  this->previousMillis = timeMillis;
+  this->hasPrevious = true;
+  return hit_count;
+}
+
+size_t RulesEngine::CarryOver(const RulesEngine& current, RuleHit* cleared)
+{
+  size_t cleared_count = 0;
+
+  for (size_t i = 0; i < current.count; i++)
+  {
+    const CompiledRule& old_rule = current.rules[i];
+    bool kept = false;
+
+    for (size_t j = 0; j < this->count; j++)
+    {
+      if (strcmp(this->rules[j].name, old_rule.name) == 0)
+      {
+        this->rules[j].streak = old_rule.streak;
+        this->rules[j].active = old_rule.active;
+        kept = true;
+        break;
+      }
+    }
+
+    if (!kept && old_rule.active)
+    {
+      cleared[cleared_count].rule = (uint8_t)i;
+      cleared[cleared_count].active = false;
+      cleared_count++;
+    }
+  }
+
+  this->previous = current.previous;
+  this->previousMillis = current.previousMillis;
+  this->hasPrevious = current.hasPrevious;
+  return cleared_count;
+}
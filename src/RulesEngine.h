@@ -0,0 +1,95 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef RULESENGINE_H
+#define RULESENGINE_H
+
+#include "SensorSample.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef RULES_MAX
+#define RULES_MAX 8
+#endif
+
+#define RULE_NAME_SIZE 16
+#define RULE_CODE_SIZE 48
+#define RULE_STACK_DEPTH 8
+
+// Rule arithmetic is fixed-point with three decimals (30.5 is 30500).
+#define RULE_VALUE_DECIMALS 3
+
+// A rule that changed state during Evaluate().
+struct RuleHit
+{
+  uint8_t rule;
+  bool active;
+};
+
+/*
+ * Edge rules evaluated against every sample.
+ *
+ * A rule is an infix expression over the sensor channels, compiled once into a
+ * small stack bytecode and interpreted with a fixed stack, e.g.
+ *   temperature > 30
+ *   rate(humidity) > 5 && temperature >= 25.5
+ * Channels are referenced by their telemetry key; rate(<channel>) is the change
+ * per minute since the previous sample. Supported operators, by precedence:
+ * || && (comparisons) + - * / and unary -. An expression over a failed reading
+ * is false.
+ *
+ * A rule becomes active once its expression has held for forSamples consecutive
+ * samples and clears on the first sample where it does not; only these
+ * transitions are reported.
+ */
+class RulesEngine
+{
+public:
+  RulesEngine();
+  void Clear();
+
+  /*
+   * @brief Compiles a rule and appends it.
+   * @return NULL on success, otherwise a description of the error.
+   */
+  const char* Add(const char* name, const char* expression, uint8_t forSamples);
+
+  size_t Count();
+  const char* Name(size_t rule);
+  bool IsActive(size_t rule);
+
+  /*
+   * @brief Evaluates every rule against a sample taken at timeMillis.
+   * @return Number of state changes written to hits (at most RULES_MAX).
+   */
+  size_t Evaluate(const SensorSample& sample, uint32_t timeMillis, RuleHit* hits);
+
+  /*
+   * @brief Before this set replaces current: rules that keep their name take over their state
+   *        there, and rate() continues from current's last sample.
+   * @return Number of rules of current that are active and not in this set, written to cleared
+   *         (indices into current) so they can be reported as cleared.
+   */
+  size_t CarryOver(const RulesEngine& current, RuleHit* cleared);
+
+private:
+  struct CompiledRule
+  {
+    char name[RULE_NAME_SIZE];
+    uint8_t code[RULE_CODE_SIZE];
+    uint8_t codeLength;
+    uint8_t forSamples;
+    uint8_t streak;
+    bool active;
+  };
+
+  bool run(const CompiledRule& rule, const SensorSample& sample, uint32_t elapsedMillis);
+
+  CompiledRule rules[RULES_MAX];
+  size_t count;
+  SensorSample previous;
+  uint32_t previousMillis;
+  bool hasPrevious;
+};
+
+#endif // RULESENGINE_H
@@ -0,0 +1,498 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "SchemaCodec.h"
+#include "SensorSample.h"
+
+// CBOR tag 4: decimal fraction [exponent, mantissa] (RFC 8949, section 3.4.4).
+#define CBOR_TAG_DECIMAL_FRACTION 4
+
+SchemaWriter::SchemaWriter(uint8_t* buffer, size_t size)
+{
+  this->buffer = buffer;
+  this->size = size;
+  this->length = 0;
+  this->overflowed = false;
+}
+
+void SchemaWriter::Put(uint8_t byte)
+{
+  if (this->length < this->size)
+  {
+    this->buffer[this->length++] = byte;
+  }
+  else
+  {
+    this->overflowed = true;
+  }
+}
+
+void SchemaWriter::Put(const void* data, size_t length)
+{
+  if (length > this->size - this->length)
+  {
+    this->overflowed = true;
+    return;
+  }
+
+  memcpy(this->buffer + this->length, data, length);
+  this->length += length;
+}
+
+size_t SchemaWriter::Length() { return this->length; }
+
+bool SchemaWriter::Overflowed() { return this->overflowed; }
+
+SchemaReader::SchemaReader(const uint8_t* data, size_t length)
+{
+  this->data = data;
+  this->length = length;
+  this->position = 0;
+}
+
+bool SchemaReader::AtEnd() { return this->position >= this->length; }
+
+bool SchemaReader::Peek(uint8_t* byte)
+{
+  if (this->AtEnd())
+  {
+    return false;
+  }
+
+  *byte = this->data[this->position];
+  return true;
+}
+
+bool SchemaReader::Get(uint8_t* byte)
+{
+  if (!this->Peek(byte))
+  {
+    return false;
+  }
+
+  this->position++;
+  return true;
+}
+
+bool SchemaReader::Match(const void* data, size_t length)
+{
+  if (length > this->length - this->position
+      || memcmp(this->data + this->position, data, length) != 0)
+  {
+    return false;
+  }
+
+  this->position += length;
+  return true;
+}
+
+size_t SchemaReader::Position() { return this->position; }
+
+void SchemaReader::Rewind(size_t position) { this->position = position; }
+
+void SchemaJsonWriteUInt(SchemaWriter& writer, uint32_t value)
+{
+  char digits[10];
+  size_t count = 0;
+
+  do
+  {
+    digits[count++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+
+  while (count > 0)
+  {
+    writer.Put((uint8_t)digits[--count]);
+  }
+}
+
+void SchemaJsonWriteFixed(SchemaWriter& writer, int16_t value, uint8_t decimals)
+{
+  char text[SENSOR_VALUE_TEXT_SIZE];
+  size_t length = FormatFixedPoint(value, decimals, text, sizeof(text));
+
+  if (length == 0)
+  {
+    writer.Put(text, sizeof(text)); // Cannot fit; marks the writer overflowed.
+    return;
+  }
+
+  writer.Put(text, length);
+}
+
+void SchemaJsonWriteText(SchemaWriter& writer, const char* text)
+{
+  writer.Put('"');
+
+  for (; *text != '\0'; text++)
+  {
+    uint8_t c = (uint8_t)*text;
+
+    if (c == '"' || c == '\\')
+    {
+      writer.Put('\\');
+      writer.Put(c);
+    }
+    else if (c < 0x20)
+    {
+      static const char hex_digits[] = "0123456789abcdef";
+      writer.Put("\\u00", 4);
+      writer.Put((uint8_t)hex_digits[c >> 4]);
+      writer.Put((uint8_t)hex_digits[c & 0x0F]);
+    }
+    else
+    {
+      writer.Put(c);
+    }
+  }
+
+  writer.Put('"');
+}
+
+bool SchemaJsonReadUInt(SchemaReader& reader, uint32_t* value)
+{
+  uint8_t c;
+  uint64_t result = 0;
+  size_t digits = 0;
+
+  while (reader.Peek(&c) && c >= '0' && c <= '9')
+  {
+    result = result * 10 + (c - '0');
+    digits++;
+
+    if (result > UINT32_MAX)
+    {
+      return false;
+    }
+
+    (void)reader.Get(&c);
+  }
+
+  *value = (uint32_t)result;
+  return digits > 0;
+}
+
+bool SchemaJsonReadFixed(SchemaReader& reader, uint8_t decimals, int16_t* value)
+{
+  uint8_t c;
+  bool negative = reader.Match("-", 1);
+  uint32_t whole;
+  int32_t result;
+  uint8_t fraction_digits = 0;
+
+  if (!SchemaJsonReadUInt(reader, &whole) || whole > INT16_MAX)
+  {
+    return false;
+  }
+
+  result = (int32_t)whole;
+
+  if (reader.Match(".", 1))
+  {
+    while (reader.Peek(&c) && c >= '0' && c <= '9')
+    {
+      if (++fraction_digits > decimals)
+      {
+        return false; // More precision than the schema carries.
+      }
+
+      result = result * 10 + (c - '0');
+      (void)reader.Get(&c);
+    }
+
+    if (fraction_digits == 0)
+    {
+      return false;
+    }
+  }
+
+  for (; fraction_digits < decimals; fraction_digits++)
+  {
+    result *= 10;
+  }
+
+  // SCHEMA_FIXED16_ABSENT is never written; accepting it would turn a value into "absent".
+  result = negative ? -result : result;
+  if (result <= SCHEMA_FIXED16_ABSENT || result > INT16_MAX)
+  {
+    return false;
+  }
+
+  *value = (int16_t)result;
+  return true;
+}
+
+bool SchemaJsonReadText(SchemaReader& reader, char* text, size_t size)
+{
+  uint8_t c;
+  size_t length = 0;
+
+  if (!reader.Match("\"", 1))
+  {
+    return false;
+  }
+
+  while (reader.Get(&c) && c != '"')
+  {
+    if (c == '\\')
+    {
+      uint8_t escaped;
+      if (!reader.Get(&escaped))
+      {
+        return false;
+      }
+
+      if (escaped == 'u')
+      {
+        // Only the \u00XX control characters written by SchemaJsonWriteText().
+        uint8_t hex[4];
+        uint8_t decoded = 0;
+
+        for (int i = 0; i < 4; i++)
+        {
+          if (!reader.Get(&hex[i]))
+          {
+            return false;
+          }
+        }
+
+        if (hex[0] != '0' || hex[1] != '0')
+        {
+          return false;
+        }
+
+        for (int i = 2; i < 4; i++)
+        {
+          uint8_t h = hex[i];
+          uint8_t nibble = (h >= '0' && h <= '9') ? h - '0'
+              : (h >= 'a' && h <= 'f')            ? h - 'a' + 10
+              : (h >= 'A' && h <= 'F')            ? h - 'A' + 10
+                                                  : 0xFF;
+          if (nibble == 0xFF)
+          {
+            return false;
+          }
+
+          decoded = (uint8_t)(decoded << 4 | nibble);
+        }
+
+        if (decoded == 0)
+        {
+          return false; // Would end the string early.
+        }
+
+        c = decoded;
+      }
+      else
+      {
+        c = escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped == 'r' ? '\r' : escaped;
+      }
+    }
+
+    if (length + 1 >= size)
+    {
+      return false;
+    }
+
+    text[length++] = (char)c;
+  }
+
+  if (c != '"')
+  {
+    return false;
+  }
+
+  text[length] = '\0';
+  return true;
+}
+
+void SchemaCborWriteHead(SchemaWriter& writer, uint8_t major, uint32_t value)
+{
+  uint8_t initial = (uint8_t)(major << 5);
+
+  if (value < 24)
+  {
+    writer.Put((uint8_t)(initial | value));
+  }
+  else if (value <= UINT8_MAX)
+  {
+    writer.Put((uint8_t)(initial | 24));
+    writer.Put((uint8_t)value);
+  }
+  else if (value <= UINT16_MAX)
+  {
+    writer.Put((uint8_t)(initial | 25));
+    writer.Put((uint8_t)(value >> 8));
+    writer.Put((uint8_t)value);
+  }
+  else
+  {
+    writer.Put((uint8_t)(initial | 26));
+    writer.Put((uint8_t)(value >> 24));
+    writer.Put((uint8_t)(value >> 16));
+    writer.Put((uint8_t)(value >> 8));
+    writer.Put((uint8_t)value);
+  }
+}
+
+static void cborWriteInt(SchemaWriter& writer, int32_t value)
+{
+  if (value >= 0)
+  {
+    SchemaCborWriteHead(writer, CBOR_MAJOR_UNSIGNED, (uint32_t)value);
+  }
+  else
+  {
+    SchemaCborWriteHead(writer, CBOR_MAJOR_NEGATIVE, (uint32_t)(-1 - value));
+  }
+}
+
+static bool cborReadInt(SchemaReader& reader, int32_t* value)
+{
+  uint8_t major;
+  uint32_t argument;
+
+  if (!SchemaCborReadHead(reader, &major, &argument) || argument > INT32_MAX)
+  {
+    return false;
+  }
+
+  if (major == CBOR_MAJOR_UNSIGNED)
+  {
+    *value = (int32_t)argument;
+    return true;
+  }
+
+  if (major == CBOR_MAJOR_NEGATIVE)
+  {
+    *value = -1 - (int32_t)argument;
+    return true;
+  }
+
+  return false;
+}
+
+void SchemaCborWriteFixed(SchemaWriter& writer, int16_t value, uint8_t decimals)
+{
+  if (decimals > 0)
+  {
+    SchemaCborWriteHead(writer, CBOR_MAJOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+    SchemaCborWriteHead(writer, CBOR_MAJOR_ARRAY, 2);
+    cborWriteInt(writer, -(int32_t)decimals);
+  }
+
+  cborWriteInt(writer, value);
+}
+
+void SchemaCborWriteText(SchemaWriter& writer, const char* text, size_t length)
+{
+  SchemaCborWriteHead(writer, CBOR_MAJOR_TEXT, (uint32_t)length);
+  writer.Put(text, length);
+}
+
+bool SchemaCborReadHead(SchemaReader& reader, uint8_t* major, uint32_t* value)
+{
+  uint8_t initial;
+  uint8_t byte;
+  uint8_t extra;
+
+  if (!reader.Get(&initial))
+  {
+    return false;
+  }
+
+  *major = initial >> 5;
+  *value = initial & 0x1F;
+
+  if (*value < 24)
+  {
+    return true;
+  }
+
+  if (*value > 26)
+  {
+    return false; // 64-bit, indefinite-length and simple values are never written.
+  }
+
+  extra = (uint8_t)(1 << (*value - 24));
+  *value = 0;
+
+  while (extra-- > 0)
+  {
+    if (!reader.Get(&byte))
+    {
+      return false;
+    }
+
+    *value = (*value << 8) | byte;
+  }
+
+  return true;
+}
+
+bool SchemaCborReadFixed(SchemaReader& reader, uint8_t decimals, int16_t* value)
+{
+  int32_t exponent;
+  int32_t mantissa;
+
+  if (decimals > 0)
+  {
+    uint8_t major;
+    uint32_t argument;
+
+    if (!SchemaCborReadHead(reader, &major, &argument) || major != CBOR_MAJOR_TAG
+        || argument != CBOR_TAG_DECIMAL_FRACTION
+        || !SchemaCborReadHead(reader, &major, &argument) || major != CBOR_MAJOR_ARRAY
+        || argument != 2 || !cborReadInt(reader, &exponent) || exponent != -(int32_t)decimals)
+    {
+      return false;
+    }
+  }
+
+  if (!cborReadInt(reader, &mantissa) || mantissa <= SCHEMA_FIXED16_ABSENT || mantissa > INT16_MAX)
+  {
+    return false;
+  }
+
+  *value = (int16_t)mantissa;
+  return true;
+}
+
+bool SchemaCborReadText(SchemaReader& reader, char* text, size_t size)
+{
+  uint8_t major;
+  uint32_t length;
+
+  if (!SchemaCborReadHead(reader, &major, &length) || major != CBOR_MAJOR_TEXT || length >= size)
+  {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < length; i++)
+  {
+    if (!reader.Get((uint8_t*)&text[i]))
+    {
+      return false;
+    }
+  }
+
+  text[length] = '\0';
+  return true;
+}
+
+bool SchemaCborMatchText(SchemaReader& reader, const char* text, size_t length)
+{
+  size_t start = reader.Position();
+  uint8_t major;
+  uint32_t argument;
+
+  if (SchemaCborReadHead(reader, &major, &argument) && major == CBOR_MAJOR_TEXT
+      && argument == length && reader.Match(text, length))
+  {
+    return true;
+  }
+
+  reader.Rewind(start);
+  return false;
+}
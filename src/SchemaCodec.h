@@ -0,0 +1,380 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef SCHEMACODEC_H
+#define SCHEMACODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Compile-time record schemas.
+ *
+ * A record is described once as a list of SchemaField types (name, value type,
+ * decimals, optional). SchemaFields<...> then expands into straight-line JSON
+ * and CBOR encoders and decoders for that record: field order is fixed, JSON
+ * keys are string literals with the quotes and colon already in place, and
+ * there is no key hashing or lookup at run time.
+ */
+
+enum SchemaType
+{
+  SCHEMA_TYPE_UINT32 = 0, // uint32_t
+  SCHEMA_TYPE_FIXED16, // int16_t scaled by 10^decimals; SCHEMA_FIXED16_ABSENT when missing
+  SCHEMA_TYPE_TEXT // char array, empty when missing
+};
+
+#define SCHEMA_FIXED16_ABSENT INT16_MIN
+
+// Bounds-checked output buffer; once something does not fit, Overflowed() stays true.
+class SchemaWriter
+{
+public:
+  SchemaWriter(uint8_t* buffer, size_t size);
+  void Put(uint8_t byte);
+  void Put(const void* data, size_t length);
+  size_t Length();
+  bool Overflowed();
+
+private:
+  uint8_t* buffer;
+  size_t size;
+  size_t length;
+  bool overflowed;
+};
+
+class SchemaReader
+{
+public:
+  SchemaReader(const uint8_t* data, size_t length);
+  bool AtEnd();
+  bool Peek(uint8_t* byte);
+  bool Get(uint8_t* byte);
+  // Consumes the bytes only if they match.
+  bool Match(const void* data, size_t length);
+  size_t Position();
+  void Rewind(size_t position);
+
+private:
+  const uint8_t* data;
+  size_t length;
+  size_t position;
+};
+
+// Primitive encoders shared by all schemas (SchemaCodec.cpp).
+void SchemaJsonWriteUInt(SchemaWriter& writer, uint32_t value);
+void SchemaJsonWriteFixed(SchemaWriter& writer, int16_t value, uint8_t decimals);
+void SchemaJsonWriteText(SchemaWriter& writer, const char* text);
+bool SchemaJsonReadUInt(SchemaReader& reader, uint32_t* value);
+bool SchemaJsonReadFixed(SchemaReader& reader, uint8_t decimals, int16_t* value);
+bool SchemaJsonReadText(SchemaReader& reader, char* text, size_t size);
+
+void SchemaCborWriteHead(SchemaWriter& writer, uint8_t major, uint32_t value);
+void SchemaCborWriteFixed(SchemaWriter& writer, int16_t value, uint8_t decimals);
+void SchemaCborWriteText(SchemaWriter& writer, const char* text, size_t length);
+bool SchemaCborReadHead(SchemaReader& reader, uint8_t* major, uint32_t* value);
+bool SchemaCborReadFixed(SchemaReader& reader, uint8_t decimals, int16_t* value);
+bool SchemaCborReadText(SchemaReader& reader, char* text, size_t size);
+bool SchemaCborMatchText(SchemaReader& reader, const char* text, size_t length);
+
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+
+// Per-type encoding, selected at compile time by SchemaField.
+template <SchemaType Type>
+struct SchemaCodec;
+
+template <>
+struct SchemaCodec<SCHEMA_TYPE_UINT32>
+{
+  static bool IsPresent(uint32_t value)
+  {
+    (void)value;
+    return true;
+  }
+  static void Clear(uint32_t& value) { value = 0; }
+  static void WriteJson(SchemaWriter& writer, uint32_t value, uint8_t decimals)
+  {
+    (void)decimals;
+    SchemaJsonWriteUInt(writer, value);
+  }
+  static bool ReadJson(SchemaReader& reader, uint32_t& value, uint8_t decimals)
+  {
+    (void)decimals;
+    return SchemaJsonReadUInt(reader, &value);
+  }
+  static void WriteCbor(SchemaWriter& writer, uint32_t value, uint8_t decimals)
+  {
+    (void)decimals;
+    SchemaCborWriteHead(writer, CBOR_MAJOR_UNSIGNED, value);
+  }
+  static bool ReadCbor(SchemaReader& reader, uint32_t& value, uint8_t decimals)
+  {
+    uint8_t major;
+    (void)decimals;
+    return SchemaCborReadHead(reader, &major, &value) && major == CBOR_MAJOR_UNSIGNED;
+  }
+};
+
+template <>
+struct SchemaCodec<SCHEMA_TYPE_FIXED16>
+{
+  static bool IsPresent(int16_t value) { return value != SCHEMA_FIXED16_ABSENT; }
+  static void Clear(int16_t& value) { value = SCHEMA_FIXED16_ABSENT; }
+  static void WriteJson(SchemaWriter& writer, int16_t value, uint8_t decimals)
+  {
+    SchemaJsonWriteFixed(writer, value, decimals);
+  }
+  static bool ReadJson(SchemaReader& reader, int16_t& value, uint8_t decimals)
+  {
+    return SchemaJsonReadFixed(reader, decimals, &value);
+  }
+  static void WriteCbor(SchemaWriter& writer, int16_t value, uint8_t decimals)
+  {
+    SchemaCborWriteFixed(writer, value, decimals);
+  }
+  static bool ReadCbor(SchemaReader& reader, int16_t& value, uint8_t decimals)
+  {
+    return SchemaCborReadFixed(reader, decimals, &value);
+  }
+};
+
+template <>
+struct SchemaCodec<SCHEMA_TYPE_TEXT>
+{
+  template <size_t Size>
+  static bool IsPresent(const char (&value)[Size])
+  {
+    return value[0] != '\0';
+  }
+  template <size_t Size>
+  static void Clear(char (&value)[Size])
+  {
+    value[0] = '\0';
+  }
+  template <size_t Size>
+  static void WriteJson(SchemaWriter& writer, const char (&value)[Size], uint8_t decimals)
+  {
+    (void)decimals;
+    SchemaJsonWriteText(writer, value);
+  }
+  template <size_t Size>
+  static bool ReadJson(SchemaReader& reader, char (&value)[Size], uint8_t decimals)
+  {
+    (void)decimals;
+    return SchemaJsonReadText(reader, value, Size);
+  }
+  template <size_t Size>
+  static void WriteCbor(SchemaWriter& writer, const char (&value)[Size], uint8_t decimals)
+  {
+    (void)decimals;
+    SchemaCborWriteText(writer, value, strnlen(value, Size));
+  }
+  template <size_t Size>
+  static bool ReadCbor(SchemaReader& reader, char (&value)[Size], uint8_t decimals)
+  {
+    (void)decimals;
+    return SchemaCborReadText(reader, value, Size);
+  }
+};
+
+/*
+ * One field of a record. Accessor (declared with SCHEMA_FIELD_ACCESSOR) supplies
+ * the key text and a reference to the value inside the record.
+ */
+template <typename Accessor, SchemaType Type, uint8_t Decimals, bool Optional>
+struct SchemaField
+{
+  typedef SchemaCodec<Type> Codec;
+
+  template <typename Record>
+  static bool IsPresent(const Record& record)
+  {
+    return !Optional || Codec::IsPresent(Accessor::Get(record));
+  }
+
+  template <typename Record>
+  static void WriteJson(SchemaWriter& writer, const Record& record)
+  {
+    writer.Put(Accessor::JsonKey(), Accessor::JsonKeyLength);
+    Codec::WriteJson(writer, Accessor::Get(record), Decimals);
+  }
+
+  template <typename Record>
+  static bool ReadJson(SchemaReader& reader, Record& record)
+  {
+    return reader.Match(Accessor::JsonKey(), Accessor::JsonKeyLength)
+        && Codec::ReadJson(reader, Accessor::Get(record), Decimals);
+  }
+
+  template <typename Record>
+  static void WriteCbor(SchemaWriter& writer, const Record& record)
+  {
+    SchemaCborWriteText(writer, Accessor::Name(), Accessor::NameLength);
+    Codec::WriteCbor(writer, Accessor::Get(record), Decimals);
+  }
+
+  template <typename Record>
+  static bool ReadCbor(SchemaReader& reader, Record& record)
+  {
+    return SchemaCborMatchText(reader, Accessor::Name(), Accessor::NameLength)
+        && Codec::ReadCbor(reader, Accessor::Get(record), Decimals);
+  }
+
+  // Marks the field absent when it is optional and missing from the input.
+  template <typename Record>
+  static bool SkipAbsent(Record& record)
+  {
+    if (!Optional)
+    {
+      return false;
+    }
+
+    Codec::Clear(Accessor::Get(record));
+    return true;
+  }
+};
+
+/*
+ * Declares NAME##Accessor for a field stored at record.MEMBER. The JSON key
+ * ("\"KEY\":") and its length are compile-time constants.
+ */
+#define SCHEMA_FIELD_ACCESSOR(NAME, RECORD, KEY, MEMBER)                         \
+  struct NAME##Accessor                                                         \
+  {                                                                             \
+    static const size_t NameLength = sizeof(KEY) - 1;                           \
+    static const size_t JsonKeyLength = sizeof("\"" KEY "\":") - 1;             \
+    static const char* Name() { return KEY; }                                   \
+    static const char* JsonKey() { return "\"" KEY "\":"; }                     \
+    static auto Get(RECORD& record) -> decltype((record.MEMBER))                \
+    {                                                                           \
+      return record.MEMBER;                                                     \
+    }                                                                           \
+    static auto Get(const RECORD& record) -> decltype((record.MEMBER))          \
+    {                                                                           \
+      return record.MEMBER;                                                     \
+    }                                                                           \
+  }
+
+// Expands a list of fields into the encoders and decoders of a record.
+template <typename... Fields>
+struct SchemaFields;
+
+template <>
+struct SchemaFields<>
+{
+  template <typename Record>
+  static size_t CountPresent(const Record& record)
+  {
+    (void)record;
+    return 0;
+  }
+
+  template <typename Record>
+  static void WriteJson(SchemaWriter& writer, const Record& record, bool first)
+  {
+    (void)writer;
+    (void)record;
+    (void)first;
+  }
+
+  template <typename Record>
+  static bool ReadJson(SchemaReader& reader, Record& record, bool first)
+  {
+    (void)reader;
+    (void)record;
+    (void)first;
+    return true;
+  }
+
+  template <typename Record>
+  static void WriteCbor(SchemaWriter& writer, const Record& record)
+  {
+    (void)writer;
+    (void)record;
+  }
+
+  template <typename Record>
+  static bool ReadCbor(SchemaReader& reader, Record& record, uint32_t entries)
+  {
+    (void)reader;
+    (void)record;
+    return entries == 0;
+  }
+};
+
+template <typename Field, typename... Rest>
+struct SchemaFields<Field, Rest...>
+{
+  template <typename Record>
+  static size_t CountPresent(const Record& record)
+  {
+    return (Field::IsPresent(record) ? 1 : 0) + SchemaFields<Rest...>::CountPresent(record);
+  }
+
+  // Writes the fields without the surrounding braces.
+  template <typename Record>
+  static void WriteJson(SchemaWriter& writer, const Record& record, bool first)
+  {
+    if (Field::IsPresent(record))
+    {
+      if (!first)
+      {
+        writer.Put(',');
+      }
+
+      Field::WriteJson(writer, record);
+      first = false;
+    }
+
+    SchemaFields<Rest...>::WriteJson(writer, record, first);
+  }
+
+  template <typename Record>
+  static bool ReadJson(SchemaReader& reader, Record& record, bool first)
+  {
+    size_t start = reader.Position();
+
+    if ((first || reader.Match(",", 1)) && Field::ReadJson(reader, record))
+    {
+      return SchemaFields<Rest...>::ReadJson(reader, record, false);
+    }
+
+    // An absent optional field: try the next one from the same place.
+    reader.Rewind(start);
+    return Field::SkipAbsent(record) && SchemaFields<Rest...>::ReadJson(reader, record, first);
+  }
+
+  // Writes the key/value pairs; the caller writes the map head from CountPresent().
+  template <typename Record>
+  static void WriteCbor(SchemaWriter& writer, const Record& record)
+  {
+    if (Field::IsPresent(record))
+    {
+      Field::WriteCbor(writer, record);
+    }
+
+    SchemaFields<Rest...>::WriteCbor(writer, record);
+  }
+
+  template <typename Record>
+  static bool ReadCbor(SchemaReader& reader, Record& record, uint32_t entries)
+  {
+    size_t start = reader.Position();
+
+    if (entries > 0 && Field::ReadCbor(reader, record))
+    {
+      return SchemaFields<Rest...>::ReadCbor(reader, record, entries - 1);
+    }
+
+    reader.Rewind(start);
+    return Field::SkipAbsent(record) && SchemaFields<Rest...>::ReadCbor(reader, record, entries);
+  }
+};
+
+#endif // SCHEMACODEC_H
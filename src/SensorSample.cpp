@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "SensorSample.h"
+
+#define SENSOR_CHANNEL_SCHEMA_ENTRY(id, key, decimals, minimum, maximum) \
+  { key, decimals, minimum, maximum },
+
+const SensorChannelSchema SensorSchema[SENSOR_CHANNEL_COUNT] = {
+  SENSOR_CHANNEL_LIST(SENSOR_CHANNEL_SCHEMA_ENTRY)
+};
+
+static const int32_t decimal_scale[] = { 1, 10, 100, 1000, 10000 };
+
+void SensorSample::Invalidate()
+{
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++)
+  {
+    this->value[i] = SENSOR_VALUE_INVALID;
+  }
+}
+
+bool SensorSample::IsValid(SensorChannel channel) const
+{
+  return this->value[channel] != SENSOR_VALUE_INVALID;
+}
+
+SensorAccumulator::SensorAccumulator() { this->Reset(); }
+
+void SensorAccumulator::Reset()
+{
+  this->sum = 0;
+  this->count = 0;
+}
+
+void SensorAccumulator::Add(int16_t value)
+{
+  if (value == SENSOR_VALUE_INVALID || this->count == UINT16_MAX)
+  {
+    return;
+  }
+
+  this->sum += value;
+  this->count++;
+}
+
+uint16_t SensorAccumulator::Count() const { return this->count; }
+
+int16_t SensorAccumulator::Mean() const
+{
+  if (this->count == 0)
+  {
+    return SENSOR_VALUE_INVALID;
+  }
+
+  int32_t half = this->count / 2;
+  return (int16_t)(this->sum >= 0 ? (this->sum + half) / this->count
+                                  : (this->sum - half) / this->count);
+}
+
+int16_t SensorRescale(SensorChannel channel, int32_t value, uint8_t decimals)
+{
+  const SensorChannelSchema& schema = SensorSchema[channel];
+
+  if (decimals < schema.decimals)
+  {
+    value *= decimal_scale[schema.decimals - decimals];
+  }
+  else if (decimals > schema.decimals)
+  {
+    int32_t divisor = decimal_scale[decimals - schema.decimals];
+    int32_t half = divisor / 2;
+    value = value >= 0 ? (value + half) / divisor : (value - half) / divisor;
+  }
+
+  if (value < schema.minimum)
+  {
+    value = schema.minimum;
+  }
+  else if (value > schema.maximum)
+  {
+    value = schema.maximum;
+  }
+
+  return (int16_t)value;
+}
+
+size_t FormatFixedPoint(int32_t value, uint8_t decimals, char* buffer, size_t size)
+{
+  char digits[16];
+  size_t digit_count = 0;
+  size_t length = 0;
+  uint32_t magnitude = value < 0 ? 0U - (uint32_t)value : (uint32_t)value;
+
+  if (decimals >= sizeof(digits) - 1)
+  {
+    return 0;
+  }
+
+  // Least significant digit first; at least one digit left of the decimal point.
+  do
+  {
+    digits[digit_count++] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0 || digit_count <= decimals);
+
+  size_t needed = digit_count + (value < 0 ? 1 : 0) + (decimals > 0 ? 1 : 0) + 1;
+  if (buffer == NULL || needed > size)
+  {
+    return 0;
+  }
+
+  if (value < 0)
+  {
+    buffer[length++] = '-';
+  }
+
+  while (digit_count > 0)
+  {
+    if (digit_count == decimals)
+    {
+      buffer[length++] = '.';
+    }
+
+    buffer[length++] = digits[--digit_count];
+  }
+
+  buffer[length] = '\0';
+  return length;
+}
+
+size_t SensorFormat(SensorChannel channel, int16_t value, char* buffer, size_t size)
+{
+  return FormatFixedPoint(value, SensorSchema[channel].decimals, buffer, size);
+}
@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef SENSORSAMPLE_H
+#define SENSORSAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Marks a channel whose reading failed; never produced by SensorRescale().
+#define SENSOR_VALUE_INVALID INT16_MIN
+
+// Enough for "-32767.5" style values plus the terminator.
+#define SENSOR_VALUE_TEXT_SIZE 12
+
+/*
+ * The single definition of the sensor channels: id, telemetry key, decimals,
+ * minimum and maximum (the last two in channel units). The channel
+ * enum, SensorSchema and the telemetry schema are all expanded from this list.
+ * DHT22: -40..80 C at 0.1 C resolution, 0..100 %RH at 0.1 %RH resolution.
+ */
+#define SENSOR_CHANNEL_LIST(X)                  \
+  X(TEMPERATURE, "temperature", 2, -4000, 8000) \
+  X(HUMIDITY, "humidity", 1, 0, 1000)
+
+#define SENSOR_CHANNEL_ENUM_ENTRY(id, key, decimals, minimum, maximum) SENSOR_CHANNEL_##id,
+
+enum SensorChannel
+{
+  SENSOR_CHANNEL_LIST(SENSOR_CHANNEL_ENUM_ENTRY) SENSOR_CHANNEL_COUNT
+};
+
+/*
+ * Telemetry schema for one channel. Values are carried as integers in units of
+ * 10^-decimals of the physical unit (centi-degrees, per-mille humidity), so
+ * comparisons, aggregation and JSON formatting never touch floating point.
+ */
+struct SensorChannelSchema
+{
+  const char* name;
+  uint8_t decimals;
+  int16_t minimum;
+  int16_t maximum;
+};
+
+extern const SensorChannelSchema SensorSchema[SENSOR_CHANNEL_COUNT];
+
+struct SensorSample
+{
+  int16_t value[SENSOR_CHANNEL_COUNT];
+
+  void Invalidate();
+  bool IsValid(SensorChannel channel) const;
+};
+
+/*
+ * Integer running aggregate of one channel. Invalid values are skipped; the mean
+ * is rounded to the nearest unit.
+ */
+class SensorAccumulator
+{
+public:
+  SensorAccumulator();
+  void Reset();
+  void Add(int16_t value);
+  uint16_t Count() const;
+  int16_t Mean() const;
+
+private:
+  int32_t sum;
+  uint16_t count;
+};
+
+/*
+ * @brief Converts a fixed-point reading with the given decimals into channel
+ *        units, rounding half away from zero and clamping to the schema range.
+ */
+int16_t SensorRescale(SensorChannel channel, int32_t value, uint8_t decimals);
+
+/*
+ * @brief Formats a fixed-point value as a decimal number ("23.45", "-0.5")
+ *        without floating point.
+ * @return Length written (excluding the terminator), or 0 if it does not fit.
+ */
+size_t FormatFixedPoint(int32_t value, uint8_t decimals, char* buffer, size_t size);
+
+// FormatFixedPoint() with the decimals of the channel.
+size_t SensorFormat(SensorChannel channel, int16_t value, char* buffer, size_t size);
+
+#endif // SENSORSAMPLE_H
@@ -0,0 +1,69 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "StartupProfiler.h"
+#include "SerialLogger.h"
+#include <string.h>
+
+static const char* const phase_names[STARTUP_PHASE_COUNT] = {
+  "wifi", "time", "timeSync", "provisioning", "mqttConnect", "firstTelemetry",
+};
+
+StartupProfiler::StartupProfiler()
+{
+  memset(this->startMillis, 0, sizeof(this->startMillis));
+  memset(this->endMillis, 0, sizeof(this->endMillis));
+  memset(this->started, 0, sizeof(this->started));
+  memset(this->ended, 0, sizeof(this->ended));
+}
+
+void StartupProfiler::Begin(StartupPhase phase)
+{
+  if (!this->started[phase])
+  {
+    this->startMillis[phase] = millis();
+    this->started[phase] = true;
+  }
+}
+
+void StartupProfiler::End(StartupPhase phase)
+{
+  if (this->started[phase] && !this->ended[phase])
+  {
+    this->endMillis[phase] = millis();
+    this->ended[phase] = true;
+  }
+}
+
+bool StartupProfiler::IsComplete() { return this->ended[STARTUP_PHASE_FIRST_TELEMETRY]; }
+
+void StartupProfiler::ToJson(JsonDocument& document)
+{
+  JsonObject startup = document["startupMs"].to<JsonObject>();
+
+  for (int i = 0; i < STARTUP_PHASE_COUNT; i++)
+  {
+    if (this->ended[i])
+    {
+      JsonArray phase = startup[phase_names[i]].to<JsonArray>();
+      phase.add(this->startMillis[i]);
+      phase.add(this->endMillis[i]);
+    }
+  }
+}
+
+void StartupProfiler::Dump()
+{
+  for (int i = 0; i < STARTUP_PHASE_COUNT; i++)
+  {
+    if (this->ended[i])
+    {
+      Logger.Info(
+          "Startup phase " + String(phase_names[i]) + ": " + String(this->startMillis[i]) + " -> "
+          + String(this->endMillis[i]) + " ms (" + String(this->endMillis[i] - this->startMillis[i])
+          + " ms)");
+    }
+  }
+}
+
+StartupProfiler StartupPhases;
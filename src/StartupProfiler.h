@@ -0,0 +1,45 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef STARTUPPROFILER_H
+#define STARTUPPROFILER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+enum StartupPhase
+{
+  STARTUP_PHASE_WIFI = 0,
+  STARTUP_PHASE_TIME,
+  STARTUP_PHASE_TIME_SYNC,
+  STARTUP_PHASE_PROVISIONING,
+  STARTUP_PHASE_MQTT_CONNECT,
+  STARTUP_PHASE_FIRST_TELEMETRY,
+  STARTUP_PHASE_COUNT
+};
+
+/*
+ * Records when each startup phase began and ended, in milliseconds since boot.
+ * Phases may overlap (Wi-Fi association and SNTP run concurrently); only the
+ * first Begin/End of each phase after boot is kept.
+ */
+class StartupProfiler
+{
+public:
+  StartupProfiler();
+  void Begin(StartupPhase phase);
+  void End(StartupPhase phase);
+  bool IsComplete();
+  void ToJson(JsonDocument& document);
+  void Dump();
+
+private:
+  uint32_t startMillis[STARTUP_PHASE_COUNT];
+  uint32_t endMillis[STARTUP_PHASE_COUNT];
+  bool started[STARTUP_PHASE_COUNT];
+  bool ended[STARTUP_PHASE_COUNT];
+};
+
+extern StartupProfiler StartupPhases;
+
+#endif // STARTUPPROFILER_H
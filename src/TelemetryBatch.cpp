@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "TelemetryBatch.h"
+
+TelemetryBatch::TelemetryBatch() { this->count = 0; }
+
+void TelemetryBatch::Add(uint32_t epoch, const SensorSample& sample)
+{
+  if (this->count < TELEMETRY_BATCH_SIZE)
+  {
+    this->readings[this->count].epoch = epoch;
+    this->readings[this->count].sample = sample;
+    this->count++;
+  }
+}
+
+bool TelemetryBatch::IsFull() { return this->count >= TELEMETRY_BATCH_SIZE; }
+
+size_t TelemetryBatch::Count() { return this->count; }
+
+void TelemetryBatch::Clear() { this->count = 0; }
+
+const BatchedReading* TelemetryBatch::Readings() { return this->readings; }
+
+bool TelemetryBatch::Summarize(BatchedReading* summary)
+{
+  if (this->count == 0)
+  {
+    return false;
+  }
+
+  summary->epoch = this->readings[this->count - 1].epoch;
+
+  for (int channel = 0; channel < SENSOR_CHANNEL_COUNT; channel++)
+  {
+    SensorAccumulator accumulator;
+
+    for (size_t i = 0; i < this->count; i++)
+    {
+      accumulator.Add(this->readings[i].sample.value[channel]);
+    }
+
+    summary->sample.value[channel] = accumulator.Mean();
+  }
+
+  return true;
+}
@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef TELEMETRYBATCH_H
+#define TELEMETRYBATCH_H
+
+#include "SensorSample.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Readings per routine telemetry message.
+#ifndef TELEMETRY_BATCH_SIZE
+#define TELEMETRY_BATCH_SIZE 5
+#endif
+
+struct BatchedReading
+{
+  uint32_t epoch;
+  SensorSample sample;
+};
+
+/*
+ * Fixed-size collection of routine readings that go out together in one message
+ * (encoded by TelemetryEncode()).
+ */
+class TelemetryBatch
+{
+public:
+  TelemetryBatch();
+  void Add(uint32_t epoch, const SensorSample& sample);
+  bool IsFull();
+  size_t Count();
+  void Clear();
+  const BatchedReading* Readings();
+
+  // Collapses the batch into one reading: the latest epoch and the mean of each channel.
+  bool Summarize(BatchedReading* summary);
+
+private:
+  BatchedReading readings[TELEMETRY_BATCH_SIZE];
+  size_t count;
+};
+
+#endif // TELEMETRYBATCH_H
@@ -0,0 +1,160 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "TelemetrySchema.h"
+
+#define READINGS_KEY "readings"
+
+static void encodeJson(
+    SchemaWriter& writer,
+    const TelemetryHeader& header,
+    const BatchedReading* readings,
+    size_t count)
+{
+  writer.Put('{');
+  TelemetryHeaderSchema::WriteJson(writer, header, true);
+  writer.Put(",\"" READINGS_KEY "\":[", sizeof(",\"" READINGS_KEY "\":[") - 1);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i > 0)
+    {
+      writer.Put(',');
+    }
+
+    writer.Put('{');
+    TelemetryReadingSchema::WriteJson(writer, readings[i], true);
+    writer.Put('}');
+  }
+
+  writer.Put("]}", 2);
+}
+
+static void encodeCbor(
+    SchemaWriter& writer,
+    const TelemetryHeader& header,
+    const BatchedReading* readings,
+    size_t count)
+{
+  SchemaCborWriteHead(
+      writer, CBOR_MAJOR_MAP, (uint32_t)TelemetryHeaderSchema::CountPresent(header) + 1);
+  TelemetryHeaderSchema::WriteCbor(writer, header);
+  SchemaCborWriteText(writer, READINGS_KEY, sizeof(READINGS_KEY) - 1);
+  SchemaCborWriteHead(writer, CBOR_MAJOR_ARRAY, (uint32_t)count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    SchemaCborWriteHead(
+        writer, CBOR_MAJOR_MAP, (uint32_t)TelemetryReadingSchema::CountPresent(readings[i]));
+    TelemetryReadingSchema::WriteCbor(writer, readings[i]);
+  }
+}
+
+size_t TelemetryEncode(
+    TelemetryEncoding encoding,
+    const TelemetryHeader& header,
+    const BatchedReading* readings,
+    size_t count,
+    uint8_t* buffer,
+    size_t size)
+{
+  SchemaWriter writer(buffer, size);
+
+  if (encoding == TELEMETRY_ENCODING_CBOR)
+  {
+    encodeCbor(writer, header, readings, count);
+  }
+  else
+  {
+    encodeJson(writer, header, readings, count);
+  }
+
+  return writer.Overflowed() ? 0 : writer.Length();
+}
+
+static bool decodeJson(
+    SchemaReader& reader,
+    TelemetryHeader* header,
+    BatchedReading* readings,
+    size_t capacity,
+    size_t* count)
+{
+  *count = 0;
+
+  if (!reader.Match("{", 1) || !TelemetryHeaderSchema::ReadJson(reader, *header, true)
+      || !reader.Match(",\"" READINGS_KEY "\":[", sizeof(",\"" READINGS_KEY "\":[") - 1))
+  {
+    return false;
+  }
+
+  while (!reader.Match("]", 1))
+  {
+    if (*count == capacity || (*count > 0 && !reader.Match(",", 1)) || !reader.Match("{", 1)
+        || !TelemetryReadingSchema::ReadJson(reader, readings[*count], true)
+        || !reader.Match("}", 1))
+    {
+      return false;
+    }
+
+    (*count)++;
+  }
+
+  return reader.Match("}", 1) && reader.AtEnd();
+}
+
+static bool decodeCbor(
+    SchemaReader& reader,
+    TelemetryHeader* header,
+    BatchedReading* readings,
+    size_t capacity,
+    size_t* count)
+{
+  uint8_t major;
+  uint32_t entries;
+
+  *count = 0;
+
+  if (!SchemaCborReadHead(reader, &major, &entries) || major != CBOR_MAJOR_MAP || entries == 0)
+  {
+    return false;
+  }
+
+  // Header fields take all entries but the trailing "readings" array.
+  if (!TelemetryHeaderSchema::ReadCbor(reader, *header, entries - 1)
+      || !SchemaCborMatchText(reader, READINGS_KEY, sizeof(READINGS_KEY) - 1)
+      || !SchemaCborReadHead(reader, &major, &entries) || major != CBOR_MAJOR_ARRAY
+      || entries > capacity)
+  {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < entries; i++)
+  {
+    uint32_t fields;
+
+    if (!SchemaCborReadHead(reader, &major, &fields) || major != CBOR_MAJOR_MAP
+        || !TelemetryReadingSchema::ReadCbor(reader, readings[i], fields))
+    {
+      return false;
+    }
+  }
+
+  *count = entries;
+  return reader.AtEnd();
+}
+
+bool TelemetryDecode(
+    TelemetryEncoding encoding,
+    const uint8_t* data,
+    size_t length,
+    TelemetryHeader* header,
+    BatchedReading* readings,
+    size_t capacity,
+    size_t* count)
+{
+  SchemaReader reader(data, length);
+
+  return encoding == TELEMETRY_ENCODING_CBOR
+      ? decodeCbor(reader, header, readings, capacity, count)
+      : decodeJson(reader, header, readings, capacity, count);
+}
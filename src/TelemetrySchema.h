@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef TELEMETRYSCHEMA_H
+#define TELEMETRYSCHEMA_H
+
+#include "SchemaCodec.h"
+#include "SensorSample.h"
+#include "TelemetryBatch.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define TELEMETRY_TIME_TEXT_SIZE 30
+
+static_assert(SCHEMA_FIXED16_ABSENT == SENSOR_VALUE_INVALID, "absent readings must round-trip");
+
+// Message-level fields of a routine telemetry message.
+struct TelemetryHeader
+{
+  uint32_t id;
+  char currentTime[TELEMETRY_TIME_TEXT_SIZE];
+  uint32_t msgCount;
+};
+
+/*
+ * The telemetry record, defined once. A message is the header fields followed by
+ * "readings": an array of reading records. Sensor channels, their keys and their
+ * decimals come from SENSOR_CHANNEL_LIST; a failed channel is left out.
+ */
+SCHEMA_FIELD_ACCESSOR(TelemetryId, TelemetryHeader, "id", id);
+SCHEMA_FIELD_ACCESSOR(TelemetryCurrentTime, TelemetryHeader, "currentTime", currentTime);
+SCHEMA_FIELD_ACCESSOR(TelemetryMsgCount, TelemetryHeader, "msgCount", msgCount);
+
+typedef SchemaFields<
+    SchemaField<TelemetryIdAccessor, SCHEMA_TYPE_UINT32, 0, false>,
+    SchemaField<TelemetryCurrentTimeAccessor, SCHEMA_TYPE_TEXT, 0, true>,
+    SchemaField<TelemetryMsgCountAccessor, SCHEMA_TYPE_UINT32, 0, false>>
+    TelemetryHeaderSchema;
+
+#define TELEMETRY_CHANNEL_ACCESSOR(id, key, decimals, minimum, maximum) \
+  SCHEMA_FIELD_ACCESSOR(Reading##id, BatchedReading, key, sample.value[SENSOR_CHANNEL_##id]);
+#define TELEMETRY_CHANNEL_FIELD(id, key, decimals, minimum, maximum) \
+  , SchemaField<Reading##id##Accessor, SCHEMA_TYPE_FIXED16, decimals, true>
+
+SCHEMA_FIELD_ACCESSOR(ReadingTimestamp, BatchedReading, "ts", epoch);
+SENSOR_CHANNEL_LIST(TELEMETRY_CHANNEL_ACCESSOR)
+
+typedef SchemaFields<
+    SchemaField<ReadingTimestampAccessor, SCHEMA_TYPE_UINT32, 0, false>
+        SENSOR_CHANNEL_LIST(TELEMETRY_CHANNEL_FIELD)>
+    TelemetryReadingSchema;
+
+enum TelemetryEncoding
+{
+  TELEMETRY_ENCODING_JSON = 0,
+  TELEMETRY_ENCODING_CBOR
+};
+
+/*
+ * @brief Encodes a batched telemetry message.
+ * @return Bytes written, or 0 if the message does not fit in the buffer.
+ */
+size_t TelemetryEncode(
+    TelemetryEncoding encoding,
+    const TelemetryHeader& header,
+    const BatchedReading* readings,
+    size_t count,
+    uint8_t* buffer,
+    size_t size);
+
+/*
+ * @brief Decodes a message produced by TelemetryEncode() (for host-side checks
+ *        and tools); fields must appear in schema order.
+ * @return false if the input does not match the schema or has more than
+ *         capacity readings.
+ */
+bool TelemetryDecode(
+    TelemetryEncoding encoding,
+    const uint8_t* data,
+    size_t length,
+    TelemetryHeader* header,
+    BatchedReading* readings,
+    size_t capacity,
+    size_t* count);
+
+#endif // TELEMETRYSCHEMA_H
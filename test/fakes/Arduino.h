@@ -0,0 +1,113 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKE_ARDUINO_H
+#define FAKE_ARDUINO_H
+
+/*
+ * Just enough of the Arduino-ESP32 core for the modules built by [env:native].
+ * The clock only moves when a test advances it (fake_micros or delay()), so
+ * time-dependent behaviour is deterministic.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+typedef uint8_t byte;
+
+class String : public std::string
+{
+public:
+  String() {}
+  String(const char* text) : std::string(text != NULL ? text : "") {}
+  String(const std::string& text) : std::string(text) {}
+  String(char character) : std::string(1, character) {}
+
+  template <typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+  String(T value) : std::string(std::to_string(value))
+  {
+  }
+};
+
+class FakeSerial
+{
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  int available() { return 0; }
+  int read() { return -1; }
+
+  template <typename T>
+  size_t print(const T& value)
+  {
+    (void)value;
+    return 0;
+  }
+
+  size_t println() { return 0; }
+
+  template <typename T>
+  size_t println(const T& value)
+  {
+    (void)value;
+    return 0;
+  }
+};
+
+inline FakeSerial Serial;
+
+inline uint64_t fake_micros = 0;
+
+// Runs on every delay(), standing in for the tasks that would run meanwhile (e.g. esp-mqtt).
+inline void (*fake_delay_hook)() = NULL;
+
+inline unsigned long millis() { return (unsigned long)(fake_micros / 1000); }
+inline unsigned long micros() { return (unsigned long)fake_micros; }
+
+inline void delay(uint32_t ms)
+{
+  fake_micros += (uint64_t)ms * 1000;
+  if (fake_delay_hook != NULL)
+  {
+    fake_delay_hook();
+  }
+}
+
+inline void* ps_malloc(size_t size) { return malloc(size); }
+
+class FakeEsp
+{
+public:
+  uint32_t getFreeHeap() { return 0; }
+  uint32_t getMinFreeHeap() { return 0; }
+  uint32_t getMaxAllocHeap() { return 0; }
+  uint32_t getFreePsram() { return 0; }
+  uint32_t getMinFreePsram() { return 0; }
+  uint32_t getMaxAllocPsram() { return 0; }
+  uint32_t getCycleCount() { return (uint32_t)(fake_micros * 240); }
+  uint32_t getCpuFreqMHz() { return 240; }
+};
+
+inline FakeEsp ESP;
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+typedef void* TaskHandle_t;
+inline TaskHandle_t xTaskGetHandle(const char* name)
+{
+  (void)name;
+  return NULL;
+}
+inline uint32_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+  (void)task;
+  return 0;
+}
+
+#endif // FAKE_ARDUINO_H
@@ -0,0 +1,134 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKE_PREFERENCES_H
+#define FAKE_PREFERENCES_H
+
+/*
+ * In-memory NVS. Every Preferences instance sees the same store, which outlives
+ * them, so a test can "reboot" by constructing fresh objects; fake_nvs.clear()
+ * erases the flash.
+ */
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef std::map<std::string, std::vector<uint8_t>> FakeNvsNamespace;
+
+inline std::map<std::string, FakeNvsNamespace> fake_nvs;
+
+class Preferences
+{
+public:
+  Preferences() : space(NULL), readOnly(true) {}
+
+  bool begin(const char* name, bool readOnly = false)
+  {
+    // As with NVS, a namespace can only be opened read-only once something was written to it.
+    if (readOnly && fake_nvs.find(name) == fake_nvs.end())
+    {
+      return false;
+    }
+
+    this->space = &fake_nvs[name];
+    this->readOnly = readOnly;
+    return true;
+  }
+
+  void end() { this->space = NULL; }
+
+  bool clear()
+  {
+    if (!this->isWritable())
+    {
+      return false;
+    }
+    this->space->clear();
+    return true;
+  }
+
+  bool remove(const char* key) { return this->isWritable() && this->space->erase(key) > 0; }
+
+  size_t putUChar(const char* key, uint8_t value) { return this->put(key, &value, sizeof(value)); }
+  size_t putUInt(const char* key, uint32_t value) { return this->put(key, &value, sizeof(value)); }
+  size_t putULong64(const char* key, uint64_t value) { return this->put(key, &value, sizeof(value)); }
+  size_t putBytes(const char* key, const void* value, size_t length) { return this->put(key, value, length); }
+
+  // Stored with its terminator, like nvs_set_str().
+  size_t putString(const char* key, const char* value)
+  {
+    return this->put(key, value, strlen(value) + 1) > 0 ? strlen(value) : 0;
+  }
+  size_t putString(const char* key, const String& value) { return this->putString(key, value.c_str()); }
+
+  uint8_t getUChar(const char* key, uint8_t defaultValue = 0) { return this->get(key, defaultValue); }
+  uint32_t getUInt(const char* key, uint32_t defaultValue = 0) { return this->get(key, defaultValue); }
+  uint64_t getULong64(const char* key, uint64_t defaultValue = 0) { return this->get(key, defaultValue); }
+
+  size_t getBytes(const char* key, void* buffer, size_t maxLength)
+  {
+    const std::vector<uint8_t>* value = this->find(key);
+    if (value == NULL || value->size() > maxLength)
+    {
+      return 0;
+    }
+    memcpy(buffer, value->data(), value->size());
+    return value->size();
+  }
+
+  // @return the length including the terminator, like the Arduino-ESP32 core.
+  size_t getString(const char* key, char* buffer, size_t maxLength)
+  {
+    return this->getBytes(key, buffer, maxLength);
+  }
+
+  String getString(const char* key, const String& defaultValue = String())
+  {
+    const std::vector<uint8_t>* value = this->find(key);
+    return value != NULL ? String((const char*)value->data()) : defaultValue;
+  }
+
+private:
+  bool isWritable() { return this->space != NULL && !this->readOnly; }
+
+  const std::vector<uint8_t>* find(const char* key)
+  {
+    if (this->space == NULL)
+    {
+      return NULL;
+    }
+    FakeNvsNamespace::const_iterator entry = this->space->find(key);
+    return entry != this->space->end() ? &entry->second : NULL;
+  }
+
+  size_t put(const char* key, const void* value, size_t length)
+  {
+    if (!this->isWritable())
+    {
+      return 0;
+    }
+    const uint8_t* bytes = (const uint8_t*)value;
+    (*this->space)[key].assign(bytes, bytes + length);
+    return length;
+  }
+
+  template <typename T>
+  T get(const char* key, T defaultValue)
+  {
+    const std::vector<uint8_t>* value = this->find(key);
+    if (value == NULL || value->size() != sizeof(T))
+    {
+      return defaultValue;
+    }
+    T result;
+    memcpy(&result, value->data(), sizeof(T));
+    return result;
+  }
+
+  FakeNvsNamespace* space;
+  bool readOnly;
+};
+
+#endif // FAKE_PREFERENCES_H
@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKE_ESP_OTA_OPS_H
+#define FAKE_ESP_OTA_OPS_H
+
+/*
+ * The otadata partition: which app slot is running and which one boots next. A
+ * test "reboots" by calling fakeOtaBoot() and constructing a fresh OtaUpdater.
+ */
+
+#include <esp_partition.h>
+
+// First byte of every ESP app image; esp_ota_set_boot_partition() refuses anything else.
+#define FAKE_ESP_IMAGE_MAGIC 0xE9
+
+inline int fake_running_slot = 0;
+inline int fake_boot_slot = 0;
+inline int fake_rollback_cancels = 0;
+
+inline const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from)
+{
+  (void)start_from;
+  return &fake_app_partitions[1 - fake_running_slot];
+}
+
+inline esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition)
+{
+  uint8_t magic;
+  if (partition == NULL || esp_partition_read(partition, 0, &magic, 1) != ESP_OK
+      || magic != FAKE_ESP_IMAGE_MAGIC)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  fake_boot_slot = partition == &fake_app_partitions[0] ? 0 : 1;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_ota_mark_app_valid_cancel_rollback()
+{
+  fake_rollback_cancels++;
+  return ESP_OK;
+}
+
+// Power-on: the bootloader starts whatever otadata selects.
+inline void fakeOtaBoot() { fake_running_slot = fake_boot_slot; }
+
+#endif // FAKE_ESP_OTA_OPS_H
@@ -0,0 +1,154 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKE_ESP_PARTITION_H
+#define FAKE_ESP_PARTITION_H
+
+/*
+ * The two app slots of ota_ab.csv over a file standing in for the SPI flash, so
+ * what was written survives a test's "reboot" (a fresh OtaUpdater). As with NOR
+ * flash, an erase sets a sector to 0xFF and a write can only clear bits; bytes
+ * past the end of the file read as erased. Remove fake_flash_path to erase the chip.
+ */
+
+#include <esp_err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef struct
+{
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+} esp_partition_t;
+
+inline const char* fake_flash_path = "fake_flash.bin";
+
+inline const esp_partition_t fake_app_partitions[2] = {
+  { 0x10000, 0x1B0000, "app0" },
+  { 0x1C0000, 0x1B0000, "app1" },
+};
+
+// Fails the next write or erase that touches the flash at or past this address; UINT32_MAX never.
+inline uint32_t fake_flash_fail_at = UINT32_MAX;
+
+inline FILE* fakeFlashOpen()
+{
+  FILE* file = fopen(fake_flash_path, "r+b");
+  return file != NULL ? file : fopen(fake_flash_path, "w+b");
+}
+
+inline void fakeFlashRead(FILE* file, uint32_t address, uint8_t* buffer, size_t length)
+{
+  memset(buffer, 0xFF, length);
+  if (fseek(file, (long)address, SEEK_SET) == 0)
+  {
+    (void)fread(buffer, 1, length, file);
+  }
+}
+
+inline bool fakeFlashStore(FILE* file, uint32_t address, const uint8_t* data, size_t length)
+{
+  // Extends the file with erased bytes first, so a gap never reads back as zeros.
+  fseek(file, 0, SEEK_END);
+  for (long end = ftell(file); end < (long)address; end++)
+  {
+    fputc(0xFF, file);
+  }
+  return fseek(file, (long)address, SEEK_SET) == 0 && fwrite(data, 1, length, file) == length;
+}
+
+inline bool fakeFlashInRange(const esp_partition_t* partition, size_t offset, size_t length)
+{
+  return partition != NULL && offset <= partition->size && length <= partition->size - offset;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+  if (!fakeFlashInRange(partition, src_offset, size))
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  FILE* file = fakeFlashOpen();
+  if (file == NULL)
+  {
+    return ESP_FAIL;
+  }
+  fakeFlashRead(file, partition->address + (uint32_t)src_offset, (uint8_t*)dst, size);
+  fclose(file);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(
+    const esp_partition_t* partition,
+    size_t dst_offset,
+    const void* src,
+    size_t size)
+{
+  uint32_t address = partition != NULL ? partition->address + (uint32_t)dst_offset : 0;
+  if (!fakeFlashInRange(partition, dst_offset, size))
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (address + size > fake_flash_fail_at)
+  {
+    return ESP_FAIL;
+  }
+
+  FILE* file = fakeFlashOpen();
+  if (file == NULL)
+  {
+    return ESP_FAIL;
+  }
+
+  uint8_t cell[256];
+  const uint8_t* bytes = (const uint8_t*)src;
+  bool stored = true;
+  for (size_t done = 0; stored && done < size; done += sizeof(cell))
+  {
+    size_t take = size - done < sizeof(cell) ? size - done : sizeof(cell);
+    fakeFlashRead(file, address + (uint32_t)done, cell, take);
+    for (size_t i = 0; i < take; i++)
+    {
+      cell[i] &= bytes[done + i];
+    }
+    stored = fakeFlashStore(file, address + (uint32_t)done, cell, take);
+  }
+  fclose(file);
+  return stored ? ESP_OK : ESP_FAIL;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+  if (!fakeFlashInRange(partition, offset, size) || offset % SPI_FLASH_SEC_SIZE != 0
+      || size % SPI_FLASH_SEC_SIZE != 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (partition->address + offset + size > fake_flash_fail_at)
+  {
+    return ESP_FAIL;
+  }
+
+  FILE* file = fakeFlashOpen();
+  if (file == NULL)
+  {
+    return ESP_FAIL;
+  }
+
+  uint8_t erased[SPI_FLASH_SEC_SIZE];
+  memset(erased, 0xFF, sizeof(erased));
+  bool stored = true;
+  for (size_t done = 0; stored && done < size; done += sizeof(erased))
+  {
+    stored = fakeFlashStore(file, partition->address + (uint32_t)(offset + done), erased, sizeof(erased));
+  }
+  fclose(file);
+  return stored ? ESP_OK : ESP_FAIL;
+}
+
+#endif // FAKE_ESP_PARTITION_H
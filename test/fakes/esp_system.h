@@ -0,0 +1,23 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKE_ESP_SYSTEM_H
+#define FAKE_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+// esp_restart() does not return on the device; here it is counted and the caller carries on.
+inline int fake_restarts = 0;
+
+inline void esp_restart() { fake_restarts++; }
+
+// Deterministic, but a different value on every call like the hardware generator.
+inline uint32_t fake_random = 0;
+
+inline uint32_t esp_random()
+{
+  fake_random = fake_random * 1664525 + 1013904223;
+  return fake_random;
+}
+
+#endif // FAKE_ESP_SYSTEM_H
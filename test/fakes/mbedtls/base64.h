@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKE_MBEDTLS_BASE64_H
+#define FAKE_MBEDTLS_BASE64_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL -0x002A
+#define MBEDTLS_ERR_BASE64_INVALID_CHARACTER -0x002C
+
+static const char fake_base64_alphabet[]
+    = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// *olen is the length written, not counting the terminator; on a short dst, the length needed.
+inline int mbedtls_base64_encode(
+    unsigned char* dst,
+    size_t dlen,
+    size_t* olen,
+    const unsigned char* src,
+    size_t slen)
+{
+  size_t needed = 4 * ((slen + 2) / 3);
+  if (dst == NULL || dlen < needed + 1)
+  {
+    *olen = needed + 1;
+    return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+  }
+
+  unsigned char* out = dst;
+  for (size_t i = 0; i < slen; i += 3)
+  {
+    uint32_t group = (uint32_t)src[i] << 16;
+    group |= i + 1 < slen ? (uint32_t)src[i + 1] << 8 : 0;
+    group |= i + 2 < slen ? (uint32_t)src[i + 2] : 0;
+
+    *out++ = fake_base64_alphabet[(group >> 18) & 0x3F];
+    *out++ = fake_base64_alphabet[(group >> 12) & 0x3F];
+    *out++ = i + 1 < slen ? fake_base64_alphabet[(group >> 6) & 0x3F] : '=';
+    *out++ = i + 2 < slen ? fake_base64_alphabet[group & 0x3F] : '=';
+  }
+
+  *out = '\0';
+  *olen = needed;
+  return 0;
+}
+
+inline int mbedtls_base64_decode(
+    unsigned char* dst,
+    size_t dlen,
+    size_t* olen,
+    const unsigned char* src,
+    size_t slen)
+{
+  uint32_t group = 0;
+  int bits = 0;
+  size_t written = 0;
+
+  for (size_t i = 0; i < slen && src[i] != '='; i++)
+  {
+    const char* position = strchr(fake_base64_alphabet, src[i]);
+    if (src[i] == '\0' || position == NULL)
+    {
+      return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+    }
+
+    group = (group << 6) | (uint32_t)(position - fake_base64_alphabet);
+    bits += 6;
+    if (bits >= 8)
+    {
+      bits -= 8;
+      if (dst != NULL && written < dlen)
+      {
+        dst[written] = (unsigned char)(group >> bits);
+      }
+      written++;
+    }
+  }
+
+  *olen = written;
+  return dst == NULL || written > dlen ? MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL : 0;
+}
+
+#endif // FAKE_MBEDTLS_BASE64_H
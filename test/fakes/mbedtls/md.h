@@ -0,0 +1,89 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKE_MBEDTLS_MD_H
+#define FAKE_MBEDTLS_MD_H
+
+// HMAC-SHA256 through the generic mbedtls message digest API; SHA-256 is the only digest.
+
+#include <mbedtls/sha256.h>
+
+typedef enum
+{
+  MBEDTLS_MD_NONE = 0,
+  MBEDTLS_MD_SHA256 = 6,
+} mbedtls_md_type_t;
+
+typedef struct
+{
+  mbedtls_md_type_t type;
+} mbedtls_md_info_t;
+
+typedef struct
+{
+  const mbedtls_md_info_t* md_info;
+  mbedtls_sha256_context inner;
+  uint8_t outerKey[64];
+} mbedtls_md_context_t;
+
+inline const mbedtls_md_info_t* mbedtls_md_info_from_type(mbedtls_md_type_t type)
+{
+  static const mbedtls_md_info_t sha256 = { MBEDTLS_MD_SHA256 };
+  return type == MBEDTLS_MD_SHA256 ? &sha256 : NULL;
+}
+
+inline void mbedtls_md_init(mbedtls_md_context_t* ctx) { memset(ctx, 0, sizeof(*ctx)); }
+inline void mbedtls_md_free(mbedtls_md_context_t* ctx) { memset(ctx, 0, sizeof(*ctx)); }
+
+inline int mbedtls_md_setup(mbedtls_md_context_t* ctx, const mbedtls_md_info_t* info, int hmac)
+{
+  if (info == NULL || !hmac)
+  {
+    return -1;
+  }
+  ctx->md_info = info;
+  return 0;
+}
+
+inline int mbedtls_md_hmac_starts(mbedtls_md_context_t* ctx, const unsigned char* key, size_t keylen)
+{
+  uint8_t block[64];
+  memset(block, 0, sizeof(block));
+  if (keylen > sizeof(block))
+  {
+    (void)mbedtls_sha256_ret(key, keylen, block, 0);
+  }
+  else
+  {
+    memcpy(block, key, keylen);
+  }
+
+  uint8_t innerKey[64];
+  for (size_t i = 0; i < sizeof(block); i++)
+  {
+    innerKey[i] = block[i] ^ 0x36;
+    ctx->outerKey[i] = block[i] ^ 0x5c;
+  }
+
+  (void)mbedtls_sha256_starts_ret(&ctx->inner, 0);
+  return mbedtls_sha256_update_ret(&ctx->inner, innerKey, sizeof(innerKey));
+}
+
+inline int mbedtls_md_hmac_update(mbedtls_md_context_t* ctx, const unsigned char* input, size_t ilen)
+{
+  return mbedtls_sha256_update_ret(&ctx->inner, input, ilen);
+}
+
+inline int mbedtls_md_hmac_finish(mbedtls_md_context_t* ctx, unsigned char* output)
+{
+  uint8_t innerDigest[32];
+  (void)mbedtls_sha256_finish_ret(&ctx->inner, innerDigest);
+
+  mbedtls_sha256_context outer;
+  (void)mbedtls_sha256_starts_ret(&outer, 0);
+  (void)mbedtls_sha256_update_ret(&outer, ctx->outerKey, sizeof(ctx->outerKey));
+  (void)mbedtls_sha256_update_ret(&outer, innerDigest, sizeof(innerDigest));
+  return mbedtls_sha256_finish_ret(&outer, output);
+}
+
+#endif // FAKE_MBEDTLS_MD_H
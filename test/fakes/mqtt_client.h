@@ -0,0 +1,335 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef FAKE_MQTT_CLIENT_H
+#define FAKE_MQTT_CLIENT_H
+
+/*
+ * esp-mqtt (IDF 4.4 API) against an in-process broker. Events are queued and
+ * handed to the event handler from delay(), the way the MQTT task would run
+ * while loop() waits; the broker a test installs in fake_mqtt_broker decides
+ * how connections and publishes are answered.
+ */
+
+#include <Arduino.h>
+#include <algorithm>
+#include <deque>
+#include <esp_err.h>
+#include <string>
+#include <vector>
+
+typedef struct esp_mqtt_client* esp_mqtt_client_handle_t;
+
+typedef enum
+{
+  MQTT_EVENT_ANY = -1,
+  MQTT_EVENT_ERROR = 0,
+  MQTT_EVENT_CONNECTED,
+  MQTT_EVENT_DISCONNECTED,
+  MQTT_EVENT_SUBSCRIBED,
+  MQTT_EVENT_UNSUBSCRIBED,
+  MQTT_EVENT_PUBLISHED,
+  MQTT_EVENT_DATA,
+  MQTT_EVENT_BEFORE_CONNECT,
+  MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef enum
+{
+  MQTT_ERROR_TYPE_NONE = 0,
+  MQTT_ERROR_TYPE_TCP_TRANSPORT,
+  MQTT_ERROR_TYPE_CONNECTION_REFUSED,
+} esp_mqtt_error_type_t;
+
+typedef enum
+{
+  MQTT_CONNECTION_ACCEPTED = 0,
+  MQTT_CONNECTION_REFUSE_PROTOCOL,
+  MQTT_CONNECTION_REFUSE_ID_REJECTED,
+  MQTT_CONNECTION_REFUSE_SERVER_UNAVAILABLE,
+  MQTT_CONNECTION_REFUSE_BAD_USERNAME,
+  MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED,
+} esp_mqtt_connect_return_code_t;
+
+typedef struct
+{
+  esp_err_t esp_tls_last_esp_err;
+  int esp_tls_stack_err;
+  int esp_tls_cert_verify_flags;
+  esp_mqtt_error_type_t error_type;
+  esp_mqtt_connect_return_code_t connect_return_code;
+  int esp_transport_sock_errno;
+} esp_mqtt_error_codes_t;
+
+typedef struct
+{
+  esp_mqtt_event_id_t event_id;
+  esp_mqtt_client_handle_t client;
+  void* user_context;
+  char* data;
+  int data_len;
+  int total_data_len;
+  int current_data_offset;
+  char* topic;
+  int topic_len;
+  int msg_id;
+  int session_present;
+  esp_mqtt_error_codes_t* error_handle;
+  bool retain;
+  int qos;
+  bool dup;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t* esp_mqtt_event_handle_t;
+typedef esp_err_t (*mqtt_event_callback_t)(esp_mqtt_event_handle_t event);
+
+typedef struct
+{
+  mqtt_event_callback_t event_handle;
+  const char* host;
+  const char* uri;
+  uint32_t port;
+  const char* client_id;
+  const char* username;
+  const char* password;
+  int keepalive;
+  int disable_clean_session;
+  bool disable_auto_reconnect;
+  void* user_context;
+  const char* cert_pem;
+  size_t cert_len;
+  const char* client_cert_pem;
+  const char* client_key_pem;
+  bool use_global_ca_store;
+} esp_mqtt_client_config_t;
+
+class FakeMqttBroker
+{
+public:
+  virtual ~FakeMqttBroker() {}
+
+  // @return the CONNACK code for a client connecting with config.
+  virtual esp_mqtt_connect_return_code_t Connect(const esp_mqtt_client_config_t& config)
+  {
+    (void)config;
+    return MQTT_CONNECTION_ACCEPTED;
+  }
+
+  // Called for every message the client sends; answer with FakeMqttDeliver().
+  virtual void Publish(esp_mqtt_client_handle_t client, const std::string& topic, const std::string& payload)
+  {
+    (void)client;
+    (void)topic;
+    (void)payload;
+  }
+};
+
+inline FakeMqttBroker* fake_mqtt_broker = NULL;
+
+struct FakeMqttEvent
+{
+  esp_mqtt_event_id_t id;
+  int msgId;
+  esp_mqtt_connect_return_code_t connectReturnCode;
+  std::string topic;
+  std::string data;
+};
+
+struct esp_mqtt_client
+{
+  esp_mqtt_client_config_t config;
+  bool connected;
+  int nextMsgId;
+  int outboxBytes;
+  std::deque<FakeMqttEvent> events;
+};
+
+inline std::vector<esp_mqtt_client*> fake_mqtt_clients;
+
+inline void FakeMqttPost(
+    esp_mqtt_client_handle_t client,
+    esp_mqtt_event_id_t id,
+    int msgId = 0,
+    const std::string& topic = std::string(),
+    const std::string& data = std::string(),
+    esp_mqtt_connect_return_code_t connectReturnCode = MQTT_CONNECTION_ACCEPTED)
+{
+  client->events.push_back(FakeMqttEvent{ id, msgId, connectReturnCode, topic, data });
+}
+
+// A message from the broker to client, delivered on the next delay().
+inline void FakeMqttDeliver(esp_mqtt_client_handle_t client, const std::string& topic, const std::string& payload)
+{
+  FakeMqttPost(client, MQTT_EVENT_DATA, 0, topic, payload);
+}
+
+// Hands every queued event to its client's handler, including events queued by the handlers.
+inline void FakeMqttDispatch()
+{
+  for (size_t i = 0; i < fake_mqtt_clients.size(); i++)
+  {
+    esp_mqtt_client* client = fake_mqtt_clients[i];
+
+    while (!client->events.empty())
+    {
+      FakeMqttEvent queued = client->events.front();
+      client->events.pop_front();
+
+      esp_mqtt_error_codes_t error;
+      memset(&error, 0, sizeof(error));
+      esp_mqtt_event_t event;
+      memset(&event, 0, sizeof(event));
+      event.event_id = queued.id;
+      event.client = client;
+      event.user_context = client->config.user_context;
+      event.msg_id = queued.msgId;
+      event.topic = (char*)queued.topic.data();
+      event.topic_len = (int)queued.topic.size();
+      event.data = (char*)queued.data.data();
+      event.data_len = (int)queued.data.size();
+      event.total_data_len = event.data_len;
+
+      if (queued.id == MQTT_EVENT_ERROR)
+      {
+        error.error_type = MQTT_ERROR_TYPE_CONNECTION_REFUSED;
+        error.connect_return_code = queued.connectReturnCode;
+        event.error_handle = &error;
+      }
+
+      if (client->config.event_handle != NULL)
+      {
+        (void)client->config.event_handle(&event);
+      }
+
+      // The handler may have destroyed its own client.
+      if (std::find(fake_mqtt_clients.begin(), fake_mqtt_clients.end(), client) == fake_mqtt_clients.end())
+      {
+        return;
+      }
+    }
+  }
+}
+
+inline esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config)
+{
+  esp_mqtt_client* client = new esp_mqtt_client();
+  client->config = *config;
+  client->connected = false;
+  client->nextMsgId = 1;
+  client->outboxBytes = 0;
+  fake_mqtt_clients.push_back(client);
+  fake_delay_hook = FakeMqttDispatch;
+  return client;
+}
+
+inline esp_err_t esp_mqtt_set_config(esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t* config)
+{
+  client->config = *config;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+  FakeMqttPost(client, MQTT_EVENT_BEFORE_CONNECT);
+
+  esp_mqtt_connect_return_code_t code
+      = fake_mqtt_broker != NULL ? fake_mqtt_broker->Connect(client->config) : MQTT_CONNECTION_ACCEPTED;
+  if (code == MQTT_CONNECTION_ACCEPTED)
+  {
+    client->connected = true;
+    FakeMqttPost(client, MQTT_EVENT_CONNECTED);
+  }
+  else
+  {
+    // esp-mqtt reports the refusal and then aborts the connection.
+    FakeMqttPost(client, MQTT_EVENT_ERROR, 0, std::string(), std::string(), code);
+    FakeMqttPost(client, MQTT_EVENT_DISCONNECTED);
+  }
+
+  return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+  client->connected = false;
+  client->events.clear();
+  return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+  if (client == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  fake_mqtt_clients.erase(std::find(fake_mqtt_clients.begin(), fake_mqtt_clients.end(), client));
+  delete client;
+  return ESP_OK;
+}
+
+inline int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char* topic, int qos)
+{
+  (void)topic;
+  (void)qos;
+
+  if (!client->connected)
+  {
+    return -1;
+  }
+
+  int msgId = client->nextMsgId++;
+  FakeMqttPost(client, MQTT_EVENT_SUBSCRIBED, msgId);
+  return msgId;
+}
+
+inline int esp_mqtt_client_publish(
+    esp_mqtt_client_handle_t client,
+    const char* topic,
+    const char* data,
+    int length,
+    int qos,
+    int retain)
+{
+  (void)retain;
+
+  if (!client->connected)
+  {
+    return -1;
+  }
+
+  if (length == 0)
+  {
+    length = (int)strlen(data);
+  }
+
+  int msgId = qos > 0 ? client->nextMsgId++ : 0;
+  if (fake_mqtt_broker != NULL)
+  {
+    fake_mqtt_broker->Publish(client, topic, std::string(data, (size_t)length));
+  }
+
+  if (qos > 0)
+  {
+    FakeMqttPost(client, MQTT_EVENT_PUBLISHED, msgId);
+  }
+
+  return msgId;
+}
+
+inline int esp_mqtt_client_enqueue(
+    esp_mqtt_client_handle_t client,
+    const char* topic,
+    const char* data,
+    int length,
+    int qos,
+    int retain,
+    bool store)
+{
+  (void)store;
+  return esp_mqtt_client_publish(client, topic, data, length, qos, retain);
+}
+
+inline int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client) { return client->outboxBytes; }
+
+#endif // FAKE_MQTT_CLIENT_H
@@ -0,0 +1,221 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "ConnectionCache.h"
+#include <Preferences.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unity.h>
+
+#define MINIMUM_VALID_EPOCH 1510592825 // Nov 13 2017, as in the sketch.
+#define LAST_SYNC_EPOCH 1760000000
+#define POWERED_OFF_SECS (3 * 24 * 60 * 60)
+
+// The system clock, owned by the test: time() and settimeofday() below replace the C library's,
+// so the cache can set the clock without touching the host's.
+static time_t fake_clock = 0;
+static int clock_sets = 0;
+
+#if defined(__GLIBC__)
+#define CLOCK_HOOK_AVAILABLE 1
+
+extern "C" time_t time(time_t* timer) __THROW
+{
+  if (timer != NULL)
+  {
+    *timer = fake_clock;
+  }
+  return fake_clock;
+}
+
+extern "C" int settimeofday(const struct timeval* tv, const struct timezone* tz) __THROW
+{
+  (void)tz;
+  fake_clock = tv->tv_sec;
+  clock_sets++;
+  return 0;
+}
+#endif
+
+static void advance(uint32_t seconds)
+{
+  fake_clock += seconds;
+  fake_micros += (uint64_t)seconds * 1000000;
+}
+
+static uint64_t storedEpoch()
+{
+  Preferences preferences;
+  if (!preferences.begin("netcache", true))
+  {
+    return 0;
+  }
+  uint64_t epoch = preferences.getULong64("epoch", 0);
+  preferences.end();
+  return epoch;
+}
+
+// One boot that reaches SNTP: the clock is correct from the callback on, and Service() persists it.
+static void bootAndSynchronize(ConnectionCache& cache, time_t sntpEpoch)
+{
+  cache.Begin();
+  (void)cache.RestoreTime(MINIMUM_VALID_EPOCH);
+  advance(2);
+  fake_clock = sntpEpoch;
+  cache.OnTimeSynchronized();
+  cache.Service();
+}
+
+void setUp(void)
+{
+#ifndef CLOCK_HOOK_AVAILABLE
+  TEST_IGNORE_MESSAGE("time() can only be replaced on glibc");
+#endif
+  fake_nvs.clear();
+  fake_clock = 0; // Power-on: the RTC starts at the epoch.
+  fake_micros = 0;
+  clock_sets = 0;
+}
+
+void tearDown(void) {}
+
+void test_first_boot_has_no_clock_to_restore(void)
+{
+  ConnectionCache cache;
+  cache.Begin();
+
+  TEST_ASSERT_FALSE(cache.RestoreTime(MINIMUM_VALID_EPOCH));
+  TEST_ASSERT_EQUAL_INT(0, clock_sets);
+
+  uint32_t epoch = 7;
+  TEST_ASSERT_FALSE(cache.SynchronizedTime(&epoch));
+  TEST_ASSERT_EQUAL_UINT32(7, epoch);
+}
+
+void test_sync_is_persisted_by_the_next_service(void)
+{
+  ConnectionCache cache;
+  bootAndSynchronize(cache, LAST_SYNC_EPOCH);
+
+  TEST_ASSERT_EQUAL_UINT64(LAST_SYNC_EPOCH, storedEpoch());
+
+  uint32_t epoch = 0;
+  TEST_ASSERT_TRUE(cache.SynchronizedTime(&epoch));
+  TEST_ASSERT_EQUAL_UINT32(LAST_SYNC_EPOCH, epoch);
+}
+
+void test_power_cycle_restores_a_lower_bound_that_is_not_synchronized(void)
+{
+  {
+    ConnectionCache before;
+    bootAndSynchronize(before, LAST_SYNC_EPOCH);
+  }
+
+  // Off for three days; the RTC does not survive it.
+  fake_clock = 0;
+  fake_micros = 0;
+
+  ConnectionCache cache;
+  cache.Begin();
+
+  // Phase 1: the restored clock is good enough for TLS certificate checks...
+  TEST_ASSERT_TRUE(cache.RestoreTime(MINIMUM_VALID_EPOCH));
+  TEST_ASSERT_EQUAL_UINT32(LAST_SYNC_EPOCH, (uint32_t)time(NULL));
+
+  // ...but three days behind, so nothing may be signed or stamped with it.
+  uint32_t epoch = 0;
+  TEST_ASSERT_FALSE(cache.SynchronizedTime(&epoch));
+  advance(5);
+  cache.Service();
+  TEST_ASSERT_FALSE(cache.SynchronizedTime(&epoch));
+  TEST_ASSERT_EQUAL_UINT64_MESSAGE(LAST_SYNC_EPOCH, storedEpoch(), "unsynchronized clock was persisted");
+
+  // Phase 2: SNTP answers with the real time.
+  fake_clock = LAST_SYNC_EPOCH + POWERED_OFF_SECS;
+  cache.OnTimeSynchronized();
+  TEST_ASSERT_TRUE(cache.SynchronizedTime(&epoch));
+  TEST_ASSERT_EQUAL_UINT32(LAST_SYNC_EPOCH + POWERED_OFF_SECS, epoch);
+
+  cache.Service();
+  TEST_ASSERT_EQUAL_UINT64(LAST_SYNC_EPOCH + POWERED_OFF_SECS, storedEpoch());
+}
+
+void test_software_reset_keeps_the_running_clock(void)
+{
+  {
+    ConnectionCache before;
+    bootAndSynchronize(before, LAST_SYNC_EPOCH);
+  }
+  clock_sets = 0;
+
+  // The RTC survives a software reset and is ahead of the cached epoch.
+  advance(600);
+  time_t running = fake_clock;
+
+  ConnectionCache cache;
+  cache.Begin();
+  TEST_ASSERT_TRUE(cache.RestoreTime(MINIMUM_VALID_EPOCH));
+  TEST_ASSERT_EQUAL_INT(0, clock_sets);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)running, (uint32_t)time(NULL));
+
+  // Still only trusted for stamping once SNTP confirms it after this boot.
+  uint32_t epoch;
+  TEST_ASSERT_FALSE(cache.SynchronizedTime(&epoch));
+}
+
+void test_epoch_is_saved_hourly_not_on_every_loop(void)
+{
+  ConnectionCache cache;
+  bootAndSynchronize(cache, LAST_SYNC_EPOCH);
+
+  for (int minute = 1; minute <= 59; minute++)
+  {
+    advance(60);
+    cache.Service();
+  }
+  TEST_ASSERT_EQUAL_UINT64(LAST_SYNC_EPOCH, storedEpoch());
+
+  advance(61);
+  cache.Service();
+  TEST_ASSERT_EQUAL_UINT64(LAST_SYNC_EPOCH + 59 * 60 + 61, storedEpoch());
+}
+
+void test_access_point_survives_reboot_until_forgotten(void)
+{
+  const uint8_t bssid[CONNECTION_CACHE_BSSID_SIZE] = { 0x24, 0x0a, 0xc4, 0x01, 0x02, 0x03 };
+
+  {
+    ConnectionCache before;
+    before.Begin();
+    TEST_ASSERT_FALSE(before.HasAccessPoint());
+    before.SaveAccessPoint(bssid, 6);
+  }
+
+  ConnectionCache cache;
+  cache.Begin();
+  TEST_ASSERT_TRUE(cache.HasAccessPoint());
+  TEST_ASSERT_EQUAL_INT32(6, cache.Channel());
+  TEST_ASSERT_EQUAL_MEMORY(bssid, cache.Bssid(), sizeof(bssid));
+
+  cache.ForgetAccessPoint();
+  TEST_ASSERT_FALSE(cache.HasAccessPoint());
+
+  ConnectionCache after;
+  after.Begin();
+  TEST_ASSERT_FALSE(after.HasAccessPoint());
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_first_boot_has_no_clock_to_restore);
+  RUN_TEST(test_sync_is_persisted_by_the_next_service);
+  RUN_TEST(test_power_cycle_restores_a_lower_bound_that_is_not_synchronized);
+  RUN_TEST(test_software_reset_keeps_the_running_clock);
+  RUN_TEST(test_epoch_is_saved_hourly_not_on_every_loop);
+  RUN_TEST(test_access_point_survives_reboot_until_forgotten);
+  return UNITY_END();
+}
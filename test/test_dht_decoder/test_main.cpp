@@ -0,0 +1,343 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "DhtDecoder.h"
+#include "SensorSample.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+// Tail of the host start signal, response low/high, 40 bits and the closing low.
+#define LEAD_PULSES 2
+#define FRAME_PULSES (2 + 2 * DHT_FRAME_BITS + 1)
+
+#define BIT_LOW_MICROS 50
+#define BIT_ZERO_HIGH_MICROS 27
+#define BIT_ONE_HIGH_MICROS 70
+
+#define BENCHMARK_FRAMES 100000
+
+// A frame takes about 4 ms on the wire; decoding it should cost a small fraction of that.
+#define DECODE_BUDGET_NANOS 40000
+
+// Same field order as rmt_item32_t, so a dump of the RMT ring buffer can be pasted in as is.
+struct TraceItem
+{
+  uint16_t duration0;
+  uint8_t level0;
+  uint16_t duration1;
+  uint8_t level1;
+};
+
+// RMT traces of a whole read, from the arming of the capture to the idle threshold (the zero
+// duration), at 1 us per tick. These are not hardware captures: they follow the timing of the
+// datasheets with a few microseconds of jitter on every pulse, as captured frames show. A trace
+// dumped from DhtSensor on a board can replace either one without other changes.
+// 22.8 C, 48.3 %RH from a DHT22.
+static const TraceItem dht22_trace[] = {
+  { 17, 0, 31, 1 }, { 79, 0, 80, 1 }, { 49, 0, 27, 1 }, { 52, 0, 24, 1 },
+  { 54, 0, 23, 1 }, { 54, 0, 28, 1 }, { 51, 0, 29, 1 }, { 49, 0, 24, 1 },
+  { 51, 0, 23, 1 }, { 51, 0, 72, 1 }, { 50, 0, 72, 1 }, { 54, 0, 73, 1 },
+  { 52, 0, 73, 1 }, { 49, 0, 27, 1 }, { 49, 0, 27, 1 }, { 51, 0, 25, 1 },
+  { 52, 0, 69, 1 }, { 50, 0, 74, 1 }, { 49, 0, 27, 1 }, { 53, 0, 28, 1 },
+  { 55, 0, 27, 1 }, { 49, 0, 28, 1 }, { 51, 0, 27, 1 }, { 51, 0, 25, 1 },
+  { 50, 0, 26, 1 }, { 51, 0, 29, 1 }, { 55, 0, 73, 1 }, { 53, 0, 69, 1 },
+  { 51, 0, 74, 1 }, { 51, 0, 28, 1 }, { 54, 0, 24, 1 }, { 52, 0, 68, 1 },
+  { 51, 0, 27, 1 }, { 49, 0, 26, 1 }, { 51, 0, 72, 1 }, { 51, 0, 72, 1 },
+  { 52, 0, 26, 1 }, { 54, 0, 24, 1 }, { 51, 0, 72, 1 }, { 51, 0, 26, 1 },
+  { 53, 0, 23, 1 }, { 51, 0, 27, 1 }, { 54, 0, 0, 1 },
+};
+
+// 24.0 C, 41 %RH from a DHT11, which answers sooner after the release and with longer bit lows.
+static const TraceItem dht11_trace[] = {
+  { 9, 0, 24, 1 }, { 81, 0, 85, 1 }, { 55, 0, 28, 1 }, { 57, 0, 25, 1 },
+  { 54, 0, 73, 1 }, { 57, 0, 26, 1 }, { 52, 0, 70, 1 }, { 57, 0, 26, 1 },
+  { 54, 0, 27, 1 }, { 55, 0, 75, 1 }, { 52, 0, 22, 1 }, { 54, 0, 24, 1 },
+  { 52, 0, 22, 1 }, { 55, 0, 28, 1 }, { 56, 0, 27, 1 }, { 51, 0, 26, 1 },
+  { 54, 0, 25, 1 }, { 56, 0, 27, 1 }, { 55, 0, 27, 1 }, { 52, 0, 26, 1 },
+  { 51, 0, 28, 1 }, { 55, 0, 69, 1 }, { 51, 0, 69, 1 }, { 52, 0, 23, 1 },
+  { 55, 0, 22, 1 }, { 57, 0, 25, 1 }, { 53, 0, 25, 1 }, { 55, 0, 28, 1 },
+  { 52, 0, 26, 1 }, { 52, 0, 27, 1 }, { 53, 0, 25, 1 }, { 51, 0, 27, 1 },
+  { 51, 0, 25, 1 }, { 56, 0, 24, 1 }, { 54, 0, 26, 1 }, { 57, 0, 69, 1 },
+  { 56, 0, 24, 1 }, { 53, 0, 28, 1 }, { 52, 0, 26, 1 }, { 53, 0, 22, 1 },
+  { 51, 0, 26, 1 }, { 57, 0, 69, 1 }, { 55, 0, 0, 1 },
+};
+
+// -10.1 C, 65.2 %RH as a DHT22 sends it: sign in the top bit of the temperature.
+static const uint8_t dht22_negative[5] = { 0x02, 0x8C, 0x80, 0x65, 0x73 };
+
+static DhtPulse pulses[LEAD_PULSES + FRAME_PULSES];
+
+// What the RMT capture of a clean frame of these five bytes looks like.
+static size_t capture(const uint8_t bytes[5], bool withLead = true)
+{
+  size_t count = 0;
+  if (withLead)
+  {
+    pulses[count++] = { 0, 300 };
+    pulses[count++] = { 1, 30 };
+  }
+
+  pulses[count++] = { 0, 80 };
+  pulses[count++] = { 1, 80 };
+  for (int i = 0; i < DHT_FRAME_BITS; i++)
+  {
+    bool one = (bytes[i / 8] >> (7 - i % 8)) & 1;
+    pulses[count++] = { 0, BIT_LOW_MICROS };
+    pulses[count++] = { 1, (uint16_t)(one ? BIT_ONE_HIGH_MICROS : BIT_ZERO_HIGH_MICROS) };
+  }
+  pulses[count++] = { 0, 50 };
+  return count;
+}
+
+static uint8_t checksum(const uint8_t bytes[4])
+{
+  return (uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]);
+}
+
+// The conversion DhtSensor::toPulses applies to the RMT ring buffer: same-level runs are merged
+// and a zero duration ends the capture.
+static size_t fromTrace(const TraceItem* items, size_t itemCount, DhtPulse* out)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < 2 * itemCount; i++)
+  {
+    const TraceItem& item = items[i / 2];
+    uint8_t level = i % 2 == 0 ? item.level0 : item.level1;
+    uint16_t micros = i % 2 == 0 ? item.duration0 : item.duration1;
+    if (micros == 0)
+    {
+      break;
+    }
+
+    if (count > 0 && out[count - 1].level == level)
+    {
+      out[count - 1].micros += micros;
+    }
+    else
+    {
+      out[count].level = level;
+      out[count].micros = micros;
+      count++;
+    }
+  }
+
+  return count;
+}
+
+// Index of the high pulse of a data bit in a capture with the leading pulses.
+static size_t bitHigh(int bit) { return LEAD_PULSES + 2 + 2 * bit + 1; }
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_dht22_negative_temperature(void)
+{
+  DhtReading reading;
+  size_t count = capture(dht22_negative);
+
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_OK, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(-101, reading.temperature);
+  TEST_ASSERT_EQUAL_INT16(652, reading.humidity);
+}
+
+void test_frame_without_leading_pulses(void)
+{
+  DhtReading reading;
+  size_t count = capture(dht22_negative, false);
+
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_OK, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(-101, reading.temperature);
+}
+
+void test_dht11_positive_and_negative_temperature(void)
+{
+  DhtReading reading;
+  uint8_t bytes[5] = { 45, 0, 23, 5, 0 };
+  bytes[4] = checksum(bytes);
+  size_t count = capture(bytes);
+
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_OK, DhtDecode(DHT_MODEL_DHT11, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(235, reading.temperature);
+  TEST_ASSERT_EQUAL_INT16(450, reading.humidity);
+
+  // The DHT11 keeps the sign in the top bit of the decimal byte.
+  bytes[3] = 0x85;
+  bytes[4] = checksum(bytes);
+  count = capture(bytes);
+
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_OK, DhtDecode(DHT_MODEL_DHT11, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(-235, reading.temperature);
+  TEST_ASSERT_EQUAL_INT16(450, reading.humidity);
+}
+
+void test_checksum_mismatch(void)
+{
+  DhtReading reading = { 7, 7 };
+  uint8_t bytes[5];
+  memcpy(bytes, dht22_negative, sizeof(bytes));
+  bytes[4] ^= 0x01;
+  size_t count = capture(bytes);
+
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_CHECKSUM, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(7, reading.temperature);
+  TEST_ASSERT_EQUAL_INT16(7, reading.humidity);
+
+  // A flipped data bit is caught the same way.
+  count = capture(dht22_negative);
+  pulses[bitHigh(10)].micros = BIT_ONE_HIGH_MICROS; // A 0 in the humidity read as a 1.
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_CHECKSUM, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+}
+
+void test_short_frame(void)
+{
+  DhtReading reading;
+  size_t count = capture(dht22_negative, false);
+
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_TIMEOUT, DhtDecode(DHT_MODEL_DHT22, pulses, 0, &reading));
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_SHORT_FRAME, DhtDecode(DHT_MODEL_DHT22, pulses, 10, &reading));
+
+  // Without the leading pulses a missed edge (one low/high pair fewer) leaves too few pulses.
+  memmove(&pulses[10], &pulses[12], (count - 12) * sizeof(DhtPulse));
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_SHORT_FRAME, DhtDecode(DHT_MODEL_DHT22, pulses, count - 2, &reading));
+}
+
+void test_bad_timing(void)
+{
+  DhtReading reading;
+  size_t count = capture(dht22_negative);
+
+  // A high too long for a 1 bit.
+  pulses[bitHigh(20)].micros = 200;
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_BAD_TIMING, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+
+  // A bit low too short to be real, e.g. a glitch.
+  count = capture(dht22_negative);
+  pulses[bitHigh(5) - 1].micros = 5;
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_BAD_TIMING, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+
+  // The response high missing its length.
+  count = capture(dht22_negative);
+  pulses[LEAD_PULSES + 1].micros = 20;
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_BAD_TIMING, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+
+  // The capture stopped before the closing low.
+  count = capture(dht22_negative);
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_BAD_TIMING, DhtDecode(DHT_MODEL_DHT22, pulses, count - 1, &reading));
+
+  // With the leading pulses, a missed edge shifts the frame onto the start signal.
+  count = capture(dht22_negative);
+  memmove(&pulses[10], &pulses[12], (count - 12) * sizeof(DhtPulse));
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_BAD_TIMING, DhtDecode(DHT_MODEL_DHT22, pulses, count - 2, &reading));
+}
+
+void test_bit_threshold(void)
+{
+  DhtReading reading;
+  uint8_t bytes[5] = { 0, 0, 0, 0, 0 };
+  size_t count = capture(bytes);
+
+  // The last humidity bit at either side of the threshold between a 0 and a 1, with the last
+  // checksum bit matching it.
+  pulses[bitHigh(15)].micros = 48;
+  pulses[bitHigh(39)].micros = 27;
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_OK, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(0, reading.humidity);
+
+  pulses[bitHigh(15)].micros = 49;
+  pulses[bitHigh(39)].micros = 49;
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_OK, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(1, reading.humidity);
+}
+
+void test_impossible_values_are_out_of_range(void)
+{
+  DhtReading reading;
+  uint8_t bytes[5] = { 0xFF, 0xFF, 0, 0, 0 };
+  bytes[4] = checksum(bytes);
+  size_t count = capture(bytes);
+
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_RANGE, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+}
+
+void test_reading_is_rescaled_to_channel_units(void)
+{
+  TEST_ASSERT_EQUAL_INT16(-1010, SensorRescale(SENSOR_CHANNEL_TEMPERATURE, -101, 1));
+  TEST_ASSERT_EQUAL_INT16(652, SensorRescale(SENSOR_CHANNEL_HUMIDITY, 652, 1));
+  TEST_ASSERT_EQUAL_INT16(653, SensorRescale(SENSOR_CHANNEL_HUMIDITY, 6525, 2));
+  TEST_ASSERT_EQUAL_INT16(0, SensorRescale(SENSOR_CHANNEL_HUMIDITY, -6525, 2));
+}
+
+void test_recorded_traces(void)
+{
+  DhtReading reading;
+  size_t count = fromTrace(dht22_trace, sizeof(dht22_trace) / sizeof(dht22_trace[0]), pulses);
+
+  TEST_ASSERT_EQUAL_size_t(LEAD_PULSES + FRAME_PULSES, count);
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_OK, DhtDecode(DHT_MODEL_DHT22, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(228, reading.temperature);
+  TEST_ASSERT_EQUAL_INT16(483, reading.humidity);
+
+  count = fromTrace(dht11_trace, sizeof(dht11_trace) / sizeof(dht11_trace[0]), pulses);
+  TEST_ASSERT_EQUAL_INT(DHT_STATUS_OK, DhtDecode(DHT_MODEL_DHT11, pulses, count, &reading));
+  TEST_ASSERT_EQUAL_INT16(240, reading.temperature);
+  TEST_ASSERT_EQUAL_INT16(410, reading.humidity);
+}
+
+void test_decode_cost_of_recorded_traces(void)
+{
+  static DhtPulse dht11_pulses[DHT_MAX_PULSES];
+  static DhtPulse dht22_pulses[DHT_MAX_PULSES];
+  size_t dht11_count
+      = fromTrace(dht11_trace, sizeof(dht11_trace) / sizeof(dht11_trace[0]), dht11_pulses);
+  size_t dht22_count
+      = fromTrace(dht22_trace, sizeof(dht22_trace) / sizeof(dht22_trace[0]), dht22_pulses);
+
+  // The readings feed the checked sum, so the loop cannot be optimized away.
+  DhtReading reading;
+  uint32_t ok = 0;
+  int32_t sum = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCHMARK_FRAMES; i++)
+  {
+    DhtStatus status = i % 2 == 0
+        ? DhtDecode(DHT_MODEL_DHT22, dht22_pulses, dht22_count, &reading)
+        : DhtDecode(DHT_MODEL_DHT11, dht11_pulses, dht11_count, &reading);
+    ok += status == DHT_STATUS_OK ? 1 : 0;
+    sum += reading.temperature;
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  double cost = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()
+      / BENCHMARK_FRAMES;
+
+  char message[80];
+  snprintf(message, sizeof(message), "%u frames: %.0f ns/frame", (unsigned)BENCHMARK_FRAMES, cost);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_EQUAL_UINT32(BENCHMARK_FRAMES, ok);
+  TEST_ASSERT_EQUAL_INT32((228 + 240) * (BENCHMARK_FRAMES / 2), sum);
+  TEST_ASSERT_TRUE_MESSAGE(cost <= DECODE_BUDGET_NANOS, "decoding a frame is over budget");
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_dht22_negative_temperature);
+  RUN_TEST(test_frame_without_leading_pulses);
+  RUN_TEST(test_dht11_positive_and_negative_temperature);
+  RUN_TEST(test_checksum_mismatch);
+  RUN_TEST(test_short_frame);
+  RUN_TEST(test_bad_timing);
+  RUN_TEST(test_bit_threshold);
+  RUN_TEST(test_impossible_values_are_out_of_range);
+  RUN_TEST(test_reading_is_rescaled_to_channel_units);
+  RUN_TEST(test_recorded_traces);
+  RUN_TEST(test_decode_cost_of_recorded_traces);
+  return UNITY_END();
+}
@@ -0,0 +1,307 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "GatewayLink.h"
+#include <unity.h>
+
+// Leaves and gateway talk over real UDP on the loopback interface.
+#define GATEWAY_TEST_PORT 47811
+#define LEAF_ADDRESS "127.0.0.1"
+
+#define FIRST_EPOCH 1760000000
+#define LEAF_PERIOD_MILLISECS 2000
+#define LOOP_MILLISECS 10
+
+static SensorSample leafSample(uint16_t board, uint32_t reading)
+{
+  SensorSample sample;
+  sample.value[SENSOR_CHANNEL_TEMPERATURE] = (int16_t)(board * 100 + reading % 100);
+  sample.value[SENSOR_CHANNEL_HUMIDITY] = (int16_t)(400 + reading % 50);
+  return sample;
+}
+
+static GatewayFrame frameOf(uint16_t board, uint16_t sequence, uint32_t boot = 1)
+{
+  GatewayFrame frame;
+  frame.board = board;
+  frame.boot = boot;
+  frame.sequence = sequence;
+  frame.epoch = FIRST_EPOCH + sequence;
+  frame.sample = leafSample(board, sequence);
+  return frame;
+}
+
+struct SiteRun
+{
+  uint32_t sent;
+  uint32_t published;
+  uint32_t batches;
+  uint32_t maxBatchAgeMillis;
+};
+
+/*
+ * loop() of a site: every leaf sends a reading each LEAF_PERIOD_MILLISECS, staggered over the
+ * period, and the gateway services its socket and publishes at most one leaf batch per loop.
+ */
+static SiteRun runSite(uint16_t leafCount, uint32_t durationMillis)
+{
+  SiteRun run;
+  memset(&run, 0, sizeof(run));
+
+  GatewayLink gateway;
+  TEST_ASSERT_TRUE(gateway.BeginGateway(GATEWAY_TEST_PORT));
+
+  static GatewayLink leaves[GATEWAY_MAX_LEAVES];
+  uint32_t readings[GATEWAY_MAX_LEAVES] = { 0 };
+  for (uint16_t i = 0; i < leafCount; i++)
+  {
+    TEST_ASSERT_TRUE(leaves[i].BeginLeaf(LEAF_ADDRESS, GATEWAY_TEST_PORT, (uint16_t)(i + 1)));
+  }
+
+  uint32_t expectedReading[GATEWAY_MAX_LEAVES + 1] = { 0 };
+
+  for (uint32_t now = 0; now < durationMillis; now += LOOP_MILLISECS)
+  {
+    fake_micros = (uint64_t)now * 1000;
+
+    for (uint16_t i = 0; i < leafCount; i++)
+    {
+      uint32_t offset = (uint32_t)i * LEAF_PERIOD_MILLISECS / leafCount / LOOP_MILLISECS * LOOP_MILLISECS;
+      if (now >= offset && (now - offset) % LEAF_PERIOD_MILLISECS == 0)
+      {
+        uint16_t board = (uint16_t)(i + 1);
+        TEST_ASSERT_TRUE(leaves[i].Send(FIRST_EPOCH + now / 1000, leafSample(board, readings[i]++)));
+        run.sent++;
+      }
+    }
+
+    gateway.Service();
+
+    GatewayLeaf* leaf = gateway.NextReady();
+    if (leaf != NULL)
+    {
+      // Each leaf's readings arrive complete and in order.
+      TEST_ASSERT_TRUE(leaf->board >= 1 && leaf->board <= leafCount);
+      for (size_t r = 0; r < leaf->batch.Count(); r++)
+      {
+        SensorSample expected = leafSample(leaf->board, expectedReading[leaf->board]++);
+        TEST_ASSERT_EQUAL_INT16(
+            expected.value[SENSOR_CHANNEL_TEMPERATURE],
+            leaf->batch.Readings()[r].sample.value[SENSOR_CHANNEL_TEMPERATURE]);
+      }
+
+      uint32_t age = now - leaf->batchStartMillis;
+      if (age > run.maxBatchAgeMillis)
+      {
+        run.maxBatchAgeMillis = age;
+      }
+      run.published += (uint32_t)leaf->batch.Count();
+      run.batches++;
+      leaf->batch.Clear();
+    }
+  }
+
+  for (uint16_t i = 0; i < leafCount; i++)
+  {
+    leaves[i].End();
+  }
+
+  // Partial batches go out once they are old enough; then every reading sent has been published.
+  fake_micros += (uint64_t)GATEWAY_BATCH_MAX_AGE_MILLISECS * 1000;
+  gateway.Service();
+  for (GatewayLeaf* leaf = gateway.NextReady(); leaf != NULL; leaf = gateway.NextReady())
+  {
+    run.published += (uint32_t)leaf->batch.Count();
+    leaf->batch.Clear();
+  }
+
+  gateway.End();
+  return run;
+}
+
+void setUp(void) { fake_micros = 0; }
+
+void tearDown(void) {}
+
+void test_full_site_over_udp_loses_nothing(void)
+{
+  SiteRun run = runSite(GATEWAY_MAX_LEAVES, 10 * 60 * 1000);
+
+  TEST_ASSERT_EQUAL_UINT32(GATEWAY_MAX_LEAVES * (10 * 60 * 1000 / LEAF_PERIOD_MILLISECS), run.sent);
+  TEST_ASSERT_EQUAL_UINT32(run.sent, run.published);
+
+  // Batches fill at the leaf rate, and none waits much longer than it takes to fill.
+  TEST_ASSERT_EQUAL_UINT32(run.sent / TELEMETRY_BATCH_SIZE, run.batches);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(
+      (TELEMETRY_BATCH_SIZE - 1) * LEAF_PERIOD_MILLISECS + GATEWAY_MAX_LEAVES * LOOP_MILLISECS,
+      run.maxBatchAgeMillis);
+}
+
+void test_single_leaf_over_udp(void)
+{
+  SiteRun run = runSite(1, 60 * 1000);
+
+  TEST_ASSERT_EQUAL_UINT32(60 * 1000 / LEAF_PERIOD_MILLISECS, run.sent);
+  TEST_ASSERT_EQUAL_UINT32(run.sent, run.published);
+}
+
+void test_frame_round_trip_and_corruption(void)
+{
+  GatewayFrame frame = frameOf(7, 65535, 0xA5C3E10F);
+  uint8_t buffer[GATEWAY_FRAME_SIZE + 1];
+  TEST_ASSERT_EQUAL_size_t(0, GatewayFrameEncode(frame, buffer, GATEWAY_FRAME_SIZE - 1));
+  TEST_ASSERT_EQUAL_size_t(GATEWAY_FRAME_SIZE, GatewayFrameEncode(frame, buffer, sizeof(buffer)));
+
+  GatewayFrame decoded;
+  TEST_ASSERT_EQUAL_INT(GATEWAY_FRAME_OK, GatewayFrameDecode(buffer, GATEWAY_FRAME_SIZE, &decoded));
+  TEST_ASSERT_EQUAL_UINT16(7, decoded.board);
+  TEST_ASSERT_EQUAL_UINT32(0xA5C3E10F, decoded.boot);
+  TEST_ASSERT_EQUAL_UINT16(65535, decoded.sequence);
+  TEST_ASSERT_EQUAL_UINT32(FIRST_EPOCH + 65535, decoded.epoch);
+  TEST_ASSERT_EQUAL_INT16(frame.sample.value[SENSOR_CHANNEL_HUMIDITY], decoded.sample.value[SENSOR_CHANNEL_HUMIDITY]);
+
+  TEST_ASSERT_EQUAL_INT(GATEWAY_FRAME_MALFORMED, GatewayFrameDecode(buffer, GATEWAY_FRAME_SIZE + 1, &decoded));
+  TEST_ASSERT_EQUAL_INT(GATEWAY_FRAME_MALFORMED, GatewayFrameDecode(buffer, GATEWAY_FRAME_SIZE - 1, &decoded));
+
+  buffer[10] ^= 0x40;
+  TEST_ASSERT_EQUAL_INT(GATEWAY_FRAME_CRC, GatewayFrameDecode(buffer, GATEWAY_FRAME_SIZE, &decoded));
+
+  buffer[10] ^= 0x40;
+  buffer[0] = 'X';
+  TEST_ASSERT_EQUAL_INT(GATEWAY_FRAME_MALFORMED, GatewayFrameDecode(buffer, GATEWAY_FRAME_SIZE, &decoded));
+}
+
+void test_merger_counts_gaps_and_drops_duplicates(void)
+{
+  GatewayMerger merger;
+
+  TEST_ASSERT_TRUE(merger.Add(frameOf(3, 100), 0));
+  TEST_ASSERT_TRUE(merger.Add(frameOf(3, 101), 0));
+  TEST_ASSERT_TRUE(merger.Add(frameOf(3, 104), 0)); // 102 and 103 lost
+  TEST_ASSERT_FALSE(merger.Add(frameOf(3, 101), 0)); // Retransmitted
+  TEST_ASSERT_EQUAL_UINT32(1, merger.Duplicates());
+
+  // Far behind the window the leaf is followed from the new sequence, not dropped.
+  TEST_ASSERT_TRUE(merger.Add(frameOf(3, 0), 0));
+
+  TEST_ASSERT_EQUAL_size_t(1, merger.LeafCount());
+  TEST_ASSERT_EQUAL_UINT32(2, merger.Leaf(0)->lost);
+  TEST_ASSERT_EQUAL_UINT32(4, merger.Leaf(0)->frames);
+  TEST_ASSERT_EQUAL_UINT32(0, merger.Leaf(0)->restarts);
+
+  // The sequence wraps without a gap.
+  GatewayMerger wrapping;
+  TEST_ASSERT_TRUE(wrapping.Add(frameOf(4, 65535), 0));
+  TEST_ASSERT_TRUE(wrapping.Add(frameOf(4, 0), 0));
+  TEST_ASSERT_EQUAL_UINT32(0, wrapping.Leaf(0)->lost);
+}
+
+void test_merger_follows_a_leaf_restarted_within_the_duplicate_window(void)
+{
+  GatewayMerger merger;
+
+  // Three frames, then a restart: sequence 0 again, well inside the window behind 3.
+  for (uint16_t i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_TRUE(merger.Add(frameOf(5, i, 1), 0));
+  }
+  TEST_ASSERT_TRUE(merger.Add(frameOf(5, 0, 2), 0));
+  TEST_ASSERT_TRUE(merger.Add(frameOf(5, 1, 2), 0));
+
+  const GatewayLeaf* leaf = merger.Leaf(0);
+  TEST_ASSERT_EQUAL_UINT32(0, merger.Duplicates());
+  TEST_ASSERT_EQUAL_UINT32(1, leaf->restarts);
+  TEST_ASSERT_EQUAL_UINT32(0, leaf->lost);
+  TEST_ASSERT_EQUAL_UINT32(5, leaf->frames);
+  TEST_ASSERT_EQUAL_size_t(5, merger.NextReady(GATEWAY_BATCH_MAX_AGE_MILLISECS)->batch.Count());
+
+  // Within the new boot a retransmission is still a duplicate.
+  TEST_ASSERT_FALSE(merger.Add(frameOf(5, 1, 2), 0));
+  TEST_ASSERT_EQUAL_UINT32(1, merger.Duplicates());
+}
+
+void test_leaf_restart_over_udp(void)
+{
+  GatewayLink gateway;
+  GatewayLink leaf;
+  TEST_ASSERT_TRUE(gateway.BeginGateway(GATEWAY_TEST_PORT));
+
+  // BeginLeaf() again is what the gateway sees of a reboot: a new boot and sequence 0.
+  uint32_t reading = 0;
+  for (int boot = 0; boot < 2; boot++)
+  {
+    TEST_ASSERT_TRUE(leaf.BeginLeaf(LEAF_ADDRESS, GATEWAY_TEST_PORT, 1));
+    for (int i = 0; i < 2; i++, reading++)
+    {
+      TEST_ASSERT_TRUE(leaf.Send(FIRST_EPOCH + reading, leafSample(1, reading)));
+    }
+    gateway.Service();
+  }
+
+  fake_micros += (uint64_t)GATEWAY_BATCH_MAX_AGE_MILLISECS * 1000;
+  GatewayLeaf* ready = gateway.NextReady();
+  TEST_ASSERT_NOT_NULL(ready);
+  TEST_ASSERT_EQUAL_size_t(reading, ready->batch.Count());
+  TEST_ASSERT_EQUAL_UINT32(1, ready->restarts);
+
+  leaf.End();
+  gateway.End();
+}
+
+void test_merger_ages_out_a_slow_leaf_and_round_robins(void)
+{
+  GatewayMerger merger;
+
+  // Leaf 1 fills a batch; leaf 2 sends one reading.
+  for (uint16_t i = 0; i < TELEMETRY_BATCH_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(merger.Add(frameOf(1, i), 0));
+  }
+  TEST_ASSERT_TRUE(merger.Add(frameOf(2, 0), 0));
+
+  GatewayLeaf* leaf = merger.NextReady(0);
+  TEST_ASSERT_NOT_NULL(leaf);
+  TEST_ASSERT_EQUAL_UINT16(1, leaf->board);
+
+  // Leaf 1 keeps its batch full (not yet published); leaf 2's single reading waits for its age.
+  TEST_ASSERT_FALSE(merger.Add(frameOf(1, TELEMETRY_BATCH_SIZE), 0));
+  TEST_ASSERT_EQUAL_UINT32(1, merger.Overflows());
+  TEST_ASSERT_EQUAL_PTR(leaf, merger.NextReady(GATEWAY_BATCH_MAX_AGE_MILLISECS - 1));
+  leaf->batch.Clear();
+  TEST_ASSERT_NULL(merger.NextReady(GATEWAY_BATCH_MAX_AGE_MILLISECS - 1));
+
+  leaf = merger.NextReady(GATEWAY_BATCH_MAX_AGE_MILLISECS);
+  TEST_ASSERT_NOT_NULL(leaf);
+  TEST_ASSERT_EQUAL_UINT16(2, leaf->board);
+  TEST_ASSERT_EQUAL_size_t(1, leaf->batch.Count());
+}
+
+void test_merger_drops_leaves_beyond_its_slots(void)
+{
+  GatewayMerger merger;
+
+  for (uint16_t board = 1; board <= GATEWAY_MAX_LEAVES; board++)
+  {
+    TEST_ASSERT_TRUE(merger.Add(frameOf(board, 0), 0));
+  }
+  TEST_ASSERT_FALSE(merger.Add(frameOf(GATEWAY_MAX_LEAVES + 1, 0), 0));
+  TEST_ASSERT_EQUAL_UINT32(1, merger.Overflows());
+  TEST_ASSERT_EQUAL_size_t(GATEWAY_MAX_LEAVES, merger.LeafCount());
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_full_site_over_udp_loses_nothing);
+  RUN_TEST(test_single_leaf_over_udp);
+  RUN_TEST(test_frame_round_trip_and_corruption);
+  RUN_TEST(test_merger_counts_gaps_and_drops_duplicates);
+  RUN_TEST(test_merger_follows_a_leaf_restarted_within_the_duplicate_window);
+  RUN_TEST(test_leaf_restart_over_udp);
+  RUN_TEST(test_merger_ages_out_a_slow_leaf_and_round_robins);
+  RUN_TEST(test_merger_drops_leaves_beyond_its_slots);
+  return UNITY_END();
+}
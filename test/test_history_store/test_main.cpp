@@ -0,0 +1,298 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "HistoryStore.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+
+#define FIRST_EPOCH 1760000000
+#define SAMPLE_PERIOD_SECS 10
+#define PAGE_READINGS 32
+#define QUERIES 200
+
+// A query reads at most one index stride before its range; a full scan reads the whole history.
+// The margin allows for the host's page cache making the scan cheap.
+#define SCAN_TO_QUERY_MIN_RATIO 20
+
+#if defined(__GLIBC__)
+#define FILE_SIZE_LIMIT_AVAILABLE 1
+#include <signal.h>
+#include <sys/resource.h>
+#endif
+
+static SensorSample sampleAt(uint32_t index)
+{
+  SensorSample sample;
+  sample.value[SENSOR_CHANNEL_TEMPERATURE] = (int16_t)(2000 + index % 1000);
+  sample.value[SENSOR_CHANNEL_HUMIDITY] = (int16_t)(index % 700);
+  return sample;
+}
+
+static uint32_t epochAt(uint32_t index) { return FIRST_EPOCH + index * SAMPLE_PERIOD_SECS; }
+
+// Each test keeps its history in a directory of its own, under $TMPDIR when the path fits.
+static char test_directory[HISTORY_PATH_SIZE];
+static char history_path[HISTORY_PATH_SIZE];
+
+static void makeTestDirectory()
+{
+  const char* base = getenv("TMPDIR");
+  if (base == NULL || strlen(base) + sizeof("/history_XXXXXX/history.0") > sizeof(history_path))
+  {
+    base = "/tmp";
+  }
+
+  snprintf(test_directory, sizeof(test_directory), "%s/history_XXXXXX", base);
+  TEST_ASSERT_NOT_NULL(mkdtemp(test_directory));
+  snprintf(history_path, sizeof(history_path), "%s/history", test_directory);
+}
+
+static void removeTestDirectory()
+{
+  for (int i = 0; i < HISTORY_SEGMENT_COUNT; i++)
+  {
+    char segment_path[HISTORY_PATH_SIZE + 8];
+    snprintf(segment_path, sizeof(segment_path), "%s.%d", history_path, i);
+    remove(segment_path);
+  }
+  rmdir(test_directory);
+}
+
+static void appendReadings(HistoryStore& store, uint32_t first, uint32_t count)
+{
+  for (uint32_t i = first; i < first + count; i++)
+  {
+    TEST_ASSERT_TRUE(store.Append(epochAt(i), sampleAt(i)));
+  }
+  TEST_ASSERT_TRUE(store.Flush());
+}
+
+// Checks that the history holds readings first..first+count-1, in order, with nothing else.
+static void assertHolds(HistoryStore& store, uint32_t first, uint32_t count)
+{
+  TEST_ASSERT_EQUAL_UINT32(count, store.Count());
+
+  HistoryQuery query;
+  TEST_ASSERT_TRUE(store.Seek(query, 0, UINT32_MAX, 0));
+
+  uint32_t next = first;
+  BatchedReading readings[PAGE_READINGS];
+  while (!query.done)
+  {
+    size_t read = store.Read(query, readings, PAGE_READINGS);
+    for (size_t i = 0; i < read; i++, next++)
+    {
+      TEST_ASSERT_EQUAL_UINT32(epochAt(next), readings[i].epoch);
+      TEST_ASSERT_EQUAL_INT16(
+          sampleAt(next).value[SENSOR_CHANNEL_HUMIDITY], readings[i].sample.value[SENSOR_CHANNEL_HUMIDITY]);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(first + count, next);
+}
+
+static double elapsedMicros(std::chrono::steady_clock::time_point start)
+{
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+             .count()
+      / 1000;
+}
+
+void setUp(void) { makeTestDirectory(); }
+
+void tearDown(void) { removeTestDirectory(); }
+
+void test_readings_survive_reopening(void)
+{
+  {
+    HistoryStore store;
+    TEST_ASSERT_TRUE(store.Begin(history_path));
+    appendReadings(store, 0, 1000);
+    TEST_ASSERT_FALSE(store.Append(epochAt(10), sampleAt(10))); // The clock went backwards.
+    store.End();
+  }
+
+  HistoryStore store;
+  TEST_ASSERT_TRUE(store.Begin(history_path));
+  assertHolds(store, 0, 1000);
+  TEST_ASSERT_EQUAL_UINT32(epochAt(0), store.OldestEpoch());
+  TEST_ASSERT_EQUAL_UINT32(epochAt(999), store.NewestEpoch());
+}
+
+void test_failed_flush_rolls_back_to_what_reached_the_file(void)
+{
+#ifndef FILE_SIZE_LIMIT_AVAILABLE
+  TEST_IGNORE_MESSAGE("the file size limit can only be set on glibc");
+#else
+  HistoryStore store;
+  TEST_ASSERT_TRUE(store.Begin(history_path));
+  appendReadings(store, 0, 100);
+
+  // A full filesystem: room for two and a half more records in the head segment.
+  struct rlimit original;
+  TEST_ASSERT_EQUAL_INT(0, getrlimit(RLIMIT_FSIZE, &original));
+  struct rlimit full = original;
+  full.rlim_cur = 8 + 102 * HISTORY_RECORD_SIZE + HISTORY_RECORD_SIZE / 2;
+  void (*previous_handler)(int) = signal(SIGXFSZ, SIG_IGN);
+  TEST_ASSERT_EQUAL_INT(0, setrlimit(RLIMIT_FSIZE, &full));
+
+  bool appended = true;
+  for (uint32_t i = 100; i < 100 + HISTORY_BUFFER_RECORDS; i++)
+  {
+    appended = store.Append(epochAt(i), sampleAt(i)) && appended;
+  }
+
+  (void)setrlimit(RLIMIT_FSIZE, &original);
+  signal(SIGXFSZ, previous_handler);
+
+  // The flush of the full buffer failed; only the records that reached the file are counted.
+  TEST_ASSERT_FALSE(appended);
+  TEST_ASSERT_EQUAL_UINT32(102, store.Count());
+  TEST_ASSERT_EQUAL_UINT32(epochAt(101), store.NewestEpoch());
+
+  // With space again, appending continues right after them, over the torn record.
+  appendReadings(store, 102, 50);
+  assertHolds(store, 0, 152);
+  store.End();
+
+  HistoryStore reopened;
+  TEST_ASSERT_TRUE(reopened.Begin(history_path));
+  assertHolds(reopened, 0, 152);
+#endif
+}
+
+void test_query_latency_over_a_multi_megabyte_history(void)
+{
+  // Fill every segment and half of a wrapped one, so the oldest readings have been dropped.
+  const uint32_t appended = HISTORY_SEGMENT_COUNT * HISTORY_SEGMENT_RECORDS + HISTORY_SEGMENT_RECORDS / 2;
+  const uint32_t held = appended - HISTORY_SEGMENT_RECORDS;
+  const uint32_t oldest = appended - held;
+
+  {
+    HistoryStore writer;
+    TEST_ASSERT_TRUE(writer.Begin(history_path));
+    appendReadings(writer, 0, appended);
+    writer.End();
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  HistoryStore store;
+  TEST_ASSERT_TRUE(store.Begin(history_path));
+  double begin_micros = elapsedMicros(start);
+
+  TEST_ASSERT_EQUAL_UINT32(held, store.Count());
+  TEST_ASSERT_EQUAL_UINT32(epochAt(oldest), store.OldestEpoch());
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(2 * 1024 * 1024, held * HISTORY_RECORD_SIZE);
+
+  // One page from a pseudo-random point of the history, as a getHistory call does.
+  BatchedReading readings[PAGE_READINGS];
+  uint32_t seed = 1;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < QUERIES; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    uint32_t first = oldest + (seed >> 8) % (held - PAGE_READINGS);
+
+    HistoryQuery query;
+    TEST_ASSERT_TRUE(store.Seek(query, epochAt(first), epochAt(first + PAGE_READINGS - 1), 0));
+    TEST_ASSERT_EQUAL_size_t(PAGE_READINGS, store.Read(query, readings, PAGE_READINGS));
+    TEST_ASSERT_EQUAL_UINT32(epochAt(first), readings[0].epoch);
+    TEST_ASSERT_EQUAL_UINT32(epochAt(first + PAGE_READINGS - 1), readings[PAGE_READINGS - 1].epoch);
+  }
+  double query_micros = elapsedMicros(start) / QUERIES;
+
+  // Without the index a query would read from the oldest record on; time the whole history.
+  start = std::chrono::steady_clock::now();
+  HistoryQuery scan;
+  TEST_ASSERT_TRUE(store.Seek(scan, 0, UINT32_MAX, 0));
+  uint32_t scanned = 0;
+  while (!scan.done)
+  {
+    scanned += (uint32_t)store.Read(scan, readings, PAGE_READINGS);
+  }
+  double scan_micros = elapsedMicros(start);
+  TEST_ASSERT_EQUAL_UINT32(held, scanned);
+
+  char message[128];
+  snprintf(
+      message,
+      sizeof(message),
+      "%u KB history: open %.0f us, page query %.1f us, full scan %.0f us",
+      (unsigned)(held * HISTORY_RECORD_SIZE / 1024),
+      begin_micros,
+      query_micros,
+      scan_micros);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_TRUE_MESSAGE(
+      query_micros * SCAN_TO_QUERY_MIN_RATIO < scan_micros, "a page query costs as much as a scan");
+}
+
+void test_paged_query_continues_after_its_segment_is_rotated_out(void)
+{
+  HistoryStore store;
+  TEST_ASSERT_TRUE(store.Begin(history_path));
+  const uint32_t full = HISTORY_SEGMENT_COUNT * HISTORY_SEGMENT_RECORDS;
+  appendReadings(store, 0, full);
+
+  HistoryQuery query;
+  TEST_ASSERT_TRUE(store.Seek(query, 0, UINT32_MAX, 0));
+  BatchedReading readings[PAGE_READINGS];
+  TEST_ASSERT_EQUAL_size_t(PAGE_READINGS, store.Read(query, readings, PAGE_READINGS));
+
+  // Between two pages, the next reading empties the oldest segment, the one being read.
+  TEST_ASSERT_TRUE(store.Append(epochAt(full), sampleAt(full)));
+  TEST_ASSERT_EQUAL_UINT32(epochAt(HISTORY_SEGMENT_RECORDS), store.OldestEpoch());
+
+  // The rest of the query starts at the oldest reading still held and ends with the new one.
+  uint32_t next = HISTORY_SEGMENT_RECORDS;
+  while (!query.done)
+  {
+    size_t read = store.Read(query, readings, PAGE_READINGS);
+    for (size_t i = 0; i < read; i++, next++)
+    {
+      TEST_ASSERT_EQUAL_UINT32(epochAt(next), readings[i].epoch);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(full + 1, next);
+}
+
+void test_averaged_query_buckets_the_range(void)
+{
+  HistoryStore store;
+  TEST_ASSERT_TRUE(store.Begin(history_path));
+  appendReadings(store, 0, 600);
+
+  // Ten minutes from a whole minute (reading 4), one averaged reading per minute of six samples.
+  HistoryQuery query;
+  TEST_ASSERT_EQUAL_UINT32(0, epochAt(4) % 60);
+  TEST_ASSERT_TRUE(store.Seek(query, epochAt(4), epochAt(63), 60));
+  BatchedReading readings[PAGE_READINGS];
+  size_t read = store.Read(query, readings, PAGE_READINGS);
+
+  TEST_ASSERT_TRUE(query.done);
+  TEST_ASSERT_EQUAL_size_t(10, read);
+  for (size_t i = 0; i < read; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(epochAt(4 + 6 * i), readings[i].epoch);
+    // The mean of six consecutive values, x.5, rounds up.
+    TEST_ASSERT_EQUAL_INT16(2000 + 4 + 6 * i + 3, readings[i].sample.value[SENSOR_CHANNEL_TEMPERATURE]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_readings_survive_reopening);
+  RUN_TEST(test_failed_flush_rolls_back_to_what_reached_the_file);
+  RUN_TEST(test_query_latency_over_a_multi_megabyte_history);
+  RUN_TEST(test_paged_query_continues_after_its_segment_is_rotated_out);
+  RUN_TEST(test_averaged_query_buckets_the_range);
+  return UNITY_END();
+}
@@ -0,0 +1,87 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "LatencyTracer.h"
+#include <unity.h>
+
+// Longest span representable in the 32-bit cycle count ("cycles" are nanoseconds on the host).
+#define MAX_SPAN_MICROS (UINT32_MAX / 1000)
+
+static LatencyTracer tracer;
+
+void setUp(void) { tracer.Clear(); }
+
+void tearDown(void) {}
+
+void test_span_timed_in_micros_keeps_its_length(void)
+{
+  tracer.RecordMicros(TRACE_STAGE_MQTT_CONNECT, 1000, 1000 + 1500000);
+
+  TraceStageSummary summary;
+  tracer.GetSummary(TRACE_STAGE_MQTT_CONNECT, &summary);
+  TEST_ASSERT_EQUAL_UINT32(1, summary.count);
+  TEST_ASSERT_EQUAL_UINT32(1500000, summary.maxCycles / LatencyTracer::CyclesPerMicro());
+}
+
+void test_span_across_the_micros_rollover(void)
+{
+  tracer.RecordMicros(TRACE_STAGE_MQTT_CONNECT, UINT32_MAX - 999, 1000);
+
+  TraceStageSummary summary;
+  tracer.GetSummary(TRACE_STAGE_MQTT_CONNECT, &summary);
+  TEST_ASSERT_EQUAL_UINT32(2000, summary.maxCycles / LatencyTracer::CyclesPerMicro());
+}
+
+void test_span_longer_than_the_cycle_counter_saturates(void)
+{
+  // A connect stuck in TCP retries for a minute must not wrap around to a short span.
+  tracer.RecordMicros(TRACE_STAGE_MQTT_CONNECT, 0, 60000000);
+
+  TraceStageSummary summary;
+  tracer.GetSummary(TRACE_STAGE_MQTT_CONNECT, &summary);
+  TEST_ASSERT_EQUAL_UINT32(MAX_SPAN_MICROS, summary.maxCycles / LatencyTracer::CyclesPerMicro());
+  TEST_ASSERT_EQUAL_UINT32(1, summary.histogram[TRACE_HISTOGRAM_BUCKETS - 1]);
+}
+
+void test_ack_latency_uses_the_same_clock(void)
+{
+  uint32_t before = LatencyTracer::Micros();
+  tracer.BeginAck(7);
+  tracer.EndAck(8); // Not in flight; ignored.
+  tracer.EndAck(7);
+  uint32_t after = LatencyTracer::Micros();
+
+  TraceStageSummary summary;
+  tracer.GetSummary(TRACE_STAGE_MQTT_ACK, &summary);
+  TEST_ASSERT_EQUAL_UINT32(1, summary.count);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(after - before, summary.maxCycles / LatencyTracer::CyclesPerMicro());
+}
+
+void test_micros_scope_records_one_span(void)
+{
+  Tracer.Clear();
+  uint32_t before = LatencyTracer::Micros();
+  {
+    TraceMicrosScope trace(TRACE_STAGE_MQTT_EVENT);
+  }
+  uint32_t after = LatencyTracer::Micros();
+
+  TraceStageSummary summary;
+  Tracer.GetSummary(TRACE_STAGE_MQTT_EVENT, &summary);
+  TEST_ASSERT_EQUAL_UINT32(1, summary.count);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(after - before, summary.maxCycles / LatencyTracer::CyclesPerMicro());
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_span_timed_in_micros_keeps_its_length);
+  RUN_TEST(test_span_across_the_micros_rollover);
+  RUN_TEST(test_span_longer_than_the_cycle_counter_saturates);
+  RUN_TEST(test_ack_latency_uses_the_same_clock);
+  RUN_TEST(test_micros_scope_records_one_span);
+  return UNITY_END();
+}
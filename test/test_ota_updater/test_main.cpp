@@ -0,0 +1,366 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "OtaUpdater.h"
+#include <Preferences.h>
+#include <chrono>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <unity.h>
+
+
+// Three whole sectors and a partial one; chunk sizes do not line up with sectors.
+#define IMAGE_SIZE (3 * SPI_FLASH_SEC_SIZE + 1234)
+#define CHUNK_SIZE 1000
+
+// A typical application image, for the throughput and resume timings.
+#define BENCHMARK_IMAGE_SIZE (1024 * 1024)
+
+static uint8_t image[IMAGE_SIZE];
+static uint8_t image_digest[OTA_DIGEST_SIZE];
+
+static void buildImage(uint8_t* data, size_t size, uint8_t digest[OTA_DIGEST_SIZE])
+{
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < size; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (uint8_t)(seed >> 16);
+  }
+  data[0] = FAKE_ESP_IMAGE_MAGIC;
+  (void)mbedtls_sha256_ret(data, size, digest, 0);
+}
+
+// Sends chunks from the updater's offset, as the cloud does after each type=ota reply, until end.
+static bool sendChunks(
+    OtaUpdater& updater,
+    const uint8_t* data,
+    uint32_t size,
+    const uint8_t digest[OTA_DIGEST_SIZE],
+    uint32_t end)
+{
+  while (updater.Offset() < end && updater.State() != OTA_STATE_FAILED)
+  {
+    uint32_t offset = updater.Offset();
+    uint32_t length = end - offset < CHUNK_SIZE ? end - offset : CHUNK_SIZE;
+    if (!updater.Write(size, digest, offset, data + offset, length))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool sendImage(OtaUpdater& updater, uint32_t end)
+{
+  return sendChunks(updater, image, IMAGE_SIZE, image_digest, end);
+}
+
+// Each test keeps its flash image in a directory of its own, under $TMPDIR.
+static char test_directory[256];
+static char flash_path[sizeof(test_directory) + sizeof("/flash.bin")];
+
+static void makeTestDirectory()
+{
+  const char* base = getenv("TMPDIR");
+  snprintf(test_directory, sizeof(test_directory), "%s/ota_XXXXXX", base != NULL ? base : "/tmp");
+  TEST_ASSERT_NOT_NULL(mkdtemp(test_directory));
+  snprintf(flash_path, sizeof(flash_path), "%s/flash.bin", test_directory);
+}
+
+static double elapsedMicros(std::chrono::steady_clock::time_point start)
+{
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+             .count()
+      / 1000;
+}
+
+// Restart with whatever otadata selects, then run the sketch's setup() call.
+static void reboot(OtaUpdater& updater)
+{
+  fakeOtaBoot();
+  updater = OtaUpdater();
+  updater.Begin();
+}
+
+// The image the device shipped with, running from app0.
+static void flashFactoryImage()
+{
+  static const uint8_t header[] = { FAKE_ESP_IMAGE_MAGIC, 0x03, 0x02, 0x20 };
+  TEST_ASSERT_EQUAL_INT(ESP_OK, esp_partition_erase_range(&fake_app_partitions[0], 0, SPI_FLASH_SEC_SIZE));
+  TEST_ASSERT_EQUAL_INT(ESP_OK, esp_partition_write(&fake_app_partitions[0], 0, header, sizeof(header)));
+}
+
+static bool flashHoldsImage()
+{
+  static uint8_t flash[IMAGE_SIZE];
+  return esp_partition_read(&fake_app_partitions[1], 0, flash, IMAGE_SIZE) == ESP_OK
+      && memcmp(flash, image, IMAGE_SIZE) == 0;
+}
+
+void setUp(void)
+{
+  buildImage(image, IMAGE_SIZE, image_digest);
+  makeTestDirectory();
+  fake_flash_path = flash_path;
+  fake_flash_fail_at = UINT32_MAX;
+  fake_nvs.clear();
+  fake_micros = 0;
+  fake_running_slot = 0;
+  fake_boot_slot = 0;
+  fake_rollback_cancels = 0;
+  fake_restarts = 0;
+  flashFactoryImage();
+}
+
+void tearDown(void)
+{
+  remove(flash_path);
+  rmdir(test_directory);
+}
+
+void test_complete_image_is_verified_and_made_bootable(void)
+{
+  OtaUpdater updater;
+  updater.Begin();
+  TEST_ASSERT_FALSE(updater.IsTrialBoot());
+
+  TEST_ASSERT_TRUE(sendImage(updater, IMAGE_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_READY, updater.State());
+  TEST_ASSERT_EQUAL_INT(1, fake_boot_slot);
+  TEST_ASSERT_TRUE(flashHoldsImage());
+
+  // Further chunks are refused until the restart.
+  TEST_ASSERT_FALSE(updater.Write(IMAGE_SIZE, image_digest, 0, image, CHUNK_SIZE));
+}
+
+void test_download_resumes_from_the_last_sector_after_reboot(void)
+{
+  OtaUpdater updater;
+  updater.Begin();
+
+  // Power lost mid-way through the third sector, after a partial write into it.
+  TEST_ASSERT_TRUE(sendImage(updater, 2 * SPI_FLASH_SEC_SIZE + 1500));
+  reboot(updater);
+
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_RECEIVING, updater.State());
+  TEST_ASSERT_EQUAL_UINT32(2 * SPI_FLASH_SEC_SIZE, updater.Offset());
+  TEST_ASSERT_EQUAL_UINT32(IMAGE_SIZE, updater.Size());
+  TEST_ASSERT_EQUAL_INT(0, fake_restarts);
+
+  // The hash rebuilt from flash must match, or the finished image would be rejected.
+  TEST_ASSERT_TRUE(sendImage(updater, IMAGE_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_READY, updater.State());
+  TEST_ASSERT_EQUAL_INT(1, fake_boot_slot);
+
+  // The partly written sector was erased again before the resumed writes.
+  TEST_ASSERT_TRUE(flashHoldsImage());
+}
+
+void test_resume_survives_a_second_reboot_at_a_sector_boundary(void)
+{
+  OtaUpdater updater;
+  updater.Begin();
+
+  TEST_ASSERT_TRUE(sendImage(updater, 5000));
+  reboot(updater);
+  TEST_ASSERT_EQUAL_UINT32(SPI_FLASH_SEC_SIZE, updater.Offset());
+
+  TEST_ASSERT_TRUE(sendImage(updater, 3 * SPI_FLASH_SEC_SIZE + 100));
+  reboot(updater);
+  TEST_ASSERT_EQUAL_UINT32(3 * SPI_FLASH_SEC_SIZE, updater.Offset());
+
+  TEST_ASSERT_TRUE(sendImage(updater, IMAGE_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_READY, updater.State());
+  TEST_ASSERT_TRUE(flashHoldsImage());
+}
+
+void test_chunk_out_of_order_is_refused_without_losing_progress(void)
+{
+  OtaUpdater updater;
+  updater.Begin();
+  TEST_ASSERT_TRUE(sendImage(updater, 2 * CHUNK_SIZE));
+
+  TEST_ASSERT_FALSE(updater.Write(IMAGE_SIZE, image_digest, 3 * CHUNK_SIZE, image, CHUNK_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_RECEIVING, updater.State());
+  TEST_ASSERT_EQUAL_UINT32(2 * CHUNK_SIZE, updater.Offset());
+
+  TEST_ASSERT_TRUE(sendImage(updater, IMAGE_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_READY, updater.State());
+}
+
+void test_chunk_past_the_end_fails_the_download(void)
+{
+  OtaUpdater updater;
+  updater.Begin();
+  TEST_ASSERT_TRUE(sendImage(updater, 3 * SPI_FLASH_SEC_SIZE));
+
+  uint32_t offset = updater.Offset();
+  TEST_ASSERT_FALSE(updater.Write(IMAGE_SIZE, image_digest, offset, image + offset, IMAGE_SIZE - offset + 1));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_FAILED, updater.State());
+  TEST_ASSERT_EQUAL_INT(0, fake_boot_slot);
+
+  // The progress is gone, so a reboot does not resume into the bad download...
+  reboot(updater);
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_IDLE, updater.State());
+
+  // ...and the sender starts over from 0.
+  TEST_ASSERT_FALSE(updater.Write(IMAGE_SIZE, image_digest, offset, image + offset, CHUNK_SIZE));
+  TEST_ASSERT_TRUE(sendImage(updater, IMAGE_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_READY, updater.State());
+}
+
+void test_digest_mismatch_is_not_made_bootable(void)
+{
+  image_digest[0] ^= 0x01;
+
+  OtaUpdater updater;
+  updater.Begin();
+  TEST_ASSERT_FALSE(sendImage(updater, IMAGE_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_FAILED, updater.State());
+  TEST_ASSERT_EQUAL_INT(0, fake_boot_slot);
+}
+
+void test_flash_write_error_fails_the_download(void)
+{
+  fake_flash_fail_at = fake_app_partitions[1].address + SPI_FLASH_SEC_SIZE + 10;
+
+  OtaUpdater updater;
+  updater.Begin();
+  TEST_ASSERT_FALSE(sendImage(updater, IMAGE_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_FAILED, updater.State());
+
+  reboot(updater);
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_IDLE, updater.State());
+}
+
+void test_unconfirmed_image_is_rolled_back_after_the_boot_attempts(void)
+{
+  OtaUpdater updater;
+  updater.Begin();
+  TEST_ASSERT_TRUE(sendImage(updater, IMAGE_SIZE));
+
+  // The new image keeps failing to reach IoT Hub.
+  for (int boot = 1; boot <= OTA_BOOT_ATTEMPTS; boot++)
+  {
+    reboot(updater);
+    TEST_ASSERT_EQUAL_INT(1, fake_running_slot);
+    TEST_ASSERT_TRUE(updater.IsTrialBoot());
+    TEST_ASSERT_EQUAL_INT(0, fake_restarts);
+  }
+
+  reboot(updater);
+  TEST_ASSERT_EQUAL_INT(1, fake_restarts);
+  TEST_ASSERT_EQUAL_INT(0, fake_boot_slot);
+  TEST_ASSERT_EQUAL_INT(0, fake_rollback_cancels);
+
+  // Back on the previous image, which is not on trial.
+  reboot(updater);
+  TEST_ASSERT_EQUAL_INT(0, fake_running_slot);
+  TEST_ASSERT_FALSE(updater.IsTrialBoot());
+}
+
+void test_confirmed_image_is_kept(void)
+{
+  OtaUpdater updater;
+  updater.Begin();
+  TEST_ASSERT_TRUE(sendImage(updater, IMAGE_SIZE));
+
+  reboot(updater);
+  TEST_ASSERT_TRUE(updater.IsTrialBoot());
+  updater.Confirm();
+  TEST_ASSERT_FALSE(updater.IsTrialBoot());
+  TEST_ASSERT_EQUAL_INT(1, fake_rollback_cancels);
+
+  for (int boot = 0; boot <= OTA_BOOT_ATTEMPTS; boot++)
+  {
+    reboot(updater);
+    TEST_ASSERT_FALSE(updater.IsTrialBoot());
+  }
+  TEST_ASSERT_EQUAL_INT(0, fake_restarts);
+  TEST_ASSERT_EQUAL_INT(1, fake_running_slot);
+}
+
+void test_trial_image_restarts_when_it_does_not_connect_in_time(void)
+{
+  OtaUpdater updater;
+  updater.Begin();
+  TEST_ASSERT_TRUE(sendImage(updater, IMAGE_SIZE));
+  reboot(updater);
+
+  fake_micros = (uint64_t)OTA_CONFIRM_TIMEOUT_MILLISECS * 1000;
+  updater.Service();
+  TEST_ASSERT_EQUAL_INT(0, fake_restarts);
+
+  fake_micros += 1000;
+  updater.Service();
+  TEST_ASSERT_EQUAL_INT(1, fake_restarts);
+}
+
+void test_throughput_and_resume_time_of_a_full_size_image(void)
+{
+  static uint8_t large_image[BENCHMARK_IMAGE_SIZE];
+  uint8_t large_digest[OTA_DIGEST_SIZE];
+  buildImage(large_image, BENCHMARK_IMAGE_SIZE, large_digest);
+
+  OtaUpdater updater;
+  updater.Begin();
+
+  // Every chunk is hashed, written, and its progress saved; sectors are erased as they are reached.
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  TEST_ASSERT_TRUE(sendChunks(updater, large_image, BENCHMARK_IMAGE_SIZE, large_digest, BENCHMARK_IMAGE_SIZE));
+  double send_micros = elapsedMicros(start);
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_READY, updater.State());
+
+  // Again from the factory image, with a reboot half-way: Begin() re-reads and re-hashes
+  // everything written so far.
+  fake_nvs.clear();
+  fake_boot_slot = 0;
+  updater = OtaUpdater();
+  updater.Begin();
+  TEST_ASSERT_TRUE(sendChunks(updater, large_image, BENCHMARK_IMAGE_SIZE, large_digest, BENCHMARK_IMAGE_SIZE / 2));
+  fakeOtaBoot();
+  updater = OtaUpdater();
+  start = std::chrono::steady_clock::now();
+  updater.Begin();
+  double resume_micros = elapsedMicros(start);
+  TEST_ASSERT_EQUAL_UINT32(BENCHMARK_IMAGE_SIZE / 2, updater.Offset());
+
+  char message[128];
+  snprintf(
+      message,
+      sizeof(message),
+      "%u KB image in %u-byte chunks: %.0f KB/s; resume at %u KB: %.0f us",
+      (unsigned)(BENCHMARK_IMAGE_SIZE / 1024),
+      (unsigned)CHUNK_SIZE,
+      BENCHMARK_IMAGE_SIZE / 1024 / (send_micros / 1000000),
+      (unsigned)(BENCHMARK_IMAGE_SIZE / 2 / 1024),
+      resume_micros);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_TRUE(sendChunks(updater, large_image, BENCHMARK_IMAGE_SIZE, large_digest, BENCHMARK_IMAGE_SIZE));
+  TEST_ASSERT_EQUAL_INT(OTA_STATE_READY, updater.State());
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_complete_image_is_verified_and_made_bootable);
+  RUN_TEST(test_download_resumes_from_the_last_sector_after_reboot);
+  RUN_TEST(test_resume_survives_a_second_reboot_at_a_sector_boundary);
+  RUN_TEST(test_chunk_out_of_order_is_refused_without_losing_progress);
+  RUN_TEST(test_chunk_past_the_end_fails_the_download);
+  RUN_TEST(test_digest_mismatch_is_not_made_bootable);
+  RUN_TEST(test_flash_write_error_fails_the_download);
+  RUN_TEST(test_unconfirmed_image_is_rolled_back_after_the_boot_attempts);
+  RUN_TEST(test_confirmed_image_is_kept);
+  RUN_TEST(test_trial_image_restarts_when_it_does_not_connect_in_time);
+  RUN_TEST(test_throughput_and_resume_time_of_a_full_size_image);
+  return UNITY_END();
+}
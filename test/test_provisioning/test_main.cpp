@@ -0,0 +1,377 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "AzIoTProvisioning.h"
+#include "ReprovisionBackoff.h"
+#include <Preferences.h>
+#include <mqtt_client.h>
+#include <stdio.h>
+#include <string>
+#include <unity.h>
+
+#define DPS_ENDPOINT "global.azure-devices-provisioning.net"
+#define ID_SCOPE "0ne00000001"
+#define REGISTRATION_ID "sensor-17"
+#define DEVICE_KEY "c2FtcGxlLWRldmljZS1rZXktZm9yLXRlc3RzLTAxMjM="
+#define ASSIGNED_HUB "site-b.azure-devices.net"
+#define REGISTRATION_TIMEOUT_MILLISECS 60000
+
+#define REGISTER_TOPIC_PREFIX "$dps/registrations/PUT/iotdps-register/"
+#define QUERY_TOPIC_PREFIX "$dps/registrations/GET/iotdps-get-operationstatus/"
+#define OPERATION_ID "4.0a1b2c3d4e5f6a7b.00000000-1111-2222-3333-444444444444"
+
+static bool startsWith(const std::string& text, const char* prefix)
+{
+  return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+/*
+ * Local stand-in for the Device Provisioning Service: answers the register and
+ * operation-status requests with the topics and payloads DPS sends, keeping the
+ * device polling for a configurable number of "assigning" rounds.
+ */
+class DpsStandIn : public FakeMqttBroker
+{
+public:
+  DpsStandIn()
+  {
+    this->refusal = MQTT_CONNECTION_ACCEPTED;
+    this->assigningResponses = 1;
+    this->retryAfterSeconds = 3;
+    this->silent = false;
+    this->failRegistration = false;
+    this->connects = 0;
+    this->registrations = 0;
+    this->queries = 0;
+  }
+
+  esp_mqtt_connect_return_code_t Connect(const esp_mqtt_client_config_t& config) override
+  {
+    this->connects++;
+    this->uri = config.uri != NULL ? config.uri : "";
+    this->port = config.port;
+    this->username = config.username != NULL ? config.username : "";
+    this->password = config.password != NULL ? config.password : "";
+    return this->refusal;
+  }
+
+  void Publish(esp_mqtt_client_handle_t client, const std::string& topic, const std::string& payload)
+      override
+  {
+    if (startsWith(topic, REGISTER_TOPIC_PREFIX))
+    {
+      this->registrations++;
+      this->registerPayload = payload;
+    }
+    else if (startsWith(topic, QUERY_TOPIC_PREFIX))
+    {
+      this->queries++;
+      this->queriedOperation = topic.substr(topic.find("operationId=") + strlen("operationId="));
+    }
+    else
+    {
+      return;
+    }
+
+    if (this->silent)
+    {
+      return;
+    }
+
+    if (this->failRegistration)
+    {
+      FakeMqttDeliver(
+          client,
+          "$dps/registrations/res/401/?$rid=1",
+          "{\"errorCode\":401002,\"trackingId\":\"8ad0463c\",\"message\":\"The device is unauthorized.\"}");
+    }
+    else if (this->assigningResponses > 0)
+    {
+      this->assigningResponses--;
+      FakeMqttDeliver(
+          client,
+          "$dps/registrations/res/202/?$rid=1&retry-after=" + std::to_string(this->retryAfterSeconds),
+          "{\"operationId\":\"" OPERATION_ID "\",\"status\":\"assigning\"}");
+    }
+    else
+    {
+      FakeMqttDeliver(
+          client,
+          "$dps/registrations/res/200/?$rid=1",
+          "{\"operationId\":\"" OPERATION_ID "\",\"status\":\"assigned\",\"registrationState\":{"
+          "\"registrationId\":\"" REGISTRATION_ID "\",\"assignedHub\":\"" ASSIGNED_HUB "\","
+          "\"deviceId\":\"" REGISTRATION_ID "\",\"status\":\"assigned\",\"substatus\":"
+          "\"initialAssignment\",\"etag\":\"IjAwMDAi\"}}");
+    }
+  }
+
+  esp_mqtt_connect_return_code_t refusal;
+  int assigningResponses;
+  uint32_t retryAfterSeconds;
+  bool silent;
+  bool failRegistration;
+
+  int connects;
+  int registrations;
+  int queries;
+  std::string uri;
+  uint32_t port;
+  std::string username;
+  std::string password;
+  std::string registerPayload;
+  std::string queriedOperation;
+};
+
+static DpsStandIn* dps;
+static char hostname[DPS_HOSTNAME_BUFFER_SIZE];
+static char device_id[DPS_DEVICE_ID_BUFFER_SIZE];
+
+void setUp(void)
+{
+  fake_nvs.clear();
+  fake_micros = 0;
+  dps = new DpsStandIn();
+  fake_mqtt_broker = dps;
+  hostname[0] = '\0';
+  device_id[0] = '\0';
+}
+
+void tearDown(void)
+{
+  fake_mqtt_broker = NULL;
+  delete dps;
+  TEST_ASSERT_EQUAL_size_t_MESSAGE(0, fake_mqtt_clients.size(), "DPS MQTT client left behind");
+}
+
+void test_cold_boot_registers_polls_and_caches_the_assignment(void)
+{
+  dps->assigningResponses = 2;
+  AzIoTProvisioning provisioning(DPS_ENDPOINT, ID_SCOPE, REGISTRATION_ID, DEVICE_KEY);
+
+  TEST_ASSERT_FALSE(provisioning.LoadAssignment(hostname, sizeof(hostname), device_id, sizeof(device_id)));
+
+  unsigned long start = millis();
+  TEST_ASSERT_EQUAL_INT(
+      0,
+      provisioning.Register(
+          hostname, sizeof(hostname), device_id, sizeof(device_id), REGISTRATION_TIMEOUT_MILLISECS));
+  unsigned long elapsed = millis() - start;
+
+  TEST_ASSERT_EQUAL_STRING(ASSIGNED_HUB, hostname);
+  TEST_ASSERT_EQUAL_STRING(REGISTRATION_ID, device_id);
+
+  TEST_ASSERT_EQUAL_INT(1, dps->connects);
+  TEST_ASSERT_EQUAL_STRING("mqtts://" DPS_ENDPOINT, dps->uri.c_str());
+  TEST_ASSERT_EQUAL_UINT32(8883, dps->port);
+  TEST_ASSERT_TRUE(startsWith(dps->username, ID_SCOPE "/registrations/" REGISTRATION_ID "/"));
+  TEST_ASSERT_TRUE(startsWith(dps->password, "SharedAccessSignature sr="));
+  TEST_ASSERT_EQUAL_STRING("{\"registrationId\":\"" REGISTRATION_ID "\"}", dps->registerPayload.c_str());
+  TEST_ASSERT_EQUAL_INT(1, dps->registrations);
+  TEST_ASSERT_EQUAL_INT(2, dps->queries);
+  TEST_ASSERT_EQUAL_STRING(OPERATION_ID, dps->queriedOperation.c_str());
+
+  // Each "assigning" answer is followed by the retry-after wait DPS asked for.
+  TEST_ASSERT_GREATER_OR_EQUAL(2 * dps->retryAfterSeconds * 1000, elapsed);
+  TEST_ASSERT_LESS_THAN(REGISTRATION_TIMEOUT_MILLISECS, elapsed);
+
+  char message[96];
+  snprintf(message, sizeof(message), "cold boot: DPS assignment after %lu ms", elapsed);
+  TEST_MESSAGE(message);
+}
+
+void test_warm_boot_uses_the_cached_assignment_without_dps(void)
+{
+  {
+    AzIoTProvisioning provisioning(DPS_ENDPOINT, ID_SCOPE, REGISTRATION_ID, DEVICE_KEY);
+    TEST_ASSERT_EQUAL_INT(
+        0,
+        provisioning.Register(
+            hostname, sizeof(hostname), device_id, sizeof(device_id), REGISTRATION_TIMEOUT_MILLISECS));
+  }
+
+  // A reboot: new objects, same NVS.
+  int connects = dps->connects;
+  hostname[0] = '\0';
+  device_id[0] = '\0';
+  AzIoTProvisioning provisioning(DPS_ENDPOINT, ID_SCOPE, REGISTRATION_ID, DEVICE_KEY);
+
+  unsigned long start = millis();
+  TEST_ASSERT_TRUE(provisioning.LoadAssignment(hostname, sizeof(hostname), device_id, sizeof(device_id)));
+  TEST_ASSERT_EQUAL_UINT32(0, millis() - start);
+
+  TEST_ASSERT_EQUAL_STRING(ASSIGNED_HUB, hostname);
+  TEST_ASSERT_EQUAL_STRING(REGISTRATION_ID, device_id);
+  TEST_ASSERT_EQUAL_INT(connects, dps->connects);
+}
+
+void test_assignment_cached_for_another_scope_is_stale(void)
+{
+  {
+    AzIoTProvisioning provisioning(DPS_ENDPOINT, ID_SCOPE, REGISTRATION_ID, DEVICE_KEY);
+    TEST_ASSERT_EQUAL_INT(
+        0,
+        provisioning.Register(
+            hostname, sizeof(hostname), device_id, sizeof(device_id), REGISTRATION_TIMEOUT_MILLISECS));
+  }
+
+  AzIoTProvisioning other_scope(DPS_ENDPOINT, "0ne00000002", REGISTRATION_ID, DEVICE_KEY);
+  TEST_ASSERT_FALSE(other_scope.LoadAssignment(hostname, sizeof(hostname), device_id, sizeof(device_id)));
+
+  AzIoTProvisioning other_registration(DPS_ENDPOINT, ID_SCOPE, "sensor-18", DEVICE_KEY);
+  TEST_ASSERT_FALSE(
+      other_registration.LoadAssignment(hostname, sizeof(hostname), device_id, sizeof(device_id)));
+}
+
+void test_refused_dps_connection_fails_without_caching(void)
+{
+  dps->refusal = MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED;
+  AzIoTProvisioning provisioning(DPS_ENDPOINT, ID_SCOPE, REGISTRATION_ID, DEVICE_KEY);
+
+  unsigned long start = millis();
+  TEST_ASSERT_EQUAL_INT(
+      1,
+      provisioning.Register(
+          hostname, sizeof(hostname), device_id, sizeof(device_id), REGISTRATION_TIMEOUT_MILLISECS));
+
+  // The disconnect ends the attempt at once instead of waiting for the timeout.
+  TEST_ASSERT_LESS_THAN(1000, millis() - start);
+  TEST_ASSERT_EQUAL_INT(0, dps->registrations);
+  TEST_ASSERT_FALSE(provisioning.LoadAssignment(hostname, sizeof(hostname), device_id, sizeof(device_id)));
+}
+
+void test_rejected_registration_fails(void)
+{
+  dps->failRegistration = true;
+  AzIoTProvisioning provisioning(DPS_ENDPOINT, ID_SCOPE, REGISTRATION_ID, DEVICE_KEY);
+
+  TEST_ASSERT_EQUAL_INT(
+      1,
+      provisioning.Register(
+          hostname, sizeof(hostname), device_id, sizeof(device_id), REGISTRATION_TIMEOUT_MILLISECS));
+  TEST_ASSERT_EQUAL_INT(1, dps->registrations);
+  TEST_ASSERT_EQUAL_INT(0, dps->queries);
+  TEST_ASSERT_FALSE(provisioning.LoadAssignment(hostname, sizeof(hostname), device_id, sizeof(device_id)));
+}
+
+void test_unanswered_registration_times_out(void)
+{
+  dps->silent = true;
+  AzIoTProvisioning provisioning(DPS_ENDPOINT, ID_SCOPE, REGISTRATION_ID, DEVICE_KEY);
+
+  unsigned long start = millis();
+  TEST_ASSERT_EQUAL_INT(
+      1, provisioning.Register(hostname, sizeof(hostname), device_id, sizeof(device_id), 5000));
+  TEST_ASSERT_UINT32_WITHIN(200, 5000, millis() - start);
+}
+
+void test_only_refusals_meaning_the_device_moved_reprovision(void)
+{
+  ReprovisionBackoff backoff;
+
+  backoff.OnRefused(MQTT_CONNECTION_REFUSE_PROTOCOL, 0);
+  backoff.OnRefused(MQTT_CONNECTION_REFUSE_SERVER_UNAVAILABLE, 0);
+  TEST_ASSERT_FALSE(backoff.IsDue(REPROVISION_MAX_DELAY_MILLISECS));
+
+  TEST_ASSERT_TRUE(ReprovisionBackoff::MeansDeviceMoved(MQTT_CONNECTION_REFUSE_ID_REJECTED));
+  TEST_ASSERT_TRUE(ReprovisionBackoff::MeansDeviceMoved(MQTT_CONNECTION_REFUSE_BAD_USERNAME));
+  TEST_ASSERT_TRUE(ReprovisionBackoff::MeansDeviceMoved(MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED));
+
+  backoff.OnRefused(MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED, 1000);
+  TEST_ASSERT_FALSE(backoff.IsDue(1000));
+  TEST_ASSERT_FALSE(backoff.IsDue(1000 + REPROVISION_FIRST_DELAY_MILLISECS - 1));
+  TEST_ASSERT_TRUE(backoff.IsDue(1000 + REPROVISION_FIRST_DELAY_MILLISECS));
+}
+
+void test_reprovisioning_backs_off_exponentially_and_gives_up(void)
+{
+  ReprovisionBackoff backoff;
+  uint32_t now = 5000;
+  uint32_t expected_delay = REPROVISION_FIRST_DELAY_MILLISECS;
+
+  for (int attempt = 0; attempt < REPROVISION_MAX_ATTEMPTS; attempt++)
+  {
+    // esp-mqtt keeps reconnecting to the cached hub, so refusals repeat while the backoff runs.
+    for (uint32_t t = now; t < now + expected_delay; t += 10000)
+    {
+      backoff.OnRefused(MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED, t);
+      TEST_ASSERT_FALSE(backoff.IsDue(t));
+    }
+
+    now += expected_delay;
+    TEST_ASSERT_TRUE(backoff.IsDue(now));
+    TEST_ASSERT_EQUAL_UINT32(expected_delay, backoff.DelayMillis());
+    backoff.OnAttempt(now);
+    TEST_ASSERT_EQUAL_UINT8(attempt + 1, backoff.Attempts());
+    TEST_ASSERT_FALSE(backoff.IsDue(now));
+
+    expected_delay = expected_delay * 2 < REPROVISION_MAX_DELAY_MILLISECS ? expected_delay * 2
+                                                                          : REPROVISION_MAX_DELAY_MILLISECS;
+  }
+
+  TEST_ASSERT_TRUE(backoff.IsExhausted());
+  backoff.OnRefused(MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED, now);
+  TEST_ASSERT_FALSE(backoff.IsDue(now + 10 * REPROVISION_MAX_DELAY_MILLISECS));
+
+  // A hub that accepts the device again starts the policy over.
+  backoff.OnConnected();
+  TEST_ASSERT_FALSE(backoff.IsExhausted());
+  TEST_ASSERT_EQUAL_UINT32(REPROVISION_FIRST_DELAY_MILLISECS, backoff.DelayMillis());
+  backoff.OnRefused(MQTT_CONNECTION_REFUSE_ID_REJECTED, now);
+  TEST_ASSERT_TRUE(backoff.IsDue(now + REPROVISION_FIRST_DELAY_MILLISECS));
+}
+
+void test_backoff_survives_the_millis_rollover(void)
+{
+  ReprovisionBackoff backoff;
+  uint32_t now = UINT32_MAX - 1000;
+
+  backoff.OnRefused(MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED, now);
+  TEST_ASSERT_FALSE(backoff.IsDue(now + 1000 + 1));
+  TEST_ASSERT_TRUE(backoff.IsDue(now + REPROVISION_FIRST_DELAY_MILLISECS));
+}
+
+void test_device_moved_between_hubs_is_reassigned_by_dps(void)
+{
+  ReprovisionBackoff backoff;
+  AzIoTProvisioning provisioning(DPS_ENDPOINT, ID_SCOPE, REGISTRATION_ID, DEVICE_KEY);
+
+  // Cached from an earlier registration on the hub the device was since moved away from.
+  strcpy(hostname, "site-a.azure-devices.net");
+  strcpy(device_id, REGISTRATION_ID);
+
+  backoff.OnRefused(MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED, millis());
+  while (!backoff.IsDue(millis()))
+  {
+    delay(1000);
+  }
+
+  backoff.OnAttempt(millis());
+  provisioning.ClearAssignment();
+  TEST_ASSERT_EQUAL_INT(
+      0,
+      provisioning.Register(
+          hostname, sizeof(hostname), device_id, sizeof(device_id), REGISTRATION_TIMEOUT_MILLISECS));
+  TEST_ASSERT_EQUAL_STRING(ASSIGNED_HUB, hostname);
+
+  backoff.OnConnected();
+  TEST_ASSERT_EQUAL_UINT8(0, backoff.Attempts());
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_cold_boot_registers_polls_and_caches_the_assignment);
+  RUN_TEST(test_warm_boot_uses_the_cached_assignment_without_dps);
+  RUN_TEST(test_assignment_cached_for_another_scope_is_stale);
+  RUN_TEST(test_refused_dps_connection_fails_without_caching);
+  RUN_TEST(test_rejected_registration_fails);
+  RUN_TEST(test_unanswered_registration_times_out);
+  RUN_TEST(test_only_refusals_meaning_the_device_moved_reprovision);
+  RUN_TEST(test_reprovisioning_backs_off_exponentially_and_gives_up);
+  RUN_TEST(test_backoff_survives_the_millis_rollover);
+  RUN_TEST(test_device_moved_between_hubs_is_reassigned_by_dps);
+  return UNITY_END();
+}
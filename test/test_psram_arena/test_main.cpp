@@ -0,0 +1,196 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "MemoryMonitor.h"
+#include "PsramArena.h"
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unity.h>
+
+#define SERIALIZE_ITERATIONS 1000
+
+// Every heap allocation made while `counting` is set is tallied, so a test can
+// prove a code path never reaches malloc() once it is warmed up.
+static volatile bool counting = false;
+static volatile size_t heap_allocations = 0;
+
+#if defined(__GLIBC__)
+#define HEAP_HOOK_AVAILABLE 1
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* pointer, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+  if (counting)
+  {
+    heap_allocations++;
+  }
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+  if (counting)
+  {
+    heap_allocations++;
+  }
+  return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size)
+{
+  if (counting)
+  {
+    heap_allocations++;
+  }
+  return __libc_realloc(pointer, size);
+}
+#endif
+
+static uint32_t jsonBytesInUse()
+{
+  MemorySnapshot snapshot;
+  MemoryStats.Sample(&snapshot);
+  return snapshot.subsystems[MEMORY_SUBSYSTEM_JSON].bytesInUse;
+}
+
+// Builds a message shaped like the diagnostics one, with copied strings so the arena is exercised.
+static void buildMessage(JsonDocument& doc, uint32_t sequence)
+{
+  char task_name[16];
+  snprintf(task_name, sizeof(task_name), "task%u", (unsigned)(sequence % 4));
+
+  doc["msgCount"] = sequence;
+  JsonObject heap = doc["heap"].to<JsonObject>();
+  heap["free"] = 200000 - sequence;
+  heap["minFree"] = 150000;
+
+  JsonObject stacks = doc["stackFree"].to<JsonObject>();
+  stacks[task_name] = 1024 + sequence % 512;
+
+  JsonArray readings = doc["readings"].to<JsonArray>();
+  for (int i = 0; i < 10; i++)
+  {
+    JsonArray reading = readings.add<JsonArray>();
+    reading.add(1700000000 + sequence * 10 + i);
+    reading.add(2150 + i);
+    reading.add(455 - i);
+  }
+}
+
+void setUp(void)
+{
+  counting = false;
+  heap_allocations = 0;
+}
+
+void tearDown(void) { counting = false; }
+
+void test_serializing_repeatedly_never_mallocs(void)
+{
+#ifndef HEAP_HOOK_AVAILABLE
+  TEST_IGNORE_MESSAGE("malloc() can only be hooked on glibc");
+#else
+  PsramArena arena(JSON_ARENA_SIZE);
+  PayloadBufferPool buffers;
+  TEST_ASSERT_TRUE(arena.Begin());
+  TEST_ASSERT_TRUE(buffers.Begin());
+
+  JsonDocument doc(&arena);
+  size_t first_length = 0;
+
+  // The backing stores above are the only allocations; the loop below must not add any.
+  counting = true;
+  for (uint32_t sequence = 0; sequence < SERIALIZE_ITERATIONS; sequence++)
+  {
+    buildMessage(doc, sequence);
+    TEST_ASSERT_FALSE(doc.overflowed());
+
+    char* payload = buffers.Acquire();
+    TEST_ASSERT_NOT_NULL(payload);
+    size_t length = serializeJson(doc, payload, buffers.BufferSize());
+    TEST_ASSERT_GREATER_THAN(0, length);
+    TEST_ASSERT_LESS_THAN(buffers.BufferSize(), length);
+    if (sequence == 0)
+    {
+      first_length = length;
+    }
+    buffers.Release(payload);
+
+    doc.clear();
+    arena.Reset();
+  }
+  counting = false;
+
+  TEST_ASSERT_EQUAL_size_t_MESSAGE(0, heap_allocations, "heap allocations in steady state");
+  TEST_ASSERT_GREATER_THAN(0, first_length);
+  TEST_ASSERT_EQUAL_size_t(0, arena.Used());
+  TEST_ASSERT_GREATER_THAN(0, arena.HighWaterMark());
+  TEST_ASSERT_LESS_OR_EQUAL(JSON_ARENA_SIZE, arena.HighWaterMark());
+  TEST_ASSERT_EQUAL_UINT32(0, jsonBytesInUse());
+#endif
+}
+
+void test_arena_overflow_is_reported_by_the_document(void)
+{
+  PsramArena arena(256);
+  TEST_ASSERT_TRUE(arena.Begin());
+  JsonDocument doc(&arena);
+
+  counting = true;
+  buildMessage(doc, 1);
+  counting = false;
+
+  // Out of arena space, ArduinoJson gives up on the value instead of falling back to the heap.
+  TEST_ASSERT_TRUE(doc.overflowed());
+  TEST_ASSERT_EQUAL_size_t(0, heap_allocations);
+  TEST_ASSERT_LESS_OR_EQUAL(256, arena.HighWaterMark());
+
+  doc.clear();
+  arena.Reset();
+  TEST_ASSERT_EQUAL_size_t(0, arena.Used());
+}
+
+void test_payload_pool_hands_out_each_buffer_once(void)
+{
+  PayloadBufferPool buffers;
+  TEST_ASSERT_TRUE(buffers.Begin());
+
+  char* taken[PAYLOAD_BUFFER_COUNT];
+  for (int i = 0; i < PAYLOAD_BUFFER_COUNT; i++)
+  {
+    taken[i] = buffers.Acquire();
+    TEST_ASSERT_NOT_NULL(taken[i]);
+    for (int j = 0; j < i; j++)
+    {
+      TEST_ASSERT_TRUE(taken[i] != taken[j]);
+    }
+  }
+
+  TEST_ASSERT_NULL(buffers.Acquire());
+
+  buffers.Release(taken[0]);
+  buffers.Release(taken[0]); // A second release of the same buffer is ignored.
+  TEST_ASSERT_EQUAL_PTR(taken[0], buffers.Acquire());
+  TEST_ASSERT_NULL(buffers.Acquire());
+
+  for (int i = 0; i < PAYLOAD_BUFFER_COUNT; i++)
+  {
+    buffers.Release(taken[i]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_serializing_repeatedly_never_mallocs);
+  RUN_TEST(test_arena_overflow_is_reported_by_the_document);
+  RUN_TEST(test_payload_pool_hands_out_each_buffer_once);
+  return UNITY_END();
+}
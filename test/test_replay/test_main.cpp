@@ -0,0 +1,428 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "AlertMonitor.h"
+#include "EventRecorder.h"
+#include "RoutineLane.h"
+#include "RulesEngine.h"
+#include "TelemetryBatch.h"
+#include "TelemetrySchema.h"
+#include <mqtt_client.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+
+#define TRACE_SAMPLES 20
+#define FIRST_EPOCH 1760000000
+#define SAMPLE_PERIOD_SECS 10
+#define MAX_ALERTS 8
+#define MAX_HITS 8
+#define MAX_MESSAGES 8
+#define MAX_MQTT_EVENTS 8
+#define MESSAGE_SIZE 512
+
+// Temperature in centi-degrees: climbs through the 30.00 C alert and the "hot" rule, then cools.
+static const int16_t recorded_temperatures[TRACE_SAMPLES] = {
+  2500, 2600, 2750, 2900, 3010, 3120, 3250, 3300, 3280, 3190,
+  SENSOR_VALUE_INVALID, 3050, 2950, 2880, 2800, 2700, 2600, 2550, 2500, 2480,
+};
+
+static const AlertThreshold thresholds[SENSOR_CHANNEL_COUNT] = {
+  { ALERT_THRESHOLD_DISABLED_LOW, 3000, 100 },
+  { ALERT_THRESHOLD_DISABLED_LOW, ALERT_THRESHOLD_DISABLED_HIGH, 0 },
+};
+
+static SensorSample recordedSample(int index)
+{
+  SensorSample sample;
+  sample.value[SENSOR_CHANNEL_TEMPERATURE] = recorded_temperatures[index];
+  sample.value[SENSOR_CHANNEL_HUMIDITY] = (int16_t)(450 + index);
+  return sample;
+}
+
+// A reconnect storm: refused and dropped connects while the outbox grows past the routine limit.
+struct ScriptedMqttEvent
+{
+  int beforeSample;
+  RecordedMqttEvent event;
+};
+
+static const ScriptedMqttEvent reconnect_storm[] = {
+  { 0, { MQTT_EVENT_CONNECTED, MQTT_ERROR_TYPE_NONE, MQTT_CONNECTION_ACCEPTED, 0, 0, 0 } },
+  { 5, { MQTT_EVENT_ERROR, MQTT_ERROR_TYPE_TCP_TRANSPORT, MQTT_CONNECTION_ACCEPTED, 0, 0, 2900 } },
+  { 5, { MQTT_EVENT_DISCONNECTED, MQTT_ERROR_TYPE_NONE, MQTT_CONNECTION_ACCEPTED, 0, 0, 3100 } },
+  { 7, { MQTT_EVENT_ERROR, MQTT_ERROR_TYPE_CONNECTION_REFUSED, MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED, 0, 0, 6200 } },
+  { 9, { MQTT_EVENT_ERROR, MQTT_ERROR_TYPE_CONNECTION_REFUSED, MQTT_CONNECTION_REFUSE_SERVER_UNAVAILABLE, 0, 0, 9300 } },
+  { 15, { MQTT_EVENT_CONNECTED, MQTT_ERROR_TYPE_NONE, MQTT_CONNECTION_ACCEPTED, 0, 0, 9300 } },
+  { 16, { MQTT_EVENT_PUBLISHED, MQTT_ERROR_TYPE_NONE, MQTT_CONNECTION_ACCEPTED, 70000, 1234, 0 } },
+};
+
+#define RECONNECT_STORM_EVENTS (sizeof(reconnect_storm) / sizeof(reconnect_storm[0]))
+
+/*
+ * The sketch's per-sample path without the radio: alerts and rule hits are collected, readings
+ * are stamped with the last clock tick and batched, and each full batch is encoded if the routine
+ * lane admits it at the outbox size of the last MQTT event.
+ */
+class Pipeline : public EventReplayHandler
+{
+public:
+  Pipeline()
+      : alerts(thresholds), lane(ROUTINE_OUTBOX_LIMIT_BYTES), epoch(0), outboxSize(0), samples(0),
+        alertCount(0), hitCount(0), messageCount(0), mqttEventCount(0)
+  {
+  }
+
+  void OnMqttEvent(uint32_t millis, const RecordedMqttEvent& event) override
+  {
+    (void)millis;
+    if (this->mqttEventCount < MAX_MQTT_EVENTS)
+    {
+      this->mqttEventLog[this->mqttEventCount] = event;
+      this->mqttEventSample[this->mqttEventCount++] = this->samples;
+    }
+    this->outboxSize = event.outboxSize;
+  }
+
+  void OnClockTick(uint32_t millis, uint32_t epoch) override
+  {
+    (void)millis;
+    this->epoch = epoch;
+  }
+
+  void OnSensorSample(uint32_t millis, const SensorSample& sample) override
+  {
+    AlertEvent events[SENSOR_CHANNEL_COUNT];
+    int count = this->alerts.Evaluate(sample, events);
+    for (int i = 0; i < count && this->alertCount < MAX_ALERTS; i++)
+    {
+      this->alertLog[this->alertCount] = events[i];
+      this->alertSample[this->alertCount++] = this->samples;
+    }
+
+    RuleHit hits[RULES_MAX];
+    size_t hit_count = this->rules.Evaluate(sample, millis, hits);
+    for (size_t i = 0; i < hit_count && this->hitCount < MAX_HITS; i++)
+    {
+      this->hitLog[this->hitCount] = hits[i];
+      this->hitSample[this->hitCount++] = this->samples;
+    }
+
+    this->batch.Add(this->epoch, sample);
+    if (this->batch.IsFull() && !this->lane.Admit((int)this->outboxSize))
+    {
+      this->batch.Clear();
+    }
+    else if (this->batch.IsFull() && this->messageCount < MAX_MESSAGES)
+    {
+      TelemetryHeader header;
+      memset(&header, 0, sizeof(header));
+      header.id = 1;
+      header.msgCount = (uint32_t)this->messageCount;
+      this->messageLength[this->messageCount] = TelemetryEncode(
+          TELEMETRY_ENCODING_JSON,
+          header,
+          this->batch.Readings(),
+          this->batch.Count(),
+          this->messages[this->messageCount],
+          MESSAGE_SIZE);
+      this->messageCount++;
+      this->batch.Clear();
+    }
+
+    this->samples++;
+  }
+
+  AlertMonitor alerts;
+  RulesEngine rules;
+  RoutineLane lane;
+  TelemetryBatch batch;
+  uint32_t epoch;
+  uint32_t outboxSize;
+  int samples;
+
+  AlertEvent alertLog[MAX_ALERTS];
+  int alertSample[MAX_ALERTS];
+  int alertCount;
+  RuleHit hitLog[MAX_HITS];
+  int hitSample[MAX_HITS];
+  int hitCount;
+  uint8_t messages[MAX_MESSAGES][MESSAGE_SIZE];
+  size_t messageLength[MAX_MESSAGES];
+  size_t messageCount;
+  RecordedMqttEvent mqttEventLog[MAX_MQTT_EVENTS];
+  int mqttEventSample[MAX_MQTT_EVENTS];
+  size_t mqttEventCount;
+};
+
+// Each test keeps its trace in a directory of its own, under $TMPDIR when the path fits.
+static char test_directory[RECORDER_PATH_SIZE];
+static char trace_path[RECORDER_PATH_SIZE];
+static char old_trace_path[RECORDER_PATH_SIZE + sizeof(".old")];
+
+static void makeTestDirectory()
+{
+  const char* base = getenv("TMPDIR");
+  if (base == NULL || strlen(base) + sizeof("/replay_XXXXXX/trace.old") > sizeof(trace_path))
+  {
+    base = "/tmp";
+  }
+
+  snprintf(test_directory, sizeof(test_directory), "%s/replay_XXXXXX", base);
+  TEST_ASSERT_NOT_NULL(mkdtemp(test_directory));
+  snprintf(trace_path, sizeof(trace_path), "%s/trace", test_directory);
+  snprintf(old_trace_path, sizeof(old_trace_path), "%s.old", trace_path);
+}
+
+static void removeTraces()
+{
+  remove(trace_path);
+  remove(old_trace_path);
+}
+
+// Records the samples with their clock ticks and, if given, the MQTT events scripted before them.
+static void recordTrace(const ScriptedMqttEvent* events = NULL, size_t eventCount = 0)
+{
+  removeTraces();
+
+  EventRecorder recorder;
+  TEST_ASSERT_TRUE(recorder.Begin(trace_path));
+  size_t next_event = 0;
+  for (int i = 0; i < TRACE_SAMPLES; i++)
+  {
+    for (; next_event < eventCount && events[next_event].beforeSample == i; next_event++)
+    {
+      recorder.RecordMqttEvent(events[next_event].event);
+    }
+    recorder.RecordClockTick(FIRST_EPOCH + i * SAMPLE_PERIOD_SECS);
+    recorder.RecordSensorSample(recordedSample(i));
+    recorder.Service();
+  }
+  TEST_ASSERT_EQUAL_size_t(eventCount, next_event);
+  TEST_ASSERT_EQUAL_UINT32(0, recorder.Dropped());
+  recorder.End();
+}
+
+static Pipeline pipeline;
+
+void setUp(void)
+{
+  makeTestDirectory();
+  recordTrace();
+  pipeline = Pipeline();
+  TEST_ASSERT_NULL(pipeline.rules.Add("hot", "temperature > 32", 2));
+  TEST_ASSERT_EQUAL_INT32(2 * TRACE_SAMPLES, EventReplayer::Replay(trace_path, pipeline, 0));
+  TEST_ASSERT_EQUAL_INT(TRACE_SAMPLES, pipeline.samples);
+}
+
+void tearDown(void)
+{
+  removeTraces();
+  rmdir(test_directory);
+}
+
+void test_replay_raises_and_clears_the_temperature_alert_once(void)
+{
+  TEST_ASSERT_EQUAL_INT(2, pipeline.alertCount);
+
+  TEST_ASSERT_EQUAL_INT(SENSOR_CHANNEL_TEMPERATURE, pipeline.alertLog[0].channel);
+  TEST_ASSERT_EQUAL_INT(ALERT_LEVEL_HIGH, pipeline.alertLog[0].level);
+  TEST_ASSERT_EQUAL_INT16(3010, pipeline.alertLog[0].value);
+  TEST_ASSERT_EQUAL_INT(4, pipeline.alertSample[0]);
+
+  // 29.50 is inside the threshold but not by the hysteresis margin; 28.80 is.
+  TEST_ASSERT_EQUAL_INT(ALERT_LEVEL_NORMAL, pipeline.alertLog[1].level);
+  TEST_ASSERT_EQUAL_INT16(2880, pipeline.alertLog[1].value);
+  TEST_ASSERT_EQUAL_INT(13, pipeline.alertSample[1]);
+}
+
+void test_replay_activates_the_rule_after_two_samples_and_clears_it(void)
+{
+  TEST_ASSERT_EQUAL_INT(2, pipeline.hitCount);
+
+  TEST_ASSERT_TRUE(pipeline.hitLog[0].active);
+  TEST_ASSERT_EQUAL_INT(7, pipeline.hitSample[0]); // 32.50, 33.00
+
+  TEST_ASSERT_FALSE(pipeline.hitLog[1].active);
+  TEST_ASSERT_EQUAL_INT(9, pipeline.hitSample[1]); // 31.90
+}
+
+void test_replay_batches_every_reading_with_its_clock_tick(void)
+{
+  TEST_ASSERT_EQUAL_size_t(TRACE_SAMPLES / TELEMETRY_BATCH_SIZE, pipeline.messageCount);
+
+  for (size_t message = 0; message < pipeline.messageCount; message++)
+  {
+    TEST_ASSERT_GREATER_THAN(0, pipeline.messageLength[message]);
+
+    TelemetryHeader header;
+    BatchedReading readings[TELEMETRY_BATCH_SIZE];
+    size_t count;
+    TEST_ASSERT_TRUE(TelemetryDecode(
+        TELEMETRY_ENCODING_JSON,
+        pipeline.messages[message],
+        pipeline.messageLength[message],
+        &header,
+        readings,
+        TELEMETRY_BATCH_SIZE,
+        &count));
+    TEST_ASSERT_EQUAL_UINT32(message, header.msgCount);
+    TEST_ASSERT_EQUAL_size_t(TELEMETRY_BATCH_SIZE, count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+      int index = (int)(message * TELEMETRY_BATCH_SIZE + i);
+      SensorSample expected = recordedSample(index);
+      TEST_ASSERT_EQUAL_UINT32(FIRST_EPOCH + index * SAMPLE_PERIOD_SECS, readings[i].epoch);
+      TEST_ASSERT_EQUAL_INT16(
+          expected.value[SENSOR_CHANNEL_TEMPERATURE], readings[i].sample.value[SENSOR_CHANNEL_TEMPERATURE]);
+      TEST_ASSERT_EQUAL_INT16(
+          expected.value[SENSOR_CHANNEL_HUMIDITY], readings[i].sample.value[SENSOR_CHANNEL_HUMIDITY]);
+    }
+  }
+}
+
+void test_replay_encodes_the_failed_reading_by_leaving_it_out(void)
+{
+  // Readings 10..14, the first of which lost its temperature.
+  const char* expected = "{\"id\":1,\"msgCount\":2,\"readings\":["
+                         "{\"ts\":1760000100,\"humidity\":46.0},"
+                         "{\"ts\":1760000110,\"temperature\":30.50,\"humidity\":46.1},"
+                         "{\"ts\":1760000120,\"temperature\":29.50,\"humidity\":46.2},"
+                         "{\"ts\":1760000130,\"temperature\":28.80,\"humidity\":46.3},"
+                         "{\"ts\":1760000140,\"temperature\":28.00,\"humidity\":46.4}]}";
+
+  TEST_ASSERT_EQUAL_size_t(strlen(expected), pipeline.messageLength[2]);
+  TEST_ASSERT_EQUAL_MEMORY(expected, pipeline.messages[2], strlen(expected));
+}
+
+void test_recorder_counts_records_dropped_while_its_buffer_is_full(void)
+{
+  removeTraces();
+  EventRecorder recorder;
+  TEST_ASSERT_TRUE(recorder.Begin(trace_path));
+
+  // Without Service() nothing drains the RAM buffer.
+  SensorSample sample = recordedSample(0);
+  int32_t fitted = 0;
+  for (recorder.RecordSensorSample(sample); recorder.Dropped() == 0; recorder.RecordSensorSample(sample))
+  {
+    fitted++;
+  }
+  recorder.RecordSensorSample(sample);
+  TEST_ASSERT_EQUAL_UINT32(2, recorder.Dropped());
+
+  // Flushing makes room again; the count is kept for the diagnostics.
+  recorder.Flush();
+  recorder.RecordSensorSample(sample);
+  TEST_ASSERT_EQUAL_UINT32(2, recorder.Dropped());
+  recorder.End();
+
+  Pipeline replayed;
+  TEST_ASSERT_EQUAL_INT32(fitted + 1, EventReplayer::Replay(trace_path, replayed, 0));
+  TEST_ASSERT_EQUAL_INT(fitted + 1, replayed.samples);
+}
+
+void test_replayed_reconnect_storm_keeps_every_event_field(void)
+{
+  recordTrace(reconnect_storm, RECONNECT_STORM_EVENTS);
+
+  Pipeline replayed;
+  TEST_ASSERT_EQUAL_INT32(
+      2 * TRACE_SAMPLES + (int32_t)RECONNECT_STORM_EVENTS, EventReplayer::Replay(trace_path, replayed, 0));
+  TEST_ASSERT_EQUAL_size_t(RECONNECT_STORM_EVENTS, replayed.mqttEventCount);
+
+  for (size_t i = 0; i < RECONNECT_STORM_EVENTS; i++)
+  {
+    const RecordedMqttEvent& expected = reconnect_storm[i].event;
+    const RecordedMqttEvent& decoded = replayed.mqttEventLog[i];
+    TEST_ASSERT_EQUAL_INT(reconnect_storm[i].beforeSample, replayed.mqttEventSample[i]);
+    TEST_ASSERT_EQUAL_UINT8(expected.eventId, decoded.eventId);
+    TEST_ASSERT_EQUAL_UINT8(expected.errorType, decoded.errorType);
+    TEST_ASSERT_EQUAL_UINT8(expected.connectReturnCode, decoded.connectReturnCode);
+    TEST_ASSERT_EQUAL_INT32(expected.msgId, decoded.msgId);
+    TEST_ASSERT_EQUAL_UINT32(expected.dataLength, decoded.dataLength);
+    TEST_ASSERT_EQUAL_UINT32(expected.outboxSize, decoded.outboxSize);
+  }
+}
+
+void test_replayed_outbox_growth_holds_back_routine_batches(void)
+{
+  TEST_ASSERT_GREATER_THAN_UINT32(reconnect_storm[3].event.outboxSize, ROUTINE_OUTBOX_LIMIT_BYTES);
+  TEST_ASSERT_LESS_THAN_UINT32(reconnect_storm[4].event.outboxSize, ROUTINE_OUTBOX_LIMIT_BYTES);
+
+  recordTrace(reconnect_storm, RECONNECT_STORM_EVENTS);
+  Pipeline replayed;
+  TEST_ASSERT_EQUAL_INT32(
+      2 * TRACE_SAMPLES + (int32_t)RECONNECT_STORM_EVENTS, EventReplayer::Replay(trace_path, replayed, 0));
+
+  // Batches complete at samples 4, 9, 14 and 19; the outbox is over the limit from sample 9 until
+  // the PUBLISHED before sample 16 empties it.
+  TEST_ASSERT_EQUAL_UINT32(2, replayed.lane.Dropped());
+  TEST_ASSERT_EQUAL_size_t(2, replayed.messageCount);
+
+  TelemetryHeader header;
+  BatchedReading readings[TELEMETRY_BATCH_SIZE];
+  size_t count;
+  TEST_ASSERT_TRUE(TelemetryDecode(
+      TELEMETRY_ENCODING_JSON, replayed.messages[1], replayed.messageLength[1], &header, readings,
+      TELEMETRY_BATCH_SIZE, &count));
+  TEST_ASSERT_EQUAL_UINT32(FIRST_EPOCH + 15 * SAMPLE_PERIOD_SECS, readings[0].epoch);
+
+  // Without the events the same samples are all sent.
+  TEST_ASSERT_EQUAL_UINT32(0, pipeline.lane.Dropped());
+  TEST_ASSERT_EQUAL_size_t(TRACE_SAMPLES / TELEMETRY_BATCH_SIZE, pipeline.messageCount);
+}
+
+void test_recorder_counts_records_dropped_when_rotation_cannot_reopen(void)
+{
+  removeTraces();
+  EventRecorder recorder;
+  TEST_ASSERT_TRUE(recorder.Begin(trace_path));
+
+  // With the directory gone, rotation closes the full file and cannot start a new one.
+  TEST_ASSERT_EQUAL_INT(0, remove(trace_path));
+  TEST_ASSERT_EQUAL_INT(0, rmdir(test_directory));
+
+  SensorSample sample = recordedSample(0);
+  uint32_t recorded = 0;
+  while (recorder.Dropped() == 0 && recorded < 2 * RECORDER_MAX_FILE_SIZE)
+  {
+    recorder.RecordSensorSample(sample);
+    if (++recorded % 50 == 0)
+    {
+      recorder.Flush();
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, recorder.Dropped());
+  TEST_ASSERT_TRUE(recorder.IsRecording());
+
+  recorder.RecordMqttEvent(reconnect_storm[1].event);
+  recorder.RecordClockTick(FIRST_EPOCH);
+  TEST_ASSERT_EQUAL_UINT32(3, recorder.Dropped());
+
+  // Once ended, nothing is recorded and nothing is counted.
+  recorder.End();
+  recorder.RecordSensorSample(sample);
+  TEST_ASSERT_FALSE(recorder.IsRecording());
+  TEST_ASSERT_EQUAL_UINT32(3, recorder.Dropped());
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_raises_and_clears_the_temperature_alert_once);
+  RUN_TEST(test_replay_activates_the_rule_after_two_samples_and_clears_it);
+  RUN_TEST(test_replay_batches_every_reading_with_its_clock_tick);
+  RUN_TEST(test_replay_encodes_the_failed_reading_by_leaving_it_out);
+  RUN_TEST(test_recorder_counts_records_dropped_while_its_buffer_is_full);
+  RUN_TEST(test_replayed_reconnect_storm_keeps_every_event_field);
+  RUN_TEST(test_replayed_outbox_growth_holds_back_routine_batches);
+  RUN_TEST(test_recorder_counts_records_dropped_when_rotation_cannot_reopen);
+  return UNITY_END();
+}
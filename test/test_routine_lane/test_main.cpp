@@ -0,0 +1,245 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "AlertMonitor.h"
+#include "RoutineLane.h"
+#include "TelemetryBatch.h"
+#include "TelemetrySchema.h"
+#include <deque>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+// A slow uplink that cannot keep up with the routine lane: 600 B/s of telemetry against 500 B/s.
+#define DRAIN_BYTES_PER_SEC 500
+#define SAMPLE_PERIOD_MILLISECS 100
+#define SIMULATED_MILLISECS (10 * 60 * 1000)
+#define TICK_MILLISECS 10
+#define ALERT_MESSAGE_BYTES 96
+#define MESSAGE_SIZE 512
+
+static const AlertThreshold thresholds[SENSOR_CHANNEL_COUNT] = {
+  { ALERT_THRESHOLD_DISABLED_LOW, 3000, 100 },
+  { ALERT_THRESHOLD_DISABLED_LOW, ALERT_THRESHOLD_DISABLED_HIGH, 0 },
+};
+
+/*
+ * esp-mqtt's outbox as seen from loop(): one FIFO for both lanes, drained by the
+ * MQTT task at the link rate.
+ */
+class FakeOutbox
+{
+public:
+  FakeOutbox() : bytes(0), credit(0) {}
+
+  int Size() { return (int)this->bytes; }
+
+  void Enqueue(uint32_t length, bool alert, uint32_t nowMillis)
+  {
+    this->queue.push_back(Message{ length, length, alert, nowMillis });
+    this->bytes += length;
+  }
+
+  // Sends for elapsedMillis; calls onAlertSent with the queueing delay of each alert that left.
+  template <typename Callback>
+  void Drain(uint32_t nowMillis, uint32_t elapsedMillis, Callback onAlertSent)
+  {
+    this->credit += DRAIN_BYTES_PER_SEC * elapsedMillis;
+    while (!this->queue.empty() && this->credit >= 1000)
+    {
+      Message& head = this->queue.front();
+      uint32_t sent = this->credit / 1000 < head.remaining ? this->credit / 1000 : head.remaining;
+      head.remaining -= sent;
+      this->bytes -= sent;
+      this->credit -= sent * 1000;
+
+      if (head.remaining == 0)
+      {
+        if (head.alert)
+        {
+          onAlertSent(nowMillis - head.enqueuedMillis);
+        }
+        this->queue.pop_front();
+      }
+    }
+
+    if (this->queue.empty())
+    {
+      this->credit = 0;
+    }
+  }
+
+private:
+  struct Message
+  {
+    uint32_t length;
+    uint32_t remaining;
+    bool alert;
+    uint32_t enqueuedMillis;
+  };
+
+  std::deque<Message> queue;
+  uint32_t bytes;
+  uint32_t credit; // Byte-milliseconds not yet spent.
+};
+
+struct LaneRun
+{
+  uint32_t alerts;
+  uint32_t maxAlertDelayMillis;
+  uint32_t routineMessages;
+  uint32_t routineDropped;
+  uint32_t largestRoutineMessage;
+};
+
+// Temperature in centi-degrees: a slow ramp that crosses the 30.00 C alert every 20 s.
+static int16_t temperatureAt(uint32_t nowMillis)
+{
+  uint32_t phase = nowMillis % 20000;
+  return (int16_t)(phase < 10000 ? 2800 + phase / 25 : 3200 - (phase - 10000) / 25);
+}
+
+// The sketch's sampleSensors()/sendTelemetry() path, with the outbox above instead of esp-mqtt.
+static LaneRun run(RoutineLane& lane)
+{
+  AlertMonitor monitor(thresholds);
+  TelemetryBatch batch;
+  FakeOutbox outbox;
+  LaneRun result;
+  memset(&result, 0, sizeof(result));
+
+  uint32_t* max_delay = &result.maxAlertDelayMillis;
+  uint32_t* alerts_sent = &result.alerts;
+  auto on_alert_sent = [max_delay, alerts_sent](uint32_t delayMillis)
+  {
+    (*alerts_sent)++;
+    if (delayMillis > *max_delay)
+    {
+      *max_delay = delayMillis;
+    }
+  };
+
+  for (uint32_t now = 0; now < SIMULATED_MILLISECS; now += TICK_MILLISECS)
+  {
+    outbox.Drain(now, TICK_MILLISECS, on_alert_sent);
+
+    if (now % SAMPLE_PERIOD_MILLISECS != 0)
+    {
+      continue;
+    }
+
+    SensorSample sample;
+    sample.value[SENSOR_CHANNEL_TEMPERATURE] = temperatureAt(now);
+    sample.value[SENSOR_CHANNEL_HUMIDITY] = 455;
+
+    AlertEvent events[SENSOR_CHANNEL_COUNT];
+    int count = monitor.Evaluate(sample, events);
+    for (int i = 0; i < count; i++)
+    {
+      outbox.Enqueue(ALERT_MESSAGE_BYTES, true, now);
+    }
+
+    batch.Add(1760000000 + now / 1000, sample);
+    if (!batch.IsFull())
+    {
+      continue;
+    }
+
+    if (lane.Admit(outbox.Size()))
+    {
+      TelemetryHeader header;
+      memset(&header, 0, sizeof(header));
+      header.msgCount = result.routineMessages;
+      uint8_t message[MESSAGE_SIZE];
+      size_t length = TelemetryEncode(
+          TELEMETRY_ENCODING_JSON, header, batch.Readings(), batch.Count(), message, sizeof(message));
+      TEST_ASSERT_GREATER_THAN(0, length);
+
+      outbox.Enqueue((uint32_t)length, false, now);
+      result.routineMessages++;
+      if (length > result.largestRoutineMessage)
+      {
+        result.largestRoutineMessage = (uint32_t)length;
+      }
+    }
+    batch.Clear();
+  }
+
+  result.routineDropped = lane.Dropped();
+  return result;
+}
+
+// Worst case for an alert: the outbox just under the limit, one routine message admitted on top,
+// then the alert itself, plus one tick of scheduling slack.
+static uint32_t alertDelayBoundMillis(uint32_t limitBytes, uint32_t routineMessageBytes)
+{
+  return (limitBytes + routineMessageBytes + ALERT_MESSAGE_BYTES) * 1000 / DRAIN_BYTES_PER_SEC
+      + TICK_MILLISECS;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_alert_latency_is_bounded_while_the_routine_lane_is_backlogged(void)
+{
+  RoutineLane lane(ROUTINE_OUTBOX_LIMIT_BYTES);
+  LaneRun result = run(lane);
+
+  // Every crossing of the threshold raised and cleared an alert, and the link was saturated.
+  TEST_ASSERT_GREATER_OR_EQUAL(2 * (SIMULATED_MILLISECS / 20000) - 2, result.alerts);
+  TEST_ASSERT_GREATER_THAN(0, result.routineDropped);
+  TEST_ASSERT_GREATER_THAN(0, result.routineMessages);
+
+  uint32_t bound = alertDelayBoundMillis(ROUTINE_OUTBOX_LIMIT_BYTES, result.largestRoutineMessage);
+  char message[64];
+  snprintf(
+      message,
+      sizeof(message),
+      "worst alert delay %u ms, bound %u ms",
+      (unsigned)result.maxAlertDelayMillis,
+      (unsigned)bound);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(bound, result.maxAlertDelayMillis, message);
+}
+
+void test_without_admission_alerts_wait_behind_the_whole_backlog(void)
+{
+  // Shows the scenario is backlogged enough for the limit to matter.
+  RoutineLane unlimited(UINT32_MAX);
+  LaneRun result = run(unlimited);
+
+  TEST_ASSERT_EQUAL_UINT32(0, result.routineDropped);
+  TEST_ASSERT_GREATER_THAN_UINT32(
+      alertDelayBoundMillis(ROUTINE_OUTBOX_LIMIT_BYTES, result.largestRoutineMessage),
+      result.maxAlertDelayMillis);
+}
+
+void test_lane_admits_up_to_the_limit_and_counts_drops(void)
+{
+  RoutineLane lane(1000);
+
+  TEST_ASSERT_TRUE(lane.Admit(0));
+  TEST_ASSERT_TRUE(lane.Admit(1000));
+  TEST_ASSERT_FALSE(lane.IsBacklogged(1000));
+  TEST_ASSERT_EQUAL_UINT32(0, lane.Dropped());
+
+  TEST_ASSERT_TRUE(lane.IsBacklogged(1001));
+  TEST_ASSERT_EQUAL_UINT32(0, lane.Dropped());
+  TEST_ASSERT_FALSE(lane.Admit(1001));
+  TEST_ASSERT_FALSE(lane.Admit(50000));
+  TEST_ASSERT_EQUAL_UINT32(2, lane.Dropped());
+
+  TEST_ASSERT_TRUE(lane.Admit(-1));
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_alert_latency_is_bounded_while_the_routine_lane_is_backlogged);
+  RUN_TEST(test_without_admission_alerts_wait_behind_the_whole_backlog);
+  RUN_TEST(test_lane_admits_up_to_the_limit_and_counts_drops);
+  return UNITY_END();
+}
@@ -0,0 +1,195 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "RulesEngine.h"
+#include <chrono>
+#include <stdio.h>
+#include <unity.h>
+
+#define BENCHMARK_SAMPLES 20000
+#define SAMPLE_PERIOD_MILLISECS 1000
+
+// Representative of what is deployed: a rate, a conjunction and a fixed-point constant.
+#define BENCHMARK_EXPRESSION "rate(humidity) > 5 && temperature >= 25.5"
+
+// Allowed growth of the per-rule cost from one rule to RULES_MAX; evaluation is meant to be
+// linear in the rule count, and timing on a shared host is noisy.
+#define PER_RULE_COST_TOLERANCE 3
+
+// Temperature swings across 25.5 C and humidity jumps every tenth sample, so rules do change state.
+static SensorSample benchmarkSample(uint32_t index)
+{
+  SensorSample sample;
+  sample.value[SENSOR_CHANNEL_TEMPERATURE] = (int16_t)(2500 + (int16_t)(index % 20) * 10);
+  sample.value[SENSOR_CHANNEL_HUMIDITY] = (int16_t)(index % 10 == 0 ? 600 : 450);
+  return sample;
+}
+
+static void addRules(RulesEngine& engine, size_t count)
+{
+  engine.Clear();
+  for (size_t i = 0; i < count; i++)
+  {
+    char name[RULE_NAME_SIZE];
+    snprintf(name, sizeof(name), "rule%u", (unsigned)i);
+    TEST_ASSERT_NULL(engine.Add(name, BENCHMARK_EXPRESSION, 1));
+  }
+}
+
+// Nanoseconds per sample for Evaluate() over every rule, and the state changes it reported.
+static double evaluateCost(size_t ruleCount, uint32_t* hitCount)
+{
+  RulesEngine engine;
+  addRules(engine, ruleCount);
+
+  uint32_t hits_total = 0;
+  RuleHit hits[RULES_MAX];
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCHMARK_SAMPLES; i++)
+  {
+    hits_total += (uint32_t)engine.Evaluate(benchmarkSample(i), i * SAMPLE_PERIOD_MILLISECS, hits);
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  *hitCount = hits_total;
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()
+      / BENCHMARK_SAMPLES;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_evaluation_cost_grows_linearly_with_the_rule_count(void)
+{
+  // Warm up caches and the branch predictor before the first measured run.
+  uint32_t hits;
+  (void)evaluateCost(RULES_MAX, &hits);
+
+  double single_rule = 0;
+  for (size_t count = 1; count <= RULES_MAX; count++)
+  {
+    uint32_t hit_count;
+    double cost = evaluateCost(count, &hit_count);
+    if (count == 1)
+    {
+      single_rule = cost;
+    }
+
+    char message[80];
+    snprintf(
+        message,
+        sizeof(message),
+        "%u rules: %.0f ns/sample, %.0f ns/rule",
+        (unsigned)count,
+        cost,
+        cost / count);
+    TEST_MESSAGE(message);
+
+    // Every copy of the rule changes state on the same samples.
+    TEST_ASSERT_EQUAL_UINT32(count * (hits / RULES_MAX), hit_count);
+
+    if (count == RULES_MAX)
+    {
+      TEST_ASSERT_TRUE_MESSAGE(
+          cost / count <= single_rule * PER_RULE_COST_TOLERANCE,
+          "per-rule cost grew with the rule count");
+    }
+  }
+}
+
+static SensorSample sampleOf(int16_t temperature, int16_t humidity)
+{
+  SensorSample sample;
+  sample.value[SENSOR_CHANNEL_TEMPERATURE] = temperature;
+  sample.value[SENSOR_CHANNEL_HUMIDITY] = humidity;
+  return sample;
+}
+
+void test_benchmark_rule_changes_state(void)
+{
+  RulesEngine engine;
+  addRules(engine, 1);
+
+  // No rate on the first sample.
+  RuleHit hits[RULES_MAX];
+  TEST_ASSERT_EQUAL_size_t(0, engine.Evaluate(sampleOf(2600, 450), 0, hits));
+
+  // Humidity +15.0 % in a minute, but only 25.0 C.
+  TEST_ASSERT_EQUAL_size_t(0, engine.Evaluate(sampleOf(2500, 600), 60000, hits));
+
+  // Another +15.0 % at 25.5 C.
+  TEST_ASSERT_EQUAL_size_t(1, engine.Evaluate(sampleOf(2550, 750), 120000, hits));
+  TEST_ASSERT_TRUE(hits[0].active);
+  TEST_ASSERT_EQUAL_UINT8(0, hits[0].rule);
+
+  // Humidity steady: the rate drops to 0.
+  TEST_ASSERT_EQUAL_size_t(1, engine.Evaluate(sampleOf(2550, 750), 180000, hits));
+  TEST_ASSERT_FALSE(hits[0].active);
+}
+
+void test_update_keeps_the_state_of_rules_that_stay(void)
+{
+  RulesEngine current;
+  TEST_ASSERT_NULL(current.Add("hot", "temperature > 30", 1));
+  TEST_ASSERT_NULL(current.Add("humid", "humidity > 80", 2));
+  TEST_ASSERT_NULL(current.Add("drying", "rate(humidity) < -5", 1));
+
+  RuleHit hits[RULES_MAX];
+  TEST_ASSERT_EQUAL_size_t(1, current.Evaluate(sampleOf(3100, 900), 0, hits));
+  TEST_ASSERT_TRUE(current.IsActive(0));
+  TEST_ASSERT_FALSE(current.IsActive(1)); // One of its two samples.
+
+  // The same set again, with "hot" dropped and a new rule.
+  RulesEngine staged;
+  TEST_ASSERT_NULL(staged.Add("humid", "humidity > 80", 2));
+  TEST_ASSERT_NULL(staged.Add("drying", "rate(humidity) < -5", 1));
+  TEST_ASSERT_NULL(staged.Add("cold", "temperature < 5", 1));
+
+  RuleHit cleared[RULES_MAX];
+  TEST_ASSERT_EQUAL_size_t(1, staged.CarryOver(current, cleared));
+  TEST_ASSERT_EQUAL_UINT8(0, cleared[0].rule);
+  TEST_ASSERT_FALSE(cleared[0].active);
+  TEST_ASSERT_EQUAL_STRING("hot", current.Name(cleared[0].rule));
+
+  // "humid" completes its streak, and rate() runs from the sample taken before the update:
+  // -7.0 %/min.
+  current = staged;
+  TEST_ASSERT_EQUAL_size_t(2, current.Evaluate(sampleOf(3100, 830), 60000, hits));
+  TEST_ASSERT_EQUAL_UINT8(0, hits[0].rule);
+  TEST_ASSERT_TRUE(hits[0].active);
+  TEST_ASSERT_EQUAL_UINT8(1, hits[1].rule);
+  TEST_ASSERT_TRUE(hits[1].active);
+}
+
+void test_reapplying_the_same_set_reports_nothing(void)
+{
+  RulesEngine current;
+  TEST_ASSERT_NULL(current.Add("hot", "temperature > 30", 1));
+  RuleHit hits[RULES_MAX];
+  TEST_ASSERT_EQUAL_size_t(1, current.Evaluate(sampleOf(3100, 500), 0, hits));
+
+  RulesEngine staged;
+  TEST_ASSERT_NULL(staged.Add("hot", "temperature > 30", 1));
+  RuleHit cleared[RULES_MAX];
+  TEST_ASSERT_EQUAL_size_t(0, staged.CarryOver(current, cleared));
+
+  current = staged;
+  TEST_ASSERT_TRUE(current.IsActive(0));
+  TEST_ASSERT_EQUAL_size_t(0, current.Evaluate(sampleOf(3200, 500), 1000, hits));
+  TEST_ASSERT_EQUAL_size_t(1, current.Evaluate(sampleOf(2900, 500), 2000, hits));
+  TEST_ASSERT_FALSE(hits[0].active);
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_evaluation_cost_grows_linearly_with_the_rule_count);
+  RUN_TEST(test_benchmark_rule_changes_state);
+  RUN_TEST(test_update_keeps_the_state_of_rules_that_stay);
+  RUN_TEST(test_reapplying_the_same_set_reports_nothing);
+  return UNITY_END();
+}
@@ -0,0 +1,271 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "SchemaCodec.h"
+#include "TelemetrySchema.h"
+#include <string.h>
+#include <unity.h>
+
+#define MESSAGE_SIZE 512
+
+static uint8_t message[MESSAGE_SIZE];
+
+static TelemetryHeader header(const char* currentTime)
+{
+  TelemetryHeader result;
+  memset(&result, 0, sizeof(result));
+  result.id = 4294967295u;
+  strncpy(result.currentTime, currentTime, sizeof(result.currentTime) - 1);
+  result.msgCount = 0;
+  return result;
+}
+
+static BatchedReading reading(uint32_t epoch, int16_t temperature, int16_t humidity)
+{
+  BatchedReading result;
+  result.epoch = epoch;
+  result.sample.value[SENSOR_CHANNEL_TEMPERATURE] = temperature;
+  result.sample.value[SENSOR_CHANNEL_HUMIDITY] = humidity;
+  return result;
+}
+
+static void assertRoundTrip(TelemetryEncoding encoding)
+{
+  // Extremes of each channel's range, zero, values under one unit, and a failed reading.
+  TelemetryHeader sent = header("a\x01tab\t\"q\" b\\s\x1f");
+  BatchedReading readings[] = {
+    reading(0, 0, 0),
+    reading(1760000000, -4000, 1000),
+    reading(UINT32_MAX, 8000, SENSOR_VALUE_INVALID),
+    reading(1, -5, 1),
+    reading(2, SENSOR_VALUE_INVALID, SENSOR_VALUE_INVALID),
+    reading(3, 32767, -32767),
+  };
+  size_t count = sizeof(readings) / sizeof(readings[0]);
+
+  size_t length = TelemetryEncode(encoding, sent, readings, count, message, sizeof(message));
+  TEST_ASSERT_GREATER_THAN(0, length);
+
+  TelemetryHeader received;
+  BatchedReading decoded[8];
+  size_t decoded_count;
+  TEST_ASSERT_TRUE(TelemetryDecode(encoding, message, length, &received, decoded, 8, &decoded_count));
+
+  TEST_ASSERT_EQUAL_UINT32(sent.id, received.id);
+  TEST_ASSERT_EQUAL_STRING(sent.currentTime, received.currentTime);
+  TEST_ASSERT_EQUAL_UINT32(sent.msgCount, received.msgCount);
+  TEST_ASSERT_EQUAL_size_t(count, decoded_count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(readings[i].epoch, decoded[i].epoch);
+    for (int channel = 0; channel < SENSOR_CHANNEL_COUNT; channel++)
+    {
+      TEST_ASSERT_EQUAL_INT16(readings[i].sample.value[channel], decoded[i].sample.value[channel]);
+    }
+  }
+
+  // Every strict prefix of the message is rejected rather than half-decoded.
+  for (size_t prefix = 0; prefix < length; prefix++)
+  {
+    TEST_ASSERT_FALSE(TelemetryDecode(encoding, message, prefix, &received, decoded, 8, &decoded_count));
+  }
+
+  // As is a message with more readings than the caller has room for.
+  TEST_ASSERT_FALSE(
+      TelemetryDecode(encoding, message, length, &received, decoded, count - 1, &decoded_count));
+}
+
+static bool readJsonFixed(const char* text, uint8_t decimals, int16_t* value)
+{
+  SchemaReader reader((const uint8_t*)text, strlen(text));
+  return SchemaJsonReadFixed(reader, decimals, value) && reader.AtEnd();
+}
+
+static bool readJsonText(const char* json, char* text, size_t size)
+{
+  SchemaReader reader((const uint8_t*)json, strlen(json));
+  return SchemaJsonReadText(reader, text, size) && reader.AtEnd();
+}
+
+static bool readCborFixed(const uint8_t* data, size_t length, uint8_t decimals, int16_t* value)
+{
+  SchemaReader reader(data, length);
+  return SchemaCborReadFixed(reader, decimals, value) && reader.AtEnd();
+}
+
+void setUp(void) { memset(message, 0, sizeof(message)); }
+
+void tearDown(void) {}
+
+void test_json_round_trip(void) { assertRoundTrip(TELEMETRY_ENCODING_JSON); }
+
+void test_cbor_round_trip(void) { assertRoundTrip(TELEMETRY_ENCODING_CBOR); }
+
+void test_json_escapes_control_characters_as_u00xx(void)
+{
+  SchemaWriter writer(message, sizeof(message));
+  SchemaJsonWriteText(writer, "a\x01\x1f\"\\b");
+  const char* expected = "\"a\\u0001\\u001f\\\"\\\\b\"";
+  TEST_ASSERT_EQUAL_size_t(strlen(expected), writer.Length());
+  TEST_ASSERT_EQUAL_MEMORY(expected, message, strlen(expected));
+
+  char text[16];
+  TEST_ASSERT_TRUE(readJsonText("\"\\u001F\\u000a\\n\\t\\/\"", text, sizeof(text)));
+  TEST_ASSERT_EQUAL_STRING("\x1f\n\n\t/", text);
+}
+
+void test_json_rejects_malformed_escapes(void)
+{
+  char text[16];
+  TEST_ASSERT_FALSE(readJsonText("\"\\u0100\"", text, sizeof(text))); // Beyond \u00XX.
+  TEST_ASSERT_FALSE(readJsonText("\"\\u00zz\"", text, sizeof(text)));
+  TEST_ASSERT_FALSE(readJsonText("\"\\u0000\"", text, sizeof(text))); // Would truncate the text.
+  TEST_ASSERT_FALSE(readJsonText("\"\\u00", text, sizeof(text)));
+  TEST_ASSERT_FALSE(readJsonText("\"\\", text, sizeof(text)));
+  TEST_ASSERT_FALSE(readJsonText("\"unterminated", text, sizeof(text)));
+  TEST_ASSERT_FALSE(readJsonText("unquoted", text, sizeof(text)));
+
+  // Exactly filling the buffer fits; one more character does not.
+  TEST_ASSERT_TRUE(readJsonText("\"abc\"", text, 4));
+  TEST_ASSERT_FALSE(readJsonText("\"abcd\"", text, 4));
+}
+
+void test_json_numbers_reject_overflow(void)
+{
+  uint32_t whole;
+  SchemaReader max((const uint8_t*)"4294967295", 10);
+  TEST_ASSERT_TRUE(SchemaJsonReadUInt(max, &whole));
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, whole);
+  SchemaReader over((const uint8_t*)"4294967296", 10);
+  TEST_ASSERT_FALSE(SchemaJsonReadUInt(over, &whole));
+  SchemaReader huge((const uint8_t*)"99999999999999999999", 20);
+  TEST_ASSERT_FALSE(SchemaJsonReadUInt(huge, &whole));
+  SchemaReader empty((const uint8_t*)"", 0);
+  TEST_ASSERT_FALSE(SchemaJsonReadUInt(empty, &whole));
+
+  int16_t value;
+  TEST_ASSERT_TRUE(readJsonFixed("327.67", 2, &value));
+  TEST_ASSERT_EQUAL_INT16(32767, value);
+  TEST_ASSERT_TRUE(readJsonFixed("-327.67", 2, &value));
+  TEST_ASSERT_EQUAL_INT16(-32767, value);
+  TEST_ASSERT_TRUE(readJsonFixed("-0.05", 2, &value));
+  TEST_ASSERT_EQUAL_INT16(-5, value);
+  TEST_ASSERT_TRUE(readJsonFixed("12", 1, &value)); // Missing decimals are zeros.
+  TEST_ASSERT_EQUAL_INT16(120, value);
+
+  TEST_ASSERT_FALSE(readJsonFixed("327.68", 2, &value));
+  TEST_ASSERT_FALSE(readJsonFixed("-327.68", 2, &value)); // The "absent" marker.
+  TEST_ASSERT_FALSE(readJsonFixed("40000", 0, &value));
+  TEST_ASSERT_FALSE(readJsonFixed("4294967296", 0, &value));
+  TEST_ASSERT_FALSE(readJsonFixed("1.234", 2, &value)); // More precision than the schema.
+  TEST_ASSERT_FALSE(readJsonFixed("1.", 2, &value));
+  TEST_ASSERT_FALSE(readJsonFixed(".5", 2, &value));
+  TEST_ASSERT_FALSE(readJsonFixed("-", 2, &value));
+}
+
+void test_cbor_writes_tag_4_decimal_fractions(void)
+{
+  SchemaWriter writer(message, sizeof(message));
+  SchemaCborWriteFixed(writer, 2150, 2);
+  SchemaCborWriteFixed(writer, -455, 1);
+  SchemaCborWriteFixed(writer, 7, 0);
+
+  // 4([-2, 2150]), 4([-1, -455]), 7
+  const uint8_t expected[] = { 0xC4, 0x82, 0x21, 0x19, 0x08, 0x66, 0xC4, 0x82, 0x20, 0x39, 0x01, 0xC6, 0x07 };
+  TEST_ASSERT_EQUAL_size_t(sizeof(expected), writer.Length());
+  TEST_ASSERT_EQUAL_MEMORY(expected, message, sizeof(expected));
+
+  int16_t value;
+  TEST_ASSERT_TRUE(readCborFixed(expected, 6, 2, &value));
+  TEST_ASSERT_EQUAL_INT16(2150, value);
+  TEST_ASSERT_TRUE(readCborFixed(expected + 6, 6, 1, &value));
+  TEST_ASSERT_EQUAL_INT16(-455, value);
+  TEST_ASSERT_TRUE(readCborFixed(expected + 12, 1, 0, &value));
+  TEST_ASSERT_EQUAL_INT16(7, value);
+}
+
+void test_cbor_rejects_malformed_decimal_fractions(void)
+{
+  int16_t value;
+
+  const uint8_t wrong_exponent[] = { 0xC4, 0x82, 0x20, 0x19, 0x08, 0x66 }; // 4([-1, 2150]) for 2 decimals
+  TEST_ASSERT_FALSE(readCborFixed(wrong_exponent, sizeof(wrong_exponent), 2, &value));
+
+  const uint8_t untagged[] = { 0x82, 0x21, 0x19, 0x08, 0x66 };
+  TEST_ASSERT_FALSE(readCborFixed(untagged, sizeof(untagged), 2, &value));
+
+  const uint8_t other_tag[] = { 0xC5, 0x82, 0x21, 0x19, 0x08, 0x66 }; // Tag 5 is a bigfloat.
+  TEST_ASSERT_FALSE(readCborFixed(other_tag, sizeof(other_tag), 2, &value));
+
+  const uint8_t three_elements[] = { 0xC4, 0x83, 0x21, 0x19, 0x08, 0x66, 0x00 };
+  TEST_ASSERT_FALSE(readCborFixed(three_elements, sizeof(three_elements), 2, &value));
+
+  const uint8_t truncated[] = { 0xC4, 0x82, 0x21, 0x19, 0x08 };
+  TEST_ASSERT_FALSE(readCborFixed(truncated, sizeof(truncated), 2, &value));
+
+  const uint8_t over_int16[] = { 0x19, 0x80, 0x00 }; // 32768
+  TEST_ASSERT_FALSE(readCborFixed(over_int16, sizeof(over_int16), 0, &value));
+
+  const uint8_t absent_marker[] = { 0x39, 0x7F, 0xFF }; // -32768
+  TEST_ASSERT_FALSE(readCborFixed(absent_marker, sizeof(absent_marker), 0, &value));
+
+  const uint8_t uint64_head[] = { 0x1B, 0, 0, 0, 0, 0, 0, 0, 1 };
+  TEST_ASSERT_FALSE(readCborFixed(uint64_head, sizeof(uint64_head), 0, &value));
+
+  const uint8_t indefinite[] = { 0x1F };
+  TEST_ASSERT_FALSE(readCborFixed(indefinite, sizeof(indefinite), 0, &value));
+
+  const uint8_t text_instead[] = { 0x61, 0x37 };
+  TEST_ASSERT_FALSE(readCborFixed(text_instead, sizeof(text_instead), 0, &value));
+}
+
+void test_cbor_text_longer_than_the_buffer_is_rejected(void)
+{
+  char text[4];
+  const uint8_t fits[] = { 0x63, 'a', 'b', 'c' };
+  SchemaReader fits_reader(fits, sizeof(fits));
+  TEST_ASSERT_TRUE(SchemaCborReadText(fits_reader, text, sizeof(text)));
+  TEST_ASSERT_EQUAL_STRING("abc", text);
+
+  const uint8_t too_long[] = { 0x64, 'a', 'b', 'c', 'd' };
+  SchemaReader too_long_reader(too_long, sizeof(too_long));
+  TEST_ASSERT_FALSE(SchemaCborReadText(too_long_reader, text, sizeof(text)));
+
+  const uint8_t short_input[] = { 0x63, 'a' };
+  SchemaReader short_reader(short_input, sizeof(short_input));
+  TEST_ASSERT_FALSE(SchemaCborReadText(short_reader, text, sizeof(text)));
+}
+
+void test_encoder_reports_a_full_buffer(void)
+{
+  TelemetryHeader sent = header("2026-10-18 12:00:00 (Sun)");
+  BatchedReading readings[] = { reading(1760000000, 2150, 455) };
+
+  for (int encoding = TELEMETRY_ENCODING_JSON; encoding <= TELEMETRY_ENCODING_CBOR; encoding++)
+  {
+    size_t length
+        = TelemetryEncode((TelemetryEncoding)encoding, sent, readings, 1, message, sizeof(message));
+    TEST_ASSERT_GREATER_THAN(0, length);
+    TEST_ASSERT_EQUAL_size_t(
+        0, TelemetryEncode((TelemetryEncoding)encoding, sent, readings, 1, message, length - 1));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  (void)argc;
+  (void)argv;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_json_round_trip);
+  RUN_TEST(test_cbor_round_trip);
+  RUN_TEST(test_json_escapes_control_characters_as_u00xx);
+  RUN_TEST(test_json_rejects_malformed_escapes);
+  RUN_TEST(test_json_numbers_reject_overflow);
+  RUN_TEST(test_cbor_writes_tag_4_decimal_fractions);
+  RUN_TEST(test_cbor_rejects_malformed_decimal_fractions);
+  RUN_TEST(test_cbor_text_longer_than_the_buffer_is_rejected);
+  RUN_TEST(test_encoder_reports_a_full_buffer);
+  return UNITY_END();
+}